@@ -0,0 +1,239 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma warning(disable: 4996)
+
+struct BenchSuite
+{
+    const char*     pszName;
+    void            (*pfnRun)();
+};
+
+static const BenchSuite kSuites[] =
+{
+    { "format",     BenchFormat },
+    { "fault",      BenchFault },
+    { "unwind",     BenchUnwind },
+    { "symbolize",  BenchSymbolize },
+    { "report",     BenchReportFormat },
+    { "dump",       BenchDump },
+    { "crash",      BenchCrash },
+};
+
+static volatile LONG g_depthSink = 0;
+
+LONG64 BenchNow()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+double BenchElapsedNs(LONG64 start, LONG64 end)
+{
+    static LONG64 frequency = 0;
+    if (frequency == 0)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        frequency = freq.QuadPart;
+    }
+    return (double)(end - start) * 1e9 / (double)frequency;
+}
+
+void BenchResult(const char* pszName, double value, const char* pszUnit)
+{
+    printf("%s\t%.2f\t%s\n", pszName, value, pszUnit);
+    fflush(stdout);
+}
+
+void GetBenchDirectory(const char* pszSubDir, char* pszDir, DWORD cchDir)
+{
+    DWORD len = GetTempPathA(cchDir, pszDir);
+    if (len == 0 || len >= cchDir)
+    {
+        strcpy_s(pszDir, cchDir, ".");
+        return;
+    }
+    strcat_s(pszDir, cchDir, "calmdump_bench");
+    CreateDirectoryA(pszDir, NULL);
+    if (pszSubDir != NULL)
+    {
+        strcat_s(pszDir, cchDir, "\\");
+        strcat_s(pszDir, cchDir, pszSubDir);
+        CreateDirectoryA(pszDir, NULL);
+    }
+}
+
+DWORD BenchRunChild(const char* pszArgs, const char* pszDir, LONG64* pExitTime)
+{
+    char szExe[MAX_PATH];
+    char szDir[MAX_PATH];
+    GetModuleFileNameA(NULL, szExe, MAX_PATH);
+    if (pszDir == NULL)
+    {
+        GetBenchDirectory(NULL, szDir, MAX_PATH);
+        pszDir = szDir;
+    }
+
+    char szCmdLine[MAX_PATH * 2];
+    sprintf_s(szCmdLine, sizeof(szCmdLine), "\"%s\" %s", szExe, pszArgs);
+
+    // Results of the child go to our own output
+    STARTUPINFOA si = {};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    PROCESS_INFORMATION pi = {};
+    if (!CreateProcessA(NULL, szCmdLine, NULL, NULL, TRUE, 0, NULL, pszDir, &si, &pi))
+    {
+        printf("# failed to start %s: error %u\n", szCmdLine, GetLastError());
+        return (DWORD)-1;
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    if (pExitTime != NULL)
+    {
+        *pExitTime = BenchNow();
+    }
+    DWORD dwExitCode = 0;
+    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return dwExitCode;
+}
+
+BenchTimes* BenchMapTimes(const char* pszName, bool bCreate)
+{
+    // The mapping lives as long as the process
+    HANDLE hMapping = bCreate ?
+        CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(BenchTimes), pszName) :
+        OpenFileMappingA(FILE_MAP_WRITE, FALSE, pszName);
+    if (hMapping == NULL)
+    {
+        return NULL;
+    }
+    return (BenchTimes*)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, sizeof(BenchTimes));
+}
+
+__declspec(noinline) void BenchAtDepth(int depth, void (*pfn)(void*), void* pArg)
+{
+    if (depth <= 1)
+    {
+        pfn(pArg);
+    }
+    else
+    {
+        BenchAtDepth(depth - 1, pfn, pArg);
+    }
+    // Not a tail call, every level keeps its frame
+    InterlockedIncrement(&g_depthSink);
+}
+
+struct ParkParam
+{
+    HANDLE  hRelease;
+    int     depth;
+};
+
+static void WaitRelease(void* pArg)
+{
+    WaitForSingleObject(((ParkParam*)pArg)->hRelease, INFINITE);
+}
+
+static DWORD WINAPI ParkedThreadProc(LPVOID lpParameter)
+{
+    ParkParam param = *(ParkParam*)lpParameter;
+    delete (ParkParam*)lpParameter;
+    BenchAtDepth(param.depth, WaitRelease, &param);
+    return 0;
+}
+
+void BenchParkThreads(int count, int depth, ParkedThreads* pParked)
+{
+    pParked->hRelease = CreateEventA(NULL, TRUE, FALSE, NULL);
+    for (int i = 0; i < count; i++)
+    {
+        ParkParam* pParam = new ParkParam;
+        pParam->hRelease = pParked->hRelease;
+        pParam->depth = depth;
+        HANDLE hThread = CreateThread(NULL, 0, ParkedThreadProc, pParam, 0, NULL);
+        if (hThread == NULL)
+        {
+            delete pParam;
+            continue;
+        }
+        pParked->threads.push_back(hThread);
+    }
+    // Let them reach their wait
+    Sleep(50);
+}
+
+void BenchReleaseThreads(ParkedThreads* pParked)
+{
+    SetEvent(pParked->hRelease);
+    for (size_t i = 0; i < pParked->threads.size(); i++)
+    {
+        WaitForSingleObject(pParked->threads[i], INFINITE);
+        CloseHandle(pParked->threads[i]);
+    }
+    pParked->threads.clear();
+    CloseHandle(pParked->hRelease);
+    pParked->hRelease = NULL;
+}
+
+// calmdump_bench [suite]                       run all suites, or the named one, each in a child
+// calmdump_bench --suite <name>                run a suite in this process
+// calmdump_bench --fault-child <map> <d> <t>   crash at depth d with t threads, see BenchFault()
+// calmdump_bench --crash-child <map> <type>    crEmulateCrash(type), see BenchCrash()
+int main(int argc, char* argv[])
+{
+    if (argc == 5 && strcmp(argv[1], "--fault-child") == 0)
+    {
+        return BenchFaultChild(argv[2], atoi(argv[3]), atoi(argv[4]));
+    }
+    if (argc == 4 && strcmp(argv[1], "--crash-child") == 0)
+    {
+        return BenchCrashChild(argv[2], atoi(argv[3]));
+    }
+    if (argc == 3 && strcmp(argv[1], "--suite") == 0)
+    {
+        for (size_t i = 0; i < _countof(kSuites); i++)
+        {
+            if (strcmp(argv[2], kSuites[i].pszName) == 0)
+            {
+                kSuites[i].pfnRun();
+                return 0;
+            }
+        }
+        printf("# unknown suite %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("# name\tvalue\tunit\n");
+    fflush(stdout);
+    int failed = 0;
+    for (size_t i = 0; i < _countof(kSuites); i++)
+    {
+        if (argc >= 2 && strcmp(argv[1], kSuites[i].pszName) != 0)
+        {
+            continue;
+        }
+        char szArgs[64];
+        sprintf_s(szArgs, sizeof(szArgs), "--suite %s", kSuites[i].pszName);
+        DWORD dwExitCode = BenchRunChild(szArgs, NULL, NULL);
+        if (dwExitCode != 0)
+        {
+            printf("# suite %s failed: exit code 0x%08X\n", kSuites[i].pszName, dwExitCode);
+            failed++;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,69 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+// Every suite runs in a child process of its own (calmdump_bench --suite <name>), so the
+// dbghelp state, the heap and the crash handlers of a suite do not skew the next one.
+// Children run in %TEMP%\calmdump_bench, where the reports and dumps are written.
+//
+// Results are printed one per line as tab separated `name value unit`,
+// so two runs can be compared with a script.
+
+// Current value of the performance counter
+LONG64 BenchNow();
+
+// Nanoseconds between two BenchNow() values
+double BenchElapsedNs(LONG64 start, LONG64 end);
+
+// Print one result line
+void BenchResult(const char* pszName, double value, const char* pszUnit);
+
+// %TEMP%\calmdump_bench, or a subdirectory of it when `pszSubDir` is not NULL
+void GetBenchDirectory(const char* pszSubDir, char* pszDir, DWORD cchDir);
+
+// Run `calmdump_bench <args>` in `pszDir` (NULL for the bench directory) and wait for it.
+// Returns the exit code, `pExitTime` receives BenchNow() when the child was seen exiting.
+DWORD BenchRunChild(const char* pszArgs, const char* pszDir, LONG64* pExitTime);
+
+// Time stamps written by a crashing child, the performance counter is the same in every process
+struct BenchTimes
+{
+    volatile LONG64     faultTime;
+    volatile LONG64     handlerTime;
+};
+
+// Create (parent) or open (child) the named shared BenchTimes, NULL on failure
+BenchTimes* BenchMapTimes(const char* pszName, bool bCreate);
+
+// Call `pfn(pArg)` `depth` frames below the caller
+void BenchAtDepth(int depth, void (*pfn)(void*), void* pArg);
+
+// Threads waiting `depth` frames deep until released, to give the dumps something to walk
+struct ParkedThreads
+{
+    HANDLE              hRelease;
+    std::vector<HANDLE> threads;
+};
+
+void BenchParkThreads(int count, int depth, ParkedThreads* pParked);
+void BenchReleaseThreads(ParkedThreads* pParked);
+
+
+// Benchmark suites
+void BenchFormat();
+void BenchFault();
+void BenchUnwind();
+void BenchSymbolize();
+void BenchReportFormat();
+void BenchDump();
+
+void BenchCrash();
+
+// Crashing children started by BenchFault() and BenchCrash()
+int BenchFaultChild(const char* pszMappingName, int depth, int threads);
+int BenchCrashChild(const char* pszMappingName, int crashType);
@@ -0,0 +1,302 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Bench.h"
+#include <stdio.h>
+#include <DbgHelp.h>
+#include "CrashRpt.h"
+#include "CrashRecord.h"
+
+#pragma warning(disable: 4996)
+
+enum
+{
+    // Pseudo crash type: several threads fault at the same time
+    CRASH_CONCURRENT = 1000,
+    CRASH_CONCURRENT_THREADS = 8,
+
+    // Any exception type is accepted in the record
+    CRASH_ANY_TYPE = -1,
+
+    // Commit limit of a crashing child, so the new operator failure does not eat the machine
+    CRASH_CHILD_MEMORY_LIMIT = 512 * 1024 * 1024,
+};
+
+struct CrashCase
+{
+    const char*     pszName;
+    int             crashType;      // argument of crEmulateCrash()
+    int             expectedType;   // exception type written in the record
+};
+
+static const CrashCase kCrashCases[] =
+{
+    { "access_violation",   CR_SEH_EXCEPTION,               CR_SEH_EXCEPTION },
+    { "terminate",          CR_CPP_TERMINATE_CALL,          CR_CPP_TERMINATE_CALL },
+    { "unexpected",         CR_CPP_UNEXPECTED_CALL,         CR_CPP_UNEXPECTED_CALL },
+    { "pure_call",          CR_CPP_PURE_CALL,               CR_CPP_PURE_CALL },
+    { "new_failure",        CR_CPP_NEW_OPERATOR_ERROR,      CR_CPP_NEW_OPERATOR_ERROR },
+    { "invalid_parameter",  CR_CPP_INVALID_PARAMETER,       CR_CPP_INVALID_PARAMETER },
+    { "sigabrt",            CR_CPP_SIGABRT,                 CR_CPP_SIGABRT },
+    { "sigfpe",             CR_CPP_SIGFPE,                  CR_CPP_SIGFPE },
+    { "sigill",             CR_CPP_SIGILL,                  CR_CPP_SIGILL },
+    { "sigsegv",            CR_CPP_SIGSEGV,                 CR_CPP_SIGSEGV },
+    { "sigterm",            CR_CPP_SIGTERM,                 CR_CPP_SIGTERM },
+    { "noncontinuable",     CR_NONCONTINUABLE_EXCEPTION,    CR_SEH_EXCEPTION },
+    { "throw",              CR_THROW,                       CRASH_ANY_TYPE },
+    { "stack_overflow",     CR_STACK_OVERFLOW,              CR_SEH_EXCEPTION },
+    { "concurrent_faults",  CRASH_CONCURRENT,               CR_SEH_EXCEPTION },
+};
+
+static HANDLE g_hGo = NULL;
+
+static DWORD WINAPI ConcurrentFaultProc(LPVOID)
+{
+    WaitForSingleObject(g_hGo, INFINITE);
+    *(volatile int*)NULL = 0;
+    return 0;
+}
+
+// Put the child in a job with a commit limit
+static void LimitChildMemory()
+{
+    HANDLE hJob = CreateJobObjectA(NULL, NULL);
+    if (hJob == NULL)
+    {
+        return;
+    }
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limit = {};
+    limit.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_PROCESS_MEMORY;
+    limit.ProcessMemoryLimit = CRASH_CHILD_MEMORY_LIMIT;
+    SetInformationJobObject(hJob, JobObjectExtendedLimitInformation, &limit, sizeof(limit));
+    AssignProcessToJobObject(hJob, GetCurrentProcess());
+}
+
+int BenchCrashChild(const char* pszMappingName, int crashType)
+{
+    BenchTimes* pTimes = BenchMapTimes(pszMappingName, false);
+    if (pTimes == NULL)
+    {
+        return 1;
+    }
+    LimitChildMemory();
+    crInstall();
+    if (crashType == CRASH_CONCURRENT)
+    {
+        g_hGo = CreateEventA(NULL, TRUE, FALSE, NULL);
+        HANDLE threads[CRASH_CONCURRENT_THREADS];
+        for (int i = 0; i < CRASH_CONCURRENT_THREADS; i++)
+        {
+            threads[i] = CreateThread(NULL, 0, ConcurrentFaultProc, NULL, 0, NULL);
+        }
+        Sleep(50);
+        pTimes->faultTime = BenchNow();
+        SetEvent(g_hGo);
+        WaitForMultipleObjects(CRASH_CONCURRENT_THREADS, threads, TRUE, INFINITE);
+    }
+    else
+    {
+        pTimes->faultTime = BenchNow();
+        crEmulateCrash(crashType);
+    }
+    // The crash did not happen or was not fatal
+    return 2;
+}
+
+static void DeleteFiles(const char* pszDir, const char* pszPattern)
+{
+    char szPath[MAX_PATH];
+    sprintf_s(szPath, sizeof(szPath), "%s\\%s", pszDir, pszPattern);
+    WIN32_FIND_DATAA fd = {};
+    HANDLE hFind = FindFirstFileA(szPath, &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    do
+    {
+        sprintf_s(szPath, sizeof(szPath), "%s\\%s", pszDir, fd.cFileName);
+        DeleteFileA(szPath);
+    } while (FindNextFileA(hFind, &fd));
+    FindClose(hFind);
+}
+
+// Path of the single file matching `pszPattern` in `pszDir`, false if there are none or several
+static bool FindSingleFile(const char* pszDir, const char* pszPattern, char* pszPath, size_t cchPath)
+{
+    sprintf_s(pszPath, cchPath, "%s\\%s", pszDir, pszPattern);
+    WIN32_FIND_DATAA fd = {};
+    HANDLE hFind = FindFirstFileA(pszPath, &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    bool bSingle = !FindNextFileA(hFind, &fd);
+    FindClose(hFind);
+    if (bSingle)
+    {
+        hFind = FindFirstFileA(pszPath, &fd);
+        FindClose(hFind);
+        sprintf_s(pszPath, cchPath, "%s\\%s", pszDir, fd.cFileName);
+    }
+    return bSingle;
+}
+
+static bool ReadWholeFile(const char* pszPath, std::vector<BYTE>* pData)
+{
+    FILE* fp = fopen(pszPath, "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    pData->resize(size > 0 ? size : 0);
+    bool bOk = size > 0 && fread(&(*pData)[0], 1, size, fp) == (size_t)size;
+    fclose(fp);
+    return bOk;
+}
+
+// Walk the record the way an ingestion pipeline would, by fixed offsets only
+static const char* CheckRecord(const std::vector<BYTE>& data, int expectedType)
+{
+    if (data.size() < sizeof(CrRecordHeader))
+    {
+        return "record truncated";
+    }
+    const CrRecordHeader* pHeader = (const CrRecordHeader*)&data[0];
+    if (pHeader->magic != CR_RECORD_MAGIC || pHeader->version != CR_RECORD_VERSION)
+    {
+        return "bad record header";
+    }
+    if (pHeader->totalSize != data.size())
+    {
+        return "record size mismatch";
+    }
+    bool bException = false, bCrashedThread = false, bModules = false;
+    const BYTE* p = &data[0] + sizeof(CrRecordHeader);
+    const BYTE* pEnd = &data[0] + data.size();
+    for (WORD i = 0; i < pHeader->sectionCount; i++)
+    {
+        if (p + sizeof(CrSectionHeader) > pEnd)
+        {
+            return "section header out of bounds";
+        }
+        const CrSectionHeader* pSection = (const CrSectionHeader*)p;
+        const BYTE* pPayload = p + sizeof(CrSectionHeader);
+        if (pPayload + pSection->size > pEnd)
+        {
+            return "section out of bounds";
+        }
+        if (pSection->type == CR_SECTION_EXCEPTION)
+        {
+            const CrExceptionSection* pException = (const CrExceptionSection*)pPayload;
+            if (expectedType != CRASH_ANY_TYPE && (int)pException->exceptionType != expectedType)
+            {
+                return "unexpected exception type";
+            }
+            bException = true;
+        }
+        else if (pSection->type == CR_SECTION_MODULES)
+        {
+            bModules = ((const CrTableSection*)pPayload)->count > 0;
+        }
+        else if (pSection->type == CR_SECTION_THREAD)
+        {
+            bCrashedThread |= (((const CrThreadSection*)pPayload)->flags & CR_THREAD_CRASHED) != 0;
+        }
+        p = pPayload + pSection->size;
+    }
+    if (p != pEnd)
+    {
+        return "trailing bytes after the last section";
+    }
+    if (!bException || !bModules || !bCrashedThread)
+    {
+        return "missing section";
+    }
+    return NULL;
+}
+
+// Check the files written by the crashed child, returns an error message or NULL
+static const char* CheckCrashFiles(const char* pszDir, int expectedType)
+{
+    char szRecord[MAX_PATH];
+    if (!FindSingleFile(pszDir, "*.cdr", szRecord, MAX_PATH))
+    {
+        return "expected exactly one crash record";
+    }
+    std::vector<BYTE> data;
+    if (!ReadWholeFile(szRecord, &data))
+    {
+        return "crash record unreadable";
+    }
+    const char* pszError = CheckRecord(data, expectedType);
+    if (pszError != NULL)
+    {
+        return pszError;
+    }
+    char szJson[MAX_PATH];
+    sprintf_s(szJson, sizeof(szJson), "%s\\record.json", pszDir);
+    if (CrashRecordToJson(szRecord, szJson) != 0)
+    {
+        return "JSON conversion failed";
+    }
+
+    char szDump[MAX_PATH];
+    if (!FindSingleFile(pszDir, "*.dmp", szDump, MAX_PATH) || !ReadWholeFile(szDump, &data))
+    {
+        return "expected exactly one minidump";
+    }
+    if (data.size() < sizeof(MINIDUMP_HEADER) || ((const MINIDUMP_HEADER*)&data[0])->Signature != MINIDUMP_SIGNATURE)
+    {
+        return "bad minidump header";
+    }
+    return NULL;
+}
+
+// Emulate every crash type in a child of its own, check the record and the minidump
+// it leaves behind and measure the time from the fault to the exit of the process
+void BenchCrash()
+{
+    char szMappingName[64];
+    sprintf_s(szMappingName, sizeof(szMappingName), "calmdump_bench_crash_%u", GetCurrentProcessId());
+    BenchTimes* pTimes = BenchMapTimes(szMappingName, true);
+    if (pTimes == NULL)
+    {
+        printf("# crash: shared memory failed: error %u\n", GetLastError());
+        return;
+    }
+    for (size_t i = 0; i < _countof(kCrashCases); i++)
+    {
+        const CrashCase& cc = kCrashCases[i];
+        char szSubDir[64];
+        char szDir[MAX_PATH];
+        sprintf_s(szSubDir, sizeof(szSubDir), "crash.%s", cc.pszName);
+        GetBenchDirectory(szSubDir, szDir, MAX_PATH);
+        DeleteFiles(szDir, "*.*");
+
+        char szArgs[128];
+        sprintf_s(szArgs, sizeof(szArgs), "--crash-child %s %d", szMappingName, cc.crashType);
+        pTimes->faultTime = 0;
+        LONG64 exitTime = 0;
+        DWORD dwExitCode = BenchRunChild(szArgs, szDir, &exitTime);
+
+        const char* pszError = (dwExitCode == 2) ? "no crash" : CheckCrashFiles(szDir, cc.expectedType);
+        char szName[128];
+        sprintf_s(szName, sizeof(szName), "crash.%s.ok", cc.pszName);
+        BenchResult(szName, pszError == NULL ? 1 : 0, "bool");
+        if (pszError != NULL)
+        {
+            printf("# crash %s: %s (exit code 0x%08X)\n", cc.pszName, pszError, dwExitCode);
+            continue;
+        }
+        if (pTimes->faultTime != 0)
+        {
+            sprintf_s(szName, sizeof(szName), "crash.%s.to_exit", cc.pszName);
+            BenchResult(szName, BenchElapsedNs(pTimes->faultTime, exitTime) / 1000000, "ms");
+        }
+    }
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Bench.h"
+#include <stdio.h>
+#include "CrashRecord.h"
+#include "Dbghlp.h"
+
+#pragma warning(disable: 4996)
+
+enum
+{
+    DUMP_ITERATIONS = 5,
+    DUMP_THREAD_DEPTH = 32,
+};
+
+static const int kThreadCounts[] = { 1, 16, 64 };
+
+static ULONG64 GetBenchFileSize(const char* pszFileName)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data = {};
+    if (!GetFileAttributesExA(pszFileName, GetFileExInfoStandard, &data))
+    {
+        return 0;
+    }
+    return ((ULONG64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+}
+
+// Report throughput and latency of writing `pszFileName` DUMP_ITERATIONS times
+static void ReportWrite(const char* pszWhat, int threads, double ns, const char* pszFileName)
+{
+    char szName[128];
+    sprintf_s(szName, sizeof(szName), "%s.threads%d", pszWhat, threads);
+    BenchResult(szName, ns / DUMP_ITERATIONS / 1000000, "ms");
+    sprintf_s(szName, sizeof(szName), "%s_throughput.threads%d", pszWhat, threads);
+    double mb = (double)GetBenchFileSize(pszFileName) * DUMP_ITERATIONS / (1024 * 1024);
+    BenchResult(szName, (ns > 0) ? mb / (ns / 1e9) : 0, "MB/s");
+}
+
+static void MeasureDump(int threads)
+{
+    ParkedThreads parked;
+    BenchParkThreads(threads - 1, DUMP_THREAD_DEPTH, &parked);
+
+    CONTEXT ctx = {};
+    RtlCaptureContext(&ctx);
+    EXCEPTION_RECORD record = {};
+    record.ExceptionCode = EXCEPTION_BREAKPOINT;
+    EXCEPTION_POINTERS ep = { &record, &ctx };
+
+    MINIDUMP_EXCEPTION_INFORMATION mei = {};
+    mei.ThreadId = GetCurrentThreadId();
+    mei.ExceptionPointers = &ep;
+    mei.ClientPointers = TRUE;
+    LONG64 start = BenchNow();
+    for (int i = 0; i < DUMP_ITERATIONS; i++)
+    {
+        HANDLE hFile = CreateFileA("bench.dmp", GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            break;
+        }
+        GetDbghelpDll().MiniDumpWriteDump(GetCurrentProcess(), GetCurrentProcessId(), hFile, MiniDumpNormal,
+            &mei, NULL, NULL);
+        CloseHandle(hFile);
+    }
+    ReportWrite("dump.minidump", threads, BenchElapsedNs(start, BenchNow()), "bench.dmp");
+
+    CR_EXCEPTION_INFO ei = {};
+    ei.cb = sizeof(ei);
+    ei.exctype = CR_SEH_EXCEPTION;
+    ei.pexcptrs = &ep;
+    start = BenchNow();
+    for (int i = 0; i < DUMP_ITERATIONS; i++)
+    {
+        WriteCrashRecord("bench.cdr", &ei, GetCurrentThreadId());
+    }
+    ReportWrite("dump.record", threads, BenchElapsedNs(start, BenchNow()), "bench.cdr");
+
+    BenchReleaseThreads(&parked);
+}
+
+// Minidump and crash record write time with more and more threads
+void BenchDump()
+{
+    InitCrashRecord();
+    for (size_t i = 0; i < _countof(kThreadCounts); i++)
+    {
+        MeasureDump(kThreadCounts[i]);
+    }
+}
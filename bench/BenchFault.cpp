@@ -0,0 +1,115 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Bench.h"
+#include <stdio.h>
+#include "CrashRpt.h"
+
+#pragma warning(disable: 4996)
+
+enum
+{
+    FAULT_ITERATIONS = 5,
+};
+
+struct FaultCase
+{
+    int     depth;
+    int     threads;
+};
+
+static const FaultCase kFaultCases[] =
+{
+    { 16,  1 },
+    { 200, 1 },
+    { 16,  16 },
+    { 16,  64 },
+};
+
+static BenchTimes*                  g_pTimes = NULL;
+static LPTOP_LEVEL_EXCEPTION_FILTER g_pfnCrashHandler = NULL;
+
+// Installed over the calmdump filter: stamps the handler entry and forwards
+static LONG WINAPI TimingFilter(PEXCEPTION_POINTERS pExceptionPtrs)
+{
+    g_pTimes->handlerTime = BenchNow();
+    return g_pfnCrashHandler(pExceptionPtrs);
+}
+
+static void Fault(void*)
+{
+    g_pTimes->faultTime = BenchNow();
+    *(volatile int*)NULL = 0;
+}
+
+int BenchFaultChild(const char* pszMappingName, int depth, int threads)
+{
+    g_pTimes = BenchMapTimes(pszMappingName, false);
+    if (g_pTimes == NULL)
+    {
+        return 1;
+    }
+    ParkedThreads parked;
+    BenchParkThreads(threads - 1, depth, &parked);
+
+    crInstall();
+    g_pfnCrashHandler = SetUnhandledExceptionFilter(TimingFilter);
+    if (g_pfnCrashHandler == NULL)
+    {
+        return 1;
+    }
+    BenchAtDepth(depth, Fault, NULL);
+    return 1;
+}
+
+// Time from the faulting instruction to the entry of the unhandled exception filter,
+// and to the exit of the process once the dump and the report are written
+void BenchFault()
+{
+    char szMappingName[64];
+    sprintf_s(szMappingName, sizeof(szMappingName), "calmdump_bench_%u", GetCurrentProcessId());
+    BenchTimes* pTimes = BenchMapTimes(szMappingName, true);
+    if (pTimes == NULL)
+    {
+        printf("# fault: shared memory failed: error %u\n", GetLastError());
+        return;
+    }
+
+    for (size_t i = 0; i < _countof(kFaultCases); i++)
+    {
+        const FaultCase& fc = kFaultCases[i];
+        char szArgs[128];
+        sprintf_s(szArgs, sizeof(szArgs), "--fault-child %s %d %d", szMappingName, fc.depth, fc.threads);
+        double entryUs = 0, maxEntryUs = 0, totalMs = 0;
+        int runs = 0;
+        for (int n = 0; n < FAULT_ITERATIONS; n++)
+        {
+            pTimes->faultTime = 0;
+            pTimes->handlerTime = 0;
+            LONG64 exitTime = 0;
+            BenchRunChild(szArgs, NULL, &exitTime);
+            if (pTimes->faultTime == 0 || pTimes->handlerTime == 0)
+            {
+                continue;
+            }
+            double us = BenchElapsedNs(pTimes->faultTime, pTimes->handlerTime) / 1000;
+            entryUs += us;
+            maxEntryUs = (us > maxEntryUs) ? us : maxEntryUs;
+            totalMs += BenchElapsedNs(pTimes->faultTime, exitTime) / 1000000;
+            runs++;
+        }
+        if (runs == 0)
+        {
+            printf("# fault: child at depth %d with %d threads never reached the handler\n", fc.depth, fc.threads);
+            continue;
+        }
+        char szName[128];
+        sprintf_s(szName, sizeof(szName), "fault.handler_entry.depth%d.threads%d", fc.depth, fc.threads);
+        BenchResult(szName, entryUs / runs, "us");
+        sprintf_s(szName, sizeof(szName), "fault.handler_entry_max.depth%d.threads%d", fc.depth, fc.threads);
+        BenchResult(szName, maxEntryUs, "us");
+        sprintf_s(szName, sizeof(szName), "fault.to_exit.depth%d.threads%d", fc.depth, fc.threads);
+        BenchResult(szName, totalMs / runs, "ms");
+    }
+}
@@ -0,0 +1,78 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Bench.h"
+#include <stdio.h>
+#include "Format.h"
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+enum
+{
+    FORMAT_ITERATIONS = 1000000,
+};
+
+// Keeps the compiler from dropping the formatting
+static volatile size_t g_sink = 0;
+
+// A frame line as written by the profilers: module+offset
+static void BenchFrame()
+{
+    const char* pszModule = "calmdump_bench.exe";
+    char szBuffer[MAX_PATH];
+    size_t total = 0;
+
+    LONG64 start = BenchNow();
+    for (int i = 0; i < FORMAT_ITERATIONS; i++)
+    {
+        total += StringPrintf("%s+0x%I64x", pszModule, (DWORD64)i * 16).size();
+    }
+    BenchResult("format.frame.StringPrintf", BenchElapsedNs(start, BenchNow()) / FORMAT_ITERATIONS, "ns/op");
+
+    start = BenchNow();
+    for (int i = 0; i < FORMAT_ITERATIONS; i++)
+    {
+        total += _snprintf_s(szBuffer, sizeof(szBuffer), _TRUNCATE, "%s+0x%I64x", pszModule, (DWORD64)i * 16);
+    }
+    BenchResult("format.frame.snprintf", BenchElapsedNs(start, BenchNow()) / FORMAT_ITERATIONS, "ns/op");
+
+    start = BenchNow();
+    for (int i = 0; i < FORMAT_ITERATIONS; i++)
+    {
+        total += CR_FORMAT(szBuffer, sizeof(szBuffer), "{s}+0x{x}", pszModule, (DWORD64)i * 16);
+    }
+    BenchResult("format.frame.CR_FORMAT", BenchElapsedNs(start, BenchNow()) / FORMAT_ITERATIONS, "ns/op");
+    g_sink = total;
+}
+
+// A report line mixing decimal numbers and a pointer
+static void BenchReportLine()
+{
+    char szBuffer[MAX_PATH];
+    size_t total = 0;
+
+    LONG64 start = BenchNow();
+    for (int i = 0; i < FORMAT_ITERATIONS; i++)
+    {
+        total += StringPrintf("%02d. (0x%p) thread %u, %I64d hits\r\n", i % 64, (PVOID)(ULONG_PTR)i,
+            (DWORD)i, (LONG64)i * 3).size();
+    }
+    BenchResult("format.report_line.StringPrintf", BenchElapsedNs(start, BenchNow()) / FORMAT_ITERATIONS, "ns/op");
+
+    start = BenchNow();
+    for (int i = 0; i < FORMAT_ITERATIONS; i++)
+    {
+        total += CR_FORMAT(szBuffer, sizeof(szBuffer), "{02d}. ({p}) thread {}, {} hits\r\n", i % 64,
+            (PVOID)(ULONG_PTR)i, (DWORD)i, (LONG64)i * 3);
+    }
+    BenchResult("format.report_line.CR_FORMAT", BenchElapsedNs(start, BenchNow()) / FORMAT_ITERATIONS, "ns/op");
+    g_sink = total;
+}
+
+void BenchFormat()
+{
+    BenchFrame();
+    BenchReportLine();
+}
@@ -0,0 +1,174 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Bench.h"
+#include <stdio.h>
+#include "StackTrace.h"
+#include "Dbghlp.h"
+#include "Report.h"
+
+#pragma warning(disable: 4996)
+
+enum
+{
+    UNWIND_ITERATIONS = 10000,
+    STACKWALK_ITERATIONS = 1000,
+    SYMBOLIZE_ITERATIONS = 100,
+    REPORT_ITERATIONS = 20,
+};
+
+static const int kDepths[] = { 8, 32, 128 };
+
+static void ReportPerFrame(const char* pszWhat, int depth, double ns, DWORD64 frames)
+{
+    char szName[128];
+    sprintf_s(szName, sizeof(szName), "%s.depth%d", pszWhat, depth);
+    BenchResult(szName, (frames > 0) ? ns / frames : 0, "ns/frame");
+}
+
+static void MeasureUnwind(void* pArg)
+{
+    const int depth = *(int*)pArg;
+    CONTEXT captured = {};
+    RtlCaptureContext(&captured);
+    ThreadStackBounds bounds = {};
+    GetCurrentThreadStackBounds(&bounds);
+
+    DWORD64 frames[MAX_STACK_FRAMES];
+    DWORD64 total = 0;
+    LONG64 start = BenchNow();
+    for (int i = 0; i < UNWIND_ITERATIONS; i++)
+    {
+        CONTEXT ctx = captured;
+        total += UnwindStack(&ctx, bounds.StackLimit, bounds.StackBase, frames, MAX_STACK_FRAMES);
+    }
+    ReportPerFrame("unwind.fast", depth, BenchElapsedNs(start, BenchNow()), total);
+
+    // The dbghelp walk used by the text report
+    DWORD dwMachineType = 0;
+    total = 0;
+    start = BenchNow();
+    for (int i = 0; i < STACKWALK_ITERATIONS; i++)
+    {
+        CONTEXT ctx = captured;
+        STACKFRAME sf = {};
+#if defined(_M_AMD64)
+        sf.AddrPC.Offset = ctx.Rip;
+        sf.AddrStack.Offset = ctx.Rsp;
+        sf.AddrFrame.Offset = ctx.Rbp;
+        dwMachineType = IMAGE_FILE_MACHINE_AMD64;
+#elif defined(_M_IX86)
+        sf.AddrPC.Offset = ctx.Eip;
+        sf.AddrStack.Offset = ctx.Esp;
+        sf.AddrFrame.Offset = ctx.Ebp;
+        dwMachineType = IMAGE_FILE_MACHINE_I386;
+#endif
+        sf.AddrPC.Mode = AddrModeFlat;
+        sf.AddrStack.Mode = AddrModeFlat;
+        sf.AddrFrame.Mode = AddrModeFlat;
+        for (int n = 0; n < MAX_STACK_FRAMES; n++)
+        {
+            if (!GetDbghelpDll().StackWalk(dwMachineType, GetCurrentProcess(), GetCurrentThread(), &sf, &ctx,
+                NULL, GetDbghelpDll().SymFunctionTableAccess, GetDbghelpDll().SymGetModuleBase, NULL))
+            {
+                break;
+            }
+            total++;
+        }
+    }
+    ReportPerFrame("unwind.stackwalk", depth, BenchElapsedNs(start, BenchNow()), total);
+}
+
+// Unwind cost per frame for the fast unwinder and dbghelp StackWalk()
+void BenchUnwind()
+{
+    GetDbghelpDll().SymInitialize(GetCurrentProcess(), NULL, TRUE);
+    for (size_t i = 0; i < _countof(kDepths); i++)
+    {
+        int depth = kDepths[i];
+        BenchAtDepth(depth, MeasureUnwind, &depth);
+    }
+    GetDbghelpDll().SymCleanup(GetCurrentProcess());
+}
+
+static void CaptureFrames(void* pArg)
+{
+    std::vector<DWORD64>* pFrames = (std::vector<DWORD64>*)pArg;
+    DWORD64 frames[MAX_STACK_FRAMES];
+    USHORT count = CaptureCurrentStack(0, frames, MAX_STACK_FRAMES);
+    pFrames->assign(frames, frames + count);
+}
+
+// Addresses resolved per second, the first pass includes loading the PDB files
+void BenchSymbolize()
+{
+    std::vector<DWORD64> frames;
+    BenchAtDepth(48, CaptureFrames, &frames);
+    if (frames.empty())
+    {
+        return;
+    }
+    BYTE symbolBuffer[sizeof(SYMBOL_INFO) + MAX_NAME_LEN] = {};
+    PSYMBOL_INFO pSymbol = (PSYMBOL_INFO)symbolBuffer;
+
+    LONG64 start = BenchNow();
+    GetDbghelpDll().SymInitialize(GetCurrentProcess(), NULL, TRUE);
+    for (int pass = 0; pass <= SYMBOLIZE_ITERATIONS; pass++)
+    {
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+            pSymbol->MaxNameLen = MAX_NAME_LEN;
+            DWORD64 displacement = 0;
+            GetDbghelpDll().SymFromAddr(GetCurrentProcess(), frames[i], &displacement, pSymbol);
+            IMAGEHLP_LINE line = { sizeof(IMAGEHLP_LINE) };
+            DWORD dwLineDisplacement = 0;
+            GetDbghelpDll().SymGetLineFromAddr(GetCurrentProcess(), (DWORD_PTR)frames[i],
+                &dwLineDisplacement, &line);
+        }
+        if (pass == 0)
+        {
+            BenchResult("symbolize.cold", BenchElapsedNs(start, BenchNow()) / 1000000, "ms");
+            start = BenchNow();
+        }
+    }
+    double seconds = BenchElapsedNs(start, BenchNow()) / 1e9;
+    BenchResult("symbolize.warm", (double)frames.size() * SYMBOLIZE_ITERATIONS / seconds, "frames/s");
+    GetDbghelpDll().SymCleanup(GetCurrentProcess());
+}
+
+static void MeasureReport(void* pArg)
+{
+    const int depth = *(int*)pArg;
+    CONTEXT ctx = {};
+    RtlCaptureContext(&ctx);
+    EXCEPTION_RECORD record = {};
+    record.ExceptionCode = EXCEPTION_BREAKPOINT;
+#if defined(_M_AMD64)
+    record.ExceptionAddress = (PVOID)ctx.Rip;
+#elif defined(_M_IX86)
+    record.ExceptionAddress = (PVOID)(ULONG_PTR)ctx.Eip;
+#endif
+    EXCEPTION_POINTERS ep = { &record, &ctx };
+
+    LONG64 start = BenchNow();
+    for (int i = 0; i < REPORT_ITERATIONS; i++)
+    {
+        CreateReport(&ep);
+    }
+    char szName[128];
+    sprintf_s(szName, sizeof(szName), "report.create.depth%d", depth);
+    BenchResult(szName, BenchElapsedNs(start, BenchNow()) / REPORT_ITERATIONS / 1000000, "ms");
+}
+
+// Text report of CreateReport(), symbols and locals included
+void BenchReportFormat()
+{
+    InitSystemInfo();
+    for (size_t i = 0; i < _countof(kDepths); i++)
+    {
+        int depth = kDepths[i];
+        BenchAtDepth(depth, MeasureReport, &depth);
+    }
+}
@@ -0,0 +1,306 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include <winsock2.h>
+#include "Collector.h"
+#include <http.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#pragma warning(disable: 4996)
+#pragma comment(lib, "httpapi.lib")
+
+// calmdump_collector <store directory> [url prefix]
+//
+// Requests are served by http.sys, a prefix other than localhost needs a reservation:
+//   netsh http add urlacl url=http://+:8080/ user=<account>
+
+#define COLLECTOR_DEFAULT_PREFIX    L"http://localhost:8080/"
+
+enum
+{
+    COLLECTOR_REQUEST_BUFFER = 16 * 1024,
+    COLLECTOR_BODY_CHUNK = 64 * 1024,
+
+    // Defaults of the /top query
+    COLLECTOR_DEFAULT_MINUTES = 60,
+    COLLECTOR_DEFAULT_LIMIT = 20,
+};
+
+struct Collector
+{
+    HANDLE          hQueue;
+    SegmentStore*   pStore;
+    CrashIndex*     pIndex;
+};
+
+static HANDLE g_hQueue = NULL;
+
+static BOOL WINAPI ConsoleCtrlHandler(DWORD dwCtrlType)
+{
+    UNREFERENCED_PARAMETER(dwCtrlType);
+    // Pending and later receives fail, the workers quit
+    HttpShutdownRequestQueue(g_hQueue);
+    return TRUE;
+}
+
+static void SendResponse(HANDLE hQueue, HTTP_REQUEST_ID requestId, USHORT status, const char* pszReason,
+                         const char* pszContentType, const std::string& body)
+{
+    HTTP_RESPONSE response = {};
+    response.StatusCode = status;
+    response.pReason = pszReason;
+    response.ReasonLength = (USHORT)strlen(pszReason);
+    response.Headers.KnownHeaders[HttpHeaderContentType].pRawValue = pszContentType;
+    response.Headers.KnownHeaders[HttpHeaderContentType].RawValueLength = (USHORT)strlen(pszContentType);
+    HTTP_DATA_CHUNK chunk = {};
+    chunk.DataChunkType = HttpDataChunkFromMemory;
+    chunk.FromMemory.pBuffer = (PVOID)body.data();
+    chunk.FromMemory.BufferLength = (ULONG)body.size();
+    if (!body.empty())
+    {
+        response.EntityChunkCount = 1;
+        response.pEntityChunks = &chunk;
+    }
+    ULONG cbSent = 0;
+    HttpSendHttpResponse(hQueue, requestId, 0, &response, NULL, &cbSent, NULL, 0, NULL, NULL);
+}
+
+static bool ReceiveBody(HANDLE hQueue, const HTTP_REQUEST* pRequest, std::vector<BYTE>* pBody)
+{
+    pBody->clear();
+    if ((pRequest->Flags & HTTP_REQUEST_FLAG_MORE_ENTITY_BODY_EXISTS) == 0)
+    {
+        return true;
+    }
+    for (;;)
+    {
+        const size_t offset = pBody->size();
+        pBody->resize(offset + COLLECTOR_BODY_CHUNK);
+        ULONG cbRead = 0;
+        ULONG result = HttpReceiveRequestEntityBody(hQueue, pRequest->RequestId, 0, &(*pBody)[offset],
+            COLLECTOR_BODY_CHUNK, &cbRead, NULL);
+        pBody->resize(offset + cbRead);
+        // What was received counts, a body of COLLECTOR_MAX_BODY bytes is within the limit
+        if (pBody->size() > COLLECTOR_MAX_BODY)
+        {
+            return false;
+        }
+        if (result == ERROR_HANDLE_EOF)
+        {
+            return true;
+        }
+        if (result != NO_ERROR)
+        {
+            return false;
+        }
+    }
+}
+
+// Value of a query parameter, `query` starts with '?' if not empty
+static std::string GetQueryParameter(const std::string& query, const char* pszName)
+{
+    const std::string key = std::string(pszName) + "=";
+    for (size_t pos = query.find(key); pos != std::string::npos; pos = query.find(key, pos + 1))
+    {
+        if (pos > 0 && (query[pos - 1] == '?' || query[pos - 1] == '&'))
+        {
+            size_t begin = pos + key.size();
+            size_t end = query.find('&', begin);
+            return query.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin);
+        }
+    }
+    return std::string();
+}
+
+static std::string ToNarrow(const WCHAR* psz, USHORT cbLength)
+{
+    std::string text;
+    int cch = cbLength / sizeof(WCHAR);
+    if (psz != NULL && cch > 0)
+    {
+        text.resize(cch * 3);
+        int len = WideCharToMultiByte(CP_UTF8, 0, psz, cch, &text[0], (int)text.size(), NULL, NULL);
+        text.resize(len > 0 ? len : 0);
+    }
+    return text;
+}
+
+static void HandleUpload(const Collector& collector, const HTTP_REQUEST* pRequest)
+{
+    const HTTP_KNOWN_HEADER& contentType = pRequest->Headers.KnownHeaders[HttpHeaderContentType];
+    const std::string type(contentType.pRawValue, contentType.RawValueLength);
+    size_t pos = type.find("boundary=");
+    std::vector<BYTE> body;
+    std::vector<UploadedFile> files;
+    if (type.compare(0, 19, "multipart/form-data") != 0 || pos == std::string::npos)
+    {
+        SendResponse(collector.hQueue, pRequest->RequestId, 415, "Unsupported Media Type", "text/plain", "");
+        return;
+    }
+    std::string boundary = type.substr(pos + 9, type.find(';', pos) - (pos + 9));
+    if (boundary.size() >= 2 && boundary[0] == '"' && boundary[boundary.size() - 1] == '"')
+    {
+        boundary = boundary.substr(1, boundary.size() - 2);
+    }
+    if (!ReceiveBody(collector.hQueue, pRequest, &body) ||
+        !ParseMultipart(body.empty() ? NULL : &body[0], body.size(), boundary, &files))
+    {
+        SendResponse(collector.hQueue, pRequest->RequestId, 400, "Bad Request", "text/plain", "");
+        return;
+    }
+    if (!collector.pStore->Append(files))
+    {
+        SendResponse(collector.hQueue, pRequest->RequestId, 503, "Service Unavailable", "text/plain", "");
+        return;
+    }
+    SendResponse(collector.hQueue, pRequest->RequestId, 200, "OK", "text/plain", "");
+}
+
+static void HandleTop(const Collector& collector, const HTTP_REQUEST* pRequest)
+{
+    const std::string query = ToNarrow(pRequest->CookedUrl.pQueryString, pRequest->CookedUrl.QueryStringLength);
+    const std::string build = GetQueryParameter(query, "build");
+    const std::string minutes = GetQueryParameter(query, "minutes");
+    const std::string limit = GetQueryParameter(query, "limit");
+
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    DWORD64 now = ((DWORD64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    DWORD64 range = minutes.empty() ? COLLECTOR_DEFAULT_MINUTES : _strtoui64(minutes.c_str(), NULL, 10);
+    // 100 ns units
+    range *= 60ull * 10 * 1000 * 1000;
+    DWORD64 since = (range < now) ? now - range : 0;
+    size_t count = limit.empty() ? COLLECTOR_DEFAULT_LIMIT : strtoul(limit.c_str(), NULL, 10);
+    SendResponse(collector.hQueue, pRequest->RequestId, 200, "OK", "application/json",
+        collector.pIndex->QueryTop(build, since, count));
+}
+
+static DWORD WINAPI WorkerThreadProc(LPVOID lpParameter)
+{
+    const Collector& collector = *(const Collector*)lpParameter;
+    std::vector<BYTE> buffer(COLLECTOR_REQUEST_BUFFER);
+    HTTP_REQUEST_ID requestId = HTTP_NULL_ID;
+    for (;;)
+    {
+        HTTP_REQUEST* pRequest = (HTTP_REQUEST*)&buffer[0];
+        ULONG cbReceived = 0;
+        ULONG result = HttpReceiveHttpRequest(collector.hQueue, requestId, 0, pRequest,
+            (ULONG)buffer.size(), &cbReceived, NULL);
+        if (result == ERROR_MORE_DATA)
+        {
+            // Headers larger than the buffer, receive the same request again
+            requestId = pRequest->RequestId;
+            buffer.resize(cbReceived);
+            continue;
+        }
+        requestId = HTTP_NULL_ID;
+        if (result == ERROR_CONNECTION_INVALID)
+        {
+            continue;
+        }
+        if (result != NO_ERROR)
+        {
+            // The queue was shut down
+            return 0;
+        }
+
+        const std::string path = ToNarrow(pRequest->CookedUrl.pAbsPath,
+            pRequest->CookedUrl.AbsPathLength - pRequest->CookedUrl.QueryStringLength);
+        if (pRequest->Verb == HttpVerbPOST)
+        {
+            HandleUpload(collector, pRequest);
+        }
+        else if (pRequest->Verb == HttpVerbGET && path.size() >= 4 && path.compare(path.size() - 4, 4, "/top") == 0)
+        {
+            HandleTop(collector, pRequest);
+        }
+        else
+        {
+            SendResponse(collector.hQueue, pRequest->RequestId, 404, "Not Found", "text/plain", "");
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: calmdump_collector <store directory> [url prefix]\n");
+        return 1;
+    }
+    WCHAR szPrefix[256] = COLLECTOR_DEFAULT_PREFIX;
+    if (argc > 2)
+    {
+        MultiByteToWideChar(CP_UTF8, 0, argv[2], -1, szPrefix, _countof(szPrefix));
+    }
+
+    CrashIndex index;
+    SegmentStore store(&index);
+    if (!store.Open(argv[1]))
+    {
+        fprintf(stderr, "cannot open the store %s, error %u\n", argv[1], GetLastError());
+        return 1;
+    }
+    printf("%Iu crash records indexed\n", index.GetCount());
+
+    const HTTPAPI_VERSION version = HTTPAPI_VERSION_2;
+    HTTP_SERVER_SESSION_ID sessionId = HTTP_NULL_ID;
+    HTTP_URL_GROUP_ID groupId = HTTP_NULL_ID;
+    HTTP_BINDING_INFO binding = {};
+    ULONG result = HttpInitialize(version, HTTP_INITIALIZE_SERVER, NULL);
+    if (result == NO_ERROR)
+    {
+        result = HttpCreateServerSession(version, &sessionId, 0);
+    }
+    if (result == NO_ERROR)
+    {
+        result = HttpCreateUrlGroup(sessionId, &groupId, 0);
+    }
+    if (result == NO_ERROR)
+    {
+        result = HttpCreateRequestQueue(version, NULL, NULL, 0, &g_hQueue);
+    }
+    if (result == NO_ERROR)
+    {
+        binding.Flags.Present = 1;
+        binding.RequestQueueHandle = g_hQueue;
+        result = HttpSetUrlGroupProperty(groupId, HttpServerBindingProperty, &binding, sizeof(binding));
+    }
+    if (result == NO_ERROR)
+    {
+        result = HttpAddUrlToUrlGroup(groupId, szPrefix, 0, 0);
+    }
+    if (result != NO_ERROR)
+    {
+        fprintf(stderr, "cannot listen on %S, error %u\n", szPrefix, result);
+        return 1;
+    }
+    printf("listening on %S\n", szPrefix);
+    SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+
+    Collector collector = { g_hQueue, &store, &index };
+    HANDLE workers[COLLECTOR_WORKERS];
+    DWORD workerCount = 0;
+    for (int i = 0; i < COLLECTOR_WORKERS; i++)
+    {
+        HANDLE hThread = CreateThread(NULL, 0, WorkerThreadProc, &collector, 0, NULL);
+        if (hThread != NULL)
+        {
+            workers[workerCount++] = hThread;
+        }
+    }
+    WaitForMultipleObjects(workerCount, workers, TRUE, INFINITE);
+    for (DWORD i = 0; i < workerCount; i++)
+    {
+        CloseHandle(workers[i]);
+    }
+
+    HttpCloseUrlGroup(groupId);
+    HttpCloseRequestQueue(g_hQueue);
+    HttpCloseServerSession(sessionId);
+    HttpTerminate(HTTP_INITIALIZE_SERVER, NULL);
+    store.Close();
+    return 0;
+}
@@ -0,0 +1,181 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atlsync.h>
+#include "Utility.h"
+
+// Collector of the reports posted by the uploader (src/ReportUploader.h).
+//
+// Every uploaded file is appended to a segment store, a directory of append-only files
+// segment-<n>.dat. Requests do not write: their files are handed to a single committer
+// thread which appends everything pending with one write and one flush, then lets all
+// of them answer (group commit). So a storm of small uploads costs one flush per batch.
+//
+// Crash records are indexed in memory by signature, build id and time, the index is
+// rebuilt from the segments at start. Queries are answered as JSON:
+//
+//   GET /top?build=<id>&minutes=60&limit=20    most frequent signatures of a build
+//
+// The build id of a record is the PDB signature of its executable, as in the symbol
+// server path. The signature hashes the exception code and the top frames of the
+// crashed thread as module+offset, so it is specific to a build.
+
+enum
+{
+    // A new segment is started once the current one is past this size
+    COLLECTOR_SEGMENT_SIZE = 256 * 1024 * 1024,
+
+    // A commit takes the pending requests up to this size, the others join the next one
+    COLLECTOR_COMMIT_MAX_BYTES = 16 * 1024 * 1024,
+
+    // Larger request bodies are refused
+    COLLECTOR_MAX_BODY = 64 * 1024 * 1024,
+
+    // Threads receiving requests
+    COLLECTOR_WORKERS = 16,
+
+    // Frames of the crashed thread making up a signature
+    COLLECTOR_SIGNATURE_FRAMES = 5,
+
+    COLLECTOR_MAX_NAME_LEN = 256,
+
+    SEGMENT_ENTRY_MAGIC = 0x544E4553,       // "SENT"
+};
+
+// Entry of a segment, followed by the report name, the file name and the data, padded to 8 bytes
+struct SegmentEntryHeader
+{
+    DWORD       magic;                      // SEGMENT_ENTRY_MAGIC
+    WORD        nameLength;
+    WORD        fileNameLength;
+    DWORD       dataSize;
+    DWORD       checksum;                   // FNV-1a of what follows the header, padding excluded
+    DWORD64     receivedTime;               // FILETIME, UTC
+};
+
+C_ASSERT(sizeof(SegmentEntryHeader) == 24);
+
+// One uploaded file
+struct UploadedFile
+{
+    std::string         reportName;
+    std::string         fileName;
+    const BYTE*         pData;              // points into the request body
+    DWORD               dataSize;
+};
+
+// Where an entry is stored
+struct EntryLocation
+{
+    DWORD       segment;
+    DWORD64     offset;
+};
+
+// Split a multipart/form-data body, returns false if it's malformed.
+// Part names are report names, file names are given by the filename parameter.
+bool ParseMultipart(const BYTE* pBody, size_t cbBody, const std::string& boundary,
+                    std::vector<UploadedFile>* pFiles);
+
+// FNV-1a
+DWORD HashBytes(const void* pData, size_t size, DWORD hash = 2166136261u);
+
+
+class CrashIndex;
+
+// Append-only segments with group commit
+class SegmentStore
+{
+public:
+    explicit SegmentStore(CrashIndex* pIndex);
+    ~SegmentStore();
+
+    // Open the store in `pszDir`, index the existing entries and start the committer
+    bool Open(const char* pszDir);
+    void Close();
+
+    // Append the files of a request, returns once they are durable
+    bool Append(const std::vector<UploadedFile>& files);
+
+private:
+    SegmentStore(const SegmentStore&);
+    SegmentStore& operator = (const SegmentStore&);
+
+    // Files of a request waiting for the committer
+    struct PendingWrite
+    {
+        const std::vector<UploadedFile>*    pFiles;
+        HANDLE                              hDone;
+        bool                                bOk;
+    };
+
+    static DWORD WINAPI CommitThreadProc(LPVOID lpParameter);
+    void CommitLoop();
+    bool Commit(const std::vector<PendingWrite*>& batch);
+
+    bool OpenSegment(DWORD segment, bool bCreate);
+    bool LoadSegment(DWORD segment);
+    std::string GetSegmentPath(DWORD segment) const;
+
+    CrashIndex*                 pIndex_;
+    std::string                 dir_;
+    HANDLE                      hFile_;             // current segment
+    DWORD                       segment_;
+    DWORD64                     size_;
+    std::vector<BYTE>           buffer_;            // a commit is gathered here
+
+    ATL::CCriticalSection       critsec_;           // guards pending_ and bStop_
+    std::vector<PendingWrite*>  pending_;
+    HANDLE                      hPendingEvent_;
+    HANDLE                      hThread_;
+    bool                        bStop_;
+};
+
+// In-memory index of the crash records
+class CrashIndex
+{
+public:
+    CrashIndex();
+
+    // Index a crash record stored at `location`, by the time it was received (FILETIME).
+    // The clock of the crashed machine is not trusted.
+    void Add(const std::string& reportName, DWORD64 receivedTime, const BYTE* pRecord,
+             size_t cbRecord, const EntryLocation& location);
+
+    // JSON array of the most frequent signatures received since `since` (FILETIME),
+    // of all builds if `build` is empty
+    std::string QueryTop(const std::string& build, DWORD64 since, size_t limit);
+
+    size_t GetCount();
+
+private:
+    CrashIndex(const CrashIndex&);
+    CrashIndex& operator = (const CrashIndex&);
+
+    struct IndexedCrash
+    {
+        DWORD64         time;               // FILETIME the record was received
+        DWORD64         signature;
+        EntryLocation   location;
+    };
+
+    struct SignatureInfo
+    {
+        std::string     frames;             // JSON array of the signature frames
+        DWORD           exceptionCode;
+        size_t          count;
+    };
+
+    ATL::CCriticalSection                               critsec_;
+    std::vector<IndexedCrash>                           crashes_;
+    std::multimap<DWORD64, size_t>                      byTime_;
+    std::unordered_map<std::string, std::vector<size_t>> byBuild_;
+    std::unordered_map<DWORD64, SignatureInfo>          bySignature_;
+};
@@ -0,0 +1,316 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Collector.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "CrashRecord.h"
+
+#pragma warning(disable: 4996)
+
+
+// Sections of a record the index needs
+struct RecordSummary
+{
+    const CrRecordHeader*       pHeader;
+    const CrExceptionSection*   pException;
+    std::vector<const CrModuleEntry*> modules;
+    const DWORD64*              pFrames;        // crashed thread
+    WORD                        frameCount;
+};
+
+static bool SummarizeRecord(const BYTE* pRecord, size_t cbRecord, RecordSummary* pSummary)
+{
+    const CrRecordHeader* pHeader = (const CrRecordHeader*)pRecord;
+    if (cbRecord < sizeof(CrRecordHeader) || pHeader->magic != CR_RECORD_MAGIC ||
+        pHeader->version != CR_RECORD_VERSION)
+    {
+        return false;
+    }
+    pSummary->pHeader = pHeader;
+    pSummary->pException = NULL;
+    pSummary->pFrames = NULL;
+    pSummary->frameCount = 0;
+    const BYTE* pEnd = pRecord + cbRecord;
+    for (const BYTE* p = pRecord + sizeof(CrRecordHeader); p + sizeof(CrSectionHeader) <= pEnd; )
+    {
+        const CrSectionHeader* pSection = (const CrSectionHeader*)p;
+        const BYTE* pPayload = p + sizeof(CrSectionHeader);
+        const BYTE* pNext = pPayload + pSection->size;
+        if (pNext > pEnd)
+        {
+            break;
+        }
+        if (pSection->type == CR_SECTION_EXCEPTION && pSection->size >= sizeof(CrExceptionSection))
+        {
+            pSummary->pException = (const CrExceptionSection*)pPayload;
+        }
+        else if (pSection->type == CR_SECTION_MODULES && pSection->size >= sizeof(CrTableSection))
+        {
+            // Entries are at least as large as ours and within the section
+            const CrTableSection* pTable = (const CrTableSection*)pPayload;
+            const BYTE* pEntry = (const BYTE*)(pTable + 1);
+            const DWORD count = (pTable->entrySize < sizeof(CrModuleEntry)) ? 0 :
+                (DWORD)std::min<size_t>(pTable->count, (pNext - pEntry) / pTable->entrySize);
+            for (DWORD i = 0; i < count; i++)
+            {
+                pSummary->modules.push_back((const CrModuleEntry*)pEntry);
+                pEntry += pTable->entrySize;
+            }
+        }
+        else if (pSection->type == CR_SECTION_THREAD && pSection->size >= sizeof(CrThreadSection))
+        {
+            const CrThreadSection* pThread = (const CrThreadSection*)pPayload;
+            if (pThread->flags & CR_THREAD_CRASHED)
+            {
+                pSummary->pFrames = (const DWORD64*)(pThread + 1);
+                pSummary->frameCount = (WORD)std::min<size_t>(pThread->frameCount,
+                    (pNext - (const BYTE*)pSummary->pFrames) / sizeof(DWORD64));
+            }
+        }
+        p = pNext;
+    }
+    return true;
+}
+
+static void AppendJsonString(std::string* pJson, const std::string& text)
+{
+    pJson->push_back('"');
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        switch (c)
+        {
+        case '"':  pJson->append("\\\""); break;
+        case '\\': pJson->append("\\\\"); break;
+        case '\n': pJson->append("\\n"); break;
+        case '\r': pJson->append("\\r"); break;
+        case '\t': pJson->append("\\t"); break;
+        default:
+            if (c < 0x20)
+            {
+                char szEscape[8];
+                sprintf(szEscape, "\\u%04x", c);
+                pJson->append(szEscape);
+            }
+            else
+            {
+                pJson->push_back(c);
+            }
+        }
+    }
+    pJson->push_back('"');
+}
+
+static std::string GetModuleName(const CrModuleEntry* pModule)
+{
+    return std::string(pModule->name, strnlen(pModule->name, sizeof(pModule->name)));
+}
+
+// PDB signature of the executable, the report is named <AppName>_<date>-<time>-<pid>
+static std::string GetBuildId(const std::string& reportName, const RecordSummary& summary)
+{
+    const std::string exe = reportName.substr(0, reportName.rfind('_')) + ".exe";
+    const CrModuleEntry* pExe = NULL;
+    for (size_t i = 0; i < summary.modules.size(); i++)
+    {
+        const std::string name = GetModuleName(summary.modules[i]);
+        if (_stricmp(name.c_str(), exe.c_str()) == 0)
+        {
+            pExe = summary.modules[i];
+            break;
+        }
+        if (pExe == NULL && name.size() > 4 && _stricmp(name.c_str() + name.size() - 4, ".exe") == 0)
+        {
+            pExe = summary.modules[i];
+        }
+    }
+    if (pExe == NULL)
+    {
+        return "unknown";
+    }
+    const GUID& g = pExe->pdbGuid;
+    char szBuildId[64];
+    sprintf(szBuildId, "%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X", g.Data1, g.Data2, g.Data3,
+        g.Data4[0], g.Data4[1], g.Data4[2], g.Data4[3], g.Data4[4], g.Data4[5], g.Data4[6], g.Data4[7],
+        pExe->pdbAge);
+    return szBuildId;
+}
+
+static const CrModuleEntry* FindModule(const RecordSummary& summary, DWORD64 address)
+{
+    for (size_t i = 0; i < summary.modules.size(); i++)
+    {
+        const CrModuleEntry* pModule = summary.modules[i];
+        if (address >= pModule->base && address < pModule->base + pModule->size)
+        {
+            return pModule;
+        }
+    }
+    return NULL;
+}
+
+// FNV-1a, 64 bits
+static DWORD64 HashSignature(const std::string& text)
+{
+    DWORD64 hash = 14695981039346656037ull;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        hash = (hash ^ (BYTE)text[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void FormatFileTime(DWORD64 timestamp, char* pszBuffer)
+{
+    FILETIME ft = { (DWORD)timestamp, (DWORD)(timestamp >> 32) };
+    SYSTEMTIME st = {};
+    FileTimeToSystemTime(&ft, &st);
+    sprintf(pszBuffer, "%04u-%02u-%02uT%02u:%02u:%02uZ", st.wYear, st.wMonth, st.wDay,
+        st.wHour, st.wMinute, st.wSecond);
+}
+
+CrashIndex::CrashIndex()
+{
+}
+
+void CrashIndex::Add(const std::string& reportName, DWORD64 receivedTime, const BYTE* pRecord,
+                     size_t cbRecord, const EntryLocation& location)
+{
+    RecordSummary summary;
+    if (!SummarizeRecord(pRecord, cbRecord, &summary))
+    {
+        return;
+    }
+    const DWORD exceptionCode = (summary.pException != NULL) ? summary.pException->exceptionCode : 0;
+    const std::string build = GetBuildId(reportName, summary);
+
+    // Top frames of the crashed thread as module+offset, a frame out of any module by address
+    std::string frames = "[";
+    char szFrame[CR_RECORD_MODULE_NAME_LEN + 32];
+    sprintf(szFrame, "%08X", exceptionCode);
+    std::string key = szFrame;
+    for (WORD i = 0; i < summary.frameCount && i < COLLECTOR_SIGNATURE_FRAMES; i++)
+    {
+        const CrModuleEntry* pModule = FindModule(summary, summary.pFrames[i]);
+        if (pModule != NULL)
+        {
+            sprintf(szFrame, "%s+0x%I64x", GetModuleName(pModule).c_str(), summary.pFrames[i] - pModule->base);
+        }
+        else
+        {
+            sprintf(szFrame, "0x%I64x", summary.pFrames[i]);
+        }
+        key.append(";").append(szFrame);
+        if (i > 0)
+        {
+            frames.append(",");
+        }
+        AppendJsonString(&frames, szFrame);
+    }
+    frames.append("]");
+
+    IndexedCrash crash = {};
+    crash.time = receivedTime;
+    crash.signature = HashSignature(key);
+    crash.location = location;
+
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    const size_t index = crashes_.size();
+    crashes_.push_back(crash);
+    byTime_.insert(std::make_pair(crash.time, index));
+    byBuild_[build].push_back(index);
+    SignatureInfo& info = bySignature_[crash.signature];
+    if (info.count++ == 0)
+    {
+        info.frames = frames;
+        info.exceptionCode = exceptionCode;
+    }
+}
+
+size_t CrashIndex::GetCount()
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    return crashes_.size();
+}
+
+struct SignatureCount
+{
+    DWORD64     signature;
+    size_t      count;
+    DWORD64     lastSeen;
+
+    bool operator < (const SignatureCount& other) const
+    {
+        return count > other.count;
+    }
+};
+
+std::string CrashIndex::QueryTop(const std::string& build, DWORD64 since, size_t limit)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+
+    // Crashes of the build, or of the time range when no build is given
+    std::vector<size_t> matches;
+    if (!build.empty())
+    {
+        std::unordered_map<std::string, std::vector<size_t> >::const_iterator iter = byBuild_.find(build);
+        if (iter != byBuild_.end())
+        {
+            for (size_t i = 0; i < iter->second.size(); i++)
+            {
+                if (crashes_[iter->second[i]].time >= since)
+                {
+                    matches.push_back(iter->second[i]);
+                }
+            }
+        }
+    }
+    else
+    {
+        std::multimap<DWORD64, size_t>::const_iterator iter = byTime_.lower_bound(since);
+        for (; iter != byTime_.end(); ++iter)
+        {
+            matches.push_back(iter->second);
+        }
+    }
+
+    std::unordered_map<DWORD64, size_t> positions;
+    std::vector<SignatureCount> counts;
+    for (size_t i = 0; i < matches.size(); i++)
+    {
+        const IndexedCrash& crash = crashes_[matches[i]];
+        std::unordered_map<DWORD64, size_t>::iterator iter = positions.find(crash.signature);
+        if (iter == positions.end())
+        {
+            SignatureCount count = { crash.signature, 0, 0 };
+            iter = positions.insert(std::make_pair(crash.signature, counts.size())).first;
+            counts.push_back(count);
+        }
+        SignatureCount& count = counts[iter->second];
+        count.count++;
+        count.lastSeen = (crash.time > count.lastSeen) ? crash.time : count.lastSeen;
+    }
+    std::stable_sort(counts.begin(), counts.end());
+    if (counts.size() > limit)
+    {
+        counts.resize(limit);
+    }
+
+    std::string json = "[";
+    char szBuffer[256];
+    char szTime[32];
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        const SignatureInfo& info = bySignature_[counts[i].signature];
+        FormatFileTime(counts[i].lastSeen, szTime);
+        sprintf(szBuffer, "%s\n{\"signature\":\"%016I64x\",\"count\":%Iu,\"total\":%Iu,\"code\":\"0x%08X\","
+            "\"last_seen\":\"%s\",\"frames\":", i > 0 ? "," : "", counts[i].signature, counts[i].count,
+            info.count, info.exceptionCode, szTime);
+        json.append(szBuffer).append(info.frames).append("}");
+    }
+    json.append("]\n");
+    return json;
+}
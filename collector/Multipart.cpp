@@ -0,0 +1,86 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Collector.h"
+#include <string.h>
+#include <algorithm>
+
+
+static const char* FindText(const char* pBegin, const char* pEnd, const std::string& text)
+{
+    const char* p = std::search(pBegin, pEnd, text.begin(), text.end());
+    return (p != pEnd) ? p : NULL;
+}
+
+// Value of a `name="value"` parameter of the part headers
+static bool GetParameter(const std::string& headers, const char* pszName, std::string* pValue)
+{
+    const std::string key = std::string(pszName) + "=\"";
+    for (size_t pos = headers.find(key); pos != std::string::npos; pos = headers.find(key, pos + 1))
+    {
+        // Not the tail of a longer parameter name, as name in filename
+        if (pos == 0 || (headers[pos - 1] != ' ' && headers[pos - 1] != ';'))
+        {
+            continue;
+        }
+        size_t begin = pos + key.size();
+        size_t end = headers.find('"', begin);
+        if (end == std::string::npos || end == begin || end - begin >= COLLECTOR_MAX_NAME_LEN)
+        {
+            return false;
+        }
+        pValue->assign(headers, begin, end - begin);
+        return true;
+    }
+    return false;
+}
+
+bool ParseMultipart(const BYTE* pBody, size_t cbBody, const std::string& boundary,
+                    std::vector<UploadedFile>* pFiles)
+{
+    pFiles->clear();
+    const std::string delimiter = "--" + boundary;
+    const std::string separator = "\r\n" + delimiter;
+    const char* pEnd = (const char*)pBody + cbBody;
+    const char* p = FindText((const char*)pBody, pEnd, delimiter);
+    if (p == NULL || boundary.empty())
+    {
+        return false;
+    }
+    p += delimiter.size();
+    for (;;)
+    {
+        if (pEnd - p >= 2 && p[0] == '-' && p[1] == '-')
+        {
+            // Closing delimiter
+            return true;
+        }
+        if (pEnd - p < 2 || p[0] != '\r' || p[1] != '\n')
+        {
+            return false;
+        }
+        p += 2;
+        const char* pHeadersEnd = FindText(p, pEnd, "\r\n\r\n");
+        if (pHeadersEnd == NULL)
+        {
+            return false;
+        }
+        const std::string headers(p, pHeadersEnd);
+        UploadedFile file;
+        if (!GetParameter(headers, "name", &file.reportName) || !GetParameter(headers, "filename", &file.fileName))
+        {
+            return false;
+        }
+        p = pHeadersEnd + 4;
+        const char* pNext = FindText(p, pEnd, separator);
+        if (pNext == NULL)
+        {
+            return false;
+        }
+        file.pData = (const BYTE*)p;
+        file.dataSize = (DWORD)(pNext - p);
+        pFiles->push_back(file);
+        p = pNext + separator.size();
+    }
+}
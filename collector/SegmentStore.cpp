@@ -0,0 +1,347 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Collector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#pragma warning(disable: 4996)
+
+
+DWORD HashBytes(const void* pData, size_t size, DWORD hash)
+{
+    const BYTE* p = (const BYTE*)pData;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static DWORD64 GetEntrySize(const SegmentEntryHeader& header)
+{
+    DWORD64 size = sizeof(SegmentEntryHeader) + header.nameLength + header.fileNameLength + (DWORD64)header.dataSize;
+    return (size + 7) & ~7ull;
+}
+
+static bool IsCrashRecord(const char* pszFileName, size_t len)
+{
+    return len > 4 && _strnicmp(pszFileName + len - 4, ".cdr", 4) == 0;
+}
+
+SegmentStore::SegmentStore(CrashIndex* pIndex)
+    : pIndex_(pIndex), hFile_(INVALID_HANDLE_VALUE), segment_(0), size_(0),
+      hPendingEvent_(NULL), hThread_(NULL), bStop_(false)
+{
+}
+
+SegmentStore::~SegmentStore()
+{
+    Close();
+}
+
+std::string SegmentStore::GetSegmentPath(DWORD segment) const
+{
+    char szName[32];
+    sprintf(szName, "\\segment-%06u.dat", segment);
+    return dir_ + szName;
+}
+
+bool SegmentStore::Open(const char* pszDir)
+{
+    dir_ = pszDir;
+    if (!CreateDirectoryA(pszDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        return false;
+    }
+
+    // Index the existing segments in order, appends go to the last one
+    std::vector<DWORD> segments;
+    WIN32_FIND_DATAA fd = {};
+    HANDLE hFind = FindFirstFileA((dir_ + "\\segment-*.dat").c_str(), &fd);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            segments.push_back(strtoul(fd.cFileName + 8, NULL, 10));
+        } while (FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+    }
+    std::sort(segments.begin(), segments.end());
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        if (!LoadSegment(segments[i]))
+        {
+            return false;
+        }
+    }
+    if (!OpenSegment(segments.empty() ? 0 : segments.back(), segments.empty()))
+    {
+        return false;
+    }
+
+    hPendingEvent_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+    hThread_ = CreateThread(NULL, 0, &SegmentStore::CommitThreadProc, this, 0, NULL);
+    return hPendingEvent_ != NULL && hThread_ != NULL;
+}
+
+void SegmentStore::Close()
+{
+    if (hThread_ != NULL)
+    {
+        {
+            ScopedLock<ATL::CCriticalSection> lock(critsec_);
+            bStop_ = true;
+        }
+        SetEvent(hPendingEvent_);
+        WaitForSingleObject(hThread_, INFINITE);
+        CloseHandle(hThread_);
+        hThread_ = NULL;
+    }
+    if (hPendingEvent_ != NULL)
+    {
+        CloseHandle(hPendingEvent_);
+        hPendingEvent_ = NULL;
+    }
+    if (hFile_ != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile_);
+        hFile_ = INVALID_HANDLE_VALUE;
+    }
+}
+
+// Walk the entries of a segment and index the crash records. A torn entry at the end,
+// left by a crash of the collector in the middle of a write, is cut off.
+bool SegmentStore::LoadSegment(DWORD segment)
+{
+    const std::string path = GetSegmentPath(segment);
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(hFile, &fileSize);
+    DWORD64 validSize = 0;
+    if (fileSize.QuadPart > 0)
+    {
+        HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        const BYTE* pBase = (hMapping != NULL) ? (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (pBase == NULL)
+        {
+            if (hMapping != NULL)
+            {
+                CloseHandle(hMapping);
+            }
+            CloseHandle(hFile);
+            return false;
+        }
+        const DWORD64 size = (DWORD64)fileSize.QuadPart;
+        while (validSize + sizeof(SegmentEntryHeader) <= size)
+        {
+            const SegmentEntryHeader* pHeader = (const SegmentEntryHeader*)(pBase + validSize);
+            const DWORD64 cbEntry = GetEntrySize(*pHeader);
+            const size_t cbPayload = pHeader->nameLength + pHeader->fileNameLength + (size_t)pHeader->dataSize;
+            if (pHeader->magic != SEGMENT_ENTRY_MAGIC || validSize + cbEntry > size ||
+                HashBytes(pHeader + 1, cbPayload) != pHeader->checksum)
+            {
+                break;
+            }
+            const char* pszName = (const char*)(pHeader + 1);
+            const char* pszFileName = pszName + pHeader->nameLength;
+            if (IsCrashRecord(pszFileName, pHeader->fileNameLength))
+            {
+                EntryLocation location = { segment, validSize };
+                pIndex_->Add(std::string(pszName, pHeader->nameLength), pHeader->receivedTime,
+                    (const BYTE*)(pszFileName + pHeader->fileNameLength), pHeader->dataSize, location);
+            }
+            validSize += cbEntry;
+        }
+        UnmapViewOfFile(pBase);
+        CloseHandle(hMapping);
+    }
+    if (validSize < (DWORD64)fileSize.QuadPart)
+    {
+        fprintf(stderr, "%s: %I64u bytes of torn entries cut off\n", path.c_str(),
+            (DWORD64)fileSize.QuadPart - validSize);
+        LARGE_INTEGER pos = {};
+        pos.QuadPart = (LONGLONG)validSize;
+        SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN);
+        SetEndOfFile(hFile);
+    }
+    CloseHandle(hFile);
+    return true;
+}
+
+bool SegmentStore::OpenSegment(DWORD segment, bool bCreate)
+{
+    // The current segment is kept if the next one cannot be opened
+    HANDLE hFile = CreateFileA(GetSegmentPath(segment).c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        bCreate ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    if (hFile_ != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile_);
+    }
+    hFile_ = hFile;
+    LARGE_INTEGER pos = {};
+    LARGE_INTEGER end = {};
+    SetFilePointerEx(hFile_, pos, &end, FILE_END);
+    segment_ = segment;
+    size_ = (DWORD64)end.QuadPart;
+    return true;
+}
+
+bool SegmentStore::Append(const std::vector<UploadedFile>& files)
+{
+    PendingWrite write = { &files, CreateEvent(NULL, TRUE, FALSE, NULL), false };
+    if (write.hDone == NULL)
+    {
+        return false;
+    }
+    {
+        ScopedLock<ATL::CCriticalSection> lock(critsec_);
+        if (bStop_)
+        {
+            CloseHandle(write.hDone);
+            return false;
+        }
+        pending_.push_back(&write);
+    }
+    SetEvent(hPendingEvent_);
+    WaitForSingleObject(write.hDone, INFINITE);
+    CloseHandle(write.hDone);
+    return write.bOk;
+}
+
+DWORD WINAPI SegmentStore::CommitThreadProc(LPVOID lpParameter)
+{
+    ((SegmentStore*)lpParameter)->CommitLoop();
+    return 0;
+}
+
+// Requests arriving while a commit is being flushed queue up and go together in the next one
+void SegmentStore::CommitLoop()
+{
+    std::vector<PendingWrite*> batch;
+    for (;;)
+    {
+        WaitForSingleObject(hPendingEvent_, INFINITE);
+        bool bStop = false;
+        for (;;)
+        {
+            batch.clear();
+            {
+                ScopedLock<ATL::CCriticalSection> lock(critsec_);
+                size_t cbBatch = 0;
+                size_t count = 0;
+                for (; count < pending_.size() && (count == 0 || cbBatch < COLLECTOR_COMMIT_MAX_BYTES); count++)
+                {
+                    const std::vector<UploadedFile>& files = *pending_[count]->pFiles;
+                    for (size_t i = 0; i < files.size(); i++)
+                    {
+                        cbBatch += files[i].dataSize;
+                    }
+                    batch.push_back(pending_[count]);
+                }
+                pending_.erase(pending_.begin(), pending_.begin() + count);
+                bStop = bStop_;
+            }
+            if (batch.empty())
+            {
+                break;
+            }
+            bool bOk = Commit(batch);
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                batch[i]->bOk = bOk;
+                SetEvent(batch[i]->hDone);
+            }
+        }
+        if (bStop)
+        {
+            return;
+        }
+    }
+}
+
+bool SegmentStore::Commit(const std::vector<PendingWrite*>& batch)
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    const DWORD64 now = ((DWORD64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+
+    // Gather every entry of the batch, then write and flush once
+    buffer_.clear();
+    std::vector<size_t> records;        // offsets of the crash records in the buffer
+    for (size_t n = 0; n < batch.size(); n++)
+    {
+        const std::vector<UploadedFile>& files = *batch[n]->pFiles;
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            const UploadedFile& file = files[i];
+            SegmentEntryHeader header = {};
+            header.magic = SEGMENT_ENTRY_MAGIC;
+            header.nameLength = (WORD)file.reportName.size();
+            header.fileNameLength = (WORD)file.fileName.size();
+            header.dataSize = file.dataSize;
+            header.checksum = HashBytes(file.pData, file.dataSize,
+                HashBytes(file.fileName.data(), file.fileName.size(),
+                HashBytes(file.reportName.data(), file.reportName.size())));
+            header.receivedTime = now;
+
+            const size_t offset = buffer_.size();
+            buffer_.resize(offset + (size_t)GetEntrySize(header));
+            BYTE* p = &buffer_[offset];
+            memcpy(p, &header, sizeof(header));
+            p += sizeof(header);
+            memcpy(p, file.reportName.data(), file.reportName.size());
+            p += file.reportName.size();
+            memcpy(p, file.fileName.data(), file.fileName.size());
+            p += file.fileName.size();
+            memcpy(p, file.pData, file.dataSize);
+            if (IsCrashRecord(file.fileName.c_str(), file.fileName.size()))
+            {
+                records.push_back(offset);
+            }
+        }
+    }
+    if (buffer_.empty())
+    {
+        return true;
+    }
+
+    DWORD dwWritten = 0;
+    if (!WriteFile(hFile_, &buffer_[0], (DWORD)buffer_.size(), &dwWritten, NULL) ||
+        dwWritten != buffer_.size() || !FlushFileBuffers(hFile_))
+    {
+        // Drop whatever made it to the file, the requests will be retried by their senders
+        LARGE_INTEGER pos = {};
+        pos.QuadPart = (LONGLONG)size_;
+        SetFilePointerEx(hFile_, pos, NULL, FILE_BEGIN);
+        SetEndOfFile(hFile_);
+        return false;
+    }
+
+    // Durable, now it can be found
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const SegmentEntryHeader* pHeader = (const SegmentEntryHeader*)&buffer_[records[i]];
+        const char* pszName = (const char*)(pHeader + 1);
+        EntryLocation location = { segment_, size_ + records[i] };
+        pIndex_->Add(std::string(pszName, pHeader->nameLength), pHeader->receivedTime,
+            (const BYTE*)pszName + pHeader->nameLength + pHeader->fileNameLength, pHeader->dataSize, location);
+    }
+    size_ += buffer_.size();
+    if (size_ >= COLLECTOR_SEGMENT_SIZE && !OpenSegment(segment_ + 1, true))
+    {
+        fprintf(stderr, "cannot start segment %u, error %u\n", segment_ + 1, GetLastError());
+    }
+    return true;
+}
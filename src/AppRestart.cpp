@@ -0,0 +1,133 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "AppRestart.h"
+#include <stdlib.h>
+#include <wchar.h>
+#include "Utility.h"
+
+enum
+{
+    // Room at the end of the environment block for the counter
+    RESTART_COUNTER_SIZE = 64,
+};
+
+// Captured by InitAppRestart()
+static WCHAR        g_szExePath[MAX_PATH];
+static WCHAR        g_szCurrentDir[MAX_PATH];
+static WCHAR*       g_pszCommandLine = NULL;    // CreateProcessW() may write into it
+static WCHAR*       g_pEnvironment = NULL;      // without the counter
+static size_t       g_cchEnvironment = 0;       // up to the final terminator
+static DWORD        g_rapidRestarts = 0;        // counter given by the previous instance
+static ULONGLONG    g_installTime = 0;
+
+static bool IsCounterVariable(const WCHAR* pszVariable)
+{
+    const size_t len = wcslen(RESTART_COUNTER_NAME);
+    return _wcsnicmp(pszVariable, RESTART_COUNTER_NAME, len) == 0 && pszVariable[len] == L'=';
+}
+
+void InitAppRestart()
+{
+    if (g_pszCommandLine != NULL)
+    {
+        return;
+    }
+    if (GetModuleFileNameW(NULL, g_szExePath, MAX_PATH) == 0 ||
+        GetCurrentDirectoryW(MAX_PATH, g_szCurrentDir) == 0)
+    {
+        LogLastError();
+        return;
+    }
+
+    WCHAR* pStrings = GetEnvironmentStringsW();
+    if (pStrings == NULL)
+    {
+        return;
+    }
+    size_t cchStrings = 0;
+    for (const WCHAR* p = pStrings; *p != L'\0'; p += wcslen(p) + 1)
+    {
+        cchStrings += wcslen(p) + 1;
+    }
+    g_pEnvironment = (WCHAR*)malloc((cchStrings + RESTART_COUNTER_SIZE) * sizeof(WCHAR));
+    if (g_pEnvironment != NULL)
+    {
+        WCHAR* pOut = g_pEnvironment;
+        for (const WCHAR* p = pStrings; *p != L'\0'; p += wcslen(p) + 1)
+        {
+            if (!IsCounterVariable(p))
+            {
+                wcscpy(pOut, p);
+                pOut += wcslen(p) + 1;
+            }
+        }
+        g_cchEnvironment = pOut - g_pEnvironment;
+    }
+    FreeEnvironmentStringsW(pStrings);
+
+    const WCHAR* pszCommandLine = GetCommandLineW();
+    g_pszCommandLine = (WCHAR*)malloc((wcslen(pszCommandLine) + 1) * sizeof(WCHAR));
+    if (g_pEnvironment == NULL || g_pszCommandLine == NULL)
+    {
+        free(g_pEnvironment);
+        free(g_pszCommandLine);
+        g_pEnvironment = NULL;
+        g_pszCommandLine = NULL;
+        return;
+    }
+    wcscpy(g_pszCommandLine, pszCommandLine);
+
+    WCHAR szCounter[16];
+    if (GetEnvironmentVariableW(RESTART_COUNTER_NAME, szCounter, _countof(szCounter)) > 0)
+    {
+        g_rapidRestarts = wcstoul(szCounter, NULL, 10);
+    }
+    g_installTime = GetTickCount64();
+}
+
+bool RestartApp()
+{
+    if (g_pszCommandLine == NULL)
+    {
+        return false;
+    }
+    DWORD rapidRestarts = 0;
+    if (GetTickCount64() - g_installTime < RESTART_MIN_UPTIME)
+    {
+        rapidRestarts = g_rapidRestarts + 1;
+    }
+    if (rapidRestarts >= RESTART_MAX_RAPID)
+    {
+        return false;
+    }
+
+    // Append NAME=<count> and the final terminator, digits are written backwards
+    WCHAR* p = g_pEnvironment + g_cchEnvironment;
+    wcscpy(p, RESTART_COUNTER_NAME L"=");
+    p += wcslen(p);
+    WCHAR szDigits[16];
+    WCHAR* pDigit = szDigits + _countof(szDigits);
+    *--pDigit = L'\0';
+    do
+    {
+        *--pDigit = (WCHAR)(L'0' + rapidRestarts % 10);
+        rapidRestarts /= 10;
+    } while (rapidRestarts != 0);
+    wcscpy(p, pDigit);
+    p += wcslen(p) + 1;
+    *p = L'\0';
+
+    STARTUPINFOW si = {};
+    si.cb = sizeof(si);
+    PROCESS_INFORMATION pi = {};
+    if (!CreateProcessW(g_szExePath, g_pszCommandLine, NULL, NULL, FALSE, CREATE_UNICODE_ENVIRONMENT,
+        g_pEnvironment, g_szCurrentDir, &si, &pi))
+    {
+        return false;
+    }
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return true;
+}
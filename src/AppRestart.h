@@ -0,0 +1,27 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+
+enum
+{
+    // A crash sooner than this after install counts as rapid (milliseconds)
+    RESTART_MIN_UPTIME = 60 * 1000,
+
+    // Consecutive rapid crashes after which the application is not started again
+    RESTART_MAX_RAPID = 3,
+};
+
+// Environment variable counting the rapid crashes, passed to the new instance
+#define RESTART_COUNTER_NAME    L"CALMDUMP_RAPID_RESTARTS"
+
+// Keep the executable path, command line, environment and working directory of the process,
+// so the crash path starts a new instance without allocating or reading the PEB
+void InitAppRestart();
+
+// Start a new instance with the arguments and environment captured at install time.
+// Returns false if restart was not requested or the process keeps crashing right after start.
+bool RestartApp();
@@ -0,0 +1,58 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Breadcrumbs.h"
+#include <string.h>
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+static Breadcrumb       g_breadcrumbs[MAX_BREADCRUMBS];
+static volatile LONG    g_lastSequence = 0;
+
+void AddBreadcrumb(const char* pszText)
+{
+    assert(pszText);
+    LONG sequence = InterlockedIncrement(&g_lastSequence);
+    Breadcrumb* pSlot = &g_breadcrumbs[(DWORD)(sequence - 1) % MAX_BREADCRUMBS];
+
+    // Readers skip the slot until its sequence is published again
+    InterlockedExchange((volatile LONG*)&pSlot->sequence, 0);
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    pSlot->timestamp = ((DWORD64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    pSlot->threadId = GetCurrentThreadId();
+    strncpy_s(pSlot->text, sizeof(pSlot->text), pszText, _TRUNCATE);
+    InterlockedExchange((volatile LONG*)&pSlot->sequence, sequence);
+}
+
+DWORD CopyBreadcrumbs(Breadcrumb* pBreadcrumbs, DWORD maxCount)
+{
+    assert(pBreadcrumbs);
+    const LONG last = g_lastSequence;
+    LONG first = last - MAX_BREADCRUMBS + 1;
+    if (first < 1)
+    {
+        first = 1;
+    }
+    DWORD count = 0;
+    for (LONG sequence = first; sequence <= last && count < maxCount; sequence++)
+    {
+        const Breadcrumb* pSlot = &g_breadcrumbs[(DWORD)(sequence - 1) % MAX_BREADCRUMBS];
+        if ((LONG)pSlot->sequence != sequence)
+        {
+            continue;
+        }
+        MemoryBarrier();
+        pBreadcrumbs[count] = *pSlot;
+        MemoryBarrier();
+        // Overwritten by a newer breadcrumb while we were copying it
+        if ((LONG)pSlot->sequence != sequence)
+        {
+            continue;
+        }
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,32 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+
+enum
+{
+    // Number of breadcrumbs kept, the oldest ones are overwritten
+    MAX_BREADCRUMBS = 64,
+
+    // Max text length of a breadcrumb, including the terminating NUL
+    BREADCRUMB_TEXT_LEN = 112,
+};
+
+// A short message left by the application, written as is into the crash record
+struct Breadcrumb
+{
+    DWORD64     timestamp;      // FILETIME, UTC
+    DWORD       threadId;
+    DWORD       sequence;       // 1-based, 0 while the slot is being written
+    char        text[BREADCRUMB_TEXT_LEN];
+};
+
+// Append a breadcrumb to the process-wide ring, lock-free and allocation-free
+void AddBreadcrumb(const char* pszText);
+
+// Copy the breadcrumbs in the ring to `pBreadcrumbs`, oldest first.
+// Slots overwritten during the copy are left out.
+DWORD CopyBreadcrumbs(Breadcrumb* pBreadcrumbs, DWORD maxCount);
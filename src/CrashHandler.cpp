@@ -19,6 +19,12 @@ be found in the Authors.txt file in the root of the source tree.
 #include <signal.h>
 #include <time.h>
 #include "Report.h"
+#include "CrashRecord.h"
+#include "ModuleMap.h"
+#include "ReportSpool.h"
+#include "AppRestart.h"
+#include "ThreadRegistry.h"
+#include "Format.h"
 #include "Dbghlp.h"
 
 #pragma warning(disable: 4996)
@@ -35,15 +41,87 @@ CurrentProcessCrashHandler* GetCurrentProcessCrashHandler()
 #define LOCK_HANDLER()      GetCurrentProcessCrashHandler()->critsec.Enter()
 #define UNLOCK_HANDLER()    GetCurrentProcessCrashHandler()->critsec.Leave()
 
+
+typedef void (*SignalHandler)(int);
+
+// Handler of `sig` installed before ours, for the calling thread if the signal
+// is handled per thread. NULL if there is none to forward to.
+static SignalHandler GetPrevSignalHandler(int sig, SignalHandler pfnOwn)
+{
+    const ProcessExceptHandlder& processHandlers = GetCurrentProcessCrashHandler()->prevHandlers;
+    const ThreadSlot* pSlot = GetThreadSlot();
+    SignalHandler pfnPrev = NULL;
+    switch (sig)
+    {
+    case SIGFPE:
+        pfnPrev = (pSlot != NULL && (pSlot->flags & CR_INST_SIGFPE_HANDLER)) ?
+            (SignalHandler)pSlot->prevHandlers.pfnSigfpeHandler : (SignalHandler)processHandlers.pfnSigfpeHandler;
+        break;
+    case SIGILL:
+        pfnPrev = (pSlot != NULL && (pSlot->flags & CR_INST_SIGILL_HANDLER)) ?
+            pSlot->prevHandlers.pfnSigillHandler : processHandlers.pfnSigillHandler;
+        break;
+    case SIGSEGV:
+        pfnPrev = (pSlot != NULL && (pSlot->flags & CR_INST_SIGSEGV_HANDLER)) ?
+            pSlot->prevHandlers.pfnSigsegvHandler : processHandlers.pfnSigsegvHandler;
+        break;
+    case SIGABRT:
+        pfnPrev = processHandlers.pfnSigabrtHandler;
+        break;
+    case SIGINT:
+        pfnPrev = processHandlers.pfnSigintHandler;
+        break;
+    case SIGTERM:
+        pfnPrev = processHandlers.pfnSigtermHandler;
+        break;
+    }
+    if (pfnPrev == NULL || pfnPrev == SIG_DFL || pfnPrev == SIG_IGN || pfnPrev == SIG_ERR || pfnPrev == pfnOwn)
+    {
+        return NULL;
+    }
+    return pfnPrev;
+}
+
+// Hand the signal to the handler installed before ours, false if there is none.
+// A handler which resolves a fault jumps out or exits, one which returns leaves a crash.
+// The CRT resets the action to SIG_DFL before calling a handler, ours is set again
+// once the previous one returned.
+static bool ForwardSignal(int sig, int subcode, SignalHandler pfnOwn)
+{
+    SignalHandler pfnPrev = GetPrevSignalHandler(sig, pfnOwn);
+    if (pfnPrev == NULL)
+    {
+        return false;
+    }
+    if (sig == SIGFPE)
+    {
+        ((void (*)(int, int))pfnPrev)(sig, subcode);
+    }
+    else
+    {
+        pfnPrev(sig);
+    }
+    signal(sig, pfnOwn);
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // Exception handler functions. 
 //
 
 
+// Exception of the thread whose stack overflowed, handed to the thread reporting it
+struct StackOverflowInfo
+{
+    PEXCEPTION_POINTERS     pExceptionPtrs;
+    DWORD                   dwThreadId;
+};
+
 static DWORD WINAPI StackOverflowThreadFunction(LPVOID lpParameter)
 {
-    PEXCEPTION_POINTERS pExceptionPtrs = reinterpret_cast<PEXCEPTION_POINTERS>(lpParameter);
+    const StackOverflowInfo* pInfo = reinterpret_cast<const StackOverflowInfo*>(lpParameter);
+    PEXCEPTION_POINTERS pExceptionPtrs = pInfo->pExceptionPtrs;
 
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
@@ -56,7 +134,7 @@ static DWORD WINAPI StackOverflowThreadFunction(LPVOID lpParameter)
     ei.cb = sizeof(CR_EXCEPTION_INFO);
     ei.exctype = CR_SEH_EXCEPTION;
     ei.pexcptrs = pExceptionPtrs;
-    GenerateErrorReport(&ei);
+    GenerateErrorReport(&ei, pInfo->dwThreadId);
 
     if(!GetCurrentProcessCrashHandler()->bContinueExecution)
     {
@@ -73,6 +151,14 @@ static DWORD WINAPI StackOverflowThreadFunction(LPVOID lpParameter)
 // Structured exception handler (SEH handler)
 static LONG WINAPI SehHandler(__in PEXCEPTION_POINTERS pExceptionPtrs)
 {
+    // An exception the filter installed before ours resolves, as a guard page of a runtime's
+    // stacks or heaps, is not a crash
+    LPTOP_LEVEL_EXCEPTION_FILTER pfnPrev = GetCurrentProcessCrashHandler()->prevHandlers.pfnSehHandler;
+    if (pfnPrev != NULL && pfnPrev(pExceptionPtrs) == EXCEPTION_CONTINUE_EXECUTION)
+    {
+        return EXCEPTION_CONTINUE_EXECUTION;
+    }
+
     // Handle stack overflow in a separate thread.
     // Vojtech: Based on martin.bis...@gmail.com comment in
     // http://groups.google.com/group/crashrpt/browse_thread/thread/a1dbcc56acb58b27/fbd0151dd8e26daf?lnk=gst&q=stack+overflow#fbd0151dd8e26daf
@@ -82,8 +168,9 @@ static LONG WINAPI SehHandler(__in PEXCEPTION_POINTERS pExceptionPtrs)
         // Special case to handle the stack overflow exception.
         // The dump will be realized from another thread.
         // Create another thread that will do the dump.
+        StackOverflowInfo info = { pExceptionPtrs, GetCurrentThreadId() };
         HANDLE thread = ::CreateThread(0, 0,
-            &StackOverflowThreadFunction, pExceptionPtrs, 0, 0);
+            &StackOverflowThreadFunction, &info, 0, 0);
         ::WaitForSingleObject(thread, INFINITE);
         ::CloseHandle(thread);
         // Terminate process
@@ -301,6 +388,9 @@ static int NewHandler(size_t)
 // Signal handlers
 static void SigabrtHandler(int)
 {
+    // A crash only if the handler installed before ours comes back
+    ForwardSignal(SIGABRT, 0, SigabrtHandler);
+
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
 
@@ -329,6 +419,9 @@ static void SigfpeHandler(int code, int subcode)
 {
     UNREFERENCED_PARAMETER(code);
 
+    // A crash only if the handler installed before ours comes back
+    ForwardSignal(SIGFPE, subcode, (SignalHandler)SigfpeHandler);
+
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
 
@@ -357,6 +450,12 @@ static void SigfpeHandler(int code, int subcode)
 
 static void SigintHandler(int)
 {
+    // A handler installed before ours shuts the application down its own way
+    if (ForwardSignal(SIGINT, 0, SigintHandler))
+    {
+        return;
+    }
+
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
 
@@ -383,6 +482,9 @@ static void SigintHandler(int)
 
 static void SigillHandler(int)
 {
+    // A crash only if the handler installed before ours comes back
+    ForwardSignal(SIGILL, 0, SigillHandler);
+
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
 
@@ -409,6 +511,9 @@ static void SigillHandler(int)
 
 static void SigsegvHandler(int)
 {
+    // A crash only if the handler installed before ours comes back
+    ForwardSignal(SIGSEGV, 0, SigsegvHandler);
+
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
 
@@ -436,6 +541,12 @@ static void SigsegvHandler(int)
 
 static void SigtermHandler(int)
 {
+    // A handler installed before ours shuts the application down its own way
+    if (ForwardSignal(SIGTERM, 0, SigtermHandler))
+    {
+        return;
+    }
+
     // Acquire lock to avoid other threads (if exist) to crash while we are inside
     LOCK_HANDLER();
 
@@ -462,25 +573,26 @@ static void SigtermHandler(int)
 
 //////////////////////////////////////////////////////////////////////////
 
+// Name of a report: <AppName>_<date>-<time>
+static void GetReportName(const tm& date, char* pszName, size_t cbName)
+{
+    char szAppName[MAX_PATH];
+    GetAppName(szAppName, MAX_PATH);
+    CR_FORMAT(pszName, cbName, "{s}_{04d}{02d}{02d}-{02d}{02d}{02d}", szAppName,
+        date.tm_year+1900, date.tm_mon+1, date.tm_mday, date.tm_hour,
+        date.tm_min, date.tm_sec);
+}
+
 // Create Minidump file
-static bool CreateMiniDump(EXCEPTION_POINTERS* ep)
+static bool CreateMiniDump(EXCEPTION_POINTERS* ep, DWORD dwThreadId, const char* pszFileName)
 {
     MINIDUMP_EXCEPTION_INFORMATION mei = {};
-    mei.ThreadId = ::GetCurrentThreadId();
+    mei.ThreadId = dwThreadId;
     mei.ExceptionPointers = ep;
     mei.ClientPointers = TRUE;
 
-    // Make a name
-    char szFileName[MAX_PATH];    
-    const std::string& strModule = GetAppName();
-    time_t now = time(NULL);
-    tm thisDate = *localtime(&now);
-    sprintf_s(szFileName, MAX_PATH, ("%s_%4d%02d%02d-%02d%02d%02d.dmp"), strModule.c_str(), 
-        thisDate.tm_year+1900, thisDate.tm_mon+1, thisDate.tm_mday, thisDate.tm_hour,
-        thisDate.tm_min, thisDate.tm_sec);
-
     // Create Minidump file
-    HANDLE hFile = ::CreateFile(szFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+    HANDLE hFile = ::CreateFile(pszFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
         FILE_ATTRIBUTE_NORMAL, NULL);
     if (hFile != INVALID_HANDLE_VALUE)
     {
@@ -497,7 +609,8 @@ static bool CreateMiniDump(EXCEPTION_POINTERS* ep)
 }
 
 
-int GenerateErrorReport(PCR_EXCEPTION_INFO pExceptionInfo /*= NULL*/)
+int GenerateErrorReport(PCR_EXCEPTION_INFO pExceptionInfo, DWORD dwThreadId /*= 0*/,
+                        bool bTerminating /*= true*/)
 {
     // Only handle first chance exception in current thread
     static int excpt_chance = 0;
@@ -521,8 +634,40 @@ int GenerateErrorReport(PCR_EXCEPTION_INFO pExceptionInfo /*= NULL*/)
         pExceptionInfo->pexcptrs = &excptr;
     }
 
-    CreateMiniDump(&excptr);
-    CreateReport(&excptr);
+    if (dwThreadId == 0)
+    {
+        dwThreadId = GetCurrentThreadId();
+    }
+
+    time_t now = time(NULL);
+    tm thisDate = *localtime(&now);
+    char szName[MAX_PATH];
+    GetReportName(thisDate, szName, MAX_PATH);
+
+    // Report files go to the working directory, unless they are spooled for upload
+    char szDir[MAX_PATH] = "";
+    bool bSpooled = GetReportSpool().BeginReport(szName, szDir, MAX_PATH);
+    char szFileName[MAX_PATH];
+
+    // The crash record goes first, it is built without dbghelp
+    CR_FORMAT(szFileName, MAX_PATH, "{s}{s}.cdr", szDir, szName);
+    WriteCrashRecord(szFileName, pExceptionInfo, dwThreadId);
+
+    // The minidump and the text report are written while the new instance starts
+    if (bTerminating)
+    {
+        RestartApp();
+    }
+
+    CR_FORMAT(szFileName, MAX_PATH, "{s}{s}.dmp", szDir, szName);
+    CreateMiniDump(pExceptionInfo->pexcptrs, dwThreadId, szFileName);
+
+    // The report is complete for the uploader, the text report is only kept locally
+    if (bSpooled)
+    {
+        GetReportSpool().CommitReport();
+    }
+    CreateReport(pExceptionInfo->pexcptrs);
 
     return 0;
 }
@@ -530,7 +675,24 @@ int GenerateErrorReport(PCR_EXCEPTION_INFO pExceptionInfo /*= NULL*/)
 //////////////////////////////////////////////////////////////////////////
 int SetProcessExceptionHanlders(DWORD dwFlags)
 {
-    ProcessExceptHandlder prevHandlers = {};
+    CurrentProcessCrashHandler* pHandler = GetCurrentProcessCrashHandler();
+    ScopedLock<ATL::CCriticalSection> lock(pHandler->critsec);
+    if (pHandler->dwFlags != 0)
+    {
+        // Installed already, the saved handlers would be ours
+        return 1;
+    }
+    ProcessExceptHandlder& prevHandlers = pHandler->prevHandlers;
+    memset(&prevHandlers, 0, sizeof(prevHandlers));
+
+    // Registry and version queries are too slow for the crash path
+    InitSystemInfo();
+    InitCrashRecord();
+    GetModuleMap().Init();
+    if (dwFlags & CR_INST_APP_RESTART)
+    {
+        InitAppRestart();
+    }
 
     // If 0 is specified as dwFlags, assume all handlers should be
     // installed
@@ -561,7 +723,7 @@ int SetProcessExceptionHanlders(DWORD dwFlags)
     if(dwFlags & CR_INST_NEW_OPERATOR_ERROR_HANDLER)
     {
         // Catch new operator memory allocation exceptions
-        _set_new_mode(1); // Force malloc() to call new handler too
+        prevHandlers.nNewMode = _set_new_mode(1); // Force malloc() to call new handler too
         prevHandlers.pfnNewHandler = _set_new_handler(NewHandler);
     }
 #endif
@@ -646,6 +808,207 @@ int SetProcessExceptionHanlders(DWORD dwFlags)
         prevHandlers.pfnUnexpectedHandler = set_unexpected(UnexpectedHandler);    
     }
 
-    return TRUE;
+    if(dwFlags & CR_INST_AUTO_THREAD_HANDLERS)
+    {
+        // Threads started from now on get the per-thread handlers before their start routine
+        EnableAutoThreadHandlers(dwFlags);
+    }
+
+    pHandler->dwFlags = dwFlags;
+    return 0;
+}
+
+int UnsetProcessExceptionHandlers()
+{
+    CurrentProcessCrashHandler* pHandler = GetCurrentProcessCrashHandler();
+    ScopedLock<ATL::CCriticalSection> lock(pHandler->critsec);
+    const DWORD dwFlags = pHandler->dwFlags;
+    if (dwFlags == 0)
+    {
+        // Handlers weren't installed
+        return 1;
+    }
+    const ProcessExceptHandlder& prevHandlers = pHandler->prevHandlers;
+
+    if(dwFlags & CR_INST_AUTO_THREAD_HANDLERS)
+    {
+        // Threads already started keep theirs until crUninstallFromCurrentThread() or exit
+        EnableAutoThreadHandlers(0);
+    }
+
+    if(dwFlags & CR_INST_STRUCTURED_EXCEPTION_HANDLER)
+    {
+        SetUnhandledExceptionFilter(prevHandlers.pfnSehHandler);
+    }
+
+#if _MSC_VER >= 1300
+    if(dwFlags & CR_INST_PURE_CALL_HANDLER)
+    {
+        _set_purecall_handler(prevHandlers.pfnPurec);
+    }
+
+    if(dwFlags & CR_INST_NEW_OPERATOR_ERROR_HANDLER)
+    {
+        _set_new_handler(prevHandlers.pfnNewHandler);
+        _set_new_mode(prevHandlers.nNewMode);
+    }
+#endif
+
+#if _MSC_VER >= 1400
+    if(dwFlags & CR_INST_INVALID_PARAMETER_HANDLER)
+    {
+        _set_invalid_parameter_handler(prevHandlers.pfnInvpar);
+    }
+#endif
+
+#if _MSC_VER >= 1300 && _MSC_VER < 1400    
+    if(dwFlags & CR_INST_SECURITY_ERROR_HANDLER)
+    {
+        _set_security_error_handler(prevHandlers.pfnvSec);
+    }
+#endif
+
+    if(dwFlags & CR_INST_SIGABRT_HANDLER)
+    {
+        signal(SIGABRT, prevHandlers.pfnSigabrtHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGINT_HANDLER)
+    {
+        signal(SIGINT, prevHandlers.pfnSigintHandler);
+    }
+
+    if(dwFlags & CR_INST_TERMINATE_HANDLER)
+    {
+        signal(SIGTERM, prevHandlers.pfnSigtermHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGFPE_HANDLER)
+    {
+        typedef void (*sigh)(int);
+        signal(SIGFPE, (sigh)prevHandlers.pfnSigfpeHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGILL_HANDLER)
+    {
+        signal(SIGILL, prevHandlers.pfnSigillHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGSEGV_HANDLER)
+    {
+        signal(SIGSEGV, prevHandlers.pfnSigsegvHandler);
+    }
+
+    // terminate() and unexpected() handlers are per thread, these are the installing thread's
+    if(dwFlags & CR_INST_TERMINATE_HANDLER)
+    {
+        set_terminate(prevHandlers.pfnTerminateHandler);
+    }
+
+    if(dwFlags & CR_INST_UNEXPECTED_HANDLER)
+    {
+        set_unexpected(prevHandlers.pfnUnexpectedHandler);
+    }
+
+    pHandler->dwFlags = 0;
+    return 0;
+}
+
+int SetThreadExceptionHandlers(DWORD dwFlags)
+{
+    // Fails if the handlers are already installed or there is no slot left
+    ThreadSlot* pSlot = AcquireThreadSlot();
+    if (pSlot == NULL)
+    {
+        return 1;
+    }
+
+    // If 0 is specified as dwFlags, assume all handlers should be
+    // installed
+    if((dwFlags & CR_INST_ALL_POSSIBLE_HANDLERS) == 0)
+    {
+        dwFlags |= CR_INST_ALL_POSSIBLE_HANDLERS;
+    }
+    pSlot->flags = dwFlags;
+    ThreadExceptHandlers& prevHandlers = pSlot->prevHandlers;
+
+    // Keep room on the stack for the SEH handler after a stack overflow
+    ULONG ulGuarantee = THREAD_STACK_GUARANTEE;
+    SetThreadStackGuarantee(&ulGuarantee);
+
+    if(dwFlags & CR_INST_TERMINATE_HANDLER)
+    {
+        // Catch terminate() calls. 
+        prevHandlers.pfnTerminateHandler = set_terminate(TerminateHandler);       
+    }
+
+    if(dwFlags & CR_INST_UNEXPECTED_HANDLER)
+    {
+        // Catch unexpected() calls.
+        prevHandlers.pfnUnexpectedHandler = set_unexpected(UnexpectedHandler);    
+    }
+
+    if(dwFlags & CR_INST_SIGFPE_HANDLER)
+    {
+        // Catch a floating point error
+        typedef void (*sigh)(int);
+        typedef void (*sigfpe)(int,int);
+        prevHandlers.pfnSigfpeHandler = (sigfpe)signal(SIGFPE, (sigh)SigfpeHandler);     
+    }
+
+    if(dwFlags & CR_INST_SIGILL_HANDLER)
+    {
+        // Catch an illegal instruction
+        prevHandlers.pfnSigillHandler = signal(SIGILL, SigillHandler);     
+    }
+
+    if(dwFlags & CR_INST_SIGSEGV_HANDLER)
+    {
+        // Catch illegal storage access errors
+        prevHandlers.pfnSigsegvHandler = signal(SIGSEGV, SigsegvHandler);   
+    }
+
+    return 0;
+}
+
+int UnsetThreadExceptionHandlers()
+{
+    ThreadSlot* pSlot = GetThreadSlot();
+    if (pSlot == NULL)
+    {
+        // Handlers weren't installed for this thread
+        return 1;
+    }
+    const DWORD dwFlags = pSlot->flags;
+    const ThreadExceptHandlers& prevHandlers = pSlot->prevHandlers;
+
+    if(dwFlags & CR_INST_TERMINATE_HANDLER)
+    {
+        set_terminate(prevHandlers.pfnTerminateHandler);
+    }
+
+    if(dwFlags & CR_INST_UNEXPECTED_HANDLER)
+    {
+        set_unexpected(prevHandlers.pfnUnexpectedHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGFPE_HANDLER)
+    {
+        typedef void (*sigh)(int);
+        signal(SIGFPE, (sigh)prevHandlers.pfnSigfpeHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGILL_HANDLER)
+    {
+        signal(SIGILL, prevHandlers.pfnSigillHandler);
+    }
+
+    if(dwFlags & CR_INST_SIGSEGV_HANDLER)
+    {
+        signal(SIGSEGV, prevHandlers.pfnSigsegvHandler);
+    }
+
+    ReleaseThreadSlot();
+    return 0;
 }
 
@@ -40,6 +40,7 @@ struct ProcessExceptHandlder
 #if _MSC_VER >= 1300
     _purecall_handler   pfnPurec;       // Pure virtual call exception filter.
     _PNH    pfnNewHandler;              // New operator exception filter.
+    int     nNewMode;                   // Previous _set_new_mode() value.
 #endif
 
 #if _MSC_VER >= 1400
@@ -60,6 +61,16 @@ struct ProcessExceptHandlder
 };
 
 
+/* This structure contains pointer to the exception handlers for a thread.*/
+struct ThreadExceptHandlers
+{
+    terminate_function  pfnTerminateHandler;    // C++ terminate handler
+    unexpected_function pfnUnexpectedHandler;   // C++ unexpected handler
+    void (*pfnSigfpeHandler)(int, int);         // FPE handler
+    void (*pfnSigillHandler)(int);              // SIGILL handler
+    void (*pfnSigsegvHandler)(int);             // Illegal storage access handler
+};
+
 
 struct CurrentProcessCrashHandler
 {
@@ -71,10 +82,25 @@ struct CurrentProcessCrashHandler
 
     // Whether to terminate process (the default) or to continue execution after crash.
     BOOL                    bContinueExecution;
+
+    // Handlers installed by SetProcessExceptionHanlders(), 0 if not installed
+    DWORD                   dwFlags;
 };
 
 
-// Generates error report	
-int GenerateErrorReport(PCR_EXCEPTION_INFO pExceptionInfo);
+// Generates error report, `dwThreadId` raised the exception, 0 for the calling thread.
+// The application is restarted only if the caller terminates the process afterwards.
+int GenerateErrorReport(PCR_EXCEPTION_INFO pExceptionInfo, DWORD dwThreadId = 0,
+                        bool bTerminating = true);
 
+// Install the process-wide handlers, 0 on success, 1 if they are installed already
 int SetProcessExceptionHanlders(DWORD dwFlags = 0);
+
+// Restore the handlers saved by SetProcessExceptionHanlders(), 0 on success
+int UnsetProcessExceptionHandlers();
+
+// Install the per-thread handlers to the calling thread, 0 on success
+int SetThreadExceptionHandlers(DWORD dwFlags);
+
+// Restore the handlers of the calling thread, 0 on success
+int UnsetThreadExceptionHandlers();
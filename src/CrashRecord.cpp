@@ -0,0 +1,1276 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "CrashRecord.h"
+#include <stdio.h>
+#include <string.h>
+#include <Tlhelp32.h>
+#include <Psapi.h>
+#include <intrin.h>
+#include <vector>
+#include <algorithm>
+#include "StackTrace.h"
+#include "ThreadRegistry.h"
+#include "ModuleMap.h"
+#include "Report.h"
+#include "SafeRead.h"
+#include "Disassembler.h"
+#include "Utility.h"
+
+#pragma comment(lib, "psapi.lib")
+#pragma warning(disable: 4996)
+
+enum
+{
+    // Record buffer, enough for the max number of threads and modules, then for as much stack
+    // memory as fits while the sections written after the threads keep their room
+    CR_RECORD_BUFFER_SIZE = 8 * 1024 * 1024,
+    CR_RECORD_TAIL_RESERVE = 64 * 1024,
+
+    // Used stack copied per sampled thread, plus what the unwinder may read past it
+    CR_RECORD_STACK_COPY_SIZE = 256 * 1024,
+    CR_RECORD_STACK_COPY_SLACK = 64 * 1024,
+
+    // XSAVE area: FXSAVE image of the x87/SSE state, then the XSAVE header
+    XSAVE_LEGACY_SIZE = 512,
+    XSAVE_HEADER_SIZE = 64,
+    XSAVE_MAX_FEATURES = 64,
+    XSAVE_LEGACY_COMPONENTS = 0x3,      // x87 and SSE
+    XSAVE_AVX_COMPONENT = 2,            // upper halves of YMM0-15
+    XSAVE_AVX_OFFSET = XSAVE_LEGACY_SIZE + XSAVE_HEADER_SIZE,
+
+    // The code window is cut at the boundaries of the page of the faulting instruction
+    CR_RECORD_CODE_PAGE_SIZE = 0x1000,
+};
+
+#ifndef CONTEXT_XSTATE
+#if defined(_M_AMD64)
+#define CONTEXT_XSTATE      (CONTEXT_AMD64 | 0x00000040L)
+#elif defined(_M_IX86)
+#define CONTEXT_XSTATE      (CONTEXT_i386 | 0x00000040L)
+#endif
+#endif
+
+// Windows 7 SP1 and later
+typedef PVOID (WINAPI* LocateXStateFeature_t)(PCONTEXT Context, DWORD FeatureId, PDWORD Length);
+
+// Buffers of the crash path, allocated by InitCrashRecord()
+static BYTE* g_pRecordBuffer = NULL;
+static BYTE* g_pStackCopy = NULL;           // unwound in place
+static BYTE* g_pStackImage = NULL;          // stack of the thread being recorded, as read
+static BYTE* g_pStackReference = NULL;      // stack of the previous stack memory section
+
+// XSAVE layout of the processor, read with CPUID by InitCrashRecord()
+static DWORD    g_xsaveSize = 0;        // standard format, 0 if the OS doesn't use XSAVE
+static DWORD64  g_xstateMask = 0;       // extended components enabled by the OS
+static DWORD    g_xstateOffsets[XSAVE_MAX_FEATURES];
+static DWORD    g_xstateSizes[XSAVE_MAX_FEATURES];
+static LocateXStateFeature_t g_pfnLocateXStateFeature = NULL;
+
+// Record being built
+struct RecordBuilder
+{
+    BYTE*       pData;
+    DWORD       size;
+    DWORD       capacity;
+    WORD        sectionCount;
+    DWORD       cbStackReference;   // bytes in g_pStackReference, 0 before the first stack
+};
+
+// Reserve a zeroed section of `cbPayload` bytes, NULL if the record is full
+static BYTE* AddSection(RecordBuilder* pBuilder, WORD type, DWORD cbPayload)
+{
+    DWORD cbAligned = (cbPayload + 7) & ~7;
+    if (pBuilder->size + sizeof(CrSectionHeader) + cbAligned > pBuilder->capacity)
+    {
+        return NULL;
+    }
+    CrSectionHeader* pHeader = (CrSectionHeader*)(pBuilder->pData + pBuilder->size);
+    pHeader->type = type;
+    pHeader->reserved = 0;
+    pHeader->size = cbAligned;
+    BYTE* pPayload = (BYTE*)(pHeader + 1);
+    memset(pPayload, 0, cbAligned);
+    pBuilder->size += sizeof(CrSectionHeader) + cbAligned;
+    pBuilder->sectionCount++;
+    return pPayload;
+}
+
+// Shrink the last section added to `cbPayload` bytes
+static void TrimLastSection(RecordBuilder* pBuilder, BYTE* pPayload, DWORD cbPayload)
+{
+    CrSectionHeader* pHeader = (CrSectionHeader*)pPayload - 1;
+    DWORD cbAligned = (cbPayload + 7) & ~7;
+    assert(cbAligned <= pHeader->size);
+    pBuilder->size -= pHeader->size - cbAligned;
+    pHeader->size = cbAligned;
+}
+
+static void AddExceptionSection(RecordBuilder* pBuilder, const CR_EXCEPTION_INFO* pExceptionInfo)
+{
+    CrExceptionSection* pSection = (CrExceptionSection*)AddSection(pBuilder, CR_SECTION_EXCEPTION,
+        sizeof(CrExceptionSection));
+    if (pSection == NULL)
+    {
+        return;
+    }
+    pSection->exceptionType = pExceptionInfo->exctype;
+    pSection->exceptionCode = pExceptionInfo->code;
+    pSection->fpeSubcode = pExceptionInfo->fpe_subcode;
+    const EXCEPTION_POINTERS* ep = pExceptionInfo->pexcptrs;
+    if (ep == NULL)
+    {
+        return;
+    }
+    const EXCEPTION_RECORD* pRecord = ep->ExceptionRecord;
+    if (pRecord != NULL)
+    {
+        pSection->exceptionCode = pRecord->ExceptionCode;
+        pSection->exceptionFlags = pRecord->ExceptionFlags;
+        pSection->exceptionAddress = (DWORD64)(ULONG_PTR)pRecord->ExceptionAddress;
+        if ((pRecord->ExceptionCode == EXCEPTION_ACCESS_VIOLATION ||
+             pRecord->ExceptionCode == EXCEPTION_IN_PAGE_ERROR) && pRecord->NumberParameters >= 2)
+        {
+            pSection->accessType = pRecord->ExceptionInformation[0];
+            pSection->accessAddress = pRecord->ExceptionInformation[1];
+        }
+    }
+    const CONTEXT* pContext = ep->ContextRecord;
+    if (pContext != NULL)
+    {
+#if defined(_M_AMD64)
+        pSection->pc = pContext->Rip;
+        pSection->sp = pContext->Rsp;
+        pSection->fp = pContext->Rbp;
+#elif defined(_M_IX86)
+        pSection->pc = pContext->Eip;
+        pSection->sp = pContext->Esp;
+        pSection->fp = pContext->Ebp;
+#endif
+    }
+}
+
+static void InitXStateLayout()
+{
+    int info[4];
+    __cpuid(info, 1);
+    // OSXSAVE
+    if ((info[2] & (1 << 27)) == 0)
+    {
+        return;
+    }
+    // The extended state is kept in a CONTEXT since Windows 7 SP1
+    g_pfnLocateXStateFeature = (LocateXStateFeature_t)GetProcAddress(GetModuleHandleA("kernel32.dll"),
+        "LocateXStateFeature");
+    if (g_pfnLocateXStateFeature == NULL)
+    {
+        return;
+    }
+    const DWORD64 xcr0 = _xgetbv(0);
+    // EBX: size of the area for the components enabled in XCR0
+    __cpuidex(info, 0xD, 0);
+    const DWORD xsaveSize = (DWORD)info[1];
+    if (xsaveSize < XSAVE_LEGACY_SIZE + XSAVE_HEADER_SIZE)
+    {
+        return;
+    }
+    for (DWORD i = 2; i < XSAVE_MAX_FEATURES; i++)
+    {
+        if ((xcr0 & (1ull << i)) == 0)
+        {
+            continue;
+        }
+        // EAX: size of the component, EBX: its offset in the standard format
+        __cpuidex(info, 0xD, i);
+        if (info[0] != 0 && (DWORD)info[1] + (DWORD)info[0] <= xsaveSize)
+        {
+            g_xstateSizes[i] = info[0];
+            g_xstateOffsets[i] = info[1];
+            g_xstateMask |= 1ull << i;
+        }
+    }
+    g_xsaveSize = xsaveSize;
+}
+
+// Copy of the CONTEXT and of the FP/SIMD state of the crashed thread, the section is
+// sized at install time, the capture only copies memory
+static void AddRegistersSection(RecordBuilder* pBuilder, const EXCEPTION_POINTERS* ep)
+{
+    if (ep == NULL || ep->ContextRecord == NULL)
+    {
+        return;
+    }
+    const PCONTEXT pContext = ep->ContextRecord;
+    BYTE* pPayload = AddSection(pBuilder, CR_SECTION_REGISTERS,
+        sizeof(CrRegistersSection) + sizeof(CONTEXT) + g_xsaveSize);
+    if (pPayload == NULL)
+    {
+        return;
+    }
+    CrRegistersSection* pSection = (CrRegistersSection*)pPayload;
+#if defined(_M_AMD64)
+    pSection->machine = IMAGE_FILE_MACHINE_AMD64;
+#elif defined(_M_IX86)
+    pSection->machine = IMAGE_FILE_MACHINE_I386;
+#endif
+    pSection->contextFlags = pContext->ContextFlags;
+    pSection->contextSize = sizeof(CONTEXT);
+    pSection->xsaveSize = g_xsaveSize;
+    memcpy(pSection + 1, pContext, sizeof(CONTEXT));
+    if (g_xsaveSize == 0)
+    {
+        return;
+    }
+
+    BYTE* pXSave = (BYTE*)(pSection + 1) + sizeof(CONTEXT);
+    DWORD64 xstateMask = 0;
+#if defined(_M_AMD64)
+    if ((pContext->ContextFlags & CONTEXT_FLOATING_POINT) == CONTEXT_FLOATING_POINT)
+    {
+        memcpy(pXSave, &pContext->FltSave, XSAVE_LEGACY_SIZE);
+        xstateMask |= XSAVE_LEGACY_COMPONENTS;
+    }
+#elif defined(_M_IX86)
+    if ((pContext->ContextFlags & CONTEXT_EXTENDED_REGISTERS) == CONTEXT_EXTENDED_REGISTERS)
+    {
+        memcpy(pXSave, pContext->ExtendedRegisters, XSAVE_LEGACY_SIZE);
+        xstateMask |= XSAVE_LEGACY_COMPONENTS;
+    }
+#endif
+    if ((pContext->ContextFlags & CONTEXT_XSTATE) == CONTEXT_XSTATE)
+    {
+        for (DWORD i = 2; i < XSAVE_MAX_FEATURES; i++)
+        {
+            if ((g_xstateMask & (1ull << i)) == 0)
+            {
+                continue;
+            }
+            DWORD length = 0;
+            const BYTE* pFeature = (const BYTE*)g_pfnLocateXStateFeature(pContext, i, &length);
+            if (pFeature != NULL)
+            {
+                memcpy(pXSave + g_xstateOffsets[i], pFeature,
+                    (length < g_xstateSizes[i]) ? length : g_xstateSizes[i]);
+                xstateMask |= 1ull << i;
+            }
+        }
+    }
+    // XSTATE_BV of the XSAVE header
+    memcpy(pXSave + XSAVE_LEGACY_SIZE, &xstateMask, sizeof(xstateMask));
+    pSection->xstateMask = xstateMask;
+}
+
+// Bytes around the faulting instruction, a few before it so the exporter finds where the
+// preceding instructions start. A neighbouring page may be unmapped, then only the page
+// of the instruction is copied; nothing is copied for a jump to an unreadable address.
+static void AddCodeSection(RecordBuilder* pBuilder, const EXCEPTION_POINTERS* ep)
+{
+    if (ep == NULL || ep->ContextRecord == NULL)
+    {
+        return;
+    }
+#if defined(_M_AMD64)
+    const DWORD64 pc = ep->ContextRecord->Rip;
+#elif defined(_M_IX86)
+    const DWORD64 pc = ep->ContextRecord->Eip;
+#endif
+    DWORD64 begin = (pc > CR_RECORD_CODE_BEFORE) ? pc - CR_RECORD_CODE_BEFORE : 0;
+    DWORD64 end = begin + CR_RECORD_CODE_SIZE;
+    BYTE code[CR_RECORD_CODE_SIZE];
+    if (!SafeRead((DWORD_PTR)begin, code, (size_t)(end - begin)))
+    {
+        const DWORD64 page = pc & ~(DWORD64)(CR_RECORD_CODE_PAGE_SIZE - 1);
+        begin = (begin > page) ? begin : page;
+        end = (end < page + CR_RECORD_CODE_PAGE_SIZE) ? end : page + CR_RECORD_CODE_PAGE_SIZE;
+        if (!SafeRead((DWORD_PTR)begin, code, (size_t)(end - begin)))
+        {
+            return;
+        }
+    }
+    const DWORD size = (DWORD)(end - begin);
+    CrCodeSection* pSection = (CrCodeSection*)AddSection(pBuilder, CR_SECTION_CODE, sizeof(CrCodeSection) + size);
+    if (pSection == NULL)
+    {
+        return;
+    }
+    pSection->address = begin;
+    pSection->size = size;
+    pSection->pcOffset = (DWORD)(pc - begin);
+    memcpy(pSection + 1, code, size);
+}
+
+static void AddModuleEntry(const ModuleInfo& info, void* pContext)
+{
+    CrTableSection* pTable = (CrTableSection*)pContext;
+    if (pTable->count >= CR_RECORD_MAX_MODULES)
+    {
+        return;
+    }
+    CrModuleEntry* pEntry = (CrModuleEntry*)(pTable + 1) + pTable->count++;
+    pEntry->base = info.base;
+    pEntry->size = (DWORD)(info.end - info.base);
+    pEntry->timeDateStamp = info.timeDateStamp;
+    pEntry->pdbGuid = info.pdbGuid;
+    pEntry->pdbAge = info.pdbAge;
+    strncpy_s(pEntry->name, sizeof(pEntry->name), info.name, _TRUNCATE);
+}
+
+static void AddModulesSection(RecordBuilder* pBuilder)
+{
+    BYTE* pPayload = AddSection(pBuilder, CR_SECTION_MODULES,
+        sizeof(CrTableSection) + CR_RECORD_MAX_MODULES * sizeof(CrModuleEntry));
+    if (pPayload == NULL)
+    {
+        return;
+    }
+    CrTableSection* pTable = (CrTableSection*)pPayload;
+    pTable->entrySize = sizeof(CrModuleEntry);
+
+    // The module map was kept current by the loader, nothing to ask the loader here
+    GetModuleMap().EnumModules(AddModuleEntry, pTable);
+    TrimLastSection(pBuilder, pPayload, sizeof(CrTableSection) + pTable->count * sizeof(CrModuleEntry));
+}
+
+static void AddThreadSection(RecordBuilder* pBuilder, DWORD threadId, WORD flags,
+                             const DWORD64* pFrames, USHORT depth)
+{
+    BYTE* pPayload = AddSection(pBuilder, CR_SECTION_THREAD, sizeof(CrThreadSection) + depth * sizeof(DWORD64));
+    if (pPayload == NULL)
+    {
+        return;
+    }
+    CrThreadSection* pThread = (CrThreadSection*)pPayload;
+    pThread->threadId = threadId;
+    pThread->frameCount = depth;
+    pThread->flags = flags;
+    memcpy(pThread + 1, pFrames, depth * sizeof(DWORD64));
+}
+
+// Stack DWORD `i` XORed with the reference, both aligned at their top
+static DWORD GetStackDelta(const DWORD* pStack, DWORD count, const DWORD* pReference, DWORD refCount, DWORD i)
+{
+    const LONG j = (LONG)(i + refCount) - (LONG)count;
+    return (j >= 0) ? pStack[i] ^ pReference[j] : pStack[i];
+}
+
+// Runs of a stack memory section. Zeros shorter than 2 DWORDs stay in the literals, so
+// every run but the first saves at least its header, the runs take at most 8 bytes more
+// than the stack up to 256 KB.
+static DWORD EncodeStackRuns(const DWORD* pStack, DWORD count, const DWORD* pReference, DWORD refCount, BYTE* pOut)
+{
+    BYTE* p = pOut;
+    DWORD i = 0;
+    while (i < count)
+    {
+        DWORD zeros = 0;
+        while (i + zeros < count && zeros < 0xFFFF && GetStackDelta(pStack, count, pReference, refCount, i + zeros) == 0)
+        {
+            zeros++;
+        }
+        if (zeros < 2 && i + zeros < count)
+        {
+            zeros = 0;
+        }
+        const DWORD start = i + zeros;
+        DWORD literals = 0;
+        while (start + literals < count && literals < 0xFFFF)
+        {
+            const DWORD k = start + literals;
+            if (GetStackDelta(pStack, count, pReference, refCount, k) == 0 && k + 1 < count &&
+                GetStackDelta(pStack, count, pReference, refCount, k + 1) == 0)
+            {
+                break;
+            }
+            literals++;
+        }
+        *(WORD*)p = (WORD)zeros;
+        *(WORD*)(p + 2) = (WORD)literals;
+        DWORD* pLiterals = (DWORD*)(p + 4);
+        for (DWORD k = 0; k < literals; k++)
+        {
+            pLiterals[k] = GetStackDelta(pStack, count, pReference, refCount, start + k);
+        }
+        p += 4 + literals * sizeof(DWORD);
+        i = start + literals;
+    }
+    return (DWORD)(p - pOut);
+}
+
+// Encode the stack in g_pStackImage, which becomes the reference of the next one. Stacks
+// are left out once the record is full, then the next one is still a delta of the last
+// stack written.
+static void AddStackMemorySection(RecordBuilder* pBuilder, DWORD threadId, DWORD64 address, DWORD cbStack)
+{
+    cbStack &= ~(DWORD)(sizeof(DWORD) - 1);
+    const DWORD cbReserve = sizeof(CrStackMemorySection) + cbStack + 16;
+    if (cbStack == 0 || pBuilder->size + cbReserve + CR_RECORD_TAIL_RESERVE > pBuilder->capacity)
+    {
+        return;
+    }
+    BYTE* pPayload = AddSection(pBuilder, CR_SECTION_STACK_MEMORY, cbReserve);
+    if (pPayload == NULL)
+    {
+        return;
+    }
+    CrStackMemorySection* pSection = (CrStackMemorySection*)pPayload;
+    pSection->threadId = threadId;
+    pSection->flags = (pBuilder->cbStackReference > 0) ? CR_STACK_DELTA : 0;
+    pSection->address = address;
+    pSection->size = cbStack;
+    pSection->encodedSize = EncodeStackRuns((const DWORD*)g_pStackImage, cbStack / sizeof(DWORD),
+        (const DWORD*)g_pStackReference, pBuilder->cbStackReference / sizeof(DWORD), (BYTE*)(pSection + 1));
+    TrimLastSection(pBuilder, pPayload, sizeof(CrStackMemorySection) + pSection->encodedSize);
+
+    BYTE* pImage = g_pStackImage;
+    g_pStackImage = g_pStackReference;
+    g_pStackReference = pImage;
+    pBuilder->cbStackReference = cbStack;
+}
+
+// Unwind the faulting context, it may belong to another thread when the stack
+// overflowed, so the stack range is taken from the memory region of the stack pointer
+static void AddCrashedThreadSection(RecordBuilder* pBuilder, const EXCEPTION_POINTERS* ep, DWORD dwThreadId)
+{
+    DWORD64 frames[MAX_STACK_FRAMES];
+    USHORT depth = 0;
+    DWORD64 stackAddress = 0;
+    DWORD cbStack = 0;
+    if (ep != NULL && ep->ContextRecord != NULL)
+    {
+        CONTEXT ctx = *ep->ContextRecord;
+#if defined(_M_AMD64)
+        DWORD64 sp = ctx.Rsp;
+#elif defined(_M_IX86)
+        DWORD64 sp = ctx.Esp;
+#endif
+        ThreadStackBounds bounds = {};
+        GetCurrentThreadStackBounds(&bounds);
+        if (sp < bounds.StackLimit || sp >= bounds.StackBase)
+        {
+            MEMORY_BASIC_INFORMATION mbi = {};
+            if (VirtualQuery((LPCVOID)(ULONG_PTR)sp, &mbi, sizeof(mbi)) && mbi.State == MEM_COMMIT)
+            {
+                bounds.StackLimit = (DWORD64)(ULONG_PTR)mbi.BaseAddress;
+                bounds.StackBase = bounds.StackLimit + mbi.RegionSize;
+            }
+        }
+        // The frames are above the stack pointer and the handler runs below it, they hold still
+        stackAddress = sp & ~(DWORD64)(sizeof(ULONG_PTR) - 1);
+        if (stackAddress >= bounds.StackLimit && stackAddress < bounds.StackBase)
+        {
+            cbStack = (DWORD)std::min<DWORD64>(bounds.StackBase - stackAddress, CR_RECORD_STACK_COPY_SIZE);
+            if (!SafeRead((DWORD_PTR)stackAddress, g_pStackImage, cbStack))
+            {
+                cbStack = 0;
+            }
+        }
+        depth = UnwindStack(&ctx, bounds.StackLimit, bounds.StackBase, frames, MAX_STACK_FRAMES);
+    }
+    AddThreadSection(pBuilder, dwThreadId, CR_THREAD_CRASHED, frames, depth);
+    AddStackMemorySection(pBuilder, dwThreadId, stackAddress, cbStack);
+}
+
+// Sample the other threads of the process, each one is suspended only while its stack is copied.
+// The thread writing the record is left out, it is a helper when the stack overflowed.
+static void AddOtherThreadSections(RecordBuilder* pBuilder, DWORD dwCrashedThreadId)
+{
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    const DWORD dwProcessId = GetCurrentProcessId();
+    const DWORD dwCurrentThreadId = GetCurrentThreadId();
+    DWORD64 frames[MAX_STACK_FRAMES];
+    DWORD count = 1;    // the crashed thread
+    THREADENTRY32 te = {};
+    te.dwSize = sizeof(te);
+    for (BOOL bOk = Thread32First(hSnapshot, &te); bOk && count < CR_RECORD_MAX_THREADS;
+         bOk = Thread32Next(hSnapshot, &te))
+    {
+        if (te.th32OwnerProcessID != dwProcessId || te.th32ThreadID == dwCurrentThreadId ||
+            te.th32ThreadID == dwCrashedThreadId)
+        {
+            continue;
+        }
+        HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION,
+            FALSE, te.th32ThreadID);
+        if (hThread == NULL)
+        {
+            continue;
+        }
+        USHORT depth = 0;
+        DWORD64 stackAddress = 0;
+        SIZE_T cbStack = 0;
+        ThreadStackBounds bounds = {};
+        // Threads with handlers installed registered their bounds
+        if (FindThreadStackBounds(te.th32ThreadID, &bounds) || GetThreadStackBounds(hThread, &bounds))
+        {
+            CONTEXT ctx;
+            cbStack = CopyThreadStack(hThread, bounds, g_pStackImage, CR_RECORD_STACK_COPY_SIZE, &ctx, &stackAddress);
+            if (cbStack > 0)
+            {
+                // The unwinder rewrites the copy it runs on, the image is recorded as read
+                memcpy(g_pStackCopy, g_pStackImage, cbStack);
+                depth = UnwindStackCopy(&ctx, stackAddress, g_pStackCopy, cbStack, frames, MAX_STACK_FRAMES);
+            }
+        }
+        CloseHandle(hThread);
+        AddThreadSection(pBuilder, te.th32ThreadID, 0, frames, depth);
+        AddStackMemorySection(pBuilder, te.th32ThreadID, stackAddress, (DWORD)cbStack);
+        count++;
+    }
+    CloseHandle(hSnapshot);
+}
+
+static void AddBreadcrumbsSection(RecordBuilder* pBuilder)
+{
+    BYTE* pPayload = AddSection(pBuilder, CR_SECTION_BREADCRUMBS,
+        sizeof(CrTableSection) + MAX_BREADCRUMBS * sizeof(Breadcrumb));
+    if (pPayload == NULL)
+    {
+        return;
+    }
+    CrTableSection* pTable = (CrTableSection*)pPayload;
+    pTable->entrySize = sizeof(Breadcrumb);
+    pTable->count = CopyBreadcrumbs((Breadcrumb*)(pTable + 1), MAX_BREADCRUMBS);
+    TrimLastSection(pBuilder, pPayload, sizeof(CrTableSection) + pTable->count * sizeof(Breadcrumb));
+}
+
+static void AddSysInfoSection(RecordBuilder* pBuilder)
+{
+    const char* pszText = GetStaticSystemInfo();
+    DWORD textLength = (DWORD)strlen(pszText);
+    CrSysInfoSection* pSection = (CrSysInfoSection*)AddSection(pBuilder, CR_SECTION_SYSINFO,
+        sizeof(CrSysInfoSection) + textLength + 1);
+    if (pSection == NULL)
+    {
+        return;
+    }
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    pSection->processorCount = si.dwNumberOfProcessors;
+    pSection->pageSize = si.dwPageSize;
+
+    MEMORYSTATUSEX ms = {};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms))
+    {
+        pSection->totalPhys = ms.ullTotalPhys;
+        pSection->availPhys = ms.ullAvailPhys;
+        pSection->commitCharge = ms.ullTotalPageFile - ms.ullAvailPageFile;
+        pSection->commitLimit = ms.ullTotalPageFile;
+    }
+    PROCESS_MEMORY_COUNTERS_EX pmc = {};
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS)&pmc, sizeof(pmc)))
+    {
+        pSection->workingSet = pmc.WorkingSetSize;
+        pSection->privateBytes = pmc.PrivateUsage;
+    }
+    GetProcessHandleCount(GetCurrentProcess(), &pSection->handleCount);
+    pSection->textLength = textLength;
+    memcpy(pSection + 1, pszText, textLength);
+}
+
+void InitCrashRecord()
+{
+    if (g_pRecordBuffer != NULL)
+    {
+        return;
+    }
+    BYTE* pMemory = (BYTE*)VirtualAlloc(NULL, CR_RECORD_BUFFER_SIZE + 3 * CR_RECORD_STACK_COPY_SIZE +
+        CR_RECORD_STACK_COPY_SLACK, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (pMemory == NULL)
+    {
+        LogLastError();
+        return;
+    }
+    g_pStackImage = pMemory + CR_RECORD_BUFFER_SIZE;
+    g_pStackReference = g_pStackImage + CR_RECORD_STACK_COPY_SIZE;
+    g_pStackCopy = g_pStackReference + CR_RECORD_STACK_COPY_SIZE;
+    g_pRecordBuffer = pMemory;
+    InitXStateLayout();
+}
+
+int WriteCrashRecord(const char* pszFileName, const CR_EXCEPTION_INFO* pExceptionInfo, DWORD dwThreadId)
+{
+    assert(pszFileName && pExceptionInfo);
+    if (g_pRecordBuffer == NULL)
+    {
+        InitCrashRecord();
+        if (g_pRecordBuffer == NULL)
+        {
+            return 1;
+        }
+    }
+
+    RecordBuilder builder = { g_pRecordBuffer, sizeof(CrRecordHeader), CR_RECORD_BUFFER_SIZE, 0, 0 };
+    AddExceptionSection(&builder, pExceptionInfo);
+    AddRegistersSection(&builder, pExceptionInfo->pexcptrs);
+    AddCodeSection(&builder, pExceptionInfo->pexcptrs);
+    AddModulesSection(&builder);
+    AddCrashedThreadSection(&builder, pExceptionInfo->pexcptrs, dwThreadId);
+    AddOtherThreadSections(&builder, dwThreadId);
+    AddBreadcrumbsSection(&builder);
+    AddSysInfoSection(&builder);
+
+    CrRecordHeader* pHeader = (CrRecordHeader*)g_pRecordBuffer;
+    pHeader->magic = CR_RECORD_MAGIC;
+    pHeader->version = CR_RECORD_VERSION;
+    pHeader->sectionCount = builder.sectionCount;
+    pHeader->totalSize = builder.size;
+#if defined(_M_AMD64)
+    pHeader->machine = IMAGE_FILE_MACHINE_AMD64;
+#elif defined(_M_IX86)
+    pHeader->machine = IMAGE_FILE_MACHINE_I386;
+#endif
+    pHeader->reserved = 0;
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    pHeader->timestamp = ((DWORD64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    pHeader->processId = GetCurrentProcessId();
+    pHeader->threadId = dwThreadId;
+
+    HANDLE hFile = CreateFileA(pszFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        LogLastError();
+        return 1;
+    }
+    DWORD dwWritten = 0;
+    BOOL bOk = WriteFile(hFile, g_pRecordBuffer, builder.size, &dwWritten, NULL);
+    // Durable before anything else happens, the application may be restarted right after
+    FlushFileBuffers(hFile);
+    CloseHandle(hFile);
+    return (bOk && dwWritten == builder.size) ? 0 : 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// JSON exporter, runs offline, so it's free to allocate.
+//
+
+static void WriteJsonString(FILE* fp, const char* psz, size_t maxLen)
+{
+    fputc('"', fp);
+    for (size_t i = 0; i < maxLen && psz[i] != '\0'; i++)
+    {
+        unsigned char c = (unsigned char)psz[i];
+        switch (c)
+        {
+        case '"':  fputs("\\\"", fp); break;
+        case '\\': fputs("\\\\", fp); break;
+        case '\n': fputs("\\n", fp); break;
+        case '\r': fputs("\\r", fp); break;
+        case '\t': fputs("\\t", fp); break;
+        default:
+            if (c < 0x20)
+            {
+                fprintf(fp, "\\u%04x", c);
+            }
+            else
+            {
+                fputc(c, fp);
+            }
+        }
+    }
+    fputc('"', fp);
+}
+
+static void WriteJsonTime(FILE* fp, DWORD64 timestamp)
+{
+    FILETIME ft = { (DWORD)timestamp, (DWORD)(timestamp >> 32) };
+    SYSTEMTIME st = {};
+    FileTimeToSystemTime(&ft, &st);
+    fprintf(fp, "\"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ\"", st.wYear, st.wMonth, st.wDay,
+        st.wHour, st.wMinute, st.wSecond, st.wMilliseconds);
+}
+
+// Number of entries of a table within its section, 0 if they are smaller than `entrySize`
+static DWORD GetTableCount(const CrTableSection* pTable, const BYTE* pEnd, size_t entrySize)
+{
+    const BYTE* pFirst = (const BYTE*)(pTable + 1);
+    if (pTable->entrySize < entrySize || pFirst > pEnd)
+    {
+        return 0;
+    }
+    return (DWORD)std::min<size_t>(pTable->count, (pEnd - pFirst) / pTable->entrySize);
+}
+
+static bool CompareModuleBase(const CrModuleEntry* lhs, const CrModuleEntry* rhs)
+{
+    return lhs->base < rhs->base;
+}
+
+// Modules of a record sorted by base address
+class RecordModuleMap
+{
+public:
+    void Load(const CrTableSection* pTable, const BYTE* pEnd)
+    {
+        const BYTE* pEntry = (const BYTE*)(pTable + 1);
+        const DWORD count = GetTableCount(pTable, pEnd, sizeof(CrModuleEntry));
+        for (DWORD i = 0; i < count; i++)
+        {
+            modules_.push_back((const CrModuleEntry*)pEntry);
+            pEntry += pTable->entrySize;
+        }
+        std::sort(modules_.begin(), modules_.end(), CompareModuleBase);
+    }
+
+    const CrModuleEntry* Find(DWORD64 address) const
+    {
+        CrModuleEntry key = {};
+        key.base = address;
+        std::vector<const CrModuleEntry*>::const_iterator it =
+            std::upper_bound(modules_.begin(), modules_.end(), &key, CompareModuleBase);
+        if (it == modules_.begin())
+        {
+            return NULL;
+        }
+        --it;
+        return (address < (*it)->base + (*it)->size) ? *it : NULL;
+    }
+
+private:
+    std::vector<const CrModuleEntry*>   modules_;
+};
+
+static void WriteJsonException(FILE* fp, const CrExceptionSection* pSection)
+{
+    fprintf(fp, ",\n\"exception\":{\"type\":%u,\"code\":\"0x%08X\",\"flags\":%u,\"fpe_subcode\":%u,"
+        "\"address\":\"0x%I64X\",\"access_type\":%I64u,\"access_address\":\"0x%I64X\","
+        "\"pc\":\"0x%I64X\",\"sp\":\"0x%I64X\",\"fp\":\"0x%I64X\"}",
+        pSection->exceptionType, pSection->exceptionCode, pSection->exceptionFlags, pSection->fpeSubcode,
+        pSection->exceptionAddress, pSection->accessType, pSection->accessAddress,
+        pSection->pc, pSection->sp, pSection->fp);
+}
+
+static void WriteJsonVector(FILE* fp, const char* pszName, const BYTE* pData, DWORD count)
+{
+    fprintf(fp, ",\"%s\":[", pszName);
+    for (DWORD i = 0; i < count; i++)
+    {
+        const DWORD64* pLanes = (const DWORD64*)(pData + i * 16);
+        fprintf(fp, "%s\"%016I64X%016I64X\"", i > 0 ? "," : "", pLanes[1], pLanes[0]);
+    }
+    fputc(']', fp);
+}
+
+// Registers are decoded when the record was written by the same architecture
+static void WriteJsonRegisters(FILE* fp, const CrRegistersSection* pSection, const BYTE* pEnd)
+{
+    fprintf(fp, ",\n\"registers\":{\"context_flags\":\"0x%08X\",\"xstate_mask\":\"0x%I64X\",\"xsave_size\":%u",
+        pSection->contextFlags, pSection->xstateMask, pSection->xsaveSize);
+    const BYTE* pContext = (const BYTE*)(pSection + 1);
+    const BYTE* pXSave = pContext + pSection->contextSize;
+#if defined(_M_AMD64)
+    const WORD machine = IMAGE_FILE_MACHINE_AMD64;
+#elif defined(_M_IX86)
+    const WORD machine = IMAGE_FILE_MACHINE_I386;
+#endif
+    if (pSection->machine != machine || pSection->contextSize != sizeof(CONTEXT) || pXSave > pEnd)
+    {
+        fputc('}', fp);
+        return;
+    }
+    CONTEXT ctx;
+    memcpy(&ctx, pContext, sizeof(ctx));
+#if defined(_M_AMD64)
+    fprintf(fp, ",\"rax\":\"0x%I64X\",\"rbx\":\"0x%I64X\",\"rcx\":\"0x%I64X\",\"rdx\":\"0x%I64X\","
+        "\"rsi\":\"0x%I64X\",\"rdi\":\"0x%I64X\",\"rbp\":\"0x%I64X\",\"rsp\":\"0x%I64X\","
+        "\"r8\":\"0x%I64X\",\"r9\":\"0x%I64X\",\"r10\":\"0x%I64X\",\"r11\":\"0x%I64X\","
+        "\"r12\":\"0x%I64X\",\"r13\":\"0x%I64X\",\"r14\":\"0x%I64X\",\"r15\":\"0x%I64X\","
+        "\"rip\":\"0x%I64X\",\"eflags\":\"0x%08X\",\"mxcsr\":\"0x%08X\"",
+        ctx.Rax, ctx.Rbx, ctx.Rcx, ctx.Rdx, ctx.Rsi, ctx.Rdi, ctx.Rbp, ctx.Rsp,
+        ctx.R8, ctx.R9, ctx.R10, ctx.R11, ctx.R12, ctx.R13, ctx.R14, ctx.R15,
+        ctx.Rip, ctx.EFlags, ctx.MxCsr);
+    const DWORD vectorCount = 16;
+    WriteJsonVector(fp, "xmm", (const BYTE*)ctx.FltSave.XmmRegisters, vectorCount);
+#elif defined(_M_IX86)
+    fprintf(fp, ",\"eax\":\"0x%08X\",\"ebx\":\"0x%08X\",\"ecx\":\"0x%08X\",\"edx\":\"0x%08X\","
+        "\"esi\":\"0x%08X\",\"edi\":\"0x%08X\",\"ebp\":\"0x%08X\",\"esp\":\"0x%08X\","
+        "\"eip\":\"0x%08X\",\"eflags\":\"0x%08X\"",
+        ctx.Eax, ctx.Ebx, ctx.Ecx, ctx.Edx, ctx.Esi, ctx.Edi, ctx.Ebp, ctx.Esp, ctx.Eip, ctx.EFlags);
+    // FXSAVE image: MXCSR at 24, XMM0-7 at 160
+    const DWORD vectorCount = 8;
+    fprintf(fp, ",\"mxcsr\":\"0x%08X\"", *(const DWORD*)(ctx.ExtendedRegisters + 24));
+    WriteJsonVector(fp, "xmm", ctx.ExtendedRegisters + 160, vectorCount);
+#endif
+    if ((pSection->xstateMask & (1ull << XSAVE_AVX_COMPONENT)) &&
+        pSection->xsaveSize >= XSAVE_AVX_OFFSET + vectorCount * 16 && pXSave + pSection->xsaveSize <= pEnd)
+    {
+        WriteJsonVector(fp, "ymm_high", pXSave + XSAVE_AVX_OFFSET, vectorCount);
+    }
+    fputc('}', fp);
+}
+
+// General purpose registers in encoding order, when the record was written by the same architecture
+static bool LoadGpRegisters(const CrRegistersSection* pSection, const BYTE* pEnd, DWORD64 gpRegs[16])
+{
+    const BYTE* pContext = (const BYTE*)(pSection + 1);
+#if defined(_M_AMD64)
+    const WORD machine = IMAGE_FILE_MACHINE_AMD64;
+#elif defined(_M_IX86)
+    const WORD machine = IMAGE_FILE_MACHINE_I386;
+#endif
+    if (pSection->machine != machine || pSection->contextSize != sizeof(CONTEXT) ||
+        pContext + sizeof(CONTEXT) > pEnd)
+    {
+        return false;
+    }
+    CONTEXT ctx;
+    memcpy(&ctx, pContext, sizeof(ctx));
+    memset(gpRegs, 0, 16 * sizeof(DWORD64));
+#if defined(_M_AMD64)
+    // Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi, R8-R15 follow each other
+    memcpy(gpRegs, &ctx.Rax, 16 * sizeof(DWORD64));
+#elif defined(_M_IX86)
+    const DWORD regs[8] = { ctx.Eax, ctx.Ecx, ctx.Edx, ctx.Ebx, ctx.Esp, ctx.Ebp, ctx.Esi, ctx.Edi };
+    for (int i = 0; i < 8; i++)
+    {
+        gpRegs[i] = regs[i];
+    }
+#endif
+    return true;
+}
+
+static void WriteJsonHex(FILE* fp, const BYTE* pData, DWORD size)
+{
+    for (DWORD i = 0; i < size; i++)
+    {
+        fprintf(fp, "%02X", pData[i]);
+    }
+}
+
+// Rebuild the stack of a stack memory section, `reference` is the stack of the previous one
+static bool DecodeStackRuns(const CrStackMemorySection* pSection, const BYTE* pEnd,
+                            const std::vector<DWORD>& reference, std::vector<DWORD>* pStack)
+{
+    const DWORD count = pSection->size / sizeof(DWORD);
+    const BYTE* p = (const BYTE*)(pSection + 1);
+    const BYTE* pRunsEnd = p + pSection->encodedSize;
+    if (pRunsEnd > pEnd || pRunsEnd < p || ((pSection->flags & CR_STACK_DELTA) && reference.empty()))
+    {
+        return false;
+    }
+    pStack->assign(count, 0);
+    DWORD i = 0;
+    while (p + 4 <= pRunsEnd)
+    {
+        const DWORD zeros = *(const WORD*)p;
+        const DWORD literals = *(const WORD*)(p + 2);
+        p += 4;
+        if (i + zeros + literals > count || p + literals * sizeof(DWORD) > pRunsEnd)
+        {
+            return false;
+        }
+        i += zeros;
+        for (DWORD k = 0; k < literals; k++, i++)
+        {
+            (*pStack)[i] = ((const DWORD*)p)[k];
+        }
+        p += literals * sizeof(DWORD);
+    }
+    if (i != count)
+    {
+        return false;
+    }
+    if (pSection->flags & CR_STACK_DELTA)
+    {
+        const LONG shift = (LONG)reference.size() - (LONG)count;
+        for (DWORD k = 0; k < count; k++)
+        {
+            if ((LONG)k + shift >= 0)
+            {
+                (*pStack)[k] ^= reference[k + shift];
+            }
+        }
+    }
+    return true;
+}
+
+// Stack memory of the threads, decoded in record order since a stack is a delta of the
+// previous one. A stack which doesn't decode is written without its bytes.
+static void WriteJsonStacks(FILE* fp, const BYTE* pBegin, const BYTE* pEnd)
+{
+    std::vector<DWORD> reference;
+    std::vector<DWORD> stack;
+    bool bFirst = true;
+    for (const BYTE* p = pBegin; p + sizeof(CrSectionHeader) <= pEnd; )
+    {
+        const CrSectionHeader* pSection = (const CrSectionHeader*)p;
+        const BYTE* pNext = p + sizeof(CrSectionHeader) + pSection->size;
+        if (pNext > pEnd)
+        {
+            break;
+        }
+        p = pNext;
+        if (pSection->type != CR_SECTION_STACK_MEMORY || pSection->size < sizeof(CrStackMemorySection))
+        {
+            continue;
+        }
+        const CrStackMemorySection* pStack = (const CrStackMemorySection*)(pSection + 1);
+        const bool bOk = DecodeStackRuns(pStack, pNext, reference, &stack);
+        fprintf(fp, "%s\n{\"thread\":%u,\"address\":\"0x%I64X\",\"size\":%u,\"encoded_size\":%u,\"delta\":%s",
+            bFirst ? ",\n\"stacks\":[" : ",", pStack->threadId, pStack->address, pStack->size, pStack->encodedSize,
+            (pStack->flags & CR_STACK_DELTA) ? "true" : "false");
+        if (bOk && !stack.empty())
+        {
+            fputs(",\"bytes\":\"", fp);
+            WriteJsonHex(fp, (const BYTE*)&stack[0], (DWORD)(stack.size() * sizeof(DWORD)));
+            fputc('"', fp);
+        }
+        fputc('}', fp);
+        bFirst = false;
+        if (bOk)
+        {
+            reference.swap(stack);
+        }
+        else
+        {
+            reference.clear();
+        }
+    }
+    if (!bFirst)
+    {
+        fputs("]", fp);
+    }
+}
+
+// Memory operand of the faulting instruction: the one containing the inaccessible address
+// when there are two (movs, cmps), and its effective address if the registers are known
+static void WriteJsonFaultOperand(FILE* fp, const DisasmInstruction& inst, DWORD64 address,
+                                  const DWORD64* pGpRegs, const CrExceptionSection* pException)
+{
+    int chosen = -1;
+    DWORD64 effectiveAddress = 0;
+    bool bComputed = false;
+    for (BYTE i = 0; i < inst.operandCount; i++)
+    {
+        const DisasmOperand& op = inst.operands[i];
+        if (op.type != DISASM_OP_MEM)
+        {
+            continue;
+        }
+        DWORD64 value = 0;
+        const bool bOk = (pGpRegs != NULL) && ComputeEffectiveAddress(inst, op, address, pGpRegs, &value);
+        const bool bHit = bOk && pException != NULL && pException->accessAddress >= value &&
+            pException->accessAddress < value + (op.size ? op.size : 1);
+        if (chosen < 0 || bHit)
+        {
+            chosen = i;
+            effectiveAddress = value;
+            bComputed = bOk;
+        }
+        if (bHit)
+        {
+            break;
+        }
+    }
+    if (chosen < 0)
+    {
+        return;
+    }
+    char szOperand[64];
+    FormatOperand(inst, inst.operands[chosen], address, szOperand, sizeof(szOperand));
+    fputs(",\"memory_operand\":", fp);
+    WriteJsonString(fp, szOperand, sizeof(szOperand));
+    if (bComputed)
+    {
+        fprintf(fp, ",\"effective_address\":\"0x%I64X\"", effectiveAddress);
+    }
+}
+
+// Decoding starts at the earliest byte of the window from which the instructions fall
+// in step with the faulting one, and stops at the first byte which doesn't decode
+static void WriteJsonCode(FILE* fp, const CrCodeSection* pSection, const BYTE* pEnd, bool b64,
+                          const DWORD64* pGpRegs, const CrExceptionSection* pException)
+{
+    const BYTE* pCode = (const BYTE*)(pSection + 1);
+    const DWORD size = std::min<DWORD>(pSection->size, (DWORD)(pEnd - pCode));
+    const DWORD pcOffset = pSection->pcOffset;
+    fprintf(fp, ",\n\"code\":{\"address\":\"0x%I64X\",\"pc_offset\":%u,\"bytes\":\"",
+        pSection->address, pcOffset);
+    WriteJsonHex(fp, pCode, size);
+    fputs("\",\"instructions\":[", fp);
+    DWORD start = pcOffset;
+    for (DWORD offset = 0; offset < pcOffset && pcOffset < size; offset++)
+    {
+        DWORD pos = offset;
+        DisasmInstruction inst;
+        int len = 0;
+        while (pos < pcOffset && (len = DecodeInstruction(pCode + pos, size - pos, b64, &inst)) > 0)
+        {
+            pos += len;
+        }
+        if (pos == pcOffset)
+        {
+            start = offset;
+            break;
+        }
+    }
+    for (DWORD pos = start; pos < size; )
+    {
+        DisasmInstruction inst;
+        const int len = DecodeInstruction(pCode + pos, size - pos, b64, &inst);
+        if (len == 0)
+        {
+            break;
+        }
+        const DWORD64 address = pSection->address + pos;
+        char szText[128];
+        FormatInstruction(inst, address, szText, sizeof(szText));
+        fprintf(fp, "%s\n{\"address\":\"0x%I64X\",\"bytes\":\"", (pos == start) ? "" : ",", address);
+        WriteJsonHex(fp, pCode + pos, len);
+        fputs("\",\"text\":", fp);
+        WriteJsonString(fp, szText, sizeof(szText));
+        if (pos == pcOffset)
+        {
+            fputs(",\"faulting\":true", fp);
+            WriteJsonFaultOperand(fp, inst, address, pGpRegs, pException);
+        }
+        fputc('}', fp);
+        pos += len;
+    }
+    fputs("]}", fp);
+}
+
+static void WriteJsonModules(FILE* fp, const CrTableSection* pTable, const BYTE* pEnd)
+{
+    fputs(",\n\"modules\":[", fp);
+    const BYTE* pEntry = (const BYTE*)(pTable + 1);
+    const DWORD count = GetTableCount(pTable, pEnd, sizeof(CrModuleEntry));
+    for (DWORD i = 0; i < count; i++)
+    {
+        const CrModuleEntry* pModule = (const CrModuleEntry*)pEntry;
+        char szBuildId[MODULE_BUILD_ID_LEN];
+        FormatBuildId(pModule->pdbGuid, pModule->pdbAge, szBuildId, sizeof(szBuildId));
+        fputs(i > 0 ? ",\n{\"name\":" : "\n{\"name\":", fp);
+        WriteJsonString(fp, pModule->name, sizeof(pModule->name));
+        // Same build id as the symbol store and symbol server paths of the PDB
+        fprintf(fp, ",\"base\":\"0x%I64X\",\"size\":%u,\"timestamp\":%u,\"build_id\":\"%s\"}",
+            pModule->base, pModule->size, pModule->timeDateStamp, szBuildId);
+        pEntry += pTable->entrySize;
+    }
+    fputs("]", fp);
+}
+
+static void WriteJsonThread(FILE* fp, const CrThreadSection* pThread, const BYTE* pEnd,
+                            const RecordModuleMap& modules, bool bFirst)
+{
+    fprintf(fp, "%s\n{\"id\":%u,\"crashed\":%s,\"frames\":[", bFirst ? "" : ",", pThread->threadId,
+        (pThread->flags & CR_THREAD_CRASHED) ? "true" : "false");
+    const DWORD64* pFrames = (const DWORD64*)(pThread + 1);
+    for (WORD i = 0; i < pThread->frameCount && (const BYTE*)(pFrames + i + 1) <= pEnd; i++)
+    {
+        const CrModuleEntry* pModule = modules.Find(pFrames[i]);
+        if (i > 0)
+        {
+            fputc(',', fp);
+        }
+        if (pModule != NULL)
+        {
+            // The name comes from the crashed process and may need escaping
+            char szFrame[CR_RECORD_MODULE_NAME_LEN + 32] = {};
+            memcpy(szFrame, pModule->name, sizeof(pModule->name));
+            size_t len = strlen(szFrame);
+            sprintf(szFrame + len, "+0x%I64x", pFrames[i] - pModule->base);
+            WriteJsonString(fp, szFrame, sizeof(szFrame));
+        }
+        else
+        {
+            fprintf(fp, "\"0x%I64x\"", pFrames[i]);
+        }
+    }
+    fputs("]}", fp);
+}
+
+static void WriteJsonBreadcrumbs(FILE* fp, const CrTableSection* pTable, const BYTE* pEnd)
+{
+    fputs(",\n\"breadcrumbs\":[", fp);
+    const BYTE* pEntry = (const BYTE*)(pTable + 1);
+    const DWORD count = GetTableCount(pTable, pEnd, sizeof(Breadcrumb));
+    for (DWORD i = 0; i < count; i++)
+    {
+        const Breadcrumb* pBreadcrumb = (const Breadcrumb*)pEntry;
+        fputs(i > 0 ? ",\n{\"time\":" : "\n{\"time\":", fp);
+        WriteJsonTime(fp, pBreadcrumb->timestamp);
+        fprintf(fp, ",\"thread\":%u,\"text\":", pBreadcrumb->threadId);
+        WriteJsonString(fp, pBreadcrumb->text, sizeof(pBreadcrumb->text));
+        fputc('}', fp);
+        pEntry += pTable->entrySize;
+    }
+    fputs("]", fp);
+}
+
+static void WriteJsonSysInfo(FILE* fp, const CrSysInfoSection* pSection, const BYTE* pEnd)
+{
+    fprintf(fp, ",\n\"system\":{\"processors\":%u,\"page_size\":%u,\"total_phys\":%I64u,"
+        "\"avail_phys\":%I64u,\"commit_charge\":%I64u,\"commit_limit\":%I64u,\"working_set\":%I64u,"
+        "\"private_bytes\":%I64u,\"handle_count\":%u,\"text\":",
+        pSection->processorCount, pSection->pageSize, pSection->totalPhys, pSection->availPhys,
+        pSection->commitCharge, pSection->commitLimit, pSection->workingSet, pSection->privateBytes,
+        pSection->handleCount);
+    const char* pszText = (const char*)(pSection + 1);
+    size_t maxLen = std::min<size_t>(pSection->textLength, pEnd - (const BYTE*)pszText);
+    WriteJsonString(fp, pszText, maxLen);
+    fputc('}', fp);
+}
+
+// Read the whole record and check its header, sections are checked when visited
+static bool LoadCrashRecord(const char* pszFileName, std::vector<BYTE>* pData)
+{
+    FILE* fp = fopen(pszFileName, "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    CrRecordHeader header = {};
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != CR_RECORD_MAGIC ||
+        header.version != CR_RECORD_VERSION || header.totalSize < sizeof(header))
+    {
+        fclose(fp);
+        return false;
+    }
+    pData->resize(header.totalSize);
+    memcpy(&(*pData)[0], &header, sizeof(header));
+    size_t cbRead = fread(&(*pData)[sizeof(header)], 1, header.totalSize - sizeof(header), fp);
+    fclose(fp);
+    // A truncated record keeps its complete sections
+    pData->resize(sizeof(header) + cbRead);
+    return true;
+}
+
+int CrashRecordToJson(const char* pszInFile, const char* pszOutFile)
+{
+    if (pszInFile == NULL || pszOutFile == NULL)
+    {
+        return 1;
+    }
+    std::vector<BYTE> data;
+    if (!LoadCrashRecord(pszInFile, &data))
+    {
+        return 1;
+    }
+    const CrRecordHeader* pHeader = (const CrRecordHeader*)&data[0];
+    const BYTE* pBegin = &data[0] + sizeof(CrRecordHeader);
+    const BYTE* pEnd = &data[0] + data.size();
+
+    // Modules are needed to write the frames, the exception and the registers to resolve
+    // the faulting memory operand, wherever their sections are
+    RecordModuleMap modules;
+    const CrExceptionSection* pException = NULL;
+    DWORD64 gpRegs[16];
+    bool bGpRegs = false;
+    for (const BYTE* p = pBegin; p + sizeof(CrSectionHeader) <= pEnd; )
+    {
+        const CrSectionHeader* pSection = (const CrSectionHeader*)p;
+        p += sizeof(CrSectionHeader) + pSection->size;
+        if (p > pEnd)
+        {
+            break;
+        }
+        if (pSection->type == CR_SECTION_MODULES && pSection->size >= sizeof(CrTableSection))
+        {
+            modules.Load((const CrTableSection*)(pSection + 1), p);
+        }
+        else if (pSection->type == CR_SECTION_EXCEPTION && pSection->size >= sizeof(CrExceptionSection))
+        {
+            pException = (const CrExceptionSection*)(pSection + 1);
+        }
+        else if (pSection->type == CR_SECTION_REGISTERS && pSection->size >= sizeof(CrRegistersSection))
+        {
+            bGpRegs = LoadGpRegisters((const CrRegistersSection*)(pSection + 1), p, gpRegs);
+        }
+    }
+
+    FILE* fp = fopen(pszOutFile, "w");
+    if (fp == NULL)
+    {
+        return 1;
+    }
+    fprintf(fp, "{\"version\":%u,\"machine\":%u,\"time\":", pHeader->version, pHeader->machine);
+    WriteJsonTime(fp, pHeader->timestamp);
+    fprintf(fp, ",\"pid\":%u,\"tid\":%u", pHeader->processId, pHeader->threadId);
+
+    bool bFirstThread = true;
+    for (const BYTE* p = pBegin; p + sizeof(CrSectionHeader) <= pEnd; )
+    {
+        const CrSectionHeader* pSection = (const CrSectionHeader*)p;
+        const BYTE* pPayload = p + sizeof(CrSectionHeader);
+        const BYTE* pNext = pPayload + pSection->size;
+        if (pNext > pEnd)
+        {
+            break;
+        }
+        // Thread sections are written one after another, close the array after the last one;
+        // their stack memory is written apart
+        if (!bFirstThread && pSection->type != CR_SECTION_THREAD && pSection->type != CR_SECTION_STACK_MEMORY)
+        {
+            fputs("]", fp);
+            bFirstThread = true;
+        }
+        switch (pSection->type)
+        {
+        case CR_SECTION_EXCEPTION:
+            if (pSection->size >= sizeof(CrExceptionSection))
+            {
+                WriteJsonException(fp, (const CrExceptionSection*)pPayload);
+            }
+            break;
+        case CR_SECTION_REGISTERS:
+            if (pSection->size >= sizeof(CrRegistersSection))
+            {
+                WriteJsonRegisters(fp, (const CrRegistersSection*)pPayload, pNext);
+            }
+            break;
+        case CR_SECTION_CODE:
+            if (pSection->size >= sizeof(CrCodeSection))
+            {
+                WriteJsonCode(fp, (const CrCodeSection*)pPayload, pNext,
+                    pHeader->machine == IMAGE_FILE_MACHINE_AMD64, bGpRegs ? gpRegs : NULL, pException);
+            }
+            break;
+        case CR_SECTION_MODULES:
+            if (pSection->size >= sizeof(CrTableSection))
+            {
+                WriteJsonModules(fp, (const CrTableSection*)pPayload, pNext);
+            }
+            break;
+        case CR_SECTION_THREAD:
+            if (pSection->size >= sizeof(CrThreadSection))
+            {
+                fputs(bFirstThread ? ",\n\"threads\":[" : "", fp);
+                WriteJsonThread(fp, (const CrThreadSection*)pPayload, pNext, modules, bFirstThread);
+                bFirstThread = false;
+            }
+            break;
+        case CR_SECTION_BREADCRUMBS:
+            if (pSection->size >= sizeof(CrTableSection))
+            {
+                WriteJsonBreadcrumbs(fp, (const CrTableSection*)pPayload, pNext);
+            }
+            break;
+        case CR_SECTION_SYSINFO:
+            if (pSection->size >= sizeof(CrSysInfoSection))
+            {
+                WriteJsonSysInfo(fp, (const CrSysInfoSection*)pPayload, pNext);
+            }
+            break;
+        default:
+            break;
+        }
+        p = pNext;
+    }
+    if (!bFirstThread)
+    {
+        fputs("]", fp);
+    }
+    WriteJsonStacks(fp, pBegin, pEnd);
+    fputs("}\n", fp);
+    fclose(fp);
+    return 0;
+}
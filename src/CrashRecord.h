@@ -0,0 +1,191 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include "CrashRpt.h"
+#include "Breadcrumbs.h"
+
+// Binary crash record, written next to the minidump as <AppName>_<date>-<time>.cdr
+//
+//   CrRecordHeader
+//   CrSectionHeader + payload, `sectionCount` times
+//
+// Little endian, every structure has the same layout in 32 and 64-bit builds and
+// every field is at a fixed offset from the start of its section. Payloads are padded
+// to 8 bytes. Readers skip unknown section types by their size, so new sections do not
+// change the version; it's bumped only when the layout of an existing structure changes.
+
+enum
+{
+    CR_RECORD_MAGIC = 0x52444D43,   // "CMDR"
+    CR_RECORD_VERSION = 1,
+
+    CR_RECORD_MODULE_NAME_LEN = 64,
+
+    // Code window around the faulting instruction, starting this many bytes before it
+    CR_RECORD_CODE_SIZE = 64,
+    CR_RECORD_CODE_BEFORE = 16,
+
+    // Threads and modules beyond these are left out of the record
+    CR_RECORD_MAX_THREADS = 256,
+    CR_RECORD_MAX_MODULES = 512,
+};
+
+// Section types
+enum
+{
+    CR_SECTION_EXCEPTION = 1,       // CrExceptionSection
+    CR_SECTION_MODULES = 2,         // CrTableSection + CrModuleEntry[count]
+    CR_SECTION_THREAD = 3,          // CrThreadSection + DWORD64[frameCount], one section per thread
+    CR_SECTION_BREADCRUMBS = 4,     // CrTableSection + Breadcrumb[count]
+    CR_SECTION_SYSINFO = 5,         // CrSysInfoSection + NUL terminated text
+    CR_SECTION_REGISTERS = 6,       // CrRegistersSection + CONTEXT + XSAVE area, crashed thread
+    CR_SECTION_CODE = 7,            // CrCodeSection + code bytes around the faulting instruction
+    CR_SECTION_STACK_MEMORY = 8,    // CrStackMemorySection + runs, after the section of its thread
+};
+
+// CrThreadSection::flags
+enum
+{
+    CR_THREAD_CRASHED = 0x1,        // the thread which raised the exception
+};
+
+// CrStackMemorySection::flags
+enum
+{
+    CR_STACK_DELTA = 0x1,           // XORed with the stack of the previous stack memory section
+};
+
+struct CrRecordHeader
+{
+    DWORD       magic;              // CR_RECORD_MAGIC
+    WORD        version;            // CR_RECORD_VERSION
+    WORD        sectionCount;
+    DWORD       totalSize;          // bytes, header included
+    WORD        machine;            // IMAGE_FILE_MACHINE_xxx
+    WORD        reserved;
+    DWORD64     timestamp;          // FILETIME, UTC
+    DWORD       processId;
+    DWORD       threadId;           // thread which raised the exception
+};
+
+struct CrSectionHeader
+{
+    WORD        type;               // CR_SECTION_xxx
+    WORD        reserved;
+    DWORD       size;               // payload bytes following this header
+};
+
+struct CrTableSection
+{
+    DWORD       count;
+    DWORD       entrySize;          // entries may grow in later versions
+};
+
+struct CrExceptionSection
+{
+    DWORD       exceptionType;      // CR_SEH_EXCEPTION, CR_CPP_xxx
+    DWORD       exceptionCode;
+    DWORD       exceptionFlags;
+    DWORD       fpeSubcode;
+    DWORD64     exceptionAddress;
+    DWORD64     accessType;         // access violation: 0 read, 1 write, 8 execute
+    DWORD64     accessAddress;      // access violation: inaccessible address
+    DWORD64     pc;
+    DWORD64     sp;
+    DWORD64     fp;
+};
+
+// The CONTEXT is the native structure of `machine`. The XSAVE area is in the standard
+// (non compacted) format of the processor: x87/SSE state in the first 512 bytes, the
+// XSAVE header with XSTATE_BV next, every other component at its CPUID offset.
+struct CrRegistersSection
+{
+    WORD        machine;            // IMAGE_FILE_MACHINE_xxx, layout of the CONTEXT
+    WORD        reserved;
+    DWORD       contextFlags;       // CONTEXT_xxx, parts of the CONTEXT which are valid
+    DWORD       contextSize;        // bytes of the CONTEXT following this structure
+    DWORD       xsaveSize;          // bytes of the XSAVE area following the CONTEXT, 0 if none
+    DWORD64     xstateMask;         // state components present in the XSAVE area
+};
+
+// The window stops at a page which can't be read, so it may be shorter than
+// CR_RECORD_CODE_SIZE or start at the faulting instruction
+struct CrCodeSection
+{
+    DWORD64     address;            // of the first byte
+    DWORD       size;               // bytes following this structure
+    DWORD       pcOffset;           // offset of the faulting instruction in the bytes
+};
+
+struct CrModuleEntry
+{
+    DWORD64     base;
+    DWORD       size;
+    DWORD       timeDateStamp;      // PE header
+    GUID        pdbGuid;            // CodeView record, all zero if the module has none
+    DWORD       pdbAge;
+    DWORD       reserved;
+    char        name[CR_RECORD_MODULE_NAME_LEN];
+};
+
+struct CrThreadSection
+{
+    DWORD       threadId;
+    WORD        frameCount;
+    WORD        flags;              // CR_THREAD_xxx
+};
+
+// Live part of a thread stack, from the stack pointer up, as runs of DWORDs: a WORD count
+// of zero DWORDs, a WORD count of literal DWORDs, then the literals. With CR_STACK_DELTA
+// the DWORDs are XORed with the previous stack first, both stacks aligned at their top,
+// where the threads started by the same routine have the same frames.
+struct CrStackMemorySection
+{
+    DWORD       threadId;
+    DWORD       flags;              // CR_STACK_xxx
+    DWORD64     address;            // stack pointer
+    DWORD       size;               // bytes of stack, a multiple of 4
+    DWORD       encodedSize;        // bytes of runs following this structure
+};
+
+struct CrSysInfoSection
+{
+    DWORD       processorCount;
+    DWORD       pageSize;
+    DWORD64     totalPhys;
+    DWORD64     availPhys;
+    DWORD64     commitCharge;
+    DWORD64     commitLimit;
+    DWORD64     workingSet;
+    DWORD64     privateBytes;
+    DWORD       handleCount;
+    DWORD       textLength;         // length of the static system information text
+};
+
+C_ASSERT(sizeof(CrRecordHeader) == 32);
+C_ASSERT(sizeof(CrSectionHeader) == 8);
+C_ASSERT(sizeof(CrExceptionSection) == 64);
+C_ASSERT(sizeof(CrRegistersSection) == 24);
+C_ASSERT(sizeof(CrCodeSection) == 16);
+C_ASSERT(sizeof(CrModuleEntry) == 104);
+C_ASSERT(sizeof(CrThreadSection) == 8);
+C_ASSERT(sizeof(CrStackMemorySection) == 24);
+C_ASSERT(sizeof(CrSysInfoSection) == 64);
+C_ASSERT(sizeof(Breadcrumb) == 128);
+
+
+// Allocate the record buffers up front and read the XSAVE layout of the processor,
+// nothing is allocated or queried on the crash path
+void InitCrashRecord();
+
+// Build the crash record in the preallocated buffer and write it with a single WriteFile(),
+// `dwThreadId` raised the exception, it's not the calling thread when the stack overflowed
+int WriteCrashRecord(const char* pszFileName, const CR_EXCEPTION_INFO* pExceptionInfo, DWORD dwThreadId);
+
+// Convert a crash record to JSON, frames are written as module+offset and the code
+// window is disassembled
+int CrashRecordToJson(const char* pszInFile, const char* pszOutFile);
@@ -26,16 +26,36 @@ be found in the Authors.txt file in the root of the source tree.
 #include <signal.h>
 #include <eh.h>
 #include "CrashHandler.h"
-
-int crInstall()
+#include "Profiler.h"
+#include "LockProfiler.h"
+#include "HeapProfiler.h"
+#include "Symbolizer.h"
+#include "SymbolStore.h"
+#include "CrashRecord.h"
+#include "ReportSpool.h"
+#include "ReportUploader.h"
+#include "FaultRanges.h"
+
+int crInstall(DWORD dwFlags)
 {
-    SetProcessExceptionHanlders();
-    return 0;
+    return SetProcessExceptionHanlders(dwFlags);
 }
 
 int crUninstall()
 {
-    return 0;
+    // The background sender belongs to the installation too
+    GetReportUploader().Stop();
+    return UnsetProcessExceptionHandlers();
+}
+
+int crInstallToCurrentThread2(DWORD dwFlags)
+{
+    return SetThreadExceptionHandlers(dwFlags);
+}
+
+int crUninstallFromCurrentThread()
+{
+    return UnsetThreadExceptionHandlers();
 }
 
 int crExceptionFilter(unsigned int code, struct _EXCEPTION_POINTERS* ep)
@@ -47,7 +67,8 @@ int crExceptionFilter(unsigned int code, struct _EXCEPTION_POINTERS* ep)
     ei.pexcptrs = ep;
     ei.code = code;
 
-    int res = GenerateErrorReport(&ei);
+    // The caller's handler runs next, the process goes on
+    int res = GenerateErrorReport(&ei, 0, false);
     if(res!=0)
     {
         // If goes here than GenerateErrorReport() failed  
@@ -57,6 +78,114 @@ int crExceptionFilter(unsigned int code, struct _EXCEPTION_POINTERS* ep)
     return EXCEPTION_EXECUTE_HANDLER;  
 }
 
+int crProfilerStart(unsigned int hz)
+{
+    return GetProfiler().Start(hz);
+}
+
+int crProfilerStop()
+{
+    return GetProfiler().Stop();
+}
+
+int crProfilerDump(const char* pszFileName)
+{
+    return GetProfiler().Dump(pszFileName);
+}
+
+int crSymbolizeProfile(const char* pszInFile, const char* pszOutFile, const char* pszSearchPath)
+{
+    return SymbolizeFoldedFile(pszInFile, pszOutFile, pszSearchPath);
+}
+
+int crSetSymbolStore(const char* pszStoreDir, const char* pszServerUrl)
+{
+    return GetSymbolStore().Configure(pszStoreDir, pszServerUrl);
+}
+
+int crLockProfilerStart(unsigned int thresholdUs, DWORD dwFlags)
+{
+    return GetLockProfiler().Start(thresholdUs, dwFlags);
+}
+
+int crLockProfilerStop()
+{
+    return GetLockProfiler().Stop();
+}
+
+int crLockProfilerDump(const char* pszFileName)
+{
+    return GetLockProfiler().Dump(pszFileName);
+}
+
+// Never inlined, so its frame is always the one skipped and a call site has one stack
+__declspec(noinline) void crEnterCriticalSectionContended(LPCRITICAL_SECTION lpCriticalSection)
+{
+    EnterCriticalSectionTimed(lpCriticalSection, 1);
+}
+
+int crHeapProfilerStart(unsigned int sampleRate, ULONG64 rssThreshold)
+{
+    return GetHeapProfiler().Start(sampleRate, rssThreshold);
+}
+
+int crHeapProfilerStop()
+{
+    return GetHeapProfiler().Stop();
+}
+
+int crHeapProfilerDump(const char* pszFileName)
+{
+    return GetHeapProfiler().Dump(pszFileName);
+}
+
+int crAddBreadcrumb(const char* pszText)
+{
+    if (pszText == NULL)
+    {
+        return 1;
+    }
+    AddBreadcrumb(pszText);
+    return 0;
+}
+
+int crCrashRecordToJson(const char* pszRecordFile, const char* pszJsonFile)
+{
+    return CrashRecordToJson(pszRecordFile, pszJsonFile);
+}
+
+int crSpoolReports(const char* pszSpoolDir, const char* pszUrl, DWORD dwFlags)
+{
+    if (GetReportSpool().Open(pszSpoolDir) != 0)
+    {
+        return 1;
+    }
+    if ((dwFlags & CR_INST_SEND_QUEUED_REPORTS) && !(dwFlags & CR_INST_DONT_SEND_REPORT) && pszUrl != NULL)
+    {
+        return GetReportUploader().Start(pszUrl);
+    }
+    return 0;
+}
+
+int crSendQueuedReports(const char* pszSpoolDir, const char* pszUrl)
+{
+    if (GetReportSpool().Open(pszSpoolDir) != 0)
+    {
+        return -1;
+    }
+    return GetReportUploader().SendQueued(pszUrl);
+}
+
+int crRegisterFaultRange(void* pBase, size_t size, PFN_CR_FAULT_HANDLER pfnHandler, void* pContext)
+{
+    return GetFaultRanges().Register(pBase, size, pfnHandler, pContext);
+}
+
+int crUnregisterFaultRange(void* pBase)
+{
+    return GetFaultRanges().Unregister(pBase);
+}
+
 //-----------------------------------------------------------------------------------------------
 // Below crEmulateCrash() related stuff goes 
 
@@ -291,4 +420,3 @@ int crEmulateCrash(unsigned ExceptionType)
 
     return 1;
 }
-
@@ -104,6 +104,8 @@
 /*! \ingroup CrashRptAPI 
  *  \brief  Installs exception handlers for the caller process.
  *
+ *  \return
+ *    This function returns zero if succeeded, nonzero if the handlers are installed already.
  *
  *  \remarks
  *    This function installs unhandled exception filter for the caller process.
@@ -122,9 +124,22 @@
  *
  *    In a multithreaded program, additionally use crInstallToCurrentThread2() function for each execution
  *    thread, except the main one.
+ *
+ *    \a dwFlags selects the handlers as in crInstallToCurrentThread2(), zero installs all of them.
+ *    With \ref CR_INST_APP_RESTART, a new instance of the application is started with the original
+ *    command line, environment and working directory as soon as the crash record is on disk.
+ *    The minidump and the text report are written by the crashed process in the meantime.
+ *    After 3 crashes in a row each within 60 seconds of start, the application is not restarted.
+ *
+ *    Handlers installed before are kept and chained to. An exception goes to the previous unhandled
+ *    exception filter first, and is not reported if that filter returns
+ *    \c EXCEPTION_CONTINUE_EXECUTION, so an embedded runtime handling its own guard pages keeps
+ *    working. SIGINT and SIGTERM are forwarded to a previous handler, if any, instead of being
+ *    reported. SIGSEGV, SIGILL, SIGFPE and SIGABRT go to a previous handler first, and are
+ *    reported if it returns.
  * 
  */
-int crInstall();
+int crInstall(DWORD dwFlags = 0);
 
 
 /*! \ingroup CrashRptAPI 
@@ -138,6 +153,8 @@ int crInstall();
  *    Call this function on application exit to uninstall exception
  *    handlers previously installed with crInstall(). After function call, the exception handlers
  *    are restored to states they had before calling crInstall().
+ *    The background sender started by crSpoolReports() is stopped, and threads created afterwards
+ *    don't get handlers installed by \ref CR_INST_AUTO_THREAD_HANDLERS anymore.
  *
  *    This function fails if crInstall() wasn't previously called in context of the
  *    caller process.
@@ -172,6 +189,14 @@ int crUninstall();
 *      - \ref CR_INST_SIGILL_HANDLER                 Install SIGILL signal handler  
 *      - \ref CR_INST_SIGSEGV_HANDLER                Install SIGSEGV signal handler 
 * 
+*  The thread also gets a stack guarantee, so the handlers have stack left after a stack overflow,
+*  and its stack bounds are registered for the crash record. The state is taken from a pool
+*  allocated with the process, up to 1024 threads at the same time.
+*
+*  With \ref CR_INST_AUTO_THREAD_HANDLERS passed to crInstall(), the handlers are installed in every
+*  thread created afterwards, from a TLS callback run before the thread routine, and this call is
+*  not needed.
+*
 *  Example:
 *
 *   \code
@@ -331,7 +356,8 @@ typedef CR_EXCEPTION_INFO *PCR_EXCEPTION_INFO;
  *
  *     This function can be called instead of a SEH exception filter
  *     inside of __try{}__except(Expression){} statement. The function generates a error report
- *     and returns control to the exception handler block.
+ *     and returns control to the exception handler block. The process goes on, so
+ *     \ref CR_INST_APP_RESTART does not start a new instance.
  *
  *     The exception code is usually retrieved with \b GetExceptionCode() intrinsic function
  *     and the exception pointers are retrieved with \b GetExceptionInformation() intrinsic 
@@ -416,6 +442,298 @@ int crExceptionFilter(unsigned int code, struct _EXCEPTION_POINTERS* ep);
 int crEmulateCrash(unsigned ExceptionType) throw (...);
 
 
+/*! \ingroup CrashRptAPI
+ *  \brief Starts the in-process sampling profiler.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] hz Sampling frequency per second, from 1 to 1000.
+ *
+ *  \remarks
+ *
+ *    A background thread periodically samples the call stack of every thread of the process
+ *    which consumed CPU time since the previous tick. Stacks are captured with the same unwind
+ *    tables the crash handler uses, without dbghelp, and accumulated in a preallocated
+ *    lock-free table, so the profiler can be left running in production.
+ *
+ *    The effective frequency is bounded by the system timer resolution (usually 64 Hz).
+ *
+ *  \sa crProfilerStop(), crProfilerDump(), crSymbolizeProfile()
+ */
+int crProfilerStart(unsigned int hz);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Stops the sampling profiler, collected samples are kept until the process exits.
+ *
+ *  \return This function returns zero if succeeded.
+ */
+int crProfilerStop();
+
+/*! \ingroup CrashRptAPI
+ *  \brief Writes the samples collected so far to a file in folded-stack format.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszFileName Output file name.
+ *
+ *  \remarks
+ *
+ *    Every line is a stack, outermost frame first, followed by the number of samples.
+ *    Frames are raw \c module+0xoffset, preceded by \c "# module" lines describing the loaded
+ *    images. Use crSymbolizeProfile() on a machine with the PDB files to resolve function names,
+ *    the result can be fed to flamegraph.pl directly.
+ */
+int crProfilerDump(const char* pszFileName);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Resolves function names of a profile written by crProfilerDump().
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszInFile   Profile written by crProfilerDump().
+ *  \param[in] pszOutFile  Output file name.
+ *  \param[in] pszSearchPath Symbol search path, may be NULL.
+ */
+int crSymbolizeProfile(const char* pszInFile, const char* pszOutFile, const char* pszSearchPath);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Sets the symbol store crSymbolizeProfile() takes the PDB files from.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszStoreDir  Store directory, created if missing, NULL turns the store off.
+ *  \param[in] pszServerUrl Server to fetch missing PDB files from, may be NULL.
+ *
+ *  \remarks
+ *
+ *    PDB files are looked up by build id, the GUID and age of the CodeView record of their
+ *    module, in the layout of debuginfod: \c buildid/BUILDID/debuginfo under the store directory.
+ *
+ *    A PDB missing from the store is fetched from the same path under \a pszServerUrl, a
+ *    debuginfod server or any HTTP server over another store, at most 4 at once, and kept in
+ *    the store. \a pszServerUrl may also be the directory of another store, such as a share.
+ *    Each build is looked up once per process, so symbolizing a backlog of profiles fetches
+ *    every PDB once. A build found nowhere is looked up again after 10 minutes.
+ *
+ *    Do not call it while a profile is being symbolized.
+ */
+int crSetSymbolStore(const char* pszStoreDir, const char* pszServerUrl);
+
+
+// Flags for crLockProfilerStart()
+#define CR_LOCK_PROFILE_INTERPOSE       0x1  //!< Also profile every EnterCriticalSection() call of the loaded non-system modules.
+
+/*! \ingroup CrashRptAPI
+ *  \brief Starts the lock contention profiler.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] thresholdUs Waits shorter than this many microseconds are not recorded.
+ *  \param[in] dwFlags     Zero or \ref CR_LOCK_PROFILE_INTERPOSE.
+ *
+ *  \remarks
+ *
+ *    Contended acquisitions of a CrCriticalSection, and with \ref CR_LOCK_PROFILE_INTERPOSE
+ *    of any critical section entered through the import table of an application module
+ *    loaded before this call, are timed with \c rdtsc. When the wait exceeds the threshold,
+ *    the wait time is accounted to the acquiring call stack.
+ *
+ *    The most contended call sites are also listed in the crash report.
+ *
+ *  \sa crLockProfilerStop(), crLockProfilerDump(), CrCriticalSection
+ */
+int crLockProfilerStart(unsigned int thresholdUs, DWORD dwFlags);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Stops the lock contention profiler and restores the patched import tables.
+ *
+ *  \return This function returns zero if succeeded.
+ */
+int crLockProfilerStop();
+
+/*! \ingroup CrashRptAPI
+ *  \brief Writes contended call sites in folded-stack format, weighted by microseconds waited.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszFileName Output file name.
+ *
+ *  \remarks The output can be symbolized with crSymbolizeProfile().
+ */
+int crLockProfilerDump(const char* pszFileName);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Enters a critical section which is owned by another thread, timing the wait.
+ *
+ *  \remarks Used by CrCriticalSection when \c TryEnterCriticalSection() fails.
+ */
+void crEnterCriticalSectionContended(LPCRITICAL_SECTION lpCriticalSection);
+
+
+/*! \ingroup CrashRptAPI
+ *  \brief Starts the sampling heap profiler.
+ *
+ *  \return This function returns zero if succeeded, non-zero if the library was built
+ *    without \c CALMDUMP_HEAP_PROFILER.
+ *
+ *  \param[in] sampleRate   Mean number of bytes allocated between two samples, zero for the default (512 KB).
+ *  \param[in] rssThreshold Commit charge in bytes above which a heap report is written once, zero to disable.
+ *
+ *  \remarks
+ *
+ *    Built with the \c CALMDUMP_HEAP_PROFILER CMake option, the library replaces the global
+ *    operator new and delete. Allocations are sampled by byte count and the estimated live bytes
+ *    are kept per allocation call stack. Blocks obtained with \c malloc() directly are not seen.
+ *
+ *    The call sites holding most of the heap are listed in every crash report, notably
+ *    the one written when operator new fails, and in the heap report written when the
+ *    commit charge crosses \a rssThreshold.
+ *
+ *  \sa crHeapProfilerStop(), crHeapProfilerDump()
+ */
+int crHeapProfilerStart(unsigned int sampleRate, ULONG64 rssThreshold);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Stops sampling new allocations, the blocks already sampled are tracked until freed.
+ *
+ *  \return This function returns zero if succeeded.
+ */
+int crHeapProfilerStop();
+
+/*! \ingroup CrashRptAPI
+ *  \brief Writes live allocation call stacks in folded-stack format, weighted by bytes.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszFileName Output file name.
+ *
+ *  \remarks The output can be symbolized with crSymbolizeProfile().
+ */
+int crHeapProfilerDump(const char* pszFileName);
+
+
+/*! \ingroup CrashRptAPI
+ *  \brief Leaves a breadcrumb which will be written into the crash record.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszText Message, truncated to 111 characters.
+ *
+ *  \remarks
+ *
+ *    The last 64 breadcrumbs of the process are kept in a ring buffer. The call does not lock
+ *    and does not allocate memory, so it's cheap enough to trace what the application was doing.
+ *
+ *  \sa crCrashRecordToJson()
+ */
+int crAddBreadcrumb(const char* pszText);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Converts a binary crash record to JSON.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszRecordFile Crash record (.cdr file) written next to the minidump.
+ *  \param[in] pszJsonFile   Output file name.
+ *
+ *  \remarks
+ *
+ *    The crash record holds the exception, the module table with the PDB signatures, the
+ *    call stacks of all threads, the breadcrumbs and the system information. It's made of
+ *    length-prefixed sections of fixed-layout structures declared in CrashRecord.h, which
+ *    can also be read directly by an ingestion pipeline. Frames are written as module+offset.
+ */
+int crCrashRecordToJson(const char* pszRecordFile, const char* pszJsonFile);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Queues crash reports in a spool directory and uploads them to a collector.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pszSpoolDir Spool directory, created if missing.
+ *  \param[in] pszUrl      Collector endpoint, \c http:// or \c https://, may be NULL.
+ *  \param[in] dwFlags     Zero, \ref CR_INST_SEND_QUEUED_REPORTS or \ref CR_INST_DONT_SEND_REPORT.
+ *
+ *  \remarks
+ *
+ *    The crash record and the minidump of a crash are written into a directory of their own
+ *    under \c tmp of the spool, which is renamed into \c queue once both are complete.
+ *    The text report stays in the working directory. At most 32 reports are kept.
+ *
+ *    With \ref CR_INST_SEND_QUEUED_REPORTS, a background thread uploads the reports queued by
+ *    earlier runs. It starts 30 seconds after this call, in background processing mode, and
+ *    posts batches of 4 reports as \c multipart/form-data, one part per file named after its
+ *    report. A report is deleted once the collector answered with a 2xx status, a failed batch
+ *    is retried after a delay doubling from 1 minute to 1 hour. A report no request can carry,
+ *    larger than 4 GB or unreadable, or refused by the collector with a 4xx status other than
+ *    408 and 429, is moved to \c rejected of the spool and never sent again.
+ *
+ *    With \ref CR_INST_DONT_SEND_REPORT, reports are only queued, another process can send
+ *    them with crSendQueuedReports().
+ *
+ *  \sa crSendQueuedReports()
+ */
+int crSpoolReports(const char* pszSpoolDir, const char* pszUrl, DWORD dwFlags);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Uploads the reports queued in a spool directory, on the caller thread.
+ *
+ *  \return This function returns the number of reports left in the queue, -1 if it failed.
+ *
+ *  \param[in] pszSpoolDir Spool directory given to crSpoolReports().
+ *  \param[in] pszUrl      Collector endpoint.
+ *
+ *  \remarks
+ *
+ *    Stops at the first batch which failed, without waiting, for a sender process or a
+ *    scheduled task to try again later.
+ *
+ *  \sa crSpoolReports()
+ */
+int crSendQueuedReports(const char* pszSpoolDir, const char* pszUrl);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Called for a fault in a registered range, returns nonzero if the fault is resolved.
+ *
+ *  \param[in] pAddress Faulting address.
+ *  \param[in] bWrite   Nonzero if the access was a write.
+ *  \param[in] pContext Context given to crRegisterFaultRange().
+ */
+typedef int (CALLBACK *PFN_CR_FAULT_HANDLER)(void* pAddress, int bWrite, void* pContext);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Registers an address range whose access violations and guard page faults are expected.
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pBase      Start of the range.
+ *  \param[in] size       Size of the range in bytes.
+ *  \param[in] pfnHandler Called on the faulting thread for a fault inside the range.
+ *  \param[in] pContext   Passed to \a pfnHandler.
+ *
+ *  \remarks
+ *
+ *    A vectored exception handler, first in the list, looks the faulting address up in a
+ *    sorted table without taking a lock. If \a pfnHandler resolves the fault, for example
+ *    by committing the page or changing its protection, and returns nonzero, the faulting
+ *    instruction is executed again; otherwise the exception goes on as a crash.
+ *
+ *    Up to 256 ranges, they must not overlap. The handler must not be unregistered while a
+ *    fault in its range may be dispatched.
+ *
+ *  \sa crUnregisterFaultRange()
+ */
+int crRegisterFaultRange(void* pBase, size_t size, PFN_CR_FAULT_HANDLER pfnHandler, void* pContext);
+
+/*! \ingroup CrashRptAPI
+ *  \brief Unregisters a range registered with crRegisterFaultRange().
+ *
+ *  \return This function returns zero if succeeded.
+ *
+ *  \param[in] pBase Start of the range.
+ */
+int crUnregisterFaultRange(void* pBase);
+
 
 
 //// Helper wrapper classes
@@ -457,6 +775,49 @@ public:
   int m_nInstallStatus;
 };
 
+/*! \class CrCriticalSection
+ *  \ingroup CrashRptWrappers
+ *  \brief Critical section which reports contended waits to the lock contention profiler.
+ *  \remarks
+ *    An uncontended Enter() is a single \c TryEnterCriticalSection() call.
+ *
+ *  \sa crLockProfilerStart()
+ */
+
+class CrCriticalSection
+{
+public:
+
+  CrCriticalSection()
+  {
+    InitializeCriticalSection(&m_cs);
+  }
+
+  ~CrCriticalSection()
+  {
+    DeleteCriticalSection(&m_cs);
+  }
+
+  void Enter()
+  {
+    if (!TryEnterCriticalSection(&m_cs))
+    {
+      crEnterCriticalSectionContended(&m_cs);
+    }
+  }
+
+  void Leave()
+  {
+    LeaveCriticalSection(&m_cs);
+  }
+
+  CRITICAL_SECTION m_cs;
+
+private:
+  CrCriticalSection(const CrCriticalSection&);
+  CrCriticalSection& operator = (const CrCriticalSection&);
+};
+
 
 #endif //!_CRASHRPT_NO_WRAPPERS
 
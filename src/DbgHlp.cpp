@@ -42,13 +42,18 @@ BOOL DbghlpDll::init()
     SymSetContext = (SymSetContext_t)GetFuncAddress(("SymSetContext"));
     SymEnumSymbols = (SymEnumSymbols_t)GetFuncAddress(("SymEnumSymbols"));
     SymGetTypeInfo = (SymGetTypeInfo_t)GetFuncAddress(("SymGetTypeInfo"));
+    SymLoadModuleEx = (SymLoadModuleEx_t)GetFuncAddress(("SymLoadModuleEx"));
     EnumerateLoadedModules = (EnumerateLoadedModules_t)GetFuncAddress(("EnumerateLoadedModules"));
     MiniDumpWriteDump = (MiniDumpWriteDump_t)GetFuncAddress(("MiniDumpWriteDump"));
+    SymAddrIncludeInlineTrace = (SymAddrIncludeInlineTrace_t)GetFuncAddress(("SymAddrIncludeInlineTrace"));
+    SymQueryInlineTrace = (SymQueryInlineTrace_t)GetFuncAddress(("SymQueryInlineTrace"));
+    SymFromInlineContext = (SymFromInlineContext_t)GetFuncAddress(("SymFromInlineContext"));
+    SymGetLineFromInlineContext = (SymGetLineFromInlineContext_t)GetFuncAddress(("SymGetLineFromInlineContext"));
 
     return (SymGetOptions && SymSetOptions && SymInitialize && SymCleanup
         && StackWalk && SymFromAddr && SymFunctionTableAccess && SymGetModuleBase
         && SymGetLineFromAddr && SymSetContext && SymEnumSymbols
-        && SymGetTypeInfo && EnumerateLoadedModules && MiniDumpWriteDump);
+        && SymGetTypeInfo && SymLoadModuleEx && EnumerateLoadedModules && MiniDumpWriteDump);
 }
 
 // DbgHelp dll wrapper object
@@ -57,3 +62,23 @@ DbghlpDll&  GetDbghelpDll()
     static DbghlpDll   instance;
     return instance;
 }
+
+DWORD QueryInlineFrames(HANDLE hProcess, DWORD64 address, DWORD* pContext)
+{
+    DbghlpDll& dll = GetDbghelpDll();
+    if (!dll.SymAddrIncludeInlineTrace || !dll.SymQueryInlineTrace || !dll.SymFromInlineContext)
+    {
+        return 0;
+    }
+    DWORD count = dll.SymAddrIncludeInlineTrace(hProcess, address);
+    if (count == 0)
+    {
+        return 0;
+    }
+    DWORD frameIndex = 0;
+    if (!dll.SymQueryInlineTrace(hProcess, address, 0, address, address, pContext, &frameIndex))
+    {
+        return 0;
+    }
+    return count;
+}
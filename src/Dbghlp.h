@@ -25,12 +25,19 @@ typedef BOOL(WINAPI* SymSetContext_t)(HANDLE, PIMAGEHLP_STACK_FRAME, PIMAGEHLP_C
 typedef BOOL(WINAPI* SymEnumSymbols_t)(HANDLE, ULONG64, PCSTR, PSYM_ENUMERATESYMBOLS_CALLBACK, PVOID);
 typedef BOOL(WINAPI* SymGetTypeInfo_t)(HANDLE, DWORD64, ULONG, IMAGEHLP_SYMBOL_TYPE_INFO, PVOID);
 typedef BOOL(WINAPI* SymCleanup_t)(HANDLE);
+typedef DWORD64(WINAPI* SymLoadModuleEx_t)(HANDLE, HANDLE, PCSTR, PCSTR, DWORD64, DWORD, PMODLOAD_DATA, DWORD);
 typedef BOOL(WINAPI* EnumerateLoadedModules_t)(HANDLE, PENUMLOADED_MODULES_CALLBACK, PVOID);
 typedef BOOL(WINAPI* MiniDumpWriteDump_t)(HANDLE, DWORD, HANDLE, MINIDUMP_TYPE,
                                          CONST PMINIDUMP_EXCEPTION_INFORMATION,
                                          CONST PMINIDUMP_USER_STREAM_INFORMATION,
                                          CONST PMINIDUMP_CALLBACK_INFORMATION);
 
+// inline frame functions, dbghelp 6.2 and later
+typedef DWORD(WINAPI* SymAddrIncludeInlineTrace_t)(HANDLE, DWORD64);
+typedef BOOL(WINAPI* SymQueryInlineTrace_t)(HANDLE, DWORD64, DWORD, DWORD64, DWORD64, LPDWORD, LPDWORD);
+typedef BOOL(WINAPI* SymFromInlineContext_t)(HANDLE, DWORD64, ULONG, PDWORD64, PSYMBOL_INFO);
+typedef BOOL(WINAPI* SymGetLineFromInlineContext_t)(HANDLE, DWORD64, ULONG, DWORD64, PDWORD, PIMAGEHLP_LINE64);
+
 // wrapper class for dbghelp.dll
 struct DbghlpDll : public DllHandle
 {
@@ -51,9 +58,20 @@ struct DbghlpDll : public DllHandle
     SymSetContext_t             SymSetContext;
     SymEnumSymbols_t            SymEnumSymbols;
     SymGetTypeInfo_t            SymGetTypeInfo;
+    SymLoadModuleEx_t           SymLoadModuleEx;
     EnumerateLoadedModules_t    EnumerateLoadedModules;
     MiniDumpWriteDump_t         MiniDumpWriteDump;
+
+    // NULL if dbghelp is too old
+    SymAddrIncludeInlineTrace_t     SymAddrIncludeInlineTrace;
+    SymQueryInlineTrace_t           SymQueryInlineTrace;
+    SymFromInlineContext_t          SymFromInlineContext;
+    SymGetLineFromInlineContext_t   SymGetLineFromInlineContext;
 };
 
 // DbgHelp dll wrapper object
 DbghlpDll&  GetDbghelpDll();
+
+// Number of functions inlined at `address`, `pContext` receives the inline context of the
+// innermost one, the next ones outwards follow it. 0 if there are none or dbghelp is too old.
+DWORD QueryInlineFrames(HANDLE hProcess, DWORD64 address, DWORD* pContext);
@@ -0,0 +1,1586 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Disassembler.h"
+#include <stdio.h>
+#include <string.h>
+
+#pragma warning(disable: 4996)
+
+// Operands of the opcode maps, in the notation of the Intel manual
+enum
+{
+    OPND_NONE = 0,
+    OPND_Eb, OPND_Ew, OPND_Ed, OPND_Ev, OPND_Ey,    // ModRM r/m, general purpose register or memory
+    OPND_Gb, OPND_Gw, OPND_Gd, OPND_Gv, OPND_Gy,    // ModRM reg, general purpose register
+    OPND_M,                                         // ModRM r/m, memory of no particular size
+    OPND_Mq, OPND_Mx,                               // ModRM r/m, memory of 8/16 bytes
+    OPND_Ib, OPND_Ibs, OPND_Iw, OPND_Iz, OPND_Iv,   // immediates, Ibs sign extended to the operand size
+    OPND_Jb, OPND_Jz,                               // relative branch targets
+    OPND_AL, OPND_eAX, OPND_CL, OPND_DX, OPND_ONE,  // fixed operands
+    OPND_Zb, OPND_Zv,                               // register in the low 3 bits of the opcode
+    OPND_Ob, OPND_Ov,                               // absolute address
+    OPND_Xb, OPND_Xv, OPND_Yb, OPND_Yv,             // ds:[rsi] and es:[rdi] of the string instructions
+    OPND_Sw,                                        // segment register
+    OPND_Vx, OPND_Hx, OPND_Wx, OPND_Wq, OPND_Wd,    // vector registers: ModRM reg, VEX.vvvv, ModRM r/m
+    OPND_Lx,                                        // vector register in the high bits of an immediate
+    OPND_Pq, OPND_Qq,                               // MMX registers: ModRM reg, ModRM r/m
+    OPND_By,                                        // VEX.vvvv, general purpose register
+};
+
+struct DecodeState
+{
+    const BYTE*         pCode;
+    size_t              cbCode;
+    size_t              pos;
+    bool                b64;
+    bool                has66;
+    bool                hasF2;
+    bool                hasF3;
+    BYTE                rex;            // REX byte, or REX bits taken from VEX
+    BYTE                opcode;
+    BYTE                opSize;
+    BYTE                segment;
+
+    bool                vex;
+    bool                vexL;
+    BYTE                vexReg;         // VEX.vvvv
+
+    bool                hasModRM;
+    BYTE                mod;
+    BYTE                reg;            // ModRM reg, REX.R included
+    BYTE                rm;             // ModRM r/m as encoded
+    BYTE                rmReg;          // ModRM r/m, REX.B included
+    DisasmOperand       memory;         // r/m operand when mod != 3
+
+    BYTE                vectorMemSize;  // memory operand of a vector instruction, 0 for the full vector
+    bool                scalar;         // vector operands are xmm whatever VEX.L
+    bool                mmx;            // Vx and Wx are MMX registers
+    bool                vsib;           // index of the memory operand is a vector register
+
+    DisasmInstruction*  pInst;
+};
+
+static const char* const kAlu[8] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+static const char* const kShift[8] = { "rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar" };
+static const char* const kGroup3[8] = { "test", "test", "not", "neg", "mul", "imul", "div", "idiv" };
+static const char* const kCondition[16] = { "o", "no", "b", "ae", "e", "ne", "be", "a",
+                                            "s", "ns", "p", "np", "l", "ge", "le", "g" };
+static const char* const kFpSuffix[4] = { "ps", "pd", "ss", "sd" };
+
+// x87 instructions with a memory operand, by opcode D8-DF and ModRM reg, and the operand size
+static const char* const kX87Memory[8][8] = {
+    { "fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr" },
+    { "fld", NULL, "fst", "fstp", "fldenv", "fldcw", "fnstenv", "fnstcw" },
+    { "fiadd", "fimul", "ficom", "ficomp", "fisub", "fisubr", "fidiv", "fidivr" },
+    { "fild", "fisttp", "fist", "fistp", NULL, "fld", NULL, "fstp" },
+    { "fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr" },
+    { "fld", "fisttp", "fst", "fstp", "frstor", NULL, "fnsave", "fnstsw" },
+    { "fiadd", "fimul", "ficom", "ficomp", "fisub", "fisubr", "fidiv", "fidivr" },
+    { "fild", "fisttp", "fist", "fistp", "fbld", "fild", "fbstp", "fistp" },
+};
+static const BYTE kX87MemorySize[8][8] = {
+    { 4, 4, 4, 4, 4, 4, 4, 4 },
+    { 4, 0, 4, 4, 0, 2, 0, 2 },
+    { 4, 4, 4, 4, 4, 4, 4, 4 },
+    { 4, 4, 4, 4, 0, 10, 0, 10 },
+    { 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 8, 8, 8, 8, 0, 0, 0, 2 },
+    { 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 2, 2, 2, 2, 10, 8, 10, 8 },
+};
+
+// x87 instructions on stack registers, by opcode D8-DF and ModRM reg
+static const char* const kX87Register[8][8] = {
+    { "fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr" },
+    { "fld", "fxch", "fnop", NULL, NULL, NULL, NULL, NULL },
+    { "fcmovb", "fcmove", "fcmovbe", "fcmovu", NULL, NULL, NULL, NULL },
+    { "fcmovnb", "fcmovne", "fcmovnbe", "fcmovnu", NULL, "fucomi", "fcomi", NULL },
+    { "fadd", "fmul", "fcom", "fcomp", "fsubr", "fsub", "fdivr", "fdiv" },
+    { "ffree", NULL, "fst", "fstp", "fucom", "fucomp", NULL, NULL },
+    { "faddp", "fmulp", NULL, NULL, "fsubrp", "fsubp", "fdivrp", "fdivp" },
+    { NULL, NULL, NULL, NULL, NULL, "fucomip", "fcomip", NULL },
+};
+
+// D9 E0-FF
+static const char* const kX87D9[32] = {
+    "fchs", "fabs", NULL, NULL, "ftst", "fxam", NULL, NULL,
+    "fld1", "fldl2t", "fldl2e", "fldpi", "fldlg2", "fldln2", "fldz", NULL,
+    "f2xm1", "fyl2x", "fptan", "fpatan", "fxtract", "fprem1", "fdecstp", "fincstp",
+    "fprem", "fyl2xp1", "fsqrt", "fsincos", "frndint", "fscale", "fsin", "fcos",
+};
+
+// MMX/SSE2 integer instructions 0F 60-6D and 0F D0-FF, NULL where the opcode is special
+static const char* const kSimd60[14] = {
+    "punpcklbw", "punpcklwd", "punpckldq", "packsswb", "pcmpgtb", "pcmpgtw", "pcmpgtd", "packuswb",
+    "punpckhbw", "punpckhwd", "punpckhdq", "packssdw", "punpcklqdq", "punpckhqdq",
+};
+static const char* const kSimdD0[48] = {
+    NULL, "psrlw", "psrld", "psrlq", "paddq", "pmullw", NULL, NULL,
+    "psubusb", "psubusw", "pminub", "pand", "paddusb", "paddusw", "pmaxub", "pandn",
+    "pavgb", "psraw", "psrad", "pavgw", "pmulhuw", "pmulhw", NULL, NULL,
+    "psubsb", "psubsw", "pminsw", "por", "paddsb", "paddsw", "pmaxsw", "pxor",
+    NULL, "psllw", "pslld", "psllq", "pmuludq", "pmaddwd", "psadbw", NULL,
+    "psubb", "psubw", "psubd", "psubq", "paddb", "paddw", "paddd", NULL,
+};
+
+// 0F 38 00-4F with a 66 prefix
+static const char* const kSimd3800[80] = {
+    "pshufb", "phaddw", "phaddd", "phaddsw", "pmaddubsw", "phsubw", "phsubd", "phsubsw",
+    "psignb", "psignw", "psignd", "pmulhrsw", "permilps", "permilpd", "testps", "testpd",
+    "pblendvb", NULL, NULL, "cvtph2ps", "blendvps", "blendvpd", "permps", "ptest",
+    "broadcastss", "broadcastsd", "broadcastf128", NULL, "pabsb", "pabsw", "pabsd", NULL,
+    "pmovsxbw", "pmovsxbd", "pmovsxbq", "pmovsxwd", "pmovsxwq", "pmovsxdq", NULL, NULL,
+    "pmuldq", "pcmpeqq", "movntdqa", "packusdw", "maskmovps", "maskmovpd", "maskmovps", "maskmovpd",
+    "pmovzxbw", "pmovzxbd", "pmovzxbq", "pmovzxwd", "pmovzxwq", "pmovzxdq", "permd", "pcmpgtq",
+    "pminsb", "pminsd", "pminuw", "pminud", "pmaxsb", "pmaxsd", "pmaxuw", "pmaxud",
+    "pmulld", "phminposuw", NULL, NULL, NULL, "psrlvd", "psravd", "psllvd",
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+};
+
+// FMA 0F 38 96-9F, A6-AF, B6-BF by the low nibble, completed with 132/213/231 and ps/pd/ss/sd
+static const char* const kFma[10] = {
+    "fmaddsub", "fmsubadd", "fmadd", "fmadd", "fmsub", "fmsub", "fnmadd", "fnmadd", "fnmsub", "fnmsub",
+};
+
+static const char* const kReg64[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+static const char* const kReg32[16] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                        "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+static const char* const kReg16[16] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                        "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+static const char* const kReg8[16] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                       "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+static const char* const kReg8High[4] = { "ah", "ch", "dh", "bh" };
+static const char* const kSegment[7] = { "", "es", "cs", "ss", "ds", "fs", "gs" };
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Operands
+//
+
+// Little endian, sign extended
+static bool ReadImmediate(DecodeState& s, size_t count, LONG64* pValue)
+{
+    if (s.pos + count > s.cbCode)
+    {
+        return false;
+    }
+    DWORD64 value = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        value |= (DWORD64)s.pCode[s.pos + i] << (i * 8);
+    }
+    if (count < 8 && (value & (1ull << (count * 8 - 1))))
+    {
+        value |= ~0ull << (count * 8);
+    }
+    *pValue = (LONG64)value;
+    s.pos += count;
+    return true;
+}
+
+static bool ParseModRM(DecodeState& s)
+{
+    if (s.hasModRM)
+    {
+        return true;
+    }
+    if (s.pos >= s.cbCode)
+    {
+        return false;
+    }
+    const BYTE modrm = s.pCode[s.pos++];
+    s.hasModRM = true;
+    s.mod = modrm >> 6;
+    s.reg = ((modrm >> 3) & 7) | ((s.rex & 4) << 1);
+    s.rm = modrm & 7;
+    s.rmReg = s.rm | ((s.rex & 1) << 3);
+    if (s.mod == 3)
+    {
+        return true;
+    }
+
+    DisasmOperand& mem = s.memory;
+    mem.type = DISASM_OP_MEM;
+    mem.base = DISASM_NO_REG;
+    mem.index = DISASM_NO_REG;
+    mem.scale = 1;
+    mem.segment = s.segment;
+    if (s.pInst->addressSize == 2)
+    {
+        // bx+si, bx+di, bp+si, bp+di, si, di, bp, bx
+        static const BYTE kBase16[8] = { 3, 3, 5, 5, 6, 7, 5, 3 };
+        static const BYTE kIndex16[8] = { 6, 7, 6, 7, DISASM_NO_REG, DISASM_NO_REG, DISASM_NO_REG, DISASM_NO_REG };
+        if (s.mod == 0 && s.rm == 6)
+        {
+            return ReadImmediate(s, 2, &mem.disp);
+        }
+        mem.base = kBase16[s.rm];
+        mem.index = kIndex16[s.rm];
+        return (s.mod == 0) || ReadImmediate(s, (s.mod == 1) ? 1 : 2, &mem.disp);
+    }
+    if (s.rm == 4)
+    {
+        if (s.pos >= s.cbCode)
+        {
+            return false;
+        }
+        const BYTE sib = s.pCode[s.pos++];
+        const BYTE index = ((sib >> 3) & 7) | ((s.rex & 2) << 2);
+        mem.scale = (BYTE)(1 << (sib >> 6));
+        // Index 4 (rsp) means none, except as a vector register
+        mem.index = (index == 4 && !s.vsib) ? (BYTE)DISASM_NO_REG : index;
+        if ((sib & 7) == 5 && s.mod == 0)
+        {
+            return ReadImmediate(s, 4, &mem.disp);
+        }
+        mem.base = (sib & 7) | ((s.rex & 1) << 3);
+    }
+    else if (s.rm == 5 && s.mod == 0)
+    {
+        mem.ripRelative = s.b64;
+        return ReadImmediate(s, 4, &mem.disp);
+    }
+    else
+    {
+        mem.base = s.rmReg;
+    }
+    return (s.mod == 0) || ReadImmediate(s, (s.mod == 1) ? 1 : 4, &mem.disp);
+}
+
+static void SetGpRegister(const DecodeState& s, DisasmOperand& op, BYTE reg, BYTE size)
+{
+    op.type = DISASM_OP_REG;
+    op.regClass = DISASM_REG_GP;
+    op.size = size;
+    op.reg = reg;
+    // Without REX, spl/bpl/sil/dil encode ah/ch/dh/bh
+    if (size == 1 && s.rex == 0 && reg >= 4 && reg < 8)
+    {
+        op.highByte = true;
+        op.reg = reg - 4;
+    }
+}
+
+static BYTE GetVectorClass(const DecodeState& s)
+{
+    if (s.mmx)
+    {
+        return DISASM_REG_MMX;
+    }
+    return (s.vex && s.vexL && !s.scalar) ? DISASM_REG_YMM : DISASM_REG_XMM;
+}
+
+static BYTE GetVectorSize(BYTE regClass)
+{
+    return (regClass == DISASM_REG_YMM) ? 32 : (regClass == DISASM_REG_MMX) ? 8 : 16;
+}
+
+static void SetVectorRegister(DisasmOperand& op, BYTE regClass, BYTE reg)
+{
+    op.type = DISASM_OP_REG;
+    op.regClass = regClass;
+    op.size = GetVectorSize(regClass);
+    op.reg = (regClass == DISASM_REG_MMX) ? (reg & 7) : reg;
+}
+
+// ModRM r/m as a general purpose register or memory of `size` bytes
+static void SetRm(const DecodeState& s, DisasmOperand& op, BYTE size)
+{
+    if (s.mod == 3)
+    {
+        SetGpRegister(s, op, s.rmReg, size);
+    }
+    else
+    {
+        op = s.memory;
+        op.size = size;
+    }
+}
+
+// ModRM r/m as a vector register or memory of `memSize` bytes
+static void SetVectorRm(const DecodeState& s, DisasmOperand& op, BYTE regClass, BYTE memSize)
+{
+    if (s.mod == 3)
+    {
+        SetVectorRegister(op, regClass, s.rmReg);
+    }
+    else
+    {
+        op = s.memory;
+        op.size = memSize;
+    }
+}
+
+static bool NeedsModRM(BYTE spec)
+{
+    return (spec >= OPND_Eb && spec <= OPND_Mx) || spec == OPND_Sw || spec == OPND_Vx || spec == OPND_Wx ||
+        spec == OPND_Wq || spec == OPND_Wd || spec == OPND_Pq || spec == OPND_Qq;
+}
+
+static bool AddOperand(DecodeState& s, BYTE spec)
+{
+    DisasmInstruction* pInst = s.pInst;
+    if (spec == OPND_NONE || (spec == OPND_Hx && !s.vex))
+    {
+        return true;
+    }
+    if (pInst->operandCount >= DISASM_MAX_OPERANDS)
+    {
+        return false;
+    }
+    DisasmOperand& op = pInst->operands[pInst->operandCount++];
+    op.base = DISASM_NO_REG;
+    op.index = DISASM_NO_REG;
+    const BYTE sizeY = (s.rex & 8) ? 8 : 4;
+    const BYTE vectorClass = GetVectorClass(s);
+    LONG64 value = 0;
+    switch (spec)
+    {
+    case OPND_Eb: SetRm(s, op, 1); return true;
+    case OPND_Ew: SetRm(s, op, 2); return true;
+    case OPND_Ed: SetRm(s, op, 4); return true;
+    case OPND_Ev: SetRm(s, op, s.opSize); return true;
+    case OPND_Ey: SetRm(s, op, sizeY); return true;
+    case OPND_M: SetRm(s, op, 0); return s.mod != 3;
+    case OPND_Mq: SetRm(s, op, 8); return s.mod != 3;
+    case OPND_Mx: SetRm(s, op, GetVectorSize(vectorClass)); return s.mod != 3;
+    case OPND_Gb: SetGpRegister(s, op, s.reg, 1); return true;
+    case OPND_Gw: SetGpRegister(s, op, s.reg, 2); return true;
+    case OPND_Gd: SetGpRegister(s, op, s.reg, 4); return true;
+    case OPND_Gv: SetGpRegister(s, op, s.reg, s.opSize); return true;
+    case OPND_Gy: SetGpRegister(s, op, s.reg, sizeY); return true;
+
+    case OPND_Ib:
+    case OPND_Ibs:
+    case OPND_Iw:
+    case OPND_Iz:
+    case OPND_Iv:
+        op.type = DISASM_OP_IMM;
+        op.size = (spec == OPND_Ib) ? 1 : (spec == OPND_Iw) ? 2 : s.opSize;
+        return ReadImmediate(s, (spec == OPND_Ib || spec == OPND_Ibs) ? 1 : (spec == OPND_Iw) ? 2 :
+            (spec == OPND_Iv) ? s.opSize : (s.opSize == 2) ? 2 : 4, &op.imm);
+    case OPND_Jb:
+    case OPND_Jz:
+        op.type = DISASM_OP_REL;
+        op.size = pInst->addressSize;
+        return ReadImmediate(s, (spec == OPND_Jb) ? 1 : (s.opSize == 2 && !s.b64) ? 2 : 4, &op.imm);
+
+    case OPND_AL: SetGpRegister(s, op, 0, 1); return true;
+    case OPND_eAX: SetGpRegister(s, op, 0, s.opSize); return true;
+    case OPND_CL: SetGpRegister(s, op, 1, 1); return true;
+    case OPND_DX: SetGpRegister(s, op, 2, 2); return true;
+    case OPND_ONE:
+        op.type = DISASM_OP_IMM;
+        op.size = 1;
+        op.imm = 1;
+        return true;
+    case OPND_Zb: SetGpRegister(s, op, (s.opcode & 7) | ((s.rex & 1) << 3), 1); return true;
+    case OPND_Zv: SetGpRegister(s, op, (s.opcode & 7) | ((s.rex & 1) << 3), s.opSize); return true;
+
+    case OPND_Ob:
+    case OPND_Ov:
+        op.type = DISASM_OP_MEM;
+        op.size = (spec == OPND_Ob) ? 1 : s.opSize;
+        op.scale = 1;
+        op.segment = s.segment;
+        if (!ReadImmediate(s, pInst->addressSize, &value))
+        {
+            return false;
+        }
+        op.disp = value;
+        return true;
+    case OPND_Xb:
+    case OPND_Xv:
+    case OPND_Yb:
+    case OPND_Yv:
+        op.type = DISASM_OP_MEM;
+        op.size = (spec == OPND_Xb || spec == OPND_Yb) ? 1 : s.opSize;
+        op.scale = 1;
+        op.base = (spec == OPND_Xb || spec == OPND_Xv) ? 6 : 7;
+        op.segment = (op.base == 7) ? (BYTE)DISASM_SEG_ES : s.segment;
+        return true;
+    case OPND_Sw:
+        op.type = DISASM_OP_REG;
+        op.regClass = DISASM_REG_SEG;
+        op.size = 2;
+        op.reg = s.reg & 7;
+        return op.reg < 6;
+
+    case OPND_Vx: SetVectorRegister(op, vectorClass, s.reg); return true;
+    case OPND_Hx: SetVectorRegister(op, vectorClass, s.vexReg); return true;
+    case OPND_Wx:
+        SetVectorRm(s, op, vectorClass, s.vectorMemSize ? s.vectorMemSize : GetVectorSize(vectorClass));
+        return true;
+    case OPND_Wq: SetVectorRm(s, op, vectorClass, 8); return true;
+    case OPND_Wd: SetVectorRm(s, op, vectorClass, 4); return true;
+    case OPND_Lx:
+        if (!ReadImmediate(s, 1, &value))
+        {
+            return false;
+        }
+        SetVectorRegister(op, vectorClass, (BYTE)((value >> 4) & (s.b64 ? 15 : 7)));
+        return true;
+    case OPND_Pq: SetVectorRegister(op, DISASM_REG_MMX, s.reg); return true;
+    case OPND_Qq: SetVectorRm(s, op, DISASM_REG_MMX, 8); return true;
+    case OPND_By: SetGpRegister(s, op, s.vexReg, sizeY); return true;
+    default:
+        return false;
+    }
+}
+
+// Set the mnemonic, VEX encoded instructions get their v prefix
+static void SetName(DecodeState& s, const char* pszName, const char* pszSuffix = "")
+{
+    _snprintf(s.pInst->mnemonic, DISASM_MAX_MNEMONIC - 1, "%s%s%s", s.vex ? "v" : "", pszName, pszSuffix);
+}
+
+static bool Emit(DecodeState& s, const char* pszName, BYTE op1 = OPND_NONE, BYTE op2 = OPND_NONE,
+                 BYTE op3 = OPND_NONE, BYTE op4 = OPND_NONE)
+{
+    if (pszName == NULL)
+    {
+        return false;
+    }
+    // ModRM comes before any immediate
+    if ((NeedsModRM(op1) || NeedsModRM(op2) || NeedsModRM(op3) || NeedsModRM(op4)) && !ParseModRM(s))
+    {
+        return false;
+    }
+    if (pszName[0] != '\0')
+    {
+        SetName(s, pszName);
+    }
+    return AddOperand(s, op1) && AddOperand(s, op2) && AddOperand(s, op3) && AddOperand(s, op4);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Opcode maps
+//
+
+static bool DecodeX87(DecodeState& s)
+{
+    if (!ParseModRM(s))
+    {
+        return false;
+    }
+    const BYTE escape = s.opcode - 0xD8;
+    const BYTE reg = s.reg & 7;
+    if (s.mod == 3)
+    {
+        // Register forms, the stack registers aren't listed as operands
+        if (escape == 1 && reg >= 4)
+        {
+            return Emit(s, kX87D9[(reg - 4) * 8 + s.rm]);
+        }
+        switch (s.pCode[s.pos - 1])
+        {
+        case 0xD9: return escape == 6 && Emit(s, "fcompp");
+        case 0xE0: return escape == 7 && Emit(s, "fnstsw ax");
+        case 0xE2: return escape == 3 && Emit(s, "fnclex");
+        case 0xE3: return escape == 3 && Emit(s, "fninit");
+        case 0xE9: return escape == 2 && Emit(s, "fucompp");
+        }
+        return Emit(s, kX87Register[escape][reg]);
+    }
+    if (!Emit(s, kX87Memory[escape][reg], OPND_M))
+    {
+        return false;
+    }
+    s.pInst->operands[0].size = kX87MemorySize[escape][reg];
+    return true;
+}
+
+static bool DecodeOneByte(DecodeState& s)
+{
+    const BYTE op = s.opcode;
+    char szName[DISASM_MAX_MNEMONIC];
+    if (op < 0x40 && (op & 7) < 6)
+    {
+        static const BYTE kForms[6][2] = { { OPND_Eb, OPND_Gb }, { OPND_Ev, OPND_Gv }, { OPND_Gb, OPND_Eb },
+                                           { OPND_Gv, OPND_Ev }, { OPND_AL, OPND_Ib }, { OPND_eAX, OPND_Iz } };
+        return Emit(s, kAlu[op >> 3], kForms[op & 7][0], kForms[op & 7][1]);
+    }
+    if (op >= 0x40 && op < 0x50)
+    {
+        // REX in 64-bit mode, taken care of with the prefixes
+        return !s.b64 && Emit(s, (op < 0x48) ? "inc" : "dec", OPND_Zv);
+    }
+    if (op >= 0x50 && op < 0x60)
+    {
+        return Emit(s, (op < 0x58) ? "push" : "pop", OPND_Zv);
+    }
+    if (op >= 0x70 && op < 0x80)
+    {
+        _snprintf(szName, sizeof(szName), "j%s", kCondition[op & 15]);
+        return Emit(s, szName, OPND_Jb);
+    }
+    if (op >= 0x91 && op < 0x98)
+    {
+        return Emit(s, "xchg", OPND_Zv, OPND_eAX);
+    }
+    if (op >= 0xB0 && op < 0xB8)
+    {
+        return Emit(s, "mov", OPND_Zb, OPND_Ib);
+    }
+    if (op >= 0xB8 && op < 0xC0)
+    {
+        return Emit(s, "mov", OPND_Zv, OPND_Iv);
+    }
+    if (op >= 0xD8 && op < 0xE0)
+    {
+        return DecodeX87(s);
+    }
+    if (op >= 0xA4 && op < 0xB0 && op != 0xA8 && op != 0xA9)
+    {
+        // String instructions
+        if (s.hasF3)
+        {
+            strcpy(s.pInst->prefix, (op == 0xA6 || op == 0xA7 || op == 0xAE || op == 0xAF) ? "repe" : "rep");
+        }
+        else if (s.hasF2)
+        {
+            strcpy(s.pInst->prefix, "repne");
+        }
+    }
+
+    switch (op)
+    {
+    case 0x06: case 0x0E: case 0x16: case 0x1E:
+        return !s.b64 && Emit(s, (op == 0x06) ? "push es" : (op == 0x0E) ? "push cs" : (op == 0x16) ? "push ss" : "push ds");
+    case 0x07: case 0x17: case 0x1F:
+        return !s.b64 && Emit(s, (op == 0x07) ? "pop es" : (op == 0x17) ? "pop ss" : "pop ds");
+    case 0x27: return !s.b64 && Emit(s, "daa");
+    case 0x2F: return !s.b64 && Emit(s, "das");
+    case 0x37: return !s.b64 && Emit(s, "aaa");
+    case 0x3F: return !s.b64 && Emit(s, "aas");
+    case 0x60: return !s.b64 && Emit(s, (s.opSize == 2) ? "pusha" : "pushad");
+    case 0x61: return !s.b64 && Emit(s, (s.opSize == 2) ? "popa" : "popad");
+    case 0x62: return !s.b64 && Emit(s, "bound", OPND_Gv, OPND_M);
+    case 0x63: return s.b64 ? Emit(s, "movsxd", OPND_Gv, OPND_Ed) : Emit(s, "arpl", OPND_Ew, OPND_Gw);
+    case 0x68: return Emit(s, "push", OPND_Iz);
+    case 0x69: return Emit(s, "imul", OPND_Gv, OPND_Ev, OPND_Iz);
+    case 0x6A: return Emit(s, "push", OPND_Ibs);
+    case 0x6B: return Emit(s, "imul", OPND_Gv, OPND_Ev, OPND_Ibs);
+    case 0x6C: return Emit(s, "insb");
+    case 0x6D: return Emit(s, (s.opSize == 2) ? "insw" : "insd");
+    case 0x6E: return Emit(s, "outsb");
+    case 0x6F: return Emit(s, (s.opSize == 2) ? "outsw" : "outsd");
+    case 0x80:
+    case 0x82:
+        return (op == 0x80 || !s.b64) && ParseModRM(s) && Emit(s, kAlu[s.reg & 7], OPND_Eb, OPND_Ib);
+    case 0x81: return ParseModRM(s) && Emit(s, kAlu[s.reg & 7], OPND_Ev, OPND_Iz);
+    case 0x83: return ParseModRM(s) && Emit(s, kAlu[s.reg & 7], OPND_Ev, OPND_Ibs);
+    case 0x84: return Emit(s, "test", OPND_Eb, OPND_Gb);
+    case 0x85: return Emit(s, "test", OPND_Ev, OPND_Gv);
+    case 0x86: return Emit(s, "xchg", OPND_Eb, OPND_Gb);
+    case 0x87: return Emit(s, "xchg", OPND_Ev, OPND_Gv);
+    case 0x88: return Emit(s, "mov", OPND_Eb, OPND_Gb);
+    case 0x89: return Emit(s, "mov", OPND_Ev, OPND_Gv);
+    case 0x8A: return Emit(s, "mov", OPND_Gb, OPND_Eb);
+    case 0x8B: return Emit(s, "mov", OPND_Gv, OPND_Ev);
+    case 0x8C: return Emit(s, "mov", OPND_Ev, OPND_Sw);
+    case 0x8D: return Emit(s, "lea", OPND_Gv, OPND_M);
+    case 0x8E: return Emit(s, "mov", OPND_Sw, OPND_Ew);
+    case 0x8F: return ParseModRM(s) && (s.reg & 7) == 0 && Emit(s, "pop", OPND_Ev);
+    case 0x90:
+        if (s.rex & 1)
+        {
+            return Emit(s, "xchg", OPND_Zv, OPND_eAX);
+        }
+        return Emit(s, s.hasF3 ? "pause" : "nop");
+    case 0x98: return Emit(s, (s.opSize == 2) ? "cbw" : (s.opSize == 4) ? "cwde" : "cdqe");
+    case 0x99: return Emit(s, (s.opSize == 2) ? "cwd" : (s.opSize == 4) ? "cdq" : "cqo");
+    case 0x9B: return Emit(s, "fwait");
+    case 0x9C: return Emit(s, "pushf");
+    case 0x9D: return Emit(s, "popf");
+    case 0x9E: return Emit(s, "sahf");
+    case 0x9F: return Emit(s, "lahf");
+    case 0xA0: return Emit(s, "mov", OPND_AL, OPND_Ob);
+    case 0xA1: return Emit(s, "mov", OPND_eAX, OPND_Ov);
+    case 0xA2: return Emit(s, "mov", OPND_Ob, OPND_AL);
+    case 0xA3: return Emit(s, "mov", OPND_Ov, OPND_eAX);
+    case 0xA4: return Emit(s, "movs", OPND_Yb, OPND_Xb);
+    case 0xA5: return Emit(s, "movs", OPND_Yv, OPND_Xv);
+    case 0xA6: return Emit(s, "cmps", OPND_Xb, OPND_Yb);
+    case 0xA7: return Emit(s, "cmps", OPND_Xv, OPND_Yv);
+    case 0xA8: return Emit(s, "test", OPND_AL, OPND_Ib);
+    case 0xA9: return Emit(s, "test", OPND_eAX, OPND_Iz);
+    case 0xAA: return Emit(s, "stos", OPND_Yb, OPND_AL);
+    case 0xAB: return Emit(s, "stos", OPND_Yv, OPND_eAX);
+    case 0xAC: return Emit(s, "lods", OPND_AL, OPND_Xb);
+    case 0xAD: return Emit(s, "lods", OPND_eAX, OPND_Xv);
+    case 0xAE: return Emit(s, "scas", OPND_AL, OPND_Yb);
+    case 0xAF: return Emit(s, "scas", OPND_eAX, OPND_Yv);
+    case 0xC0: return ParseModRM(s) && Emit(s, kShift[s.reg & 7], OPND_Eb, OPND_Ib);
+    case 0xC1: return ParseModRM(s) && Emit(s, kShift[s.reg & 7], OPND_Ev, OPND_Ib);
+    case 0xC2: return Emit(s, "ret", OPND_Iw);
+    case 0xC3: return Emit(s, "ret");
+    case 0xC4: return !s.b64 && Emit(s, "les", OPND_Gv, OPND_M);
+    case 0xC5: return !s.b64 && Emit(s, "lds", OPND_Gv, OPND_M);
+    case 0xC6:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        if (s.mod == 3 && s.reg == 7 && s.rm == 0)
+        {
+            return Emit(s, "xabort", OPND_Ib);
+        }
+        return (s.reg & 7) == 0 && Emit(s, "mov", OPND_Eb, OPND_Ib);
+    case 0xC7:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        if (s.mod == 3 && s.reg == 7 && s.rm == 0)
+        {
+            return Emit(s, "xbegin", OPND_Jz);
+        }
+        return (s.reg & 7) == 0 && Emit(s, "mov", OPND_Ev, OPND_Iz);
+    case 0xC8: return Emit(s, "enter", OPND_Iw, OPND_Ib);
+    case 0xC9: return Emit(s, "leave");
+    case 0xCA: return Emit(s, "retf", OPND_Iw);
+    case 0xCB: return Emit(s, "retf");
+    case 0xCC: return Emit(s, "int3");
+    case 0xCD: return Emit(s, "int", OPND_Ib);
+    case 0xCE: return !s.b64 && Emit(s, "into");
+    case 0xCF: return Emit(s, (s.opSize == 8) ? "iretq" : (s.opSize == 4) ? "iretd" : "iret");
+    case 0xD0: return ParseModRM(s) && Emit(s, kShift[s.reg & 7], OPND_Eb, OPND_ONE);
+    case 0xD1: return ParseModRM(s) && Emit(s, kShift[s.reg & 7], OPND_Ev, OPND_ONE);
+    case 0xD2: return ParseModRM(s) && Emit(s, kShift[s.reg & 7], OPND_Eb, OPND_CL);
+    case 0xD3: return ParseModRM(s) && Emit(s, kShift[s.reg & 7], OPND_Ev, OPND_CL);
+    case 0xD4: return !s.b64 && Emit(s, "aam", OPND_Ib);
+    case 0xD5: return !s.b64 && Emit(s, "aad", OPND_Ib);
+    case 0xD7: return Emit(s, "xlat");
+    case 0xE0: return Emit(s, "loopne", OPND_Jb);
+    case 0xE1: return Emit(s, "loope", OPND_Jb);
+    case 0xE2: return Emit(s, "loop", OPND_Jb);
+    case 0xE3:
+        return Emit(s, (s.pInst->addressSize == 8) ? "jrcxz" : (s.pInst->addressSize == 4) ? "jecxz" : "jcxz", OPND_Jb);
+    case 0xE4: return Emit(s, "in", OPND_AL, OPND_Ib);
+    case 0xE5: return Emit(s, "in", OPND_eAX, OPND_Ib);
+    case 0xE6: return Emit(s, "out", OPND_Ib, OPND_AL);
+    case 0xE7: return Emit(s, "out", OPND_Ib, OPND_eAX);
+    case 0xE8: return Emit(s, "call", OPND_Jz);
+    case 0xE9: return Emit(s, "jmp", OPND_Jz);
+    case 0xEB: return Emit(s, "jmp", OPND_Jb);
+    case 0xEC: return Emit(s, "in", OPND_AL, OPND_DX);
+    case 0xED: return Emit(s, "in", OPND_eAX, OPND_DX);
+    case 0xEE: return Emit(s, "out", OPND_DX, OPND_AL);
+    case 0xEF: return Emit(s, "out", OPND_DX, OPND_eAX);
+    case 0xF1: return Emit(s, "int1");
+    case 0xF4: return Emit(s, "hlt");
+    case 0xF5: return Emit(s, "cmc");
+    case 0xF6:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        return ((s.reg & 7) < 2) ? Emit(s, "test", OPND_Eb, OPND_Ib) : Emit(s, kGroup3[s.reg & 7], OPND_Eb);
+    case 0xF7:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        return ((s.reg & 7) < 2) ? Emit(s, "test", OPND_Ev, OPND_Iz) : Emit(s, kGroup3[s.reg & 7], OPND_Ev);
+    case 0xF8: return Emit(s, "clc");
+    case 0xF9: return Emit(s, "stc");
+    case 0xFA: return Emit(s, "cli");
+    case 0xFB: return Emit(s, "sti");
+    case 0xFC: return Emit(s, "cld");
+    case 0xFD: return Emit(s, "std");
+    case 0xFE:
+        return ParseModRM(s) && (s.reg & 7) < 2 && Emit(s, ((s.reg & 7) == 0) ? "inc" : "dec", OPND_Eb);
+    case 0xFF:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        switch (s.reg & 7)
+        {
+        case 0: return Emit(s, "inc", OPND_Ev);
+        case 1: return Emit(s, "dec", OPND_Ev);
+        case 2: return Emit(s, "call", OPND_Ev);
+        case 3: return Emit(s, "call far", OPND_M);
+        case 4: return Emit(s, "jmp", OPND_Ev);
+        case 5: return Emit(s, "jmp far", OPND_M);
+        case 6: return Emit(s, "push", OPND_Ev);
+        }
+        return false;
+    }
+    return false;
+}
+
+// SSE instructions of the 0F map selected by the mandatory prefix, also VEX map 1
+static bool DecodeSse(DecodeState& s, int prefix)
+{
+    const BYTE op = s.opcode;
+    const char* const pszFp = kFpSuffix[prefix];
+    const bool bPacked = (prefix < 2);
+    if (!bPacked)
+    {
+        s.scalar = true;
+        s.vectorMemSize = (prefix == 2) ? 4 : 8;
+    }
+    switch (op)
+    {
+    case 0x10:
+    case 0x11:
+        SetName(s, "mov", (prefix == 0) ? "ups" : (prefix == 1) ? "upd" : pszFp);
+        return (op == 0x10) ? Emit(s, "", OPND_Vx, OPND_Wx) : Emit(s, "", OPND_Wx, OPND_Vx);
+    case 0x12:
+    case 0x13:
+    case 0x16:
+    case 0x17:
+        if (prefix >= 2)
+        {
+            s.scalar = false;
+            s.vectorMemSize = (prefix == 3) ? 8 : 0;
+            return (op == 0x12 || op == 0x16) &&
+                Emit(s, (op == 0x16) ? "movshdup" : (prefix == 2) ? "movsldup" : "movddup", OPND_Vx, OPND_Wx);
+        }
+        if ((op == 0x12 || op == 0x16) && prefix == 0 && ParseModRM(s) && s.mod == 3)
+        {
+            return Emit(s, (op == 0x12) ? "movhlps" : "movlhps", OPND_Vx, OPND_Hx, OPND_Wx);
+        }
+        SetName(s, (op < 0x14) ? "movl" : "movh", pszFp);
+        if (op == 0x13 || op == 0x17)
+        {
+            return Emit(s, "", OPND_Mq, OPND_Vx);
+        }
+        return Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wq);
+    case 0x14:
+    case 0x15:
+        SetName(s, (op == 0x14) ? "unpckl" : "unpckh", pszFp);
+        return bPacked && Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x28:
+    case 0x29:
+        SetName(s, "mova", pszFp);
+        return bPacked && ((op == 0x28) ? Emit(s, "", OPND_Vx, OPND_Wx) : Emit(s, "", OPND_Wx, OPND_Vx));
+    case 0x2A:
+        SetName(s, bPacked ? "cvtpi2" : "cvtsi2", kFpSuffix[bPacked ? prefix : prefix]);
+        return bPacked ? Emit(s, "", OPND_Vx, OPND_Qq) : Emit(s, "", OPND_Vx, OPND_Hx, OPND_Ey);
+    case 0x2B:
+        SetName(s, "movnt", pszFp);
+        return bPacked && Emit(s, "", OPND_Mx, OPND_Vx);
+    case 0x2C:
+    case 0x2D:
+        SetName(s, (op == 0x2C) ? "cvtt" : "cvt", (prefix == 0) ? "ps2pi" : (prefix == 1) ? "pd2pi" :
+            (prefix == 2) ? "ss2si" : "sd2si");
+        return bPacked ? Emit(s, "", OPND_Pq, OPND_Wx) : Emit(s, "", OPND_Gy, OPND_Wx);
+    case 0x2E:
+    case 0x2F:
+        s.scalar = true;
+        s.vectorMemSize = (prefix == 0) ? 4 : 8;
+        SetName(s, (op == 0x2E) ? "ucomis" : "comis", (prefix == 0) ? "s" : "d");
+        return bPacked && Emit(s, "", OPND_Vx, OPND_Wx);
+    case 0x50:
+        SetName(s, "movmsk", pszFp);
+        return bPacked && Emit(s, "", OPND_Gd, OPND_Wx);
+    case 0x51: case 0x58: case 0x59: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+    {
+        static const char* const kNames[] = { "sqrt", NULL, NULL, NULL, NULL, NULL, NULL, "add", "mul",
+                                              NULL, NULL, "sub", "min", "div", "max" };
+        SetName(s, kNames[op - 0x51], pszFp);
+        // sqrt has no first source
+        return (op == 0x51 && bPacked) ? Emit(s, "", OPND_Vx, OPND_Wx) : Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wx);
+    }
+    case 0x52:
+    case 0x53:
+        SetName(s, (op == 0x52) ? "rsqrt" : "rcp", pszFp);
+        return (prefix == 0 || prefix == 2) && Emit(s, "", OPND_Vx, OPND_Wx);
+    case 0x54: case 0x55: case 0x56: case 0x57:
+    {
+        static const char* const kNames[] = { "and", "andn", "or", "xor" };
+        SetName(s, kNames[op - 0x54], pszFp);
+        return bPacked && Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wx);
+    }
+    case 0x5A:
+        if (prefix == 0)
+        {
+            s.vectorMemSize = 8;
+        }
+        SetName(s, "cvt", (prefix == 0) ? "ps2pd" : (prefix == 1) ? "pd2ps" : (prefix == 2) ? "ss2sd" : "sd2ss");
+        return bPacked ? Emit(s, "", OPND_Vx, OPND_Wx) : Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x5B:
+        s.scalar = false;
+        s.vectorMemSize = 0;
+        return prefix != 3 &&
+            Emit(s, (prefix == 0) ? "cvtdq2ps" : (prefix == 1) ? "cvtps2dq" : "cvttps2dq", OPND_Vx, OPND_Wx);
+    case 0xC2:
+        SetName(s, "cmp", pszFp);
+        return Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0xC6:
+        SetName(s, "shuf", pszFp);
+        return bPacked && Emit(s, "", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    }
+
+    // Integer instructions, MMX without a prefix
+    s.scalar = false;
+    s.vectorMemSize = 0;
+    s.mmx = (prefix == 0 && !s.vex);
+    if (op == 0x77)
+    {
+        return prefix == 0 && Emit(s, s.vex ? (s.vexL ? "zeroall" : "zeroupper") : "emms");
+    }
+    if (prefix == 0 && s.vex)
+    {
+        return false;
+    }
+    if (op >= 0x60 && op <= 0x6D)
+    {
+        return (op < 0x6C || prefix == 1) && prefix < 2 && Emit(s, kSimd60[op - 0x60], OPND_Vx, OPND_Hx, OPND_Wx);
+    }
+    if (op >= 0xD0 && kSimdD0[op - 0xD0] != NULL)
+    {
+        return prefix < 2 && Emit(s, kSimdD0[op - 0xD0], OPND_Vx, OPND_Hx, OPND_Wx);
+    }
+    switch (op)
+    {
+    case 0x6E:
+        s.mmx = false;
+        return prefix < 2 && Emit(s, (s.rex & 8) ? "movq" : "movd", (prefix == 0) ? OPND_Pq : OPND_Vx, OPND_Ey);
+    case 0x6F:
+    case 0x7F:
+        if (prefix == 3)
+        {
+            return false;
+        }
+        SetName(s, (prefix == 0) ? "movq" : (prefix == 1) ? "movdqa" : "movdqu");
+        s.mmx = (prefix == 0);
+        return (op == 0x6F) ? Emit(s, "", OPND_Vx, OPND_Wx) : Emit(s, "", OPND_Wx, OPND_Vx);
+    case 0x70:
+        return Emit(s, (prefix == 0) ? "pshufw" : (prefix == 1) ? "pshufd" : (prefix == 2) ? "pshufhw" : "pshuflw",
+            OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x71:
+    case 0x72:
+    case 0x73:
+    {
+        // Shifts by an immediate, ModRM reg selects the operation
+        static const char* const kNames[3][8] = {
+            { NULL, NULL, "psrlw", NULL, "psraw", NULL, "psllw", NULL },
+            { NULL, NULL, "psrld", NULL, "psrad", NULL, "pslld", NULL },
+            { NULL, NULL, "psrlq", "psrldq", NULL, NULL, "psllq", "pslldq" },
+        };
+        if (prefix >= 2 || !ParseModRM(s) || s.mod != 3)
+        {
+            return false;
+        }
+        const char* pszName = kNames[op - 0x71][s.reg & 7];
+        if (pszName == NULL || (prefix == 0 && (s.reg & 7) != 2 && (s.reg & 7) != 4 && (s.reg & 7) != 6))
+        {
+            return false;
+        }
+        // VEX.vvvv is the destination
+        if (s.vex)
+        {
+            SetName(s, pszName);
+            DisasmOperand& dest = s.pInst->operands[s.pInst->operandCount++];
+            dest.base = dest.index = DISASM_NO_REG;
+            SetVectorRegister(dest, GetVectorClass(s), s.vexReg);
+            return Emit(s, "", OPND_Wx, OPND_Ib);
+        }
+        return Emit(s, pszName, OPND_Wx, OPND_Ib);
+    }
+    case 0x74: return prefix < 2 && Emit(s, "pcmpeqb", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x75: return prefix < 2 && Emit(s, "pcmpeqw", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x76: return prefix < 2 && Emit(s, "pcmpeqd", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x7C: return (prefix == 1 || prefix == 3) && Emit(s, (prefix == 1) ? "haddpd" : "haddps", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x7D: return (prefix == 1 || prefix == 3) && Emit(s, (prefix == 1) ? "hsubpd" : "hsubps", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0x7E:
+        if (prefix == 2)
+        {
+            return Emit(s, "movq", OPND_Vx, OPND_Wq);
+        }
+        s.mmx = false;
+        return prefix < 2 && Emit(s, (s.rex & 8) ? "movq" : "movd", OPND_Ey, (prefix == 0) ? OPND_Pq : OPND_Vx);
+    case 0xC4:
+        return prefix < 2 && Emit(s, "pinsrw", OPND_Vx, OPND_Hx, OPND_Ed, OPND_Ib);
+    case 0xC5:
+        return prefix < 2 && Emit(s, "pextrw", OPND_Gd, OPND_Wx, OPND_Ib);
+    case 0xD0:
+        return (prefix == 1 || prefix == 3) && Emit(s, (prefix == 1) ? "addsubpd" : "addsubps", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0xD6:
+        return prefix == 1 && Emit(s, "movq", OPND_Wq, OPND_Vx);
+    case 0xD7:
+        return prefix < 2 && Emit(s, "pmovmskb", OPND_Gd, OPND_Wx);
+    case 0xE6:
+        s.mmx = false;
+        return prefix != 0 && Emit(s, (prefix == 1) ? "cvttpd2dq" : (prefix == 2) ? "cvtdq2pd" : "cvtpd2dq",
+            OPND_Vx, OPND_Wx);
+    case 0xE7:
+        return prefix < 2 && Emit(s, (prefix == 0) ? "movntq" : "movntdq", OPND_Mx, OPND_Vx);
+    case 0xF0:
+        s.mmx = false;
+        return prefix == 3 && Emit(s, "lddqu", OPND_Vx, OPND_Mx);
+    case 0xF7:
+        return prefix < 2 && Emit(s, (prefix == 0) ? "maskmovq" : "maskmovdqu", OPND_Vx, OPND_Wx);
+    }
+    return false;
+}
+
+static bool DecodeTwoByte(DecodeState& s, int prefix)
+{
+    const BYTE op = s.opcode;
+    char szName[DISASM_MAX_MNEMONIC];
+    if ((op >= 0x10 && op <= 0x17) || (op >= 0x28 && op <= 0x2F) || (op >= 0x50 && op <= 0x7F) ||
+        op == 0xC2 || (op >= 0xC4 && op <= 0xC6) || op >= 0xD0)
+    {
+        return DecodeSse(s, prefix);
+    }
+    if (op >= 0x40 && op < 0x50)
+    {
+        _snprintf(szName, sizeof(szName), "cmov%s", kCondition[op & 15]);
+        return Emit(s, szName, OPND_Gv, OPND_Ev);
+    }
+    if (op >= 0x80 && op < 0x90)
+    {
+        _snprintf(szName, sizeof(szName), "j%s", kCondition[op & 15]);
+        return Emit(s, szName, OPND_Jz);
+    }
+    if (op >= 0x90 && op < 0xA0)
+    {
+        _snprintf(szName, sizeof(szName), "set%s", kCondition[op & 15]);
+        return Emit(s, szName, OPND_Eb);
+    }
+    if (op >= 0xC8)
+    {
+        s.opSize = (s.rex & 8) ? 8 : 4;
+        return Emit(s, "bswap", OPND_Zv);
+    }
+
+    switch (op)
+    {
+    case 0x00:
+    {
+        static const char* const kNames[8] = { "sldt", "str", "lldt", "ltr", "verr", "verw", NULL, NULL };
+        return ParseModRM(s) && Emit(s, kNames[s.reg & 7], OPND_Ew);
+    }
+    case 0x01:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        if (s.mod == 3)
+        {
+            switch (s.pCode[s.pos - 1])
+            {
+            case 0xC8: return Emit(s, "monitor");
+            case 0xC9: return Emit(s, "mwait");
+            case 0xD0: return Emit(s, "xgetbv");
+            case 0xD1: return Emit(s, "xsetbv");
+            case 0xD5: return Emit(s, "xend");
+            case 0xD6: return Emit(s, "xtest");
+            case 0xEE: return Emit(s, "rdpkru");
+            case 0xEF: return Emit(s, "wrpkru");
+            case 0xF8: return Emit(s, "swapgs");
+            case 0xF9: return Emit(s, "rdtscp");
+            }
+            return false;
+        }
+        else
+        {
+            static const char* const kNames[8] = { "sgdt", "sidt", "lgdt", "lidt", "smsw", NULL, "lmsw", "invlpg" };
+            return Emit(s, kNames[s.reg & 7], OPND_M);
+        }
+    case 0x05: return Emit(s, "syscall");
+    case 0x06: return Emit(s, "clts");
+    case 0x07: return Emit(s, "sysret");
+    case 0x0B: return Emit(s, "ud2");
+    case 0x0D: return ParseModRM(s) && Emit(s, ((s.reg & 7) == 1) ? "prefetchw" : "prefetch", OPND_M);
+    case 0x18:
+    {
+        static const char* const kNames[4] = { "prefetchnta", "prefetcht0", "prefetcht1", "prefetcht2" };
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        return ((s.reg & 7) < 4 && s.mod != 3) ? Emit(s, kNames[s.reg & 7], OPND_Eb) : Emit(s, "nop", OPND_Ev);
+    }
+    case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E: case 0x1F:
+        if (op == 0x1E && s.hasF3 && s.pos < s.cbCode && (s.pCode[s.pos] == 0xFA || s.pCode[s.pos] == 0xFB))
+        {
+            return ParseModRM(s) && Emit(s, (s.rm == 2) ? "endbr64" : "endbr32");
+        }
+        return Emit(s, "nop", OPND_Ev);
+    case 0x30: return Emit(s, "wrmsr");
+    case 0x31: return Emit(s, "rdtsc");
+    case 0x32: return Emit(s, "rdmsr");
+    case 0x33: return Emit(s, "rdpmc");
+    case 0x34: return Emit(s, "sysenter");
+    case 0x35: return Emit(s, "sysexit");
+    case 0xA0: return Emit(s, "push fs");
+    case 0xA1: return Emit(s, "pop fs");
+    case 0xA2: return Emit(s, "cpuid");
+    case 0xA3: return Emit(s, "bt", OPND_Ev, OPND_Gv);
+    case 0xA4: return Emit(s, "shld", OPND_Ev, OPND_Gv, OPND_Ib);
+    case 0xA5: return Emit(s, "shld", OPND_Ev, OPND_Gv, OPND_CL);
+    case 0xA8: return Emit(s, "push gs");
+    case 0xA9: return Emit(s, "pop gs");
+    case 0xAB: return Emit(s, "bts", OPND_Ev, OPND_Gv);
+    case 0xAC: return Emit(s, "shrd", OPND_Ev, OPND_Gv, OPND_Ib);
+    case 0xAD: return Emit(s, "shrd", OPND_Ev, OPND_Gv, OPND_CL);
+    case 0xAE:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        if (s.mod == 3)
+        {
+            static const char* const kFsGs[4] = { "rdfsbase", "rdgsbase", "wrfsbase", "wrgsbase" };
+            if (s.hasF3 && (s.reg & 7) < 4)
+            {
+                return Emit(s, kFsGs[s.reg & 7], OPND_Ey);
+            }
+            return (s.reg & 7) >= 5 && Emit(s, ((s.reg & 7) == 5) ? "lfence" : ((s.reg & 7) == 6) ? "mfence" : "sfence");
+        }
+        else
+        {
+            static const char* const kNames[8] = { "fxsave", "fxrstor", "ldmxcsr", "stmxcsr",
+                                                   "xsave", "xrstor", "xsaveopt", "clflush" };
+            if (!Emit(s, kNames[s.reg & 7], OPND_M))
+            {
+                return false;
+            }
+            if ((s.reg & 7) == 2 || (s.reg & 7) == 3)
+            {
+                s.pInst->operands[0].size = 4;
+            }
+            return true;
+        }
+    case 0xAF: return Emit(s, "imul", OPND_Gv, OPND_Ev);
+    case 0xB0: return Emit(s, "cmpxchg", OPND_Eb, OPND_Gb);
+    case 0xB1: return Emit(s, "cmpxchg", OPND_Ev, OPND_Gv);
+    case 0xB3: return Emit(s, "btr", OPND_Ev, OPND_Gv);
+    case 0xB6: return Emit(s, "movzx", OPND_Gv, OPND_Eb);
+    case 0xB7: return Emit(s, "movzx", OPND_Gv, OPND_Ew);
+    case 0xB8: return s.hasF3 && Emit(s, "popcnt", OPND_Gv, OPND_Ev);
+    case 0xBA:
+    {
+        static const char* const kNames[8] = { NULL, NULL, NULL, NULL, "bt", "bts", "btr", "btc" };
+        return ParseModRM(s) && Emit(s, kNames[s.reg & 7], OPND_Ev, OPND_Ib);
+    }
+    case 0xBB: return Emit(s, "btc", OPND_Ev, OPND_Gv);
+    case 0xBC: return Emit(s, s.hasF3 ? "tzcnt" : "bsf", OPND_Gv, OPND_Ev);
+    case 0xBD: return Emit(s, s.hasF3 ? "lzcnt" : "bsr", OPND_Gv, OPND_Ev);
+    case 0xBE: return Emit(s, "movsx", OPND_Gv, OPND_Eb);
+    case 0xBF: return Emit(s, "movsx", OPND_Gv, OPND_Ew);
+    case 0xC0: return Emit(s, "xadd", OPND_Eb, OPND_Gb);
+    case 0xC1: return Emit(s, "xadd", OPND_Ev, OPND_Gv);
+    case 0xC3:
+        if (!Emit(s, "movnti", OPND_M, OPND_Gy))
+        {
+            return false;
+        }
+        s.pInst->operands[0].size = (s.rex & 8) ? 8 : 4;
+        return true;
+    case 0xC7:
+        if (!ParseModRM(s))
+        {
+            return false;
+        }
+        if (s.mod != 3)
+        {
+            if ((s.reg & 7) != 1 || !Emit(s, (s.rex & 8) ? "cmpxchg16b" : "cmpxchg8b", OPND_M))
+            {
+                return false;
+            }
+            s.pInst->operands[0].size = (s.rex & 8) ? 16 : 8;
+            return true;
+        }
+        if ((s.reg & 7) == 7 && s.hasF3)
+        {
+            s.opSize = s.b64 ? 8 : 4;
+            return Emit(s, "rdpid", OPND_Ev);
+        }
+        return (s.reg & 7) >= 6 && Emit(s, ((s.reg & 7) == 6) ? "rdrand" : "rdseed", OPND_Ev);
+    }
+    return false;
+}
+
+// Broadcasts and widening moves read an xmm register or `memSize` bytes
+static bool EmitWidening(DecodeState& s, const char* pszName, BYTE memSize)
+{
+    if (!Emit(s, pszName, OPND_Vx))
+    {
+        return false;
+    }
+    s.scalar = true;
+    s.vectorMemSize = memSize;
+    return AddOperand(s, OPND_Wx);
+}
+
+// 0F 38, also VEX map 2
+static bool DecodeThreeByte38(DecodeState& s, int prefix)
+{
+    const BYTE op = s.opcode;
+    char szName[DISASM_MAX_MNEMONIC];
+    if (op >= 0xF0)
+    {
+        // General purpose instructions: movbe, crc32 and BMI
+        const bool bVex = s.vex;
+        s.vex = false;
+        if (!bVex)
+        {
+            if (prefix == 3 && op <= 0xF1)
+            {
+                return Emit(s, "crc32", OPND_Gy, (op == 0xF0) ? OPND_Eb : OPND_Ev);
+            }
+            if (op > 0xF1 || prefix >= 2 ||
+                !((op == 0xF0) ? Emit(s, "movbe", OPND_Gv, OPND_M) : Emit(s, "movbe", OPND_M, OPND_Gv)))
+            {
+                return false;
+            }
+            s.pInst->operands[(op == 0xF0) ? 1 : 0].size = s.opSize;
+            return true;
+        }
+        switch (op)
+        {
+        case 0xF2: return prefix == 0 && Emit(s, "andn", OPND_Gy, OPND_By, OPND_Ey);
+        case 0xF3:
+        {
+            static const char* const kNames[8] = { NULL, "blsr", "blsmsk", "blsi", NULL, NULL, NULL, NULL };
+            return prefix == 0 && ParseModRM(s) && Emit(s, kNames[s.reg & 7], OPND_By, OPND_Ey);
+        }
+        case 0xF5:
+            return (prefix == 0) ? Emit(s, "bzhi", OPND_Gy, OPND_Ey, OPND_By) :
+                (prefix == 2) ? Emit(s, "pext", OPND_Gy, OPND_By, OPND_Ey) :
+                (prefix == 3) && Emit(s, "pdep", OPND_Gy, OPND_By, OPND_Ey);
+        case 0xF6: return prefix == 3 && Emit(s, "mulx", OPND_Gy, OPND_By, OPND_Ey);
+        case 0xF7:
+            return Emit(s, (prefix == 0) ? "bextr" : (prefix == 1) ? "shlx" : (prefix == 2) ? "sarx" : "shrx",
+                OPND_Gy, OPND_Ey, OPND_By);
+        }
+        return false;
+    }
+    if (prefix == 0 && !s.vex && op < 0x0C)
+    {
+        // SSSE3 on MMX registers
+        s.mmx = true;
+        return kSimd3800[op] != NULL && Emit(s, kSimd3800[op], OPND_Pq, OPND_Qq);
+    }
+    if (prefix != 1)
+    {
+        return false;
+    }
+    if (op >= 0x96 && op <= 0xBF && (op & 15) >= 6)
+    {
+        static const char* const kOrder[3] = { "132", "213", "231" };
+        const BYTE form = (op & 15) - 6;
+        const bool bScalar = (form >= 2) && (form & 1);
+        const bool bDouble = (s.rex & 8) != 0;
+        s.scalar = bScalar;
+        s.vectorMemSize = bScalar ? (bDouble ? 8 : 4) : 0;
+        _snprintf(szName, sizeof(szName), "%s%s%s%s", kFma[form], kOrder[(op >> 4) - 9], bScalar ? "s" : "p",
+            bDouble ? "d" : "s");
+        return s.vex && Emit(s, szName, OPND_Vx, OPND_Hx, OPND_Wx);
+    }
+    if (op >= 0x90 && op <= 0x93)
+    {
+        // Gathers, the index of the memory operand is a vector
+        static const char* const kNames[4] = { "pgatherd", "pgatherq", "gatherdp", "gatherqp" };
+        s.vsib = true;
+        _snprintf(szName, sizeof(szName), "%s%s", kNames[op - 0x90], (op < 0x92) ? ((s.rex & 8) ? "q" : "d") :
+            ((s.rex & 8) ? "d" : "s"));
+        if (!s.vex || !Emit(s, szName, OPND_Vx, OPND_Mx, OPND_Hx))
+        {
+            return false;
+        }
+        // Memory operand sized as an element, 8 dword indices of qwords don't fit a ymm
+        DisasmOperand& mem = s.pInst->operands[1];
+        mem.size = (s.rex & 8) ? 8 : 4;
+        mem.regClass = (s.vexL && !((op & 1) == 0 && (s.rex & 8))) ? DISASM_REG_YMM : DISASM_REG_XMM;
+        return true;
+    }
+    switch (op)
+    {
+    case 0x18: return s.vex && EmitWidening(s, "broadcastss", 4);
+    case 0x19: return s.vex && EmitWidening(s, "broadcastsd", 8);
+    case 0x58: return s.vex && EmitWidening(s, "pbroadcastd", 4);
+    case 0x59: return s.vex && EmitWidening(s, "pbroadcastq", 8);
+    case 0x1A: return s.vex && EmitWidening(s, "broadcastf128", 16) && s.mod != 3;
+    case 0x5A: return s.vex && EmitWidening(s, "broadcasti128", 16) && s.mod != 3;
+    case 0x78: return s.vex && EmitWidening(s, "pbroadcastb", 1);
+    case 0x79: return s.vex && EmitWidening(s, "pbroadcastw", 2);
+    case 0x8C: return s.vex && Emit(s, (s.rex & 8) ? "pmaskmovq" : "pmaskmovd", OPND_Vx, OPND_Hx, OPND_Mx);
+    case 0x8E: return s.vex && Emit(s, (s.rex & 8) ? "pmaskmovq" : "pmaskmovd", OPND_Mx, OPND_Hx, OPND_Vx);
+    case 0xDB: return Emit(s, "aesimc", OPND_Vx, OPND_Wx);
+    case 0xDC: return Emit(s, "aesenc", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0xDD: return Emit(s, "aesenclast", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0xDE: return Emit(s, "aesdec", OPND_Vx, OPND_Hx, OPND_Wx);
+    case 0xDF: return Emit(s, "aesdeclast", OPND_Vx, OPND_Hx, OPND_Wx);
+    }
+    if (op >= 0x50 || kSimd3800[op] == NULL)
+    {
+        return false;
+    }
+    switch (op)
+    {
+    case 0x10: case 0x14: case 0x15:
+        // Implicit xmm0 mask without VEX
+        return !s.vex && Emit(s, kSimd3800[op], OPND_Vx, OPND_Wx);
+    case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25:
+    case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35:
+    {
+        // bw, bd, bq, wd, wq, dq read a half, quarter or eighth of the destination
+        static const BYTE kRatio[6] = { 2, 4, 8, 2, 4, 2 };
+        return EmitWidening(s, kSimd3800[op], (BYTE)((s.vex && s.vexL ? 32 : 16) / kRatio[op & 7]));
+    }
+    case 0x13: case 0x1C: case 0x1D: case 0x1E:
+    case 0x0E: case 0x0F: case 0x17: case 0x2A: case 0x41:
+        return Emit(s, kSimd3800[op], OPND_Vx, OPND_Wx);
+    case 0x2E: case 0x2F:
+        return s.vex && Emit(s, kSimd3800[op], OPND_Mx, OPND_Hx, OPND_Vx);
+    }
+    return Emit(s, kSimd3800[op], OPND_Vx, OPND_Hx, OPND_Wx);
+}
+
+// 0F 3A, also VEX map 3, every instruction has an immediate
+static bool DecodeThreeByte3A(DecodeState& s, int prefix)
+{
+    const BYTE op = s.opcode;
+    if (prefix == 0 && !s.vex && op == 0x0F)
+    {
+        s.mmx = true;
+        return Emit(s, "palignr", OPND_Pq, OPND_Qq, OPND_Ib);
+    }
+    if (prefix == 3 && s.vex && op == 0xF0)
+    {
+        s.vex = false;
+        return Emit(s, "rorx", OPND_Gy, OPND_Ey, OPND_Ib);
+    }
+    if (prefix != 1)
+    {
+        return false;
+    }
+    switch (op)
+    {
+    case 0x00: return s.vex && Emit(s, "permq", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x01: return s.vex && Emit(s, "permpd", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x02: return s.vex && Emit(s, "pblendd", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x04: return s.vex && Emit(s, "permilps", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x05: return s.vex && Emit(s, "permilpd", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x06: return s.vex && Emit(s, "perm2f128", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x08: return Emit(s, "roundps", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x09: return Emit(s, "roundpd", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x0A:
+        s.scalar = true;
+        s.vectorMemSize = 4;
+        return Emit(s, "roundss", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x0B:
+        s.scalar = true;
+        s.vectorMemSize = 8;
+        return Emit(s, "roundsd", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x0C: return Emit(s, "blendps", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x0D: return Emit(s, "blendpd", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x0E: return Emit(s, "pblendw", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x0F: return Emit(s, "palignr", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x14: return Emit(s, "pextrb", OPND_Ed, OPND_Vx, OPND_Ib);
+    case 0x15: return Emit(s, "pextrw", OPND_Ed, OPND_Vx, OPND_Ib);
+    case 0x16: return Emit(s, (s.rex & 8) ? "pextrq" : "pextrd", OPND_Ey, OPND_Vx, OPND_Ib);
+    case 0x17: return Emit(s, "extractps", OPND_Ed, OPND_Vx, OPND_Ib);
+    case 0x18: return s.vex && Emit(s, "insertf128", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x19: return s.vex && Emit(s, "extractf128", OPND_Wx, OPND_Vx, OPND_Ib);
+    case 0x1D: return s.vex && Emit(s, "cvtps2ph", OPND_Wx, OPND_Vx, OPND_Ib);
+    case 0x20: return Emit(s, "pinsrb", OPND_Vx, OPND_Hx, OPND_Ed, OPND_Ib);
+    case 0x21: return Emit(s, "insertps", OPND_Vx, OPND_Hx, OPND_Wd, OPND_Ib);
+    case 0x22: return Emit(s, (s.rex & 8) ? "pinsrq" : "pinsrd", OPND_Vx, OPND_Hx, OPND_Ey, OPND_Ib);
+    case 0x38: return s.vex && Emit(s, "inserti128", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x39: return s.vex && Emit(s, "extracti128", OPND_Wx, OPND_Vx, OPND_Ib);
+    case 0x40: return Emit(s, "dpps", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x41: return Emit(s, "dppd", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x42: return Emit(s, "mpsadbw", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x44: return Emit(s, "pclmulqdq", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x46: return s.vex && Emit(s, "perm2i128", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Ib);
+    case 0x4A: return s.vex && Emit(s, "blendvps", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Lx);
+    case 0x4B: return s.vex && Emit(s, "blendvpd", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Lx);
+    case 0x4C: return s.vex && Emit(s, "pblendvb", OPND_Vx, OPND_Hx, OPND_Wx, OPND_Lx);
+    case 0x60: return Emit(s, "pcmpestrm", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x61: return Emit(s, "pcmpestri", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x62: return Emit(s, "pcmpistrm", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0x63: return Emit(s, "pcmpistri", OPND_Vx, OPND_Wx, OPND_Ib);
+    case 0xDF: return Emit(s, "aeskeygenassist", OPND_Vx, OPND_Wx, OPND_Ib);
+    }
+    return false;
+}
+
+int DecodeInstruction(const BYTE* pCode, size_t cbCode, bool b64, DisasmInstruction* pInst)
+{
+    memset(pInst, 0, sizeof(*pInst));
+    DecodeState s;
+    memset(&s, 0, sizeof(s));
+    s.pCode = pCode;
+    s.cbCode = (cbCode < (size_t)DISASM_MAX_INSTRUCTION) ? cbCode : (size_t)DISASM_MAX_INSTRUCTION;
+    s.b64 = b64;
+    s.pInst = pInst;
+
+    // Legacy prefixes, in any order
+    bool bLock = false;
+    bool b67 = false;
+    for (;; s.pos++)
+    {
+        if (s.pos >= s.cbCode)
+        {
+            return 0;
+        }
+        switch (pCode[s.pos])
+        {
+        case 0xF0: bLock = true; continue;
+        case 0xF2: s.hasF2 = true; s.hasF3 = false; continue;
+        case 0xF3: s.hasF3 = true; s.hasF2 = false; continue;
+        case 0x66: s.has66 = true; continue;
+        case 0x67: b67 = true; continue;
+        case 0x26: s.segment = DISASM_SEG_ES; continue;
+        case 0x2E: s.segment = DISASM_SEG_CS; continue;
+        case 0x36: s.segment = DISASM_SEG_SS; continue;
+        case 0x3E: s.segment = DISASM_SEG_DS; continue;
+        case 0x64: s.segment = DISASM_SEG_FS; continue;
+        case 0x65: s.segment = DISASM_SEG_GS; continue;
+        }
+        break;
+    }
+    // REX is the last prefix
+    if (b64 && (pCode[s.pos] & 0xF0) == 0x40)
+    {
+        s.rex = pCode[s.pos++];
+        if (s.pos >= s.cbCode)
+        {
+            return 0;
+        }
+    }
+    pInst->addressSize = b64 ? (b67 ? 4 : 8) : (b67 ? 2 : 4);
+    s.opSize = (s.rex & 8) ? 8 : (s.has66 ? 2 : 4);
+    if (bLock)
+    {
+        strcpy(pInst->prefix, "lock");
+    }
+    // Mandatory prefix of the SSE instructions, F2 and F3 win over 66
+    int prefix = s.hasF3 ? 2 : s.hasF2 ? 3 : s.has66 ? 1 : 0;
+
+    s.opcode = pCode[s.pos++];
+    bool bOk = false;
+    if ((s.opcode == 0xC4 || s.opcode == 0xC5) && s.pos < s.cbCode && (b64 || (pCode[s.pos] & 0xC0) == 0xC0))
+    {
+        // VEX, the inverted R, X, B and vvvv go back to REX bits
+        if (s.rex != 0 || s.has66 || s.hasF2 || s.hasF3 || bLock)
+        {
+            return 0;
+        }
+        const BYTE byte1 = pCode[s.pos++];
+        BYTE map = 1;
+        BYTE byte2 = byte1;
+        s.rex = 0x40 | ((byte1 & 0x80) ? 0 : 4);
+        if (s.opcode == 0xC4)
+        {
+            if (s.pos >= s.cbCode)
+            {
+                return 0;
+            }
+            byte2 = pCode[s.pos++];
+            map = byte1 & 0x1F;
+            s.rex |= ((byte1 & 0x40) ? 0 : 2) | ((byte1 & 0x20) ? 0 : 1) | ((byte2 & 0x80) ? 8 : 0);
+        }
+        if (!b64)
+        {
+            s.rex &= 0x48;
+        }
+        s.vex = true;
+        s.vexReg = (~byte2 >> 3) & (b64 ? 15 : 7);
+        s.vexL = (byte2 & 4) != 0;
+        // pp is none, 66, F3, F2 like the mandatory prefix index
+        prefix = byte2 & 3;
+        if (s.pos >= s.cbCode)
+        {
+            return 0;
+        }
+        s.opcode = pCode[s.pos++];
+        bOk = (map == 1) ? DecodeSse(s, prefix) : (map == 2) ? DecodeThreeByte38(s, prefix) :
+            (map == 3) && DecodeThreeByte3A(s, prefix);
+    }
+    else if (s.opcode == 0x0F)
+    {
+        if (s.pos >= s.cbCode)
+        {
+            return 0;
+        }
+        s.opcode = pCode[s.pos++];
+        if (s.opcode == 0x38 || s.opcode == 0x3A)
+        {
+            const BYTE escape = s.opcode;
+            if (s.pos >= s.cbCode)
+            {
+                return 0;
+            }
+            s.opcode = pCode[s.pos++];
+            bOk = (escape == 0x38) ? DecodeThreeByte38(s, prefix) : DecodeThreeByte3A(s, prefix);
+        }
+        else
+        {
+            bOk = DecodeTwoByte(s, prefix);
+        }
+    }
+    else
+    {
+        // Near branches, push and pop default to 64-bit operands
+        const BYTE op = s.opcode;
+        if (b64 && ((op >= 0x50 && op < 0x60) || op == 0x68 || op == 0x6A || op == 0x8F || op == 0x9C ||
+            op == 0x9D || op == 0xC2 || op == 0xC3 || op == 0xC9 || op == 0xE8 || op == 0xE9 || op == 0xEB ||
+            (op >= 0x70 && op < 0x80) || op == 0xFF))
+        {
+            s.opSize = s.has66 ? 2 : 8;
+            if (op == 0xFF && s.pos < s.cbCode && ((pCode[s.pos] >> 3) & 7) < 2)
+            {
+                // inc and dec
+                s.opSize = (s.rex & 8) ? 8 : (s.has66 ? 2 : 4);
+            }
+        }
+        bOk = DecodeOneByte(s);
+    }
+    if (!bOk)
+    {
+        return 0;
+    }
+    pInst->length = (BYTE)s.pos;
+    return (int)s.pos;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Formatting
+//
+
+static const char* GetSizeName(BYTE size)
+{
+    switch (size)
+    {
+    case 1: return "byte ptr ";
+    case 2: return "word ptr ";
+    case 4: return "dword ptr ";
+    case 8: return "qword ptr ";
+    case 10: return "tbyte ptr ";
+    case 16: return "xmmword ptr ";
+    case 32: return "ymmword ptr ";
+    }
+    return "";
+}
+
+static void FormatRegister(BYTE regClass, BYTE reg, BYTE size, bool bHighByte, char* pszBuffer, size_t cchBuffer)
+{
+    switch (regClass)
+    {
+    case DISASM_REG_GP:
+        _snprintf(pszBuffer, cchBuffer, "%s", bHighByte ? kReg8High[reg & 3] : (size == 8) ? kReg64[reg & 15] :
+            (size == 4) ? kReg32[reg & 15] : (size == 2) ? kReg16[reg & 15] : kReg8[reg & 15]);
+        break;
+    case DISASM_REG_XMM: _snprintf(pszBuffer, cchBuffer, "xmm%u", reg); break;
+    case DISASM_REG_YMM: _snprintf(pszBuffer, cchBuffer, "ymm%u", reg); break;
+    case DISASM_REG_MMX: _snprintf(pszBuffer, cchBuffer, "mm%u", reg); break;
+    case DISASM_REG_SEG: _snprintf(pszBuffer, cchBuffer, "%s", kSegment[1 + (reg % 6)]); break;
+    }
+}
+
+void FormatOperand(const DisasmInstruction& inst, const DisasmOperand& op, DWORD64 address,
+                   char* pszBuffer, size_t cchBuffer)
+{
+    pszBuffer[0] = '\0';
+    const DWORD64 mask = (op.size >= 8 || op.size == 0) ? ~0ull : (1ull << (op.size * 8)) - 1;
+    switch (op.type)
+    {
+    case DISASM_OP_REG:
+        FormatRegister(op.regClass, op.reg, op.size, op.highByte, pszBuffer, cchBuffer);
+        break;
+    case DISASM_OP_IMM:
+        _snprintf(pszBuffer, cchBuffer, "0x%I64x", (DWORD64)op.imm & mask);
+        break;
+    case DISASM_OP_REL:
+    {
+        const DWORD64 addressMask = (inst.addressSize == 8) ? ~0ull : (1ull << (inst.addressSize * 8)) - 1;
+        _snprintf(pszBuffer, cchBuffer, "0x%I64x", (address + inst.length + op.imm) & addressMask);
+        break;
+    }
+    case DISASM_OP_MEM:
+    {
+        char szBase[8] = "";
+        char szIndex[8] = "";
+        if (op.base != DISASM_NO_REG)
+        {
+            FormatRegister(DISASM_REG_GP, op.base, inst.addressSize, false, szBase, sizeof(szBase));
+        }
+        if (op.index != DISASM_NO_REG)
+        {
+            FormatRegister(op.regClass, op.index, inst.addressSize, false, szIndex, sizeof(szIndex));
+        }
+        char szScale[4] = "";
+        if (op.index != DISASM_NO_REG && op.scale > 1)
+        {
+            _snprintf(szScale, sizeof(szScale), "*%u", op.scale);
+        }
+        char szDisp[24] = "";
+        const bool bAlone = (op.base == DISASM_NO_REG && op.index == DISASM_NO_REG && !op.ripRelative);
+        if (bAlone)
+        {
+            _snprintf(szDisp, sizeof(szDisp), "0x%I64x", (DWORD64)op.disp &
+                ((inst.addressSize == 8) ? ~0ull : (1ull << (inst.addressSize * 8)) - 1));
+        }
+        else if (op.disp != 0)
+        {
+            _snprintf(szDisp, sizeof(szDisp), "%s0x%I64x", (op.disp < 0) ? "-" : "+",
+                (op.disp < 0) ? (DWORD64)-op.disp : (DWORD64)op.disp);
+        }
+        _snprintf(pszBuffer, cchBuffer, "%s%s%s[%s%s%s%s%s]", GetSizeName(op.size), kSegment[op.segment],
+            (op.segment != DISASM_SEG_NONE) ? ":" : "", op.ripRelative ? "rip" : szBase,
+            ((op.ripRelative || szBase[0]) && szIndex[0]) ? "+" : "", szIndex, szScale, szDisp);
+        break;
+    }
+    }
+    pszBuffer[cchBuffer - 1] = '\0';
+}
+
+void FormatInstruction(const DisasmInstruction& inst, DWORD64 address, char* pszBuffer, size_t cchBuffer)
+{
+    int len = _snprintf(pszBuffer, cchBuffer, "%s%s%s", inst.prefix, inst.prefix[0] ? " " : "", inst.mnemonic);
+    for (BYTE i = 0; i < inst.operandCount && len >= 0 && (size_t)len < cchBuffer; i++)
+    {
+        char szOperand[64];
+        FormatOperand(inst, inst.operands[i], address, szOperand, sizeof(szOperand));
+        int n = _snprintf(pszBuffer + len, cchBuffer - len, "%s%s", (i == 0) ? " " : ", ", szOperand);
+        len = (n < 0) ? -1 : len + n;
+    }
+    pszBuffer[cchBuffer - 1] = '\0';
+}
+
+bool ComputeEffectiveAddress(const DisasmInstruction& inst, const DisasmOperand& op, DWORD64 address,
+                             const DWORD64 gpRegs[16], DWORD64* pResult)
+{
+    if (op.type != DISASM_OP_MEM || op.segment == DISASM_SEG_FS || op.segment == DISASM_SEG_GS ||
+        (op.index != DISASM_NO_REG && op.regClass != DISASM_REG_GP))
+    {
+        return false;
+    }
+    DWORD64 result = (DWORD64)op.disp;
+    if (op.ripRelative)
+    {
+        result += address + inst.length;
+    }
+    if (op.base != DISASM_NO_REG)
+    {
+        result += gpRegs[op.base & 15];
+    }
+    if (op.index != DISASM_NO_REG)
+    {
+        result += gpRegs[op.index & 15] * op.scale;
+    }
+    if (inst.addressSize < 8)
+    {
+        result &= (1ull << (inst.addressSize * 8)) - 1;
+    }
+    *pResult = result;
+    return true;
+}
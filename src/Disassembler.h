@@ -0,0 +1,91 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+
+// x86 and x86-64 instruction decoder for the crash record exporter: the integer
+// instructions, x87 (length only), MMX, SSE to SSE4.2, AVX/AVX2, FMA and BMI.
+// Code is decoded from the bytes captured around the faulting instruction, offline.
+
+enum
+{
+    DISASM_MAX_INSTRUCTION = 15,
+    DISASM_MAX_OPERANDS = 4,
+    DISASM_MAX_MNEMONIC = 24,
+
+    // DisasmOperand::base and index when the register is absent
+    DISASM_NO_REG = 0xFF,
+};
+
+// DisasmOperand::type
+enum
+{
+    DISASM_OP_NONE = 0,
+    DISASM_OP_REG,
+    DISASM_OP_MEM,
+    DISASM_OP_IMM,
+    DISASM_OP_REL,          // branch target, `imm` is relative to the next instruction
+};
+
+// DisasmOperand::regClass, and of the index of a VSIB memory operand
+enum
+{
+    DISASM_REG_GP = 0,
+    DISASM_REG_XMM,
+    DISASM_REG_YMM,
+    DISASM_REG_MMX,
+    DISASM_REG_SEG,
+};
+
+// DisasmOperand::segment
+enum
+{
+    DISASM_SEG_NONE = 0,
+    DISASM_SEG_ES, DISASM_SEG_CS, DISASM_SEG_SS, DISASM_SEG_DS, DISASM_SEG_FS, DISASM_SEG_GS,
+};
+
+struct DisasmOperand
+{
+    BYTE        type;           // DISASM_OP_xxx
+    BYTE        size;           // bytes, 0 if the operand has no size (lea)
+    BYTE        regClass;       // DISASM_REG_xxx, of `reg` or of the index register
+    BYTE        reg;            // register number as encoded, REX/VEX extension included
+    BYTE        base;           // memory: general purpose register, DISASM_NO_REG if none
+    BYTE        index;          // memory: DISASM_NO_REG if none
+    BYTE        scale;          // memory: 1, 2, 4 or 8
+    BYTE        segment;        // memory: DISASM_SEG_xxx override
+    bool        ripRelative;    // memory: relative to the next instruction
+    bool        highByte;       // register: ah, ch, dh or bh
+    LONG64      disp;           // memory displacement
+    LONG64      imm;            // immediate, sign extended, or relative branch target
+};
+
+struct DisasmInstruction
+{
+    BYTE            length;
+    BYTE            operandCount;
+    BYTE            addressSize;        // 2, 4 or 8
+    char            prefix[8];          // "lock", "rep", "repne" or empty
+    char            mnemonic[DISASM_MAX_MNEMONIC];
+    DisasmOperand   operands[DISASM_MAX_OPERANDS];
+};
+
+// Decode the instruction at `pCode`, `cbCode` bytes available.
+// Returns its length, 0 if it's invalid, truncated or not supported.
+int DecodeInstruction(const BYTE* pCode, size_t cbCode, bool b64, DisasmInstruction* pInst);
+
+// Intel syntax, `address` of the instruction resolves relative operands
+void FormatInstruction(const DisasmInstruction& inst, DWORD64 address, char* pszBuffer, size_t cchBuffer);
+
+// Format an operand alone, in the same syntax
+void FormatOperand(const DisasmInstruction& inst, const DisasmOperand& op, DWORD64 address,
+                   char* pszBuffer, size_t cchBuffer);
+
+// Effective address of a memory operand, `gpRegs` are in encoding order (rax, rcx, rdx, rbx,
+// rsp, rbp, rsi, rdi, r8-r15). Fails for fs/gs relative and vector indexed operands, whose
+// base or index registers aren't known.
+bool ComputeEffectiveAddress(const DisasmInstruction& inst, const DisasmOperand& op, DWORD64 address,
+                             const DWORD64 gpRegs[16], DWORD64* pResult);
@@ -0,0 +1,152 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "FaultRanges.h"
+#include <string.h>
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+
+FaultRanges& GetFaultRanges()
+{
+    static FaultRanges instance;
+    return instance;
+}
+
+static LONG CALLBACK FaultRangesHandler(PEXCEPTION_POINTERS pExceptionPtrs)
+{
+    const EXCEPTION_RECORD* pRecord = pExceptionPtrs->ExceptionRecord;
+    if ((pRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION &&
+         pRecord->ExceptionCode != EXCEPTION_GUARD_PAGE) || pRecord->NumberParameters < 2)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+    // ExceptionInformation[0] is 0 for a read, 1 for a write, 8 for an execution
+    if (GetFaultRanges().Dispatch(pRecord->ExceptionInformation[1], pRecord->ExceptionInformation[0] == 1))
+    {
+        return EXCEPTION_CONTINUE_EXECUTION;
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+FaultRanges::FaultRanges()
+    : hHandler_(NULL), sequence_(0), count_(0)
+{
+    memset(ranges_, 0, sizeof(ranges_));
+}
+
+LONG FaultRanges::UpperBound(DWORD_PTR address, LONG count) const
+{
+    LONG low = 0;
+    LONG high = count;
+    while (low < high)
+    {
+        LONG mid = (low + high) / 2;
+        if (ranges_[mid].begin <= address)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int FaultRanges::Register(void* pBase, size_t size, PFN_CR_FAULT_HANDLER pfnHandler, void* pContext)
+{
+    const DWORD_PTR begin = (DWORD_PTR)pBase;
+    const DWORD_PTR end = begin + size;
+    if (pBase == NULL || size == 0 || end < begin || pfnHandler == NULL)
+    {
+        return 1;
+    }
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    const LONG count = count_;
+    const LONG pos = UpperBound(begin, count);
+    if (count == MAX_FAULT_RANGES || (pos > 0 && ranges_[pos - 1].end > begin) ||
+        (pos < count && ranges_[pos].begin < end))
+    {
+        return 1;
+    }
+    if (hHandler_ == NULL)
+    {
+        // First in the list, ahead of the handlers which report crashes
+        hHandler_ = AddVectoredExceptionHandler(1, FaultRangesHandler);
+        if (hHandler_ == NULL)
+        {
+            LogLastError();
+            return 1;
+        }
+    }
+    Range range = { begin, end, pfnHandler, pContext };
+    InterlockedIncrement(&sequence_);
+    memmove(&ranges_[pos + 1], &ranges_[pos], (count - pos) * sizeof(Range));
+    ranges_[pos] = range;
+    count_ = count + 1;
+    InterlockedIncrement(&sequence_);
+    return 0;
+}
+
+int FaultRanges::Unregister(void* pBase)
+{
+    const DWORD_PTR begin = (DWORD_PTR)pBase;
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    const LONG count = count_;
+    const LONG pos = UpperBound(begin, count) - 1;
+    if (pos < 0 || ranges_[pos].begin != begin)
+    {
+        return 1;
+    }
+    InterlockedIncrement(&sequence_);
+    memmove(&ranges_[pos], &ranges_[pos + 1], (count - pos - 1) * sizeof(Range));
+    count_ = count - 1;
+    InterlockedIncrement(&sequence_);
+    return 0;
+}
+
+bool FaultRanges::Find(DWORD_PTR address, Range* pRange)
+{
+    for (;;)
+    {
+        const LONG sequence = sequence_;
+        if (sequence & 1)
+        {
+            // A registration is moving entries, it doesn't take long
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        LONG count = count_;
+        if (count == 0)
+        {
+            return false;
+        }
+        count = (count < MAX_FAULT_RANGES) ? count : MAX_FAULT_RANGES;
+        const LONG pos = UpperBound(address, count) - 1;
+        bool bFound = false;
+        if (pos >= 0)
+        {
+            *pRange = ranges_[pos];
+            bFound = (address >= pRange->begin && address < pRange->end);
+        }
+        MemoryBarrier();
+        if (sequence_ == sequence)
+        {
+            return bFound;
+        }
+    }
+}
+
+bool FaultRanges::Dispatch(DWORD_PTR address, int bWrite)
+{
+    Range range;
+    if (!Find(address, &range))
+    {
+        return false;
+    }
+    return range.pfnHandler((void*)address, bWrite, range.pContext) != 0;
+}
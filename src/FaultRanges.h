@@ -0,0 +1,60 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <atlsync.h>
+#include "CrashRpt.h"
+
+enum
+{
+    // Max number of owned address ranges registered at the same time
+    MAX_FAULT_RANGES = 256,
+};
+
+// Address ranges whose faults are expected by their owner: guard pages of a GC write
+// barrier, arenas committed on first touch. A vectored handler, run before any frame
+// based handler and before the crash handlers, hands a fault inside a range to its owner.
+// The lookup is a binary search of a sorted table guarded by a sequence counter, it takes
+// no lock and doesn't allocate; registrations are serialized and rare.
+class FaultRanges
+{
+public:
+    FaultRanges();
+
+    // The range must not overlap a registered one
+    int Register(void* pBase, size_t size, PFN_CR_FAULT_HANDLER pfnHandler, void* pContext);
+    int Unregister(void* pBase);
+
+    // Call the owner of the range containing `address`, true if it resolved the fault
+    bool Dispatch(DWORD_PTR address, int bWrite);
+
+private:
+    FaultRanges(const FaultRanges&);
+    FaultRanges& operator=(const FaultRanges&);
+
+    struct Range
+    {
+        DWORD_PTR               begin;
+        DWORD_PTR               end;
+        PFN_CR_FAULT_HANDLER    pfnHandler;
+        void*                   pContext;
+    };
+
+    // Copy of the range containing `address`, consistent with a single version of the table
+    bool Find(DWORD_PTR address, Range* pRange);
+
+    // Index of the first range which begins after `address`
+    LONG UpperBound(DWORD_PTR address, LONG count) const;
+
+private:
+    ATL::CCriticalSection   critsec_;           // serializes Register()/Unregister()
+    PVOID                   hHandler_;          // vectored handler, added with the first range
+    volatile LONG           sequence_;          // odd while the table is being modified
+    volatile LONG           count_;
+    Range                   ranges_[MAX_FAULT_RANGES];  // sorted by begin, disjoint
+};
+
+FaultRanges& GetFaultRanges();
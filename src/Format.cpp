@@ -0,0 +1,157 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Format.h"
+#include <string.h>
+
+namespace FormatDetail {
+
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char kLowerHexDigits[] = "0123456789abcdef";
+static const char kUpperHexDigits[] = "0123456789ABCDEF";
+
+// Convert backwards from `pEnd`, two digits per division, returns the first character
+static char* ConvertDecimal(char* pEnd, DWORD64 value)
+{
+    while (value >= 100)
+    {
+        unsigned int pair = (unsigned int)(value % 100);
+        value /= 100;
+        pEnd -= 2;
+        memcpy(pEnd, kDigitPairs + pair * 2, 2);
+    }
+    if (value >= 10)
+    {
+        pEnd -= 2;
+        memcpy(pEnd, kDigitPairs + value * 2, 2);
+    }
+    else
+    {
+        *--pEnd = (char)('0' + value);
+    }
+    return pEnd;
+}
+
+static char* ConvertHex(char* pEnd, DWORD64 value, const char* pszDigits)
+{
+    do
+    {
+        *--pEnd = pszDigits[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+    return pEnd;
+}
+
+static char* PadZeros(char* pBegin, const char* pEnd, size_t width)
+{
+    while ((size_t)(pEnd - pBegin) < width)
+    {
+        *--pBegin = '0';
+    }
+    return pBegin;
+}
+
+// Output cursor, one byte is kept for the terminating NUL
+struct Output
+{
+    char*   pCurr;
+    char*   pLast;
+
+    void Append(const char* psz, size_t len)
+    {
+        size_t room = (size_t)(pLast - pCurr);
+        if (len > room)
+        {
+            len = room;
+        }
+        memcpy(pCurr, psz, len);
+        pCurr += len;
+    }
+};
+
+size_t FormatSegments(char* pBuffer, size_t cbBuffer, const Segment* pSegments, size_t count, const Arg* pArgs)
+{
+    if (cbBuffer == 0)
+    {
+        return 0;
+    }
+    Output out = { pBuffer, pBuffer + cbBuffer - 1 };
+    // Enough for 64 bits in decimal or hex padded to FORMAT_MAX_WIDTH, a sign and 0x
+    char temp[FORMAT_MAX_WIDTH + 8];
+    char* const pTempEnd = temp + sizeof(temp);
+    for (size_t i = 0; i < count && out.pCurr < out.pLast; i++)
+    {
+        const Segment& segment = pSegments[i];
+        if (segment.text != NULL)
+        {
+            out.Append(segment.text, segment.length);
+            continue;
+        }
+        const Arg& arg = pArgs[segment.argIndex];
+        char spec = segment.spec;
+        if (spec == 0)
+        {
+            static const char kDefaultSpecs[] = { 0, 'd', 'd', 'c', 's', 'p' };
+            spec = kDefaultSpecs[arg.kind];
+        }
+        DWORD64 value = (arg.kind == ARG_STRING) ? (DWORD64)(ULONG_PTR)arg.s : arg.u;
+        char* p = pTempEnd;
+        switch (spec)
+        {
+        case 's':
+            {
+                const char* psz = (arg.s != NULL) ? arg.s : "(null)";
+                out.Append(psz, strlen(psz));
+            }
+            continue;
+        case 'c':
+            *--p = (char)value;
+            break;
+        case 'd':
+            if (arg.kind == ARG_SIGNED && arg.i < 0)
+            {
+                p = PadZeros(ConvertDecimal(p, 0 - value), pTempEnd, segment.width > 0 ? segment.width - 1 : 0);
+                *--p = '-';
+            }
+            else
+            {
+                p = PadZeros(ConvertDecimal(p, value), pTempEnd, segment.width);
+            }
+            break;
+        case 'x':
+        case 'X':
+            if (arg.kind == ARG_SIGNED)
+            {
+                value = arg.bits;
+            }
+            p = PadZeros(ConvertHex(p, value, spec == 'x' ? kLowerHexDigits : kUpperHexDigits),
+                pTempEnd, segment.width);
+            break;
+        case 'p':
+            p = PadZeros(ConvertHex(p, value, kUpperHexDigits), pTempEnd,
+                segment.width > 0 ? segment.width : sizeof(void*) * 2);
+            *--p = 'x';
+            *--p = '0';
+            break;
+        default:
+            continue;
+        }
+        out.Append(p, (size_t)(pTempEnd - p));
+    }
+    *out.pCurr = '\0';
+    return (size_t)(out.pCurr - pBuffer);
+}
+
+} // namespace FormatDetail
@@ -0,0 +1,304 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stddef.h>
+#include <type_traits>
+#include <Windows.h>
+
+// Allocation-free formatting into a caller buffer. The format string is split into
+// segments and checked against the argument types at compile time:
+//
+//   char szFrame[MAX_PATH];
+//   size_t len = CR_FORMAT(szFrame, sizeof(szFrame), "{s}+0x{x}", pszModule, offset);
+//
+// Placeholders:
+//   {}     default conversion of the argument type
+//   {d}    decimal             {x} {X} hexadecimal     {p} 0x and all the digits of a pointer
+//   {s}    NUL terminated string                       {c} character
+// Decimal and hexadecimal take a zero padded width, as in {08x}. {{ and }} are literal braces.
+// Hexadecimal of a negative integer has the digits of its own type, -1 as an int is ffffffff.
+// The output is truncated to fit and always NUL terminated, the length written is returned.
+// Safe to use in signal handlers and on the crash path: no locale, no heap, no lock.
+#define CR_FORMAT(pBuffer, cbBuffer, fmt, ...) \
+    [&]() -> size_t { \
+        static constexpr auto kFormat = ::FormatDetail::Compile<::FormatDetail::MaxSegments(fmt)>(fmt); \
+        static_assert(kFormat.error == 0, "malformed format string: " fmt); \
+        static_assert(kFormat.argCount == decltype(::FormatDetail::ArgTypes(__VA_ARGS__))::size, \
+            "wrong number of arguments for format string: " fmt); \
+        static_assert(::FormatDetail::CheckArgTypes(kFormat, decltype(::FormatDetail::ArgTypes(__VA_ARGS__))()), \
+            "argument type does not match its placeholder in format string: " fmt); \
+        return ::FormatDetail::FormatTo(pBuffer, cbBuffer, kFormat, ##__VA_ARGS__); \
+    }()
+
+
+namespace FormatDetail {
+
+enum
+{
+    FORMAT_OK = 0,
+    FORMAT_BAD_BRACE = 1,           // single '}' outside of a placeholder
+    FORMAT_BAD_PLACEHOLDER = 2,     // unknown conversion, unterminated or too wide
+
+    FORMAT_MAX_WIDTH = 64,
+};
+
+// Kinds of arguments
+enum
+{
+    ARG_NONE = 0,                   // not formattable
+    ARG_SIGNED,
+    ARG_UNSIGNED,
+    ARG_CHAR,
+    ARG_STRING,
+    ARG_POINTER,
+};
+
+// Literal text or placeholder of a compiled format string
+struct Segment
+{
+    const char*     text;           // NULL for a placeholder
+    unsigned short  length;         // length of the literal text
+    char            spec;           // conversion of the placeholder, 0 for the default one
+    unsigned char   width;          // zero padded width of the placeholder
+    unsigned int    argIndex;
+};
+
+template <size_t N>
+struct CompiledFormat
+{
+    Segment     segments[N];
+    size_t      count;
+    size_t      argCount;
+    int         error;              // FORMAT_OK ...
+};
+
+// Type erased argument
+struct Arg
+{
+    Arg() : kind(ARG_NONE), u(0), bits(0) {}
+    explicit Arg(int argKind) : kind(argKind), u(0), bits(0) {}
+
+    int         kind;
+    union
+    {
+        LONG64      i;
+        DWORD64     u;
+        const char* s;
+    };
+    DWORD64     bits;               // hexadecimal of ARG_SIGNED, not sign extended past its width
+};
+
+template <typename... Args>
+struct TypeList
+{
+    static const size_t size = sizeof...(Args);
+};
+
+// Only used in unevaluated context to get the argument types
+template <typename... Args>
+TypeList<Args...> ArgTypes(const Args&...);
+
+template <typename T>
+struct ArgKindOf
+{
+    typedef typename std::decay<T>::type U;
+    static const int value =
+        std::is_same<U, char>::value ? ARG_CHAR :
+        (std::is_same<U, char*>::value || std::is_same<U, const char*>::value) ? ARG_STRING :
+        std::is_pointer<U>::value ? ARG_POINTER :
+        std::is_enum<U>::value ? ARG_SIGNED :
+        std::is_integral<U>::value ? (std::is_signed<U>::value ? ARG_SIGNED : ARG_UNSIGNED) :
+        ARG_NONE;
+};
+
+// Upper bound of the number of segments
+constexpr size_t MaxSegments(const char* fmt)
+{
+    size_t count = 1;
+    for (; *fmt != '\0'; fmt++)
+    {
+        if (*fmt == '{' || *fmt == '}')
+        {
+            count += 2;
+        }
+    }
+    return count;
+}
+
+constexpr bool IsValidSpec(char spec)
+{
+    return spec == 0 || spec == 'd' || spec == 'x' || spec == 'X' || spec == 'p' || spec == 's' || spec == 'c';
+}
+
+template <size_t N>
+constexpr void AddLiteral(CompiledFormat<N>& format, const char* begin, const char* end)
+{
+    if (end > begin)
+    {
+        Segment& segment = format.segments[format.count++];
+        segment.text = begin;
+        segment.length = static_cast<unsigned short>(end - begin);
+    }
+}
+
+template <size_t N>
+constexpr CompiledFormat<N> Compile(const char* fmt)
+{
+    CompiledFormat<N> format = {};
+    const char* literal = fmt;
+    const char* p = fmt;
+    while (*p != '\0')
+    {
+        if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}'))
+        {
+            // Keep one of the two braces
+            AddLiteral(format, literal, p + 1);
+            p += 2;
+            literal = p;
+            continue;
+        }
+        if (*p == '}')
+        {
+            format.error = FORMAT_BAD_BRACE;
+            return format;
+        }
+        if (*p != '{')
+        {
+            p++;
+            continue;
+        }
+        AddLiteral(format, literal, p);
+        p++;
+
+        unsigned int width = 0;
+        while (*p >= '0' && *p <= '9')
+        {
+            width = width * 10 + (*p - '0');
+            p++;
+        }
+        char spec = 0;
+        if (*p != '}' && *p != '\0')
+        {
+            spec = *p;
+            p++;
+        }
+        if (*p != '}' || !IsValidSpec(spec) || width > FORMAT_MAX_WIDTH)
+        {
+            format.error = FORMAT_BAD_PLACEHOLDER;
+            return format;
+        }
+        p++;
+        Segment& segment = format.segments[format.count++];
+        segment.text = NULL;
+        segment.spec = spec;
+        segment.width = static_cast<unsigned char>(width);
+        segment.argIndex = static_cast<unsigned int>(format.argCount++);
+        literal = p;
+    }
+    AddLiteral(format, literal, p);
+    return format;
+}
+
+constexpr bool SpecAccepts(char spec, int kind)
+{
+    return (kind != ARG_NONE) &&
+        (spec == 0 ||
+         (spec == 'd' && (kind == ARG_SIGNED || kind == ARG_UNSIGNED || kind == ARG_CHAR)) ||
+         ((spec == 'x' || spec == 'X') && kind != ARG_STRING) ||
+         (spec == 'p' && (kind == ARG_POINTER || kind == ARG_STRING || kind == ARG_UNSIGNED)) ||
+         (spec == 's' && kind == ARG_STRING) ||
+         (spec == 'c' && kind == ARG_CHAR));
+}
+
+template <size_t N, typename... Args>
+constexpr bool CheckArgTypes(const CompiledFormat<N>& format, TypeList<Args...>)
+{
+    const int kinds[] = { ArgKindOf<Args>::value..., ARG_NONE };
+    for (size_t i = 0; i < format.count; i++)
+    {
+        const Segment& segment = format.segments[i];
+        if (segment.text != NULL)
+        {
+            continue;
+        }
+        if (segment.argIndex >= sizeof...(Args) || !SpecAccepts(segment.spec, kinds[segment.argIndex]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// An integer as the unsigned type of its own width, -1 as an int is 0xffffffff
+template <typename T>
+constexpr DWORD64 ToUnsignedBits(T value)
+{
+    return (DWORD64)(typename std::make_unsigned<T>::type)value;
+}
+
+static_assert(ToUnsignedBits(-1) == 0xffffffffull, "int is converted through unsigned int");
+static_assert(ToUnsignedBits((short)-2) == 0xfffeull, "short is converted through unsigned short");
+static_assert(ToUnsignedBits((LONG64)-1) == ~0ull, "a 64-bit integer keeps all its bits");
+static_assert(ToUnsignedBits(42) == 42ull, "a positive integer is unchanged");
+
+template <typename T>
+inline Arg MakeArg(const T& value, std::integral_constant<int, ARG_SIGNED>)
+{
+    Arg arg(ARG_SIGNED);
+    arg.i = (LONG64)value;
+    arg.bits = ToUnsignedBits(value);
+    return arg;
+}
+
+template <typename T>
+inline Arg MakeArg(const T& value, std::integral_constant<int, ARG_UNSIGNED>)
+{
+    Arg arg(ARG_UNSIGNED);
+    arg.u = (DWORD64)value;
+    return arg;
+}
+
+template <typename T>
+inline Arg MakeArg(const T& value, std::integral_constant<int, ARG_CHAR>)
+{
+    Arg arg(ARG_CHAR);
+    arg.u = (unsigned char)value;
+    return arg;
+}
+
+template <typename T>
+inline Arg MakeArg(const T& value, std::integral_constant<int, ARG_STRING>)
+{
+    Arg arg(ARG_STRING);
+    arg.s = value;
+    return arg;
+}
+
+template <typename T>
+inline Arg MakeArg(const T& value, std::integral_constant<int, ARG_POINTER>)
+{
+    Arg arg(ARG_POINTER);
+    arg.u = (DWORD64)(ULONG_PTR)value;
+    return arg;
+}
+
+template <typename T>
+inline Arg MakeArg(const T& value)
+{
+    return MakeArg(value, std::integral_constant<int, ArgKindOf<T>::value>());
+}
+
+// Write the segments, placeholders take their value from `pArgs`
+size_t FormatSegments(char* pBuffer, size_t cbBuffer, const Segment* pSegments, size_t count, const Arg* pArgs);
+
+template <size_t N, typename... Args>
+inline size_t FormatTo(char* pBuffer, size_t cbBuffer, const CompiledFormat<N>& format, const Args&... args)
+{
+    const Arg argv[] = { MakeArg(args)..., Arg() };
+    return FormatSegments(pBuffer, cbBuffer, format.segments, format.count, argv);
+}
+
+} // namespace FormatDetail
@@ -0,0 +1,355 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "HeapProfiler.h"
+#include <math.h>
+#include <new.h>
+#include <new>
+#include <intrin.h>
+#include <Psapi.h>
+#include "Report.h"
+#include "Utility.h"
+
+#pragma comment(lib, "psapi.lib")
+#pragma warning(disable: 4996)
+
+// Per-thread sampling state, no locks on the allocation path
+__declspec(thread) static LONG64    t_bytesUntilSample = 0;
+__declspec(thread) static DWORD64   t_random = 0;
+__declspec(thread) static LONG      t_inProfiler = 0;
+
+static DWORD HashPointer(const void* ptr)
+{
+    DWORD64 v = (DWORD64)(ULONG_PTR)ptr >> 4;
+    return (DWORD)((v * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+HeapProfiler::HeapProfiler()
+    : bActive_(0), liveSamples_(0), bRssReported_(0), rate_(HEAP_PROFILER_DEFAULT_RATE),
+      rssThreshold_(0), reportCommitCharge_(0), hReportThread_(NULL), hReportEvent_(NULL),
+      table_(NULL), sequence_(0), samples_(NULL)
+{
+}
+
+HeapProfiler::~HeapProfiler()
+{
+    // operator delete keeps being called after static destructors,
+    // the tables are left to the process exit
+    bActive_ = 0;
+    liveSamples_ = 0;
+}
+
+int HeapProfiler::Start(unsigned int rate, ULONG64 rssThreshold)
+{
+#ifndef CALMDUMP_HEAP_PROFILER
+    UNREFERENCED_PARAMETER(rate);
+    UNREFERENCED_PARAMETER(rssThreshold);
+    return 1;   // operator new/delete are not hooked
+#else
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (bActive_)
+    {
+        return 1;
+    }
+    if (table_ == NULL)
+    {
+        samples_ = (LiveSample*)VirtualAlloc(NULL, HEAP_PROFILER_MAX_LIVE_SAMPLES * sizeof(LiveSample),
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (samples_ == NULL)
+        {
+            LogLastError();
+            return 1;
+        }
+        table_ = new StackTable(HEAP_PROFILER_MAX_STACKS);
+    }
+    if (rssThreshold > 0 && hReportThread_ == NULL)
+    {
+        // The report is symbolized with dbghelp, it's written away from the allocation hook
+        hReportEvent_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (hReportEvent_ == NULL)
+        {
+            LogLastError();
+            return 1;
+        }
+        hReportThread_ = CreateThread(NULL, 0, &HeapProfiler::ReportThreadProc, this, 0, NULL);
+        if (hReportThread_ == NULL)
+        {
+            LogLastError();
+            CloseHandle(hReportEvent_);
+            hReportEvent_ = NULL;
+            return 1;
+        }
+    }
+    rate_ = (rate > 0) ? rate : HEAP_PROFILER_DEFAULT_RATE;
+    rssThreshold_ = rssThreshold;
+    bRssReported_ = 0;
+    InterlockedExchange(&bActive_, 1);
+    return 0;
+#endif
+}
+
+int HeapProfiler::Stop()
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (!bActive_)
+    {
+        return 1;
+    }
+    // Blocks sampled so far are still tracked until they are freed
+    InterlockedExchange(&bActive_, 0);
+    return 0;
+}
+
+int HeapProfiler::Dump(const char* pszFileName)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (table_ == NULL || pszFileName == NULL)
+    {
+        return 1;
+    }
+    FILE* fp = fopen(pszFileName, "w");
+    if (fp == NULL)
+    {
+        return 1;
+    }
+    fprintf(fp, "# calmdump heap profile, live bytes sampled every %.0f bytes, %I64d stacks dropped\n",
+        rate_, table_->GetDropped());
+    WriteModuleHeader(fp);
+    table_->WriteFolded(fp, true);
+    fclose(fp);
+    return 0;
+}
+
+// Not inlined, like RecordSample() and operator new, the frames skipped for them must exist
+__declspec(noinline) void HeapProfiler::OnAlloc(void* ptr, size_t size)
+{
+    LONG64 weight = 0;
+    if (!bActive_ || t_inProfiler || !ShouldSample(size, &weight))
+    {
+        return;
+    }
+    // Allocations made by the profiler itself are not sampled
+    t_inProfiler = 1;
+    RecordSample(ptr, weight);
+    CheckRssThreshold();
+    t_inProfiler = 0;
+}
+
+void HeapProfiler::OnFree(void* ptr)
+{
+    if (ptr == NULL || liveSamples_ == 0)
+    {
+        return;
+    }
+    // Every free looks the block up, only the free of a sampled block takes the lock
+    if (FindSample(ptr) == HEAP_PROFILER_MAX_LIVE_SAMPLES)
+    {
+        return;
+    }
+    StackEntry* pEntry = NULL;
+    LONG64 weight = 0;
+    {
+        ScopedLock<ATL::CCriticalSection> lock(samplesLock_);
+        // Entries may have moved since the lookup
+        const DWORD slot = FindSample(ptr);
+        if (slot == HEAP_PROFILER_MAX_LIVE_SAMPLES)
+        {
+            return;
+        }
+        pEntry = samples_[slot].pEntry;
+        weight = samples_[slot].weight;
+
+        // Backward shift deletion: the entries after the slot which may move into
+        // the hole do, so the probe sequences stay unbroken without tombstones
+        const DWORD mask = HEAP_PROFILER_MAX_LIVE_SAMPLES - 1;
+        InterlockedIncrement(&sequence_);
+        DWORD hole = slot;
+        for (DWORD next = (hole + 1) & mask; samples_[next].ptr != NULL; next = (next + 1) & mask)
+        {
+            DWORD home = HashPointer(samples_[next].ptr) & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                samples_[hole] = samples_[next];
+                hole = next;
+            }
+        }
+        samples_[hole].ptr = NULL;
+        InterlockedDecrement(&liveSamples_);
+        InterlockedIncrement(&sequence_);
+    }
+    StackTable::Remove(pEntry, weight);
+}
+
+DWORD HeapProfiler::FindSample(const void* ptr) const
+{
+    const DWORD mask = HEAP_PROFILER_MAX_LIVE_SAMPLES - 1;
+    const DWORD index = HashPointer(ptr);
+    for (;;)
+    {
+        const LONG sequence = sequence_;
+        if (sequence & 1)
+        {
+            // An insertion or a deletion is moving entries, it doesn't take long
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        // The table is never full, the probe ends on an empty slot
+        DWORD slot = HEAP_PROFILER_MAX_LIVE_SAMPLES;
+        for (DWORD probe = 0; probe < HEAP_PROFILER_MAX_LIVE_SAMPLES; probe++)
+        {
+            const PVOID current = samples_[(index + probe) & mask].ptr;
+            if (current == NULL)
+            {
+                break;
+            }
+            if (current == ptr)
+            {
+                slot = (index + probe) & mask;
+                break;
+            }
+        }
+        MemoryBarrier();
+        if (sequence_ == sequence)
+        {
+            return slot;
+        }
+    }
+}
+
+bool HeapProfiler::ShouldSample(size_t size, LONG64* pWeight)
+{
+    if (t_bytesUntilSample == 0)
+    {
+        t_bytesUntilSample = NextSampleInterval();
+    }
+    t_bytesUntilSample -= (LONG64)size;
+    if (t_bytesUntilSample > 0)
+    {
+        return false;
+    }
+    t_bytesUntilSample = NextSampleInterval();
+
+    // A block of `size` bytes is sampled with probability 1 - exp(-size / rate),
+    // scale the sample up so the totals are unbiased estimations of the live bytes
+    double probability = 1.0 - exp(-(double)size / rate_);
+    *pWeight = (probability > 0.0) ? (LONG64)((double)size / probability) : (LONG64)rate_;
+    return true;
+}
+
+LONG64 HeapProfiler::NextSampleInterval()
+{
+    if (t_random == 0)
+    {
+        t_random = (__rdtsc() ^ ((DWORD64)GetCurrentThreadId() << 32)) | 1;
+    }
+    // xorshift64*
+    t_random ^= t_random >> 12;
+    t_random ^= t_random << 25;
+    t_random ^= t_random >> 27;
+    DWORD64 bits = (t_random * 2685821657736338717ULL) >> 11;
+
+    // Uniform in (0, 1], then exponentially distributed distance of mean `rate`
+    double uniform = (double)(bits + 1) / 9007199254740992.0;
+    LONG64 interval = (LONG64)(-log(uniform) * rate_);
+    return (interval > 0) ? interval : 1;
+}
+
+__declspec(noinline) void HeapProfiler::RecordSample(void* ptr, LONG64 weight)
+{
+    DWORD64 frames[MAX_STACK_FRAMES];
+    // Skip RecordSample(), OnAlloc() and operator new
+    USHORT depth = CaptureCurrentStack(3, frames, MAX_STACK_FRAMES);
+    StackEntry* pEntry = table_->Add(frames, depth, weight);
+    if (pEntry == NULL)
+    {
+        return;
+    }
+
+    ScopedLock<ATL::CCriticalSection> lock(samplesLock_);
+    if (liveSamples_ >= HEAP_PROFILER_MAX_LIVE_SAMPLES * 3 / 4)
+    {
+        // Too many live samples, forget this one, probes stay short
+        StackTable::Remove(pEntry, weight);
+        return;
+    }
+    const DWORD mask = HEAP_PROFILER_MAX_LIVE_SAMPLES - 1;
+    DWORD slot = HashPointer(ptr) & mask;
+    while (samples_[slot].ptr != NULL)
+    {
+        slot = (slot + 1) & mask;
+    }
+    InterlockedIncrement(&sequence_);
+    samples_[slot].pEntry = pEntry;
+    samples_[slot].weight = weight;
+    samples_[slot].ptr = ptr;
+    InterlockedIncrement(&liveSamples_);
+    InterlockedIncrement(&sequence_);
+}
+
+void HeapProfiler::CheckRssThreshold()
+{
+    if (rssThreshold_ == 0 || bRssReported_)
+    {
+        return;
+    }
+    PROCESS_MEMORY_COUNTERS_EX pmc = {};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS)&pmc, sizeof(pmc)))
+    {
+        return;
+    }
+    if (pmc.PrivateUsage >= rssThreshold_ && InterlockedCompareExchange(&bRssReported_, 1, 0) == 0)
+    {
+        reportCommitCharge_ = pmc.PrivateUsage;
+        SetEvent(hReportEvent_);
+    }
+}
+
+DWORD WINAPI HeapProfiler::ReportThreadProc(LPVOID lpParameter)
+{
+    HeapProfiler* self = (HeapProfiler*)lpParameter;
+    // Allocations made by the report are not sampled
+    t_inProfiler = 1;
+    while (WaitForSingleObject(self->hReportEvent_, INFINITE) == WAIT_OBJECT_0)
+    {
+        CreateHeapReport(self->reportCommitCharge_);
+    }
+    return 0;
+}
+
+HeapProfiler& GetHeapProfiler()
+{
+    static HeapProfiler instance;
+    return instance;
+}
+
+
+#ifdef CALMDUMP_HEAP_PROFILER
+
+// Replacements of the global allocation functions, the array and nothrow
+// versions of the CRT forward to these two.
+
+__declspec(noinline) void* operator new(size_t size)
+{
+    void* ptr;
+    // Same loop as the CRT, the new handler is called until it gives up
+    while ((ptr = malloc(size ? size : 1)) == NULL)
+    {
+        if (_callnewh(size) == 0)
+        {
+            throw std::bad_alloc();
+        }
+    }
+    GetHeapProfiler().OnAlloc(ptr, size);
+    return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+    GetHeapProfiler().OnFree(ptr);
+    free(ptr);
+}
+
+#endif // CALMDUMP_HEAP_PROFILER
@@ -0,0 +1,89 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <atlsync.h>
+#include "StackTable.h"
+
+enum
+{
+    // Max number of distinct allocation call stacks
+    HEAP_PROFILER_MAX_STACKS = 16 * 1024,
+
+    // Max number of sampled allocations alive at the same time, power of two
+    HEAP_PROFILER_MAX_LIVE_SAMPLES = 64 * 1024,
+
+    // Mean number of bytes allocated between two samples
+    HEAP_PROFILER_DEFAULT_RATE = 512 * 1024,
+};
+
+// Sampling heap profiler.
+// Allocations made through operator new are sampled by byte count: the distance between
+// two samples follows a geometric distribution of mean `rate` bytes, so big allocations
+// are likely sampled and small ones rarely, independently of the allocation pattern.
+// The allocation call stack of a sample is captured with the fast unwinder and the
+// estimated bytes are kept per stack while the sampled block is alive.
+// Only compiled in with CALMDUMP_HEAP_PROFILER, which replaces the global operator new/delete.
+class HeapProfiler
+{
+public:
+    HeapProfiler();
+    ~HeapProfiler();
+
+    // `rssThreshold` is a commit charge in bytes, above it a heap report is written once; 0 to disable
+    int Start(unsigned int rate, ULONG64 rssThreshold);
+    int Stop();
+
+    // Write live allocation call stacks in folded-stack format, weights in bytes
+    int Dump(const char* pszFileName);
+
+    // Stack table, NULL if the profiler was never started
+    const StackTable* GetTable() const { return table_; }
+
+    // Called by operator new/delete
+    void OnAlloc(void* ptr, size_t size);
+    void OnFree(void* ptr);
+
+private:
+    struct LiveSample
+    {
+        PVOID volatile      ptr;
+        StackEntry*         pEntry;
+        LONG64              weight;
+    };
+
+    static DWORD WINAPI ReportThreadProc(LPVOID lpParameter);
+
+    bool ShouldSample(size_t size, LONG64* pWeight);
+    LONG64 NextSampleInterval();
+    void RecordSample(void* ptr, LONG64 weight);
+    void CheckRssThreshold();
+
+    // Slot of a sampled block, HEAP_PROFILER_MAX_LIVE_SAMPLES if `ptr` isn't one
+    DWORD FindSample(const void* ptr) const;
+
+    // Guards Start()/Stop()/Dump()
+    ATL::CCriticalSection   critsec_;
+
+    volatile LONG           bActive_;
+    volatile LONG           liveSamples_;
+    volatile LONG           bRssReported_;
+    double                  rate_;
+    ULONG64                 rssThreshold_;
+    volatile ULONG64        reportCommitCharge_;
+    HANDLE                  hReportThread_;     // writes the heap report once over the threshold
+    HANDLE                  hReportEvent_;
+    StackTable*             table_;
+
+    // Linear probing set of sampled blocks, at most 3/4 full. Insertions and deletions are
+    // serialized and bump `sequence_`, frees look blocks up without a lock.
+    ATL::CCriticalSection   samplesLock_;
+    volatile LONG           sequence_;          // odd while entries are being moved
+    LiveSample*             samples_;
+};
+
+// Heap profiler of current process
+HeapProfiler& GetHeapProfiler();
@@ -0,0 +1,88 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "HttpConnection.h"
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+#pragma comment(lib, "winhttp.lib")
+
+
+HttpConnection::HttpConnection()
+    : hSession_(NULL), hConnect_(NULL), bSecure_(false)
+{
+    szPath_[0] = L'\0';
+}
+
+bool HttpConnection::Connect(const char* pszUrl, DWORD dwTimeout)
+{
+    Disconnect();
+    WCHAR szUrl[HTTP_MAX_URL_LEN];
+    WCHAR szHost[HTTP_MAX_HOST_LEN];
+    if (MultiByteToWideChar(CP_UTF8, 0, pszUrl, -1, szUrl, HTTP_MAX_URL_LEN) == 0)
+    {
+        return false;
+    }
+    URL_COMPONENTS uc = {};
+    uc.dwStructSize = sizeof(uc);
+    uc.lpszHostName = szHost;
+    uc.dwHostNameLength = HTTP_MAX_HOST_LEN;
+    uc.lpszUrlPath = szPath_;
+    uc.dwUrlPathLength = HTTP_MAX_URL_LEN;
+    if (!WinHttpCrackUrl(szUrl, 0, 0, &uc))
+    {
+        LogLastError();
+        szPath_[0] = L'\0';
+        return false;
+    }
+    bSecure_ = (uc.nScheme == INTERNET_SCHEME_HTTPS);
+
+    hSession_ = WinHttpOpen(L"calmdump", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME,
+        WINHTTP_NO_PROXY_BYPASS, 0);
+    if (hSession_ == NULL)
+    {
+        LogLastError();
+        Disconnect();
+        return false;
+    }
+    WinHttpSetTimeouts(hSession_, dwTimeout, dwTimeout, dwTimeout, dwTimeout);
+    hConnect_ = WinHttpConnect(hSession_, szHost, uc.nPort, 0);
+    if (hConnect_ == NULL)
+    {
+        LogLastError();
+        Disconnect();
+        return false;
+    }
+    return true;
+}
+
+void HttpConnection::Disconnect()
+{
+    if (hConnect_ != NULL)
+    {
+        WinHttpCloseHandle(hConnect_);
+        hConnect_ = NULL;
+    }
+    if (hSession_ != NULL)
+    {
+        WinHttpCloseHandle(hSession_);
+        hSession_ = NULL;
+    }
+    szPath_[0] = L'\0';
+}
+
+HINTERNET HttpConnection::OpenRequest(const WCHAR* pszVerb, const WCHAR* pszPath)
+{
+    if (hConnect_ == NULL)
+    {
+        return NULL;
+    }
+    HINTERNET hRequest = WinHttpOpenRequest(hConnect_, pszVerb, pszPath, NULL, WINHTTP_NO_REFERER,
+        WINHTTP_DEFAULT_ACCEPT_TYPES, bSecure_ ? WINHTTP_FLAG_SECURE : 0);
+    if (hRequest == NULL)
+    {
+        LogLastError();
+    }
+    return hRequest;
+}
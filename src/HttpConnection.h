@@ -0,0 +1,44 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <winhttp.h>
+
+enum
+{
+    HTTP_MAX_URL_LEN = 1024,
+    HTTP_MAX_HOST_LEN = 256,
+};
+
+// WinHTTP session and connection to the server of an http:// or https:// URL,
+// shared by the report uploader and the symbol store. Only Disconnect() closes it,
+// the uploader leaves it to its sender thread at exit.
+class HttpConnection
+{
+public:
+    HttpConnection();
+
+    // `dwTimeout` bounds each connect, send and receive (milliseconds)
+    bool Connect(const char* pszUrl, DWORD dwTimeout);
+    void Disconnect();
+
+    bool IsConnected() const { return hConnect_ != NULL; }
+
+    // Path of the URL, empty if it has none
+    const WCHAR* GetPath() const { return szPath_; }
+
+    // Request of `pszPath` on the server, over TLS for an https:// URL. NULL if it failed.
+    HINTERNET OpenRequest(const WCHAR* pszVerb, const WCHAR* pszPath);
+
+private:
+    HttpConnection(const HttpConnection&);
+    HttpConnection& operator = (const HttpConnection&);
+
+    HINTERNET   hSession_;
+    HINTERNET   hConnect_;
+    bool        bSecure_;
+    WCHAR       szPath_[HTTP_MAX_URL_LEN];
+};
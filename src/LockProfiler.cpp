@@ -0,0 +1,231 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "LockProfiler.h"
+#include <Tlhelp32.h>
+#include <limits.h>
+#include "CrashRpt.h"
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+typedef void (WINAPI* EnterCriticalSection_t)(LPCRITICAL_SECTION);
+
+// The real EnterCriticalSection(), the import table slot of our own module may be patched
+static EnterCriticalSection_t GetRealEnterCriticalSection()
+{
+    static EnterCriticalSection_t pfnEnter = (EnterCriticalSection_t)
+        GetProcAddress(GetModuleHandleA("kernel32.dll"), "EnterCriticalSection");
+    return pfnEnter;
+}
+
+// Never inlined, the stack is captured here and this frame is skipped with `skip` more
+__declspec(noinline) void EnterCriticalSectionTimed(LPCRITICAL_SECTION lpCriticalSection, DWORD skip)
+{
+    ULONG64 start = __rdtsc();
+    GetRealEnterCriticalSection()(lpCriticalSection);
+    ULONG64 cycles = __rdtsc() - start;
+    LockProfiler& profiler = GetLockProfiler();
+    if (profiler.IsOverThreshold(cycles))
+    {
+        DWORD64 frames[MAX_STACK_FRAMES];
+        USHORT depth = CaptureCurrentStack(1 + skip, frames, MAX_STACK_FRAMES);
+        profiler.RecordStack(frames, depth, cycles);
+    }
+}
+
+// Replacement of EnterCriticalSection() in the patched import tables, called through the
+// import table so never inlined, its frame is skipped
+static void WINAPI EnterCriticalSectionHook(LPCRITICAL_SECTION lpCriticalSection)
+{
+    if (!TryEnterCriticalSection(lpCriticalSection))
+    {
+        EnterCriticalSectionTimed(lpCriticalSection, 1);
+    }
+}
+
+// Measure the time stamp counter frequency against the performance counter
+static LONG64 MeasureCyclesPerUs()
+{
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    ULONG64 cycles = __rdtsc();
+    Sleep(10);
+    QueryPerformanceCounter(&end);
+    cycles = __rdtsc() - cycles;
+    LONG64 elapsedUs = (end.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart;
+    if (elapsedUs <= 0 || (LONG64)cycles < elapsedUs)
+    {
+        return 1;
+    }
+    return (LONG64)cycles / elapsedUs;
+}
+
+// Whether the module lives in the Windows directory
+static bool IsSystemModule(const char* pszPath)
+{
+    char szWinDir[MAX_PATH];
+    UINT len = GetWindowsDirectoryA(szWinDir, MAX_PATH);
+    return len > 0 && len < MAX_PATH && _strnicmp(pszPath, szWinDir, len) == 0;
+}
+
+LockProfiler::LockProfiler()
+    : thresholdCycles_(_UI64_MAX), cyclesPerUs_(1), table_(NULL)
+{
+}
+
+LockProfiler::~LockProfiler()
+{
+    Stop();
+    // The table is left alone, hooked threads may still be running at exit
+}
+
+int LockProfiler::Start(unsigned int thresholdUs, DWORD dwFlags)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (thresholdCycles_ != _UI64_MAX || GetRealEnterCriticalSection() == NULL)
+    {
+        return 1;
+    }
+    if (table_ == NULL)
+    {
+        table_ = new StackTable(LOCK_PROFILER_MAX_STACKS);
+        cyclesPerUs_ = MeasureCyclesPerUs();
+    }
+    thresholdCycles_ = (ULONG64)thresholdUs * cyclesPerUs_;
+    MemoryBarrier();
+    if (dwFlags & CR_LOCK_PROFILE_INTERPOSE)
+    {
+        PatchImports((PVOID)GetRealEnterCriticalSection(), (PVOID)EnterCriticalSectionHook);
+    }
+    return 0;
+}
+
+int LockProfiler::Stop()
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (thresholdCycles_ == _UI64_MAX)
+    {
+        return 1;
+    }
+    RestoreImports();
+    thresholdCycles_ = _UI64_MAX;
+    return 0;
+}
+
+int LockProfiler::Dump(const char* pszFileName)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (table_ == NULL || pszFileName == NULL)
+    {
+        return 1;
+    }
+    FILE* fp = fopen(pszFileName, "w");
+    if (fp == NULL)
+    {
+        return 1;
+    }
+    fprintf(fp, "# calmdump lock contention in microseconds, %I64d stacks dropped\n", table_->GetDropped());
+    WriteModuleHeader(fp);
+    table_->WriteFolded(fp, true, cyclesPerUs_);
+    fclose(fp);
+    return 0;
+}
+
+void LockProfiler::RecordStack(const DWORD64* pFrames, USHORT depth, ULONG64 cycles)
+{
+    if (depth > 0)
+    {
+        table_->Add(pFrames, depth, (LONG64)cycles);
+    }
+}
+
+void LockProfiler::PatchImports(PVOID pfnFrom, PVOID pfnTo)
+{
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+    {
+        LogLastError();
+        return;
+    }
+    MODULEENTRY32 me = {};
+    me.dwSize = sizeof(me);
+    for (BOOL bOk = Module32First(hSnapshot, &me); bOk; bOk = Module32Next(hSnapshot, &me))
+    {
+        // System DLLs take critical sections inside the loader, leave them alone
+        if (IsSystemModule(me.szExePath))
+        {
+            continue;
+        }
+        BYTE* pBase = me.modBaseAddr;
+        const IMAGE_DOS_HEADER* pDosHeader = (const IMAGE_DOS_HEADER*)pBase;
+        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+        {
+            continue;
+        }
+        const IMAGE_NT_HEADERS* pNtHeaders = (const IMAGE_NT_HEADERS*)(pBase + pDosHeader->e_lfanew);
+        if (pNtHeaders->Signature != IMAGE_NT_SIGNATURE)
+        {
+            continue;
+        }
+        const IMAGE_DATA_DIRECTORY& dir = pNtHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+        if (dir.VirtualAddress == 0 || dir.Size == 0)
+        {
+            continue;
+        }
+        const IMAGE_IMPORT_DESCRIPTOR* pImport = (const IMAGE_IMPORT_DESCRIPTOR*)(pBase + dir.VirtualAddress);
+        for (; pImport->Name != 0; pImport++)
+        {
+            // Forwarded exports are already resolved to their final address in the IAT,
+            // so the slot is found whatever DLL name the module imports it from
+            PVOID* ppSlot = (PVOID*)(pBase + pImport->FirstThunk);
+            for (; *ppSlot != NULL; ppSlot++)
+            {
+                if (*ppSlot != pfnFrom)
+                {
+                    continue;
+                }
+                HMODULE hModule = NULL;
+                if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCSTR)pBase, &hModule))
+                {
+                    continue;
+                }
+                DWORD dwOldProtect = 0;
+                if (!VirtualProtect(ppSlot, sizeof(PVOID), PAGE_READWRITE, &dwOldProtect))
+                {
+                    FreeLibrary(hModule);
+                    continue;
+                }
+                PatchedImport patch = { hModule, ppSlot, pfnFrom };
+                InterlockedExchangePointer(ppSlot, pfnTo);
+                VirtualProtect(ppSlot, sizeof(PVOID), dwOldProtect, &dwOldProtect);
+                patched_.push_back(patch);
+            }
+        }
+    }
+    CloseHandle(hSnapshot);
+}
+
+void LockProfiler::RestoreImports()
+{
+    for (size_t i = 0; i < patched_.size(); i++)
+    {
+        const PatchedImport& patch = patched_[i];
+        DWORD dwOldProtect = 0;
+        if (VirtualProtect(patch.ppSlot, sizeof(PVOID), PAGE_READWRITE, &dwOldProtect))
+        {
+            InterlockedExchangePointer(patch.ppSlot, patch.pfnOriginal);
+            VirtualProtect(patch.ppSlot, sizeof(PVOID), dwOldProtect, &dwOldProtect);
+        }
+        FreeLibrary(patch.hModule);
+    }
+    patched_.clear();
+}
+
+LockProfiler& GetLockProfiler()
+{
+    static LockProfiler instance;
+    return instance;
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <intrin.h>
+#include <atlsync.h>
+#include <vector>
+#include "StackTable.h"
+
+enum
+{
+    // Max number of distinct call sites kept by the lock contention profiler
+    LOCK_PROFILER_MAX_STACKS = 4 * 1024,
+};
+
+// Lock contention profiler.
+// Waits on a critical section longer than a threshold are accounted to the acquiring
+// call stack (raw return addresses only) in a lock-free stack table. Uncontended
+// acquisitions cost nothing, contended ones pay two rdtsc and a comparison unless
+// the wait is over the threshold.
+class LockProfiler
+{
+public:
+    LockProfiler();
+    ~LockProfiler();
+
+    // `dwFlags` may contain CR_LOCK_PROFILE_INTERPOSE
+    int Start(unsigned int thresholdUs, DWORD dwFlags);
+    int Stop();
+
+    // Write contended call sites in folded-stack format, weights in microseconds
+    int Dump(const char* pszFileName);
+
+    // Whether a contended wait of `cycles` is long enough to be recorded
+    bool IsOverThreshold(ULONG64 cycles) const { return cycles >= thresholdCycles_; }
+
+    // Account a contended wait of `cycles` to a stack captured by the caller
+    void RecordStack(const DWORD64* pFrames, USHORT depth, ULONG64 cycles);
+
+    // Stack table, NULL if the profiler was never started
+    const StackTable* GetTable() const { return table_; }
+
+    LONG64 GetCyclesPerUs() const { return cyclesPerUs_; }
+
+private:
+    // Redirect `pfnFrom` to `pfnTo` in the import tables of the modules loaded so far
+    void PatchImports(PVOID pfnFrom, PVOID pfnTo);
+    void RestoreImports();
+
+    struct PatchedImport
+    {
+        HMODULE     hModule;    // referenced, so the module can't go away while patched
+        PVOID*      ppSlot;
+        PVOID       pfnOriginal;
+    };
+
+    // Guards Start()/Stop()/Dump()
+    ATL::CCriticalSection       critsec_;
+
+    volatile ULONG64            thresholdCycles_;   // _UI64_MAX when stopped
+    LONG64                      cyclesPerUs_;
+    StackTable*                 table_;
+    std::vector<PatchedImport>  patched_;
+};
+
+// Lock contention profiler of current process
+LockProfiler& GetLockProfiler();
+
+// Enter a critical section which failed TryEnterCriticalSection() and account the wait,
+// calls the real EnterCriticalSection() even if the import tables are patched.
+// `skip` frames of never inlined callers are left out of the recorded stack.
+void EnterCriticalSectionTimed(LPCRITICAL_SECTION lpCriticalSection, DWORD skip);
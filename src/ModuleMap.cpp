@@ -0,0 +1,393 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "ModuleMap.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <winternl.h>
+#include <Tlhelp32.h>
+#include <vector>
+#include <algorithm>
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+// CodeView debug information of a PDB 7.0 file
+struct CvInfoPdb70
+{
+    DWORD       signature;      // 'RSDS'
+    GUID        guid;
+    DWORD       age;
+    char        pdbFileName[1];
+};
+
+// Loader notifications of ntdll, available since Vista
+enum
+{
+    LDR_DLL_NOTIFICATION_REASON_LOADED = 1,
+    LDR_DLL_NOTIFICATION_REASON_UNLOADED = 2,
+};
+
+struct LdrDllNotificationData
+{
+    ULONG                   Flags;
+    const UNICODE_STRING*   FullDllName;
+    const UNICODE_STRING*   BaseDllName;
+    PVOID                   DllBase;
+    ULONG                   SizeOfImage;
+};
+
+typedef VOID (CALLBACK* LdrDllNotificationFunction_t)(ULONG, const void*, PVOID);
+typedef LONG (NTAPI* LdrRegisterDllNotification_t)(ULONG, LdrDllNotificationFunction_t, PVOID, PVOID*);
+typedef LONG (NTAPI* LdrUnregisterDllNotification_t)(PVOID);
+
+void ReadImageHeaders(const BYTE* pBase, ModuleInfo* pInfo)
+{
+    __try
+    {
+        const IMAGE_DOS_HEADER* pDosHeader = (const IMAGE_DOS_HEADER*)pBase;
+        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+        {
+            return;
+        }
+        const IMAGE_NT_HEADERS* pNtHeaders = (const IMAGE_NT_HEADERS*)(pBase + pDosHeader->e_lfanew);
+        if (pNtHeaders->Signature != IMAGE_NT_SIGNATURE)
+        {
+            return;
+        }
+        pInfo->timeDateStamp = pNtHeaders->FileHeader.TimeDateStamp;
+        pInfo->loadBias = (LONG64)((ULONG_PTR)pBase - (ULONG_PTR)pNtHeaders->OptionalHeader.ImageBase);
+        const IMAGE_DATA_DIRECTORY& dir = pNtHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+        const IMAGE_DEBUG_DIRECTORY* pDebug = (const IMAGE_DEBUG_DIRECTORY*)(pBase + dir.VirtualAddress);
+        DWORD count = (dir.VirtualAddress != 0) ? dir.Size / sizeof(IMAGE_DEBUG_DIRECTORY) : 0;
+        for (DWORD i = 0; i < count; i++)
+        {
+            if (pDebug[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW || pDebug[i].AddressOfRawData == 0 ||
+                pDebug[i].SizeOfData < sizeof(CvInfoPdb70))
+            {
+                continue;
+            }
+            const CvInfoPdb70* pCvInfo = (const CvInfoPdb70*)(pBase + pDebug[i].AddressOfRawData);
+            if (pCvInfo->signature == 0x53445352)   // 'RSDS'
+            {
+                pInfo->pdbGuid = pCvInfo->guid;
+                pInfo->pdbAge = pCvInfo->age;
+                // The linker records the full path of the PDB, the file name is enough to find it
+                const char* pszPdb = pCvInfo->pdbFileName;
+                DWORD cchPdb = pDebug[i].SizeOfData - offsetof(CvInfoPdb70, pdbFileName);
+                DWORD start = 0;
+                DWORD len = 0;
+                while (len < cchPdb && pszPdb[len] != '\0')
+                {
+                    if (pszPdb[len] == '\\' || pszPdb[len] == '/')
+                    {
+                        start = len + 1;
+                    }
+                    len++;
+                }
+                if (len - start < MODULE_NAME_LEN)
+                {
+                    memcpy(pInfo->pdbName, pszPdb + start, len - start);
+                    pInfo->pdbName[len - start] = '\0';
+                }
+                return;
+            }
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+    }
+}
+
+void FormatBuildId(const GUID& pdbGuid, DWORD pdbAge, char* pszBuffer, size_t cbBuffer)
+{
+    const GUID& g = pdbGuid;
+    _snprintf_s(pszBuffer, cbBuffer, _TRUNCATE, "%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
+        g.Data1, g.Data2, g.Data3, g.Data4[0], g.Data4[1], g.Data4[2], g.Data4[3], g.Data4[4],
+        g.Data4[5], g.Data4[6], g.Data4[7], pdbAge);
+}
+
+// Fill a module entry from its load address, size and full path
+static void MakeModuleInfo(const BYTE* pBase, DWORD size, const char* pszPath, ModuleInfo* pInfo)
+{
+    memset(pInfo, 0, sizeof(*pInfo));
+    pInfo->base = (DWORD64)(ULONG_PTR)pBase;
+    pInfo->end = pInfo->base + size;
+    strncpy_s(pInfo->path, sizeof(pInfo->path), pszPath, _TRUNCATE);
+    const char* pszName = strrchr(pszPath, '\\');
+    strncpy_s(pInfo->name, sizeof(pInfo->name), pszName ? pszName + 1 : pszPath, _TRUNCATE);
+    ReadImageHeaders(pBase, pInfo);
+}
+
+static bool CompareModuleBase(const ModuleInfo& lhs, const ModuleInfo& rhs)
+{
+    return lhs.base < rhs.base;
+}
+
+ModuleMap::ModuleMap()
+    : pCurrent_(NULL), readers_(0), pRetired_(NULL), pCookie_(NULL)
+{
+    InitializeCriticalSection(&writeLock_);
+}
+
+ModuleMap::~ModuleMap()
+{
+    if (pCookie_ != NULL)
+    {
+        LdrUnregisterDllNotification_t pfnUnregister = (LdrUnregisterDllNotification_t)GetProcAddress(
+            GetModuleHandleA("ntdll.dll"), "LdrUnregisterDllNotification");
+        if (pfnUnregister != NULL)
+        {
+            pfnUnregister(pCookie_);
+        }
+    }
+    Publish(NULL);
+    DeleteCriticalSection(&writeLock_);
+}
+
+void ModuleMap::Init()
+{
+    if (pCurrent_ != NULL)
+    {
+        return;
+    }
+    if (pCookie_ == NULL)
+    {
+        // Register first, so no module loaded while the list is taken is missed
+        LdrRegisterDllNotification_t pfnRegister = (LdrRegisterDllNotification_t)GetProcAddress(
+            GetModuleHandleA("ntdll.dll"), "LdrRegisterDllNotification");
+        if (pfnRegister == NULL || pfnRegister(0, OnDllNotification, this, &pCookie_) != 0)
+        {
+            pCookie_ = NULL;
+            LogLastError();
+        }
+    }
+
+    // The toolhelp snapshot takes the loader lock, it must not be taken under `writeLock_`
+    // which the notifications acquire with the loader lock held
+    std::vector<ModuleInfo> modules;
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+    {
+        LogLastError();
+        return;
+    }
+    MODULEENTRY32 me = {};
+    me.dwSize = sizeof(me);
+    for (BOOL bOk = Module32First(hSnapshot, &me); bOk; bOk = Module32Next(hSnapshot, &me))
+    {
+        ModuleInfo info;
+        MakeModuleInfo(me.modBaseAddr, me.modBaseSize, me.szExePath, &info);
+        modules.push_back(info);
+    }
+    CloseHandle(hSnapshot);
+    std::sort(modules.begin(), modules.end(), CompareModuleBase);
+
+    EnterCriticalSection(&writeLock_);
+    if (!modules.empty())
+    {
+        AddModules(&modules[0], (DWORD)modules.size());
+    }
+    LeaveCriticalSection(&writeLock_);
+}
+
+VOID CALLBACK ModuleMap::OnDllNotification(ULONG reason, const void* pData, PVOID pContext)
+{
+    // Called with the loader lock held, nothing here loads a library
+    ModuleMap* pThis = (ModuleMap*)pContext;
+    const LdrDllNotificationData* pDll = (const LdrDllNotificationData*)pData;
+    EnterCriticalSection(&pThis->writeLock_);
+    if (reason == LDR_DLL_NOTIFICATION_REASON_LOADED)
+    {
+        char szPath[MAX_PATH] = {};
+        WideCharToMultiByte(CP_ACP, 0, pDll->FullDllName->Buffer, pDll->FullDllName->Length / sizeof(WCHAR),
+            szPath, MAX_PATH - 1, NULL, NULL);
+        ModuleInfo info;
+        MakeModuleInfo((const BYTE*)pDll->DllBase, pDll->SizeOfImage, szPath, &info);
+        pThis->AddModules(&info, 1);
+    }
+    else if (reason == LDR_DLL_NOTIFICATION_REASON_UNLOADED)
+    {
+        pThis->RemoveModule((DWORD64)(ULONG_PTR)pDll->DllBase);
+    }
+    LeaveCriticalSection(&pThis->writeLock_);
+}
+
+ModuleMap::Snapshot* ModuleMap::AllocSnapshot(DWORD count)
+{
+    SIZE_T cbSize = sizeof(Snapshot) + (count > 0 ? count - 1 : 0) * sizeof(ModuleInfo);
+    Snapshot* pSnapshot = (Snapshot*)HeapAlloc(GetProcessHeap(), 0, cbSize);
+    if (pSnapshot != NULL)
+    {
+        pSnapshot->pNextRetired = NULL;
+        pSnapshot->count = count;
+    }
+    return pSnapshot;
+}
+
+// Merge modules sorted by base address into the map, replacing those loaded at the same base
+void ModuleMap::AddModules(const ModuleInfo* pInfos, DWORD count)
+{
+    const Snapshot* pOld = pCurrent_;
+    const DWORD oldCount = pOld ? pOld->count : 0;
+    Snapshot* pNew = AllocSnapshot(oldCount + count);
+    if (pNew == NULL)
+    {
+        return;
+    }
+    DWORD i = 0;
+    DWORD j = 0;
+    DWORD n = 0;
+    while (i < oldCount || j < count)
+    {
+        if (j == count || (i < oldCount && pOld->modules[i].base < pInfos[j].base))
+        {
+            pNew->modules[n++] = pOld->modules[i++];
+            continue;
+        }
+        if (i < oldCount && pOld->modules[i].base == pInfos[j].base)
+        {
+            i++;
+        }
+        pNew->modules[n++] = pInfos[j++];
+    }
+    pNew->count = n;
+    Publish(pNew);
+}
+
+void ModuleMap::RemoveModule(DWORD64 base)
+{
+    const Snapshot* pOld = pCurrent_;
+    if (pOld == NULL)
+    {
+        return;
+    }
+    Snapshot* pNew = AllocSnapshot(pOld->count);
+    if (pNew == NULL)
+    {
+        return;
+    }
+    DWORD count = 0;
+    for (DWORD i = 0; i < pOld->count; i++)
+    {
+        if (pOld->modules[i].base != base)
+        {
+            pNew->modules[count++] = pOld->modules[i];
+        }
+    }
+    pNew->count = count;
+    Publish(pNew);
+}
+
+// Swap in the new snapshot, then free the replaced ones if no reader can still see them
+void ModuleMap::Publish(Snapshot* pSnapshot)
+{
+    if (pSnapshot != NULL)
+    {
+        pSnapshot->generation = pCurrent_ ? pCurrent_->generation + 1 : 1;
+    }
+    Snapshot* pOld = (Snapshot*)InterlockedExchangePointer((PVOID volatile*)&pCurrent_, pSnapshot);
+    if (pOld != NULL)
+    {
+        pOld->pNextRetired = pRetired_;
+        pRetired_ = pOld;
+    }
+    // A reader which starts after the exchange only sees the new snapshot
+    if (InterlockedCompareExchange(&readers_, 0, 0) == 0)
+    {
+        while (pRetired_ != NULL)
+        {
+            Snapshot* pNext = pRetired_->pNextRetired;
+            HeapFree(GetProcessHeap(), 0, pRetired_);
+            pRetired_ = pNext;
+        }
+    }
+}
+
+const ModuleMap::Snapshot* ModuleMap::BeginRead() const
+{
+    InterlockedIncrement(&readers_);
+    return pCurrent_;
+}
+
+void ModuleMap::EndRead() const
+{
+    InterlockedDecrement(&readers_);
+}
+
+const ModuleInfo* ModuleMap::Search(const Snapshot* pSnapshot, DWORD64 address)
+{
+    if (pSnapshot == NULL)
+    {
+        return NULL;
+    }
+    // Last module starting at or below `address`
+    DWORD low = 0;
+    DWORD high = pSnapshot->count;
+    while (low < high)
+    {
+        DWORD mid = (low + high) / 2;
+        if (pSnapshot->modules[mid].base <= address)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    if (low == 0 || address >= pSnapshot->modules[low - 1].end)
+    {
+        return NULL;
+    }
+    return &pSnapshot->modules[low - 1];
+}
+
+bool ModuleMap::FindModule(DWORD64 address, ModuleInfo* pInfo) const
+{
+    assert(pInfo);
+    const ModuleInfo* pModule = Search(BeginRead(), address);
+    if (pModule != NULL)
+    {
+        *pInfo = *pModule;
+    }
+    EndRead();
+    return pModule != NULL;
+}
+
+DWORD64 ModuleMap::GetModuleBase(DWORD64 address) const
+{
+    const ModuleInfo* pModule = Search(BeginRead(), address);
+    DWORD64 base = pModule ? pModule->base : 0;
+    EndRead();
+    return base;
+}
+
+DWORD ModuleMap::EnumModules(void (*pfn)(const ModuleInfo& info, void* pContext), void* pContext) const
+{
+    assert(pfn);
+    const Snapshot* pSnapshot = BeginRead();
+    DWORD count = pSnapshot ? pSnapshot->count : 0;
+    for (DWORD i = 0; i < count; i++)
+    {
+        pfn(pSnapshot->modules[i], pContext);
+    }
+    EndRead();
+    return count;
+}
+
+DWORD ModuleMap::GetGeneration() const
+{
+    const Snapshot* pSnapshot = BeginRead();
+    DWORD generation = pSnapshot ? pSnapshot->generation : 0;
+    EndRead();
+    return generation;
+}
+
+ModuleMap& GetModuleMap()
+{
+    static ModuleMap map;
+    return map;
+}
@@ -0,0 +1,90 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+
+enum
+{
+    MODULE_NAME_LEN = 64,
+    MODULE_BUILD_ID_LEN = 48,       // 32 hex digits of the PDB GUID, up to 8 of its age
+};
+
+struct ModuleInfo
+{
+    DWORD64     base;
+    DWORD64     end;                // one past the last byte of the image
+    LONG64      loadBias;           // base minus the preferred base in the PE header
+    DWORD       timeDateStamp;      // PE header
+    GUID        pdbGuid;            // CodeView record, all zero if the module has none
+    DWORD       pdbAge;
+    char        pdbName[MODULE_NAME_LEN];   // file name of the PDB, without its build path
+    char        name[MODULE_NAME_LEN];
+    char        path[MAX_PATH];
+};
+
+// Read the PE header fields and the PDB signature of a mapped image
+void ReadImageHeaders(const BYTE* pBase, ModuleInfo* pInfo);
+
+// Build id of a PDB, its GUID and age in hex as in the symbol server paths
+void FormatBuildId(const GUID& pdbGuid, DWORD pdbAge, char* pszBuffer, size_t cbBuffer);
+
+// Loaded modules of the process, sorted by base address.
+// Built once at install time and kept current by the loader notifications of ntdll. Every
+// change publishes a new immutable snapshot with a pointer swap, so the unwinder, the
+// profilers and the crash handler look addresses up with a binary search and no lock.
+// A replaced snapshot is freed by a later change, once no reader is left in it.
+class ModuleMap
+{
+public:
+    ModuleMap();
+    ~ModuleMap();
+
+    // Take the list of loaded modules and register for the loader notifications, once
+    void Init();
+
+    // Module containing `address`, false if there is none
+    bool FindModule(DWORD64 address, ModuleInfo* pInfo) const;
+
+    // Base address of the module containing `address`, 0 if there is none
+    DWORD64 GetModuleBase(DWORD64 address) const;
+
+    // Call `pfn` for each module in address order, returns the number of modules
+    DWORD EnumModules(void (*pfn)(const ModuleInfo& info, void* pContext), void* pContext) const;
+
+    // Incremented by every load and unload
+    DWORD GetGeneration() const;
+
+private:
+    ModuleMap(const ModuleMap&);
+    ModuleMap& operator = (const ModuleMap&);
+
+    struct Snapshot
+    {
+        Snapshot*   pNextRetired;
+        DWORD       generation;
+        DWORD       count;
+        ModuleInfo  modules[1];
+    };
+
+    static Snapshot* AllocSnapshot(DWORD count);
+    static const ModuleInfo* Search(const Snapshot* pSnapshot, DWORD64 address);
+    static VOID CALLBACK OnDllNotification(ULONG reason, const void* pData, PVOID pContext);
+
+    const Snapshot* BeginRead() const;
+    void EndRead() const;
+
+    void AddModules(const ModuleInfo* pInfos, DWORD count);
+    void RemoveModule(DWORD64 base);
+    void Publish(Snapshot* pSnapshot);
+
+    Snapshot* volatile      pCurrent_;
+    mutable volatile LONG   readers_;
+    Snapshot*               pRetired_;      // replaced, freed when no reader is left
+    CRITICAL_SECTION        writeLock_;     // writers only
+    PVOID                   pCookie_;       // loader notification registration
+};
+
+ModuleMap& GetModuleMap();
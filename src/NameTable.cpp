@@ -0,0 +1,115 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "NameTable.h"
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+
+enum
+{
+    NAME_TABLE_BLOCK_SIZE = 64 * 1024,
+    NAME_TABLE_MIN_SLOTS = 1024,
+};
+
+// FNV-1a
+static DWORD HashName(const char* psz, size_t len)
+{
+    DWORD hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (BYTE)psz[i]) * 16777619u;
+    }
+    return hash;
+}
+
+NameTable::NameTable()
+    : pCurr_(NULL), cbLeft_(0), count_(0)
+{
+    Slot empty = {};
+    slots_.resize(NAME_TABLE_MIN_SLOTS, empty);
+}
+
+NameTable::~NameTable()
+{
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+        free(blocks_[i]);
+    }
+}
+
+const char* NameTable::Intern(const char* psz, size_t len)
+{
+    assert(psz);
+    const DWORD hash = HashName(psz, len);
+    const size_t mask = slots_.size() - 1;
+    size_t index = hash & mask;
+    for (; slots_[index].psz != NULL; index = (index + 1) & mask)
+    {
+        const Slot& slot = slots_[index];
+        if (slot.hash == hash && slot.length == len && memcmp(slot.psz, psz, len) == 0)
+        {
+            return slot.psz;
+        }
+    }
+
+    char* pCopy = Allocate(len + 1);
+    memcpy(pCopy, psz, len);
+    pCopy[len] = '\0';
+    Slot& slot = slots_[index];
+    slot.hash = hash;
+    slot.length = (DWORD)len;
+    slot.psz = pCopy;
+
+    // Keep the load factor under 1/2
+    if (++count_ * 2 > slots_.size())
+    {
+        Rehash(slots_.size() * 2);
+    }
+    return pCopy;
+}
+
+char* NameTable::Allocate(size_t size)
+{
+    if (size > cbLeft_)
+    {
+        // A string larger than a block gets a block of its own
+        size_t cbBlock = (size > NAME_TABLE_BLOCK_SIZE) ? size : NAME_TABLE_BLOCK_SIZE;
+        char* pBlock = (char*)malloc(cbBlock);
+        if (pBlock == NULL)
+        {
+            throw std::bad_alloc();
+        }
+        blocks_.push_back(pBlock);
+        pCurr_ = pBlock;
+        cbLeft_ = cbBlock;
+    }
+    char* p = pCurr_;
+    pCurr_ += size;
+    cbLeft_ -= size;
+    return p;
+}
+
+void NameTable::Rehash(size_t capacity)
+{
+    std::vector<Slot> old;
+    old.swap(slots_);
+    Slot empty = {};
+    slots_.resize(capacity, empty);
+    const size_t mask = capacity - 1;
+    for (size_t i = 0; i < old.size(); i++)
+    {
+        if (old[i].psz == NULL)
+        {
+            continue;
+        }
+        size_t index = old[i].hash & mask;
+        while (slots_[index].psz != NULL)
+        {
+            index = (index + 1) & mask;
+        }
+        slots_[index] = old[i];
+    }
+}
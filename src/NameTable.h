@@ -0,0 +1,44 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+// Interned strings. Each distinct string is copied once into an arena of large blocks and
+// every lookup of it returns the same pointer, valid until the table is destroyed.
+// Not thread safe.
+class NameTable
+{
+public:
+    NameTable();
+    ~NameTable();
+
+    const char* Intern(const char* psz, size_t len);
+    const char* Intern(const std::string& str) { return Intern(str.c_str(), str.size()); }
+
+    size_t GetCount() const { return count_; }
+
+private:
+    NameTable(const NameTable&);
+    NameTable& operator = (const NameTable&);
+
+    struct Slot
+    {
+        DWORD       hash;
+        DWORD       length;
+        const char* psz;            // NULL if the slot is empty
+    };
+
+    char* Allocate(size_t size);
+    void Rehash(size_t capacity);
+
+    std::vector<Slot>   slots_;     // open addressing, the capacity is a power of 2
+    std::vector<char*>  blocks_;
+    char*               pCurr_;     // free space of the last block
+    size_t              cbLeft_;
+    size_t              count_;
+};
@@ -0,0 +1,233 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Profiler.h"
+#include <Tlhelp32.h>
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+
+Profiler::Profiler()
+    : hThread_(NULL), dwThreadId_(0), hStopEvent_(NULL), dwInterval_(0), hz_(0),
+      table_(NULL), copyBuffer_(NULL)
+{
+}
+
+Profiler::~Profiler()
+{
+    Stop();
+    delete table_;
+    if (copyBuffer_ != NULL)
+    {
+        VirtualFree(copyBuffer_, 0, MEM_RELEASE);
+    }
+}
+
+int Profiler::Start(unsigned int hz)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (hThread_ != NULL || hz == 0 || hz > 1000)
+    {
+        return 1;
+    }
+    if (table_ == NULL)
+    {
+        table_ = new StackTable(PROFILER_MAX_STACKS);
+    }
+    if (copyBuffer_ == NULL)
+    {
+        copyBuffer_ = (BYTE*)VirtualAlloc(NULL, PROFILER_STACK_COPY_SIZE + PROFILER_STACK_COPY_SLACK,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (copyBuffer_ == NULL)
+        {
+            LogLastError();
+            return 1;
+        }
+    }
+    hz_ = hz;
+    // The effective rate is bounded by the system timer resolution
+    dwInterval_ = 1000 / hz;
+    hStopEvent_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hStopEvent_ == NULL)
+    {
+        LogLastError();
+        return 1;
+    }
+    hThread_ = CreateThread(NULL, 0, &Profiler::ThreadProc, this, 0, &dwThreadId_);
+    if (hThread_ == NULL)
+    {
+        LogLastError();
+        CloseHandle(hStopEvent_);
+        hStopEvent_ = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int Profiler::Stop()
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (hThread_ == NULL)
+    {
+        return 1;
+    }
+    SetEvent(hStopEvent_);
+    WaitForSingleObject(hThread_, INFINITE);
+    CloseHandle(hThread_);
+    CloseHandle(hStopEvent_);
+    hThread_ = NULL;
+    hStopEvent_ = NULL;
+    dwThreadId_ = 0;
+    return 0;
+}
+
+int Profiler::Dump(const char* pszFileName)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (table_ == NULL || pszFileName == NULL)
+    {
+        return 1;
+    }
+    FILE* fp = fopen(pszFileName, "w");
+    if (fp == NULL)
+    {
+        return 1;
+    }
+    fprintf(fp, "# calmdump profile %u Hz, %I64d stacks dropped\n", hz_, table_->GetDropped());
+    WriteModuleHeader(fp);
+    table_->WriteFolded(fp, false);
+    fclose(fp);
+    return 0;
+}
+
+DWORD WINAPI Profiler::ThreadProc(LPVOID lpParameter)
+{
+    Profiler* self = (Profiler*)lpParameter;
+    DWORD dwLastRefresh = GetTickCount() - PROFILER_THREAD_REFRESH_INTERVAL;
+    while (WaitForSingleObject(self->hStopEvent_, self->dwInterval_) == WAIT_TIMEOUT)
+    {
+        DWORD dwNow = GetTickCount();
+        if (dwNow - dwLastRefresh >= PROFILER_THREAD_REFRESH_INTERVAL)
+        {
+            self->RefreshThreads();
+            dwLastRefresh = dwNow;
+        }
+        self->SampleThreads();
+    }
+    self->CloseThreads();
+    return 0;
+}
+
+void Profiler::RefreshThreads()
+{
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        threads_[i].bAlive = false;
+    }
+
+    const DWORD dwProcessId = GetCurrentProcessId();
+    THREADENTRY32 te = {};
+    te.dwSize = sizeof(te);
+    for (BOOL bOk = Thread32First(hSnapshot, &te); bOk; bOk = Thread32Next(hSnapshot, &te))
+    {
+        if (te.th32OwnerProcessID != dwProcessId || te.th32ThreadID == dwThreadId_)
+        {
+            continue;
+        }
+        bool bKnown = false;
+        for (size_t i = 0; i < threads_.size(); i++)
+        {
+            // Thread ids are recycled, make sure the handle is still of a running thread
+            if (threads_[i].dwThreadId == te.th32ThreadID &&
+                WaitForSingleObject(threads_[i].hThread, 0) == WAIT_TIMEOUT)
+            {
+                threads_[i].bAlive = true;
+                bKnown = true;
+                break;
+            }
+        }
+        if (bKnown)
+        {
+            continue;
+        }
+        HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION,
+            FALSE, te.th32ThreadID);
+        if (hThread == NULL)
+        {
+            continue;
+        }
+        SampledThread thread = {};
+        thread.dwThreadId = te.th32ThreadID;
+        thread.hThread = hThread;
+        thread.bAlive = true;
+        if (!GetThreadStackBounds(hThread, &thread.bounds))
+        {
+            CloseHandle(hThread);
+            continue;
+        }
+        QueryThreadCycleTime(hThread, &thread.cycles);
+        threads_.push_back(thread);
+    }
+    CloseHandle(hSnapshot);
+
+    for (size_t i = 0; i < threads_.size(); )
+    {
+        if (!threads_[i].bAlive)
+        {
+            CloseHandle(threads_[i].hThread);
+            threads_[i] = threads_.back();
+            threads_.pop_back();
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void Profiler::SampleThreads()
+{
+    DWORD64 frames[MAX_STACK_FRAMES];
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        SampledThread& thread = threads_[i];
+
+        // Like a CPU time timer: threads which did not run since the last tick cost nothing
+        ULONG64 cycles = 0;
+        if (!QueryThreadCycleTime(thread.hThread, &cycles) || cycles == thread.cycles)
+        {
+            continue;
+        }
+        LONG64 elapsed = (LONG64)(cycles - thread.cycles);
+        thread.cycles = cycles;
+
+        USHORT depth = SampleThreadStack(thread.hThread, thread.bounds, copyBuffer_,
+            PROFILER_STACK_COPY_SIZE, frames, MAX_STACK_FRAMES);
+        if (depth > 0)
+        {
+            table_->Add(frames, depth, elapsed);
+        }
+    }
+}
+
+void Profiler::CloseThreads()
+{
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        CloseHandle(threads_[i].hThread);
+    }
+    threads_.clear();
+}
+
+Profiler& GetProfiler()
+{
+    static Profiler instance;
+    return instance;
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <atlsync.h>
+#include <vector>
+#include "StackTable.h"
+
+enum
+{
+    // Max number of distinct stacks kept by the sampling profiler
+    PROFILER_MAX_STACKS = 8 * 1024,
+
+    // Max bytes of a thread stack copied for one sample
+    PROFILER_STACK_COPY_SIZE = 512 * 1024,
+
+    // Readable slack after the copied stack, unwind data may peek past the outermost frame
+    PROFILER_STACK_COPY_SLACK = 64 * 1024,
+
+    // How often the list of sampled threads is refreshed (milliseconds)
+    PROFILER_THREAD_REFRESH_INTERVAL = 1000,
+};
+
+// In-process sampling profiler.
+// A background thread wakes up `hz` times per second, and for every thread which consumed
+// CPU cycles since the previous tick, captures its call stack with the fast unwinder into
+// a lock-free stack table. Stacks are written as raw `module+0xoffset` frames, symbolization
+// is done offline by SymbolizeFoldedFile().
+class Profiler
+{
+public:
+    Profiler();
+    ~Profiler();
+
+    int Start(unsigned int hz);
+    int Stop();
+
+    // Write collected samples in folded-stack format
+    int Dump(const char* pszFileName);
+
+private:
+    struct SampledThread
+    {
+        DWORD               dwThreadId;
+        HANDLE              hThread;
+        ThreadStackBounds   bounds;
+        ULONG64             cycles;     // cycle time at previous tick
+        bool                bAlive;
+    };
+
+    static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+
+    void RefreshThreads();
+    void SampleThreads();
+    void CloseThreads();
+
+    // Guards Start()/Stop()/Dump()
+    ATL::CCriticalSection       critsec_;
+
+    HANDLE                      hThread_;
+    DWORD                       dwThreadId_;
+    HANDLE                      hStopEvent_;
+    DWORD                       dwInterval_;
+    unsigned int                hz_;
+    StackTable*                 table_;
+    BYTE*                       copyBuffer_;
+    std::vector<SampledThread>  threads_;   // only touched by the sampler thread
+};
+
+// Sampling profiler of current process
+Profiler& GetProfiler();
+
@@ -5,26 +5,42 @@
 #include "Report.h"
 #include "Dbghlp.h"
 #include "cvconst.h"
+#include "LockProfiler.h"
+#include "HeapProfiler.h"
+#include "TypeLayout.h"
+#include "VariableFormatter.h"
+#include "SafeRead.h"
+#include "ModuleMap.h"
+#include <Psapi.h>
 #include <time.h>
 #include <string>
 #include <list>
 
+#pragma comment(lib, "psapi.lib")
 #pragma warning(disable: 4996)
 
 // Print system information
 static void PrintSystemInfo();
 
+// Print the most contended lock call sites, if the lock profiler was started
+static void PrintLockContention();
+
+// Print the call sites holding most of the sampled heap, if the heap profiler was started
+static void PrintHeapProfile();
+
 // Callback pro to numerate symbols
 static BOOL CALLBACK EnumSymbolsProcCallback(PSYMBOL_INFO pSymInfo, ULONG SymSize, PVOID data);
 
-static bool FormatSymbolValue(PSYMBOL_INFO pSym, STACKFRAME* sf, char* pszBuffer, unsigned cbBuffer);
-
-static char* FormatOutputValue(char* pszCurrBuffer, BasicType basicType, DWORD64 length, PVOID pAddress);
+// A frame returned by StackWalk() and the registers it was unwound to
+struct FrameState
+{
+    const STACKFRAME*   pFrame;
+    const CONTEXT*      pContext;
+    bool                bTopFrame;      // the registers are those of the fault
+};
 
-static BasicType GetBasicType(DWORD typeIndex, DWORD64 modBase);
+static bool FormatSymbolValue(PSYMBOL_INFO pSym, const FrameState& frame, char* pszBuffer, unsigned cbBuffer);
 
-static char* DumpTypeIndex(char* pszCurrBuffer, DWORD64 modBase, DWORD dwTypeIndex,
-    unsigned nestingLevel, DWORD_PTR offset, bool & bHandled, char* Name);
 
 
 // Add log text to file
@@ -35,10 +51,21 @@ static void AddToReport(const char* fmt, ...)
     va_start(ap, fmt);
     StringAppendV(&text, fmt, ap);
     va_end(ap);
-    WriteTextToFile(GetAppName(), text);
+    char szAppName[MAX_PATH];
+    GetAppName(szAppName, MAX_PATH);
+    WriteTextToFile(szAppName, text);
 }
 
 
+// Local time of a report heading, without the line feed ctime() appends
+static std::string GetReportTime()
+{
+    char szTime[64];
+    time_t now = time(NULL);
+    strftime(szTime, sizeof(szTime), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    return szTime;
+}
+
 // Given an exception code, returns a pointer to a static string with a 
 // description of the exception                                         
 std::string GetExceptionString(DWORD dwCode)
@@ -81,6 +108,36 @@ std::string GetExceptionString(DWORD dwCode)
     return std::string(szBuffer);
 }
 
+// Print the functions inlined at a frame address, innermost first, each with the line
+// it had reached. Returns the number of inline frames.
+static DWORD DumpInlineFrames(DWORD dwLevel, DWORD64 dwAddress, PSYMBOL_INFO pSymbol)
+{
+    const HANDLE hProcess = ::GetCurrentProcess();
+    DWORD inlineContext = 0;
+    DWORD inlineCount = QueryInlineFrames(hProcess, dwAddress, &inlineContext);
+    for (DWORD i = 0; i < inlineCount; i++, inlineContext++)
+    {
+        DWORD64 symDisplacement = 0;
+        if (!GetDbghelpDll().SymFromInlineContext(hProcess, dwAddress, inlineContext, &symDisplacement, pSymbol))
+        {
+            continue;
+        }
+        IMAGEHLP_LINE64 line = {sizeof(IMAGEHLP_LINE64)};
+        DWORD dwLineDisplacement = 0;
+        if (GetDbghelpDll().SymGetLineFromInlineContext &&
+            GetDbghelpDll().SymGetLineFromInlineContext(hProcess, dwAddress, inlineContext, 0,
+                                                        &dwLineDisplacement, &line))
+        {
+            AddToReport(("%02d. (inline) %s()  %s [%u]\r\n"), dwLevel, pSymbol->Name, line.FileName, line.LineNumber);
+        }
+        else
+        {
+            AddToReport(("%02d. (inline) %s()\r\n"), dwLevel, pSymbol->Name);
+        }
+    }
+    return inlineCount;
+}
+
 static void DumpSymbolName(DWORD dwLevel, const STACKFRAME& sf)
 {
     DWORD64 dwAddress = sf.AddrPC.Offset;
@@ -88,6 +145,11 @@ static void DumpSymbolName(DWORD dwLevel, const STACKFRAME& sf)
     PSYMBOL_INFO pSymbol = (PSYMBOL_INFO)symbolBuffer;
     pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
     pSymbol->MaxNameLen = MAX_NAME_LEN;
+
+    // The return address of an outer frame may already belong to the next inlined call
+    const DWORD64 dwCallAddress = (dwLevel > 0) ? dwAddress - 1 : dwAddress;
+    const DWORD inlineCount = DumpInlineFrames(dwLevel, dwCallAddress, pSymbol);
+
     DWORD64 symDisplacement = 0;
     if (!GetDbghelpDll().SymFromAddr(::GetCurrentProcess(), dwAddress,
                                      &symDisplacement, pSymbol))
@@ -96,32 +158,45 @@ static void DumpSymbolName(DWORD dwLevel, const STACKFRAME& sf)
         return ;
     }
 
-    IMAGEHLP_LINE line = {sizeof(IMAGEHLP_LINE)};
+    IMAGEHLP_LINE64 line = {sizeof(IMAGEHLP_LINE64)};
     DWORD dwLineDisplacement = 0;
-    if (!GetDbghelpDll().SymGetLineFromAddr(
-                ::GetCurrentProcess(),
-                dwAddress,
-                &dwLineDisplacement,
-                &line))
+    BOOL bLine = FALSE;
+    if (inlineCount > 0 && GetDbghelpDll().SymGetLineFromInlineContext)
+    {
+        // Inline context 0 is the function itself, at the call site of the outermost inlined call
+        bLine = GetDbghelpDll().SymGetLineFromInlineContext(::GetCurrentProcess(), dwCallAddress, 0, 0,
+                                                            &dwLineDisplacement, &line);
+    }
+    else
+    {
+        IMAGEHLP_LINE addrLine = {sizeof(IMAGEHLP_LINE)};
+        bLine = GetDbghelpDll().SymGetLineFromAddr(::GetCurrentProcess(), dwAddress,
+                                                   &dwLineDisplacement, &addrLine);
+        line.FileName = addrLine.FileName;
+        line.LineNumber = addrLine.LineNumber;
+    }
+    if (!bLine)
     {
         // it is normal that we don't have source info for some symbols,
         // notably all the ones from the system DLLs...
         return;
     }
 
-    AddToReport(("%02d. (0x%08I64x) %s()  %s [%u]\n"), dwLevel, pSymbol->Address,
+    AddToReport(("%02d. (0x%p) %s()  %s [%u]\r\n"), dwLevel, (PVOID)(ULONG_PTR)pSymbol->Address,
                 pSymbol->Name, line.FileName, line.LineNumber);
 }
 
 
-static void DumpSymbolParam(const STACKFRAME& sf )
+static void DumpSymbolParam(const FrameState& frame)
 {
-    DWORD64 dwSymAddr = sf.AddrPC.Offset;
-    DWORD64 dwAddrFrame = sf.AddrFrame.Offset;
+    const STACKFRAME& sf = *frame.pFrame;
 
     // use SymSetContext to get just the locals/params for this frame
     IMAGEHLP_STACK_FRAME imagehlpStackFrame = {};
-    imagehlpStackFrame.InstructionOffset = dwSymAddr;
+    imagehlpStackFrame.InstructionOffset = sf.AddrPC.Offset;
+    imagehlpStackFrame.ReturnOffset = sf.AddrReturn.Offset;
+    imagehlpStackFrame.FrameOffset = sf.AddrFrame.Offset;
+    imagehlpStackFrame.StackOffset = sf.AddrStack.Offset;
     if (!GetDbghelpDll().SymSetContext(::GetCurrentProcess(), &imagehlpStackFrame, 0))
     {
         // for symbols from kernel DLL we might not have access to their
@@ -134,12 +209,24 @@ static void DumpSymbolParam(const STACKFRAME& sf )
                 NULL,                   // DLL base: use current context
                 NULL,                   // no mask, get all symbols
                 EnumSymbolsProcCallback,
-                (PVOID)&sf))    // data parameter for this callback
+                (PVOID)&frame)) // data parameter for this callback
     {
         LogLastError();
     }
 }
 
+// Module base lookups of StackWalk() go to the module map, dbghelp is only asked
+// about addresses outside of any loaded module, such as generated code
+static DWORD_PTR WINAPI GetModuleBaseRoutine(HANDLE hProcess, DWORD_PTR address)
+{
+    DWORD64 base = GetModuleMap().GetModuleBase(address);
+    if (base != 0)
+    {
+        return (DWORD_PTR)base;
+    }
+    return GetDbghelpDll().SymGetModuleBase(hProcess, address);
+}
+
 static void WalkStack(const CONTEXT* pContext, size_t skip, size_t maxDepth)
 {
     CONTEXT ctx = *pContext; // will be modified by dbghelp StackWalk()
@@ -179,7 +266,7 @@ static void WalkStack(const CONTEXT* pContext, size_t skip, size_t maxDepth)
                     &ctx,
                     NULL,   // read memory function (default)
                     GetDbghelpDll().SymFunctionTableAccess,
-                    GetDbghelpDll().SymGetModuleBase,
+                    GetModuleBaseRoutine,
                     NULL))    // address translator for 16 bit
         {
             break;
@@ -193,9 +280,11 @@ static void WalkStack(const CONTEXT* pContext, size_t skip, size_t maxDepth)
         // don't show this frame itself in the output
         if (nLevel >= skip)
         {
+            // StackWalk() leaves `ctx` at the registers of the frame it returned
+            FrameState frame = { &sf, &ctx, nLevel == 0 };
             DumpSymbolName((DWORD)(nLevel - skip), sf);
-            DumpSymbolParam(sf);
-            AddToReport(("\n"));
+            DumpSymbolParam(frame);
+            AddToReport(("\r\n"));
         }
     }
 }
@@ -203,28 +292,43 @@ static void WalkStack(const CONTEXT* pContext, size_t skip, size_t maxDepth)
 static void PrintExceptInfo(EXCEPTION_POINTERS* ep)
 {
     AddToReport(("\r\n*** Exception ***\r\n"));
-    MEMORY_BASIC_INFORMATION mbi;
-    char szModule[MAX_PATH];
     DWORD dwExceptCode = ep->ExceptionRecord->ExceptionCode;
     PVOID ExceptionAddress = ep->ExceptionRecord->ExceptionAddress;
-    if (VirtualQuery(ExceptionAddress, &mbi, sizeof(mbi)))
+    ModuleInfo module;
+    if (GetModuleMap().FindModule((DWORD64)(ULONG_PTR)ExceptionAddress, &module))
     {
-        PVOID hMod = (PVOID)mbi.AllocationBase;
-        if (GetModuleFileName((HMODULE)hMod, szModule, MAX_PATH))
-        {
-            AddToReport(("Module: %s\r\n"), szModule);
-        }
+        AddToReport(("Module: %s\r\n"), module.path);
     }
 
-    AddToReport(("Fault address: 0x%08x, Thread ID: %d\r\n"), ExceptionAddress, GetCurrentThreadId());
+    AddToReport(("Fault address: 0x%p, Thread ID: %u\r\n"), ExceptionAddress, GetCurrentThreadId());
     if (dwExceptCode == EXCEPTION_ACCESS_VIOLATION)
     {
         ULONG_PTR* exceptinfo = ep->ExceptionRecord->ExceptionInformation;
-        const char* szOperation = (exceptinfo[0] ? ("write") : ("read"));
-        AddToReport(("Failed to %d address 0x%08x\r\n"), szOperation, exceptinfo[1]);
+        const char* szOperation = (exceptinfo[0] == 8) ? ("execute") : (exceptinfo[0] ? ("write") : ("read"));
+        AddToReport(("Failed to %s address 0x%p\r\n"), szOperation, (PVOID)exceptinfo[1]);
     }
     std::string code = GetExceptionString(dwExceptCode);
-    AddToReport(("Exception code: 0x%08x %s\r\n\r\n"), dwExceptCode, code.c_str());
+    AddToReport(("Exception code: 0x%08x %s\r\n"), dwExceptCode, code.c_str());
+
+    // SIMD registers are in the crash record
+    const CONTEXT* pContext = ep->ContextRecord;
+#if defined(_M_AMD64)
+    AddToReport(("RAX=%016I64X RBX=%016I64X RCX=%016I64X RDX=%016I64X\r\n"),
+        pContext->Rax, pContext->Rbx, pContext->Rcx, pContext->Rdx);
+    AddToReport(("RSI=%016I64X RDI=%016I64X RBP=%016I64X RSP=%016I64X\r\n"),
+        pContext->Rsi, pContext->Rdi, pContext->Rbp, pContext->Rsp);
+    AddToReport(("R8 =%016I64X R9 =%016I64X R10=%016I64X R11=%016I64X\r\n"),
+        pContext->R8, pContext->R9, pContext->R10, pContext->R11);
+    AddToReport(("R12=%016I64X R13=%016I64X R14=%016I64X R15=%016I64X\r\n"),
+        pContext->R12, pContext->R13, pContext->R14, pContext->R15);
+    AddToReport(("RIP=%016I64X EFLAGS=%08X MXCSR=%08X\r\n\r\n"),
+        pContext->Rip, pContext->EFlags, pContext->MxCsr);
+#elif defined(_M_IX86)
+    AddToReport(("EAX=%08X EBX=%08X ECX=%08X EDX=%08X ESI=%08X EDI=%08X\r\n"),
+        pContext->Eax, pContext->Ebx, pContext->Ecx, pContext->Edx, pContext->Esi, pContext->Edi);
+    AddToReport(("EBP=%08X ESP=%08X EIP=%08X EFLAGS=%08X\r\n\r\n"),
+        pContext->Ebp, pContext->Esp, pContext->Eip, pContext->EFlags);
+#endif
 }
 
 // Create stack frame log of this exception
@@ -232,8 +336,7 @@ void CreateReport(EXCEPTION_POINTERS* ep)
 {
     assert(ep);
 
-    time_t now = time(NULL);
-    AddToReport(("\nException report created at %s"), ctime(&now));
+    AddToReport(("\r\nException report created at %s\r\n"), GetReportTime().c_str());
 
     PrintExceptInfo(ep);    
 
@@ -252,21 +355,75 @@ void CreateReport(EXCEPTION_POINTERS* ep)
     AddToReport(("\r\nCall stack:\r\n---------------------------\r\n"));
     AddToReport(("Level   Address   Function	    SourceFile\r\n"));
 
-    // enumerate stack frames from the given context
+    // enumerate stack frames from the given context, the variables of each frame
+    // are read against one snapshot of the readable memory
+    GetReadableRegions().Capture();
     WalkStack(ep->ContextRecord, 0, MAX_DUMP_DEPTH);
+    GetReadableRegions().Clear();
+
+    PrintLockContention();
+
+    PrintHeapProfile();
 
     PrintSystemInfo();
 
+    // Type indexes are only valid until SymCleanup()
+    GetTypeLayoutCache().Clear();
     if (!GetDbghelpDll().SymCleanup(::GetCurrentProcess()))
     {
         LogLastError();
     }
 }
 
+// Print the heaviest stacks of a profiler table
+static void PrintTopStacks(const StackTable& table, LONG64 divisor, const char* szUnit)
+{
+    const StackEntry* top[REPORT_TOP_STACKS];
+    DWORD count = table.GetTopEntries(top, REPORT_TOP_STACKS);
+    char szFrame[MAX_PATH];
+    for (DWORD i = 0; i < count; i++)
+    {
+        AddToReport("%02u. %I64d %s in %I64d hits\r\n", i, top[i]->weight / divisor, szUnit, top[i]->count);
+        for (USHORT n = 0; n < top[i]->depth; n++)
+        {
+            FormatModuleOffset(szFrame, sizeof(szFrame), top[i]->frames[n]);
+            AddToReport("\t%s\r\n", szFrame);
+        }
+    }
+}
+
+void PrintLockContention()
+{
+    const StackTable* pTable = GetLockProfiler().GetTable();
+    if (pTable == NULL)
+    {
+        return;
+    }
+    AddToReport("\r\n*** Lock contention ***\r\n");
+    PrintTopStacks(*pTable, GetLockProfiler().GetCyclesPerUs(), "us");
+}
+
+void PrintHeapProfile()
+{
+    const StackTable* pTable = GetHeapProfiler().GetTable();
+    if (pTable == NULL)
+    {
+        return;
+    }
+    AddToReport("\r\n*** Heap allocation sites (live bytes) ***\r\n");
+    PrintTopStacks(*pTable, 1, "bytes");
+}
+
+void CreateHeapReport(ULONG64 commitCharge)
+{
+    AddToReport(("\r\nHeap report created at %s\r\n"), GetReportTime().c_str());
+    AddToReport("Commit charge: %s\r\n", FileSizeToStr(commitCharge).c_str());
+    PrintHeapProfile();
+}
 
 BOOL CALLBACK EnumSymbolsProcCallback(PSYMBOL_INFO pSymInfo, ULONG SymSize, PVOID userContext)
 {
-    STACKFRAME* sf = (STACKFRAME*)userContext;
+    const FrameState* pFrame = (const FrameState*)userContext;
 
     // we're only interested in parameters and local variables
     if ( pSymInfo->Flags & SYMF_PARAMETER || pSymInfo->Flags & SYMF_LOCAL)
@@ -274,7 +431,7 @@ BOOL CALLBACK EnumSymbolsProcCallback(PSYMBOL_INFO pSymInfo, ULONG SymSize, PVOI
         char szBuffer[2048];
         __try
         {
-            if (FormatSymbolValue(pSymInfo, sf, szBuffer, _countof(szBuffer)))
+            if (FormatSymbolValue(pSymInfo, *pFrame, szBuffer, _countof(szBuffer)))
             {
                 AddToReport("\t%s\r\n", szBuffer);
             }
@@ -289,229 +446,97 @@ BOOL CALLBACK EnumSymbolsProcCallback(PSYMBOL_INFO pSymInfo, ULONG SymSize, PVOI
 }
 
 
+// Value of a CodeView register in a frame. Volatile registers of the frames below the
+// faulting one were not restored by the unwinder, they are only known in the top frame.
+static bool GetRegisterValue(const FrameState& frame, ULONG reg, DWORD64* pValue)
+{
+    const CONTEXT& ctx = *frame.pContext;
+    bool bVolatile = true;
+    switch (reg)
+    {
+#if defined(_M_AMD64)
+    case CV_AMD64_RAX: *pValue = ctx.Rax; break;
+    case CV_AMD64_RCX: *pValue = ctx.Rcx; break;
+    case CV_AMD64_RDX: *pValue = ctx.Rdx; break;
+    case CV_AMD64_R8:  *pValue = ctx.R8;  break;
+    case CV_AMD64_R9:  *pValue = ctx.R9;  break;
+    case CV_AMD64_R10: *pValue = ctx.R10; break;
+    case CV_AMD64_R11: *pValue = ctx.R11; break;
+    case CV_AMD64_RBX: *pValue = ctx.Rbx; bVolatile = false; break;
+    case CV_AMD64_RSI: *pValue = ctx.Rsi; bVolatile = false; break;
+    case CV_AMD64_RDI: *pValue = ctx.Rdi; bVolatile = false; break;
+    case CV_AMD64_RBP: *pValue = ctx.Rbp; bVolatile = false; break;
+    case CV_AMD64_RSP: *pValue = ctx.Rsp; bVolatile = false; break;
+    case CV_AMD64_R12: *pValue = ctx.R12; bVolatile = false; break;
+    case CV_AMD64_R13: *pValue = ctx.R13; bVolatile = false; break;
+    case CV_AMD64_R14: *pValue = ctx.R14; bVolatile = false; break;
+    case CV_AMD64_R15: *pValue = ctx.R15; bVolatile = false; break;
+#elif defined(_M_IX86)
+    // StackWalk() does not restore registers on x86, only the frame and the stack pointers are right
+    case CV_REG_EAX: *pValue = ctx.Eax; break;
+    case CV_REG_ECX: *pValue = ctx.Ecx; break;
+    case CV_REG_EDX: *pValue = ctx.Edx; break;
+    case CV_REG_EBX: *pValue = ctx.Ebx; break;
+    case CV_REG_ESI: *pValue = ctx.Esi; break;
+    case CV_REG_EDI: *pValue = ctx.Edi; break;
+    case CV_REG_EBP: *pValue = frame.pFrame->AddrFrame.Offset; bVolatile = false; break;
+    case CV_REG_ESP: *pValue = frame.pFrame->AddrStack.Offset; bVolatile = false; break;
+#endif
+    case CV_ALLREG_VFRAME: *pValue = frame.pFrame->AddrFrame.Offset; bVolatile = false; break;
+    default:
+        return false;
+    }
+    return frame.bTopFrame || !bVolatile;
+}
+
 // Given a SYMBOL_INFO representing a particular variable, displays its
 // contents.  If it's a user defined type, display the members and their
 // values.
-bool FormatSymbolValue(PSYMBOL_INFO pSym, STACKFRAME* sf, char* pszBuffer, unsigned cbBuffer)
+bool FormatSymbolValue(PSYMBOL_INFO pSym, const FrameState& frame, char* pszBuffer, unsigned cbBuffer)
 {
-    char* pszCurrBuffer = pszBuffer;
-
-    // Indicate if the variable is a local or parameter
-    if (pSym->Flags & IMAGEHLP_SYMBOL_INFO_PARAMETER)
-        pszCurrBuffer += sprintf(pszCurrBuffer, "Parameter ");
-    else if (pSym->Flags & IMAGEHLP_SYMBOL_INFO_LOCAL)
-        pszCurrBuffer += sprintf(pszCurrBuffer, "Local ");
-
     // If it's a function, don't do anything.
     if (pSym->Tag == 5)                                   // SymTagFunction from CVCONST.H from the DIA SDK
         return false;
 
     DWORD_PTR pVariable = 0;                                // Will point to the variable's data in memory
+    DWORD64 registerValue = 0;
 
     if (pSym->Flags & IMAGEHLP_SYMBOL_INFO_REGRELATIVE)
     {
-        // if ( pSym->Register == 8 )   // EBP is the value 8 (in DBGHELP 5.1)
-        {                                                   //  This may change!!!
-            pVariable = sf->AddrFrame.Offset;
-            pVariable += (DWORD_PTR)pSym->Address;
+        // Offset from a register of this frame, RSP or RBP on x64, EBP or the virtual frame on x86
+        if (!GetRegisterValue(frame, pSym->Register, &registerValue))
+        {
+            return false;
         }
-        // else
-        //  return false;
+        pVariable = (DWORD_PTR)(registerValue + pSym->Address);
     }
     else if (pSym->Flags & IMAGEHLP_SYMBOL_INFO_REGISTER)
     {
-        return false;                                       // Don't try to report register variable
+        // The value is the register itself, formatted from a copy
+        if (pSym->Size > sizeof(registerValue) || !GetRegisterValue(frame, pSym->Register, &registerValue))
+        {
+            return false;
+        }
+        pVariable = (DWORD_PTR)&registerValue;
     }
     else
     {
         pVariable = (DWORD_PTR)pSym->Address;               // It must be a global variable
     }
 
-    // Determine if the variable is a user defined type (UDT).  IF so, bHandled
-    // will return true.
-    bool bHandled;
-    pszCurrBuffer = DumpTypeIndex(pszCurrBuffer, pSym->ModBase, pSym->TypeIndex,
-        0, pVariable, bHandled, pSym->Name);
-
-    if (!bHandled)
-    {
-        // The symbol wasn't a UDT, so do basic, stupid formatting of the
-        // variable.  Based on the size, we're assuming it's a char, WORD, or
-        // DWORD.
-        BasicType basicType = GetBasicType(pSym->TypeIndex, pSym->ModBase);
-        pszCurrBuffer += sprintf(pszCurrBuffer, rgBaseType[basicType]);
-
-        // Emit the variable name
-        pszCurrBuffer += sprintf(pszCurrBuffer, "\'%s\'", pSym->Name);
-
-        pszCurrBuffer = FormatOutputValue(pszCurrBuffer, basicType, pSym->Size,
-            (PVOID)pVariable);
-    }
+    // Indicate if the variable is a local or parameter
+    const char* pszKind = NULL;
+    if (pSym->Flags & IMAGEHLP_SYMBOL_INFO_PARAMETER)
+        pszKind = "Parameter";
+    else if (pSym->Flags & IMAGEHLP_SYMBOL_INFO_LOCAL)
+        pszKind = "Local";
 
+    const VarBudget budget = { VAR_MAX_DEPTH, VAR_MAX_CHILDREN, VAR_MAX_MILLISECONDS };
+    const TypeLayout& layout = GetTypeLayoutCache().GetLayout(pSym->ModBase, pSym->TypeIndex);
+    FormatVariable(pszBuffer, cbBuffer, budget, pszKind, pSym->Name, layout, pSym->Size, pVariable);
     return true;
 }
 
-char* FormatOutputValue(char* pszCurrBuffer, BasicType basicType, DWORD64 length, PVOID pAddress)
-{
-    // Format appropriately (assuming it's a 1, 2, or 4 bytes (!!!)
-    if (length == 1)
-        pszCurrBuffer += sprintf(pszCurrBuffer, " = %X", *(PBYTE)pAddress);
-    else if (length == 2)
-        pszCurrBuffer += sprintf(pszCurrBuffer, " = %X", *(PWORD)pAddress);
-    else if (length == 4)
-    {
-        if (basicType == btFloat)
-        {
-            pszCurrBuffer += sprintf(pszCurrBuffer, " = %f", *(PFLOAT)pAddress);
-        }
-        else if (basicType == btChar)
-        {
-            if (!IsBadStringPtr(*(PSTR*)pAddress, 32))
-            {
-                pszCurrBuffer += sprintf(pszCurrBuffer, " = \"%.31s\"", *(PSTR*)pAddress);
-            }
-            else
-                pszCurrBuffer += sprintf(pszCurrBuffer, " = %X",
-                *(PDWORD)pAddress);
-        }
-        else
-            pszCurrBuffer += sprintf(pszCurrBuffer, " = %X", *(PDWORD)pAddress);
-    }
-    else if (length == 8)
-    {
-        if (basicType == btFloat)
-        {
-            pszCurrBuffer += sprintf(pszCurrBuffer, " = %lf",
-                *(double *)pAddress);
-        }
-        else
-            pszCurrBuffer += sprintf(pszCurrBuffer, " = %I64X",
-            *(DWORD64*)pAddress);
-    }
-
-    return pszCurrBuffer;
-}
-
-
-// If it's a user defined type (UDT), recurse through its members until we're
-// at fundamental types.  When he hit fundamental types, return
-// bHandled = false, so that FormatSymbolValue() will format them.
-char* DumpTypeIndex(char* pszCurrBuffer, DWORD64 modBase, DWORD dwTypeIndex, 
-                    unsigned nestingLevel, DWORD_PTR offset, bool & bHandled, char* Name)
-{
-    bHandled = false;
-
-    // Get the name of the symbol.  This will either be a Type name (if a UDT),
-    // or the structure member name.
-    WCHAR * pwszTypeName;
-    if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, dwTypeIndex, TI_GET_SYMNAME,
-        &pwszTypeName))
-    {
-        pszCurrBuffer += sprintf(pszCurrBuffer, " %ls", pwszTypeName);
-        LocalFree(pwszTypeName);
-    }
-
-    // Determine how many children this type has.
-    DWORD dwChildrenCount = 0;
-    GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, dwTypeIndex, TI_GET_CHILDRENCOUNT,
-        &dwChildrenCount);
-
-    if (!dwChildrenCount)                                 // If no children, we're done
-        return pszCurrBuffer;
-
-    // Prepare to get an array of "TypeIds", representing each of the children.
-    // SymGetTypeInfo(TI_FINDCHILDREN) expects more memory than just a
-    // TI_FINDCHILDREN_PARAMS struct has.  Use derivation to accomplish this.
-    struct FINDCHILDREN : TI_FINDCHILDREN_PARAMS
-    {
-        ULONG   MoreChildIds[1024];
-        FINDCHILDREN(){ Count = sizeof(MoreChildIds) / sizeof(MoreChildIds[0]); }
-    } children;
-
-    children.Count = dwChildrenCount;
-    children.Start = 0;
-
-    // Get the array of TypeIds, one for each child type
-    if (!GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, dwTypeIndex, TI_FINDCHILDREN,
-        &children))
-    {
-        return pszCurrBuffer;
-    }
-
-    // Append a line feed
-    pszCurrBuffer += sprintf(pszCurrBuffer, "\r\n");
-
-    // Iterate through each of the children
-    for (unsigned i = 0; i < dwChildrenCount; i++)
-    {
-        // Add appropriate indentation level (since this routine is recursive)
-        for (unsigned j = 0; j <= nestingLevel + 1; j++)
-            pszCurrBuffer += sprintf(pszCurrBuffer, "\t");
-
-        // Recurse for each of the child types
-        bool bHandled2;
-        BasicType basicType = GetBasicType(children.ChildId[i], modBase);
-        pszCurrBuffer += sprintf(pszCurrBuffer, rgBaseType[basicType]);
-
-        pszCurrBuffer = DumpTypeIndex(pszCurrBuffer, modBase,
-            children.ChildId[i], nestingLevel + 1,
-            offset, bHandled2, ""/*Name */);
-
-        // If the child wasn't a UDT, format it appropriately
-        if (!bHandled2)
-        {
-            // Get the offset of the child member, relative to its parent
-            DWORD dwMemberOffset;
-            GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, children.ChildId[i],
-                TI_GET_OFFSET, &dwMemberOffset);
-
-            // Get the real "TypeId" of the child.  We need this for the
-            // SymGetTypeInfo( TI_GET_TYPEID ) call below.
-            DWORD typeId;
-            GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, children.ChildId[i],
-                TI_GET_TYPEID, &typeId);
-
-            // Get the size of the child member
-            ULONG64 length;
-            GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeId, TI_GET_LENGTH, &length);
-
-            // Calculate the address of the member
-            DWORD_PTR dwFinalOffset = offset + dwMemberOffset;
-            pszCurrBuffer = FormatOutputValue(pszCurrBuffer, basicType,
-                length, (PVOID)dwFinalOffset);
-
-            pszCurrBuffer += sprintf(pszCurrBuffer, "\r\n");
-        }
-    }
-
-    bHandled = true;
-    return pszCurrBuffer;
-}
-
-BasicType GetBasicType(DWORD typeIndex, DWORD64 modBase)
-{
-    BasicType basicType;
-    if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex,
-        TI_GET_BASETYPE, &basicType))
-    {
-        return basicType;
-    }
-
-    // Get the real "TypeId" of the child.  We need this for the
-    // SymGetTypeInfo( TI_GET_TYPEID ) call below.
-    DWORD typeId;
-    if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex, TI_GET_TYPEID, &typeId))
-    {
-        if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeId, TI_GET_BASETYPE,
-            &basicType))
-        {
-            return basicType;
-        }
-    }
-
-    return btNoType;
-}
-
 bool GetProcessorName(char* sProcessorName, DWORD maxcount)
 {
     assert(sProcessorName);
@@ -822,45 +847,102 @@ BOOL GetWindowsVersion(char* szVersion, DWORD cntMax)
     }
     else
     {
-        strcat_s(szVersion, cntMax, "This application does not support this version of Windows.\n");
+        strcat_s(szVersion, cntMax, "This application does not support this version of Windows.");
         return FALSE;
     }
 
     return TRUE;
 }
 
-void PrintSystemInfo()
+// Static part of the system information, collected once by InitSystemInfo()
+static char g_szSystemInfo[MAX_BUF_SIZE];
+
+// Append formatted text to the static system information
+static void AppendSystemInfo(size_t* pLen, const char* fmt, ...)
+{
+    if (*pLen >= sizeof(g_szSystemInfo) - 1)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int r = _vsnprintf_s(g_szSystemInfo + *pLen, sizeof(g_szSystemInfo) - *pLen, _TRUNCATE, fmt, ap);
+    va_end(ap);
+    *pLen = (r >= 0) ? *pLen + r : strlen(g_szSystemInfo);
+}
+
+void InitSystemInfo()
 {
     SYSTEM_INFO SystemInfo;
     ::GetSystemInfo(&SystemInfo);
 
-    MEMORYSTATUS MemoryStatus;
-    MemoryStatus.dwLength = sizeof (MEMORYSTATUS);
-    ::GlobalMemoryStatus(&MemoryStatus);
+    MEMORYSTATUSEX MemoryStatus = {};
+    MemoryStatus.dwLength = sizeof(MemoryStatus);
+    ::GlobalMemoryStatusEx(&MemoryStatus);
 
-    TCHAR sString[1024];
-    AddToReport(("=====================================================\r\n"));
-    if (GetProcessorName(sString, _countof(sString)))
+    size_t len = 0;
+    char sString[1024];
+    AppendSystemInfo(&len, "=====================================================\r\n");
+    if (!GetProcessorName(sString, _countof(sString)))
     {
-        AddToReport(("*** Hardware ***\r\nProcessor: %s\r\nNumber Of Processors: %d\r\n"
-            "Physical Memory: %s (Available: %s)\r\nCommit Charge Limit: %s\r\n"),
-            sString, SystemInfo.dwNumberOfProcessors, FileSizeToStr(MemoryStatus.dwTotalPhys).c_str(), 
-            FileSizeToStr(MemoryStatus.dwAvailPhys).c_str(), FileSizeToStr(MemoryStatus.dwTotalPageFile).c_str());
+        strcpy_s(sString, _countof(sString), "<unknown>");
     }
-    else
+    AppendSystemInfo(&len, "*** Hardware ***\r\nProcessor: %s\r\nNumber Of Processors: %u\r\n"
+        "Physical Memory: %s\r\nPage Size: %u\r\n", sString, SystemInfo.dwNumberOfProcessors,
+        FileSizeToStr(MemoryStatus.ullTotalPhys).c_str(), SystemInfo.dwPageSize);
+
+    // Memory limits of the job object the process runs in, if any
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION JobLimit = {};
+    if (::QueryInformationJobObject(NULL, JobObjectExtendedLimitInformation, &JobLimit, sizeof(JobLimit), NULL))
     {
-        AddToReport(("*** Hardware ***\r\nProcessor: <unknown>\r\nNumber Of Processors: %d\r\n"
-            "Physical Memory: %s (Available: %s)\r\nCommit Charge Limit: %s\r\n"),
-                    SystemInfo.dwNumberOfProcessors, FileSizeToStr(MemoryStatus.dwTotalPhys).c_str(), 
-                    FileSizeToStr(MemoryStatus.dwAvailPhys).c_str(), FileSizeToStr(MemoryStatus.dwTotalPageFile).c_str()); 
+        if (JobLimit.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_PROCESS_MEMORY)
+        {
+            AppendSystemInfo(&len, "Job Process Memory Limit: %s\r\n",
+                FileSizeToStr(JobLimit.ProcessMemoryLimit).c_str());
+        }
+        if (JobLimit.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY)
+        {
+            AppendSystemInfo(&len, "Job Memory Limit: %s\r\n", FileSizeToStr(JobLimit.JobMemoryLimit).c_str());
+        }
     }
 
-    if(GetWindowsVersion(sString, _countof(sString)))
+    if (!GetWindowsVersion(sString, _countof(sString)))
     {
-        AddToReport(("\r\n*** Operation System ***\r\n%s\r\n"), sString);
+        strcpy_s(sString, _countof(sString), "<unknown>");
     }
-    else
+    AppendSystemInfo(&len, "\r\n*** Operation System ***\r\n%s\r\n", sString);
+}
+
+const char* GetStaticSystemInfo()
+{
+    return g_szSystemInfo;
+}
+
+// Only the memory state is queried at crash time, the rest was collected by InitSystemInfo()
+void PrintSystemInfo()
+{
+    if (g_szSystemInfo[0] == '\0')
     {
-        AddToReport(("\r\n*** Operation System:\r\n<unknown>\r\n"));
+        InitSystemInfo();
     }
+    AddToReport("%s", g_szSystemInfo);
+
+    MEMORYSTATUSEX MemoryStatus = {};
+    MemoryStatus.dwLength = sizeof(MemoryStatus);
+    ::GlobalMemoryStatusEx(&MemoryStatus);
+
+    PROCESS_MEMORY_COUNTERS_EX pmc = {};
+    pmc.cb = sizeof(pmc);
+    ::GetProcessMemoryInfo(::GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS)&pmc, sizeof(pmc));
+
+    DWORD dwHandleCount = 0;
+    ::GetProcessHandleCount(::GetCurrentProcess(), &dwHandleCount);
+
+    AddToReport("\r\n*** Memory ***\r\nAvailable Physical Memory: %s\r\nCommit Charge: %s (Limit: %s)\r\n"
+        "Working Set: %s (Peak: %s)\r\nPrivate Bytes: %s\r\nHandle Count: %u\r\n",
+        FileSizeToStr(MemoryStatus.ullAvailPhys).c_str(),
+        FileSizeToStr(MemoryStatus.ullTotalPageFile - MemoryStatus.ullAvailPageFile).c_str(),
+        FileSizeToStr(MemoryStatus.ullTotalPageFile).c_str(),
+        FileSizeToStr(pmc.WorkingSetSize).c_str(), FileSizeToStr(pmc.PeakWorkingSetSize).c_str(),
+        FileSizeToStr(pmc.PrivateUsage).c_str(), dwHandleCount);
 }
@@ -17,6 +17,9 @@ enum
 
     // Max buffer length
     MAX_BUF_SIZE = 4 * 1024,
+
+    // Number of call sites listed by the profilers in a report
+    REPORT_TOP_STACKS = 10,
 };
 
 
@@ -59,3 +62,13 @@ static const char* const rgBaseType[] =
 
 // Create stack frame log of this exception
 void CreateReport(EXCEPTION_POINTERS* ep);
+
+// Write the live heap allocation sites when the commit charge went over the threshold
+void CreateHeapReport(ULONG64 commitCharge);
+
+// Collect the system information which does not change while the process runs,
+// so the crash report only has to query the memory state
+void InitSystemInfo();
+
+// Static system information text collected by InitSystemInfo()
+const char* GetStaticSystemInfo();
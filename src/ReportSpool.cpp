@@ -0,0 +1,273 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "ReportSpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "Format.h"
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+
+ReportSpool& GetReportSpool()
+{
+    static ReportSpool instance;
+    return instance;
+}
+
+struct QueuedReport
+{
+    FILETIME    ftCreation;
+    std::string name;
+
+    bool operator < (const QueuedReport& other) const
+    {
+        return CompareFileTime(&ftCreation, &other.ftCreation) < 0;
+    }
+};
+
+// Entries of `pszDir` but . and .., `pszDir` ends with a backslash
+static void ListDirectory(const char* pszDir, std::vector<WIN32_FIND_DATAA>* pEntries)
+{
+    pEntries->clear();
+    std::string pattern = std::string(pszDir) + "*";
+    WIN32_FIND_DATAA fd = {};
+    HANDLE hFind = FindFirstFileA(pattern.c_str(), &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    do
+    {
+        if (strcmp(fd.cFileName, ".") != 0 && strcmp(fd.cFileName, "..") != 0)
+        {
+            pEntries->push_back(fd);
+        }
+    } while (FindNextFileA(hFind, &fd));
+    FindClose(hFind);
+}
+
+// Delete a directory and the files in it
+static void RemoveReportDirectory(const std::string& dir)
+{
+    std::string prefix = dir + "\\";
+    std::vector<WIN32_FIND_DATAA> entries;
+    ListDirectory(prefix.c_str(), &entries);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        DeleteFileA((prefix + entries[i].cFileName).c_str());
+    }
+    RemoveDirectoryA(dir.c_str());
+}
+
+// Whether the process which named a report `<AppName>_<date>-<time>-<pid>` still runs
+static bool IsWriterAlive(const char* pszName)
+{
+    const char* pszPid = strrchr(pszName, '-');
+    if (pszPid == NULL)
+    {
+        return false;
+    }
+    DWORD dwProcessId = strtoul(pszPid + 1, NULL, 10);
+    // A pid of ours was reused from an earlier process
+    if (dwProcessId == 0 || dwProcessId == GetCurrentProcessId())
+    {
+        return false;
+    }
+    HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, dwProcessId);
+    if (hProcess == NULL)
+    {
+        return false;
+    }
+    bool bAlive = (WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT);
+    CloseHandle(hProcess);
+    return bAlive;
+}
+
+ReportSpool::ReportSpool()
+{
+    szTmpDir_[0] = '\0';
+    szQueueDir_[0] = '\0';
+    szRejectedDir_[0] = '\0';
+    szCurrent_[0] = '\0';
+}
+
+int ReportSpool::Open(const char* pszDir)
+{
+    if (pszDir == NULL)
+    {
+        return 1;
+    }
+    char szDir[MAX_PATH];
+    DWORD dwLen = GetFullPathNameA(pszDir, MAX_PATH, szDir, NULL);
+    // Room for the subdirectories and a report name
+    if (dwLen == 0 || dwLen > MAX_PATH / 2)
+    {
+        return 1;
+    }
+    while (dwLen > 0 && (szDir[dwLen - 1] == '\\' || szDir[dwLen - 1] == '/'))
+    {
+        szDir[--dwLen] = '\0';
+    }
+    char szTmpDir[MAX_PATH];
+    char szQueueDir[MAX_PATH];
+    char szRejectedDir[MAX_PATH];
+    CR_FORMAT(szTmpDir, MAX_PATH, "{s}\\tmp", szDir);
+    CR_FORMAT(szQueueDir, MAX_PATH, "{s}\\queue", szDir);
+    CR_FORMAT(szRejectedDir, MAX_PATH, "{s}\\rejected", szDir);
+    if (!CreateDirectoryIfMissing(szDir) || !CreateDirectoryIfMissing(szTmpDir) ||
+        !CreateDirectoryIfMissing(szQueueDir) || !CreateDirectoryIfMissing(szRejectedDir))
+    {
+        LogLastError();
+        return 1;
+    }
+    CR_FORMAT(szTmpDir_, MAX_PATH, "{s}\\", szTmpDir);
+    CR_FORMAT(szRejectedDir_, MAX_PATH, "{s}\\", szRejectedDir);
+    CR_FORMAT(szQueueDir_, MAX_PATH, "{s}\\", szQueueDir);
+    return 0;
+}
+
+bool ReportSpool::BeginReport(const char* pszName, char* pszReportDir, size_t cbReportDir)
+{
+    assert(pszName && pszReportDir);
+    if (!IsOpen())
+    {
+        return false;
+    }
+    CR_FORMAT(szCurrent_, MAX_PATH, "{s}-{d}", pszName, GetCurrentProcessId());
+    char szDir[MAX_PATH];
+    CR_FORMAT(szDir, MAX_PATH, "{s}{s}", szTmpDir_, szCurrent_);
+    if (!CreateDirectoryIfMissing(szDir))
+    {
+        szCurrent_[0] = '\0';
+        return false;
+    }
+    CR_FORMAT(pszReportDir, cbReportDir, "{s}\\", szDir);
+    return true;
+}
+
+bool ReportSpool::CommitReport()
+{
+    if (szCurrent_[0] == '\0')
+    {
+        return false;
+    }
+    char szFrom[MAX_PATH];
+    char szTo[MAX_PATH];
+    CR_FORMAT(szFrom, MAX_PATH, "{s}{s}", szTmpDir_, szCurrent_);
+    CR_FORMAT(szTo, MAX_PATH, "{s}{s}", szQueueDir_, szCurrent_);
+    // Both are on the same volume, a directory rename is atomic.
+    // The name is cleared after the rename, RecoverAbandoned() leaves it alone until then
+    bool bMoved = MoveFileExA(szFrom, szTo, 0) != FALSE;
+    szCurrent_[0] = '\0';
+    return bMoved;
+}
+
+void ReportSpool::RecoverAbandoned()
+{
+    if (!IsOpen())
+    {
+        return;
+    }
+    std::vector<WIN32_FIND_DATAA> entries;
+    ListDirectory(szTmpDir_, &entries);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const WIN32_FIND_DATAA& fd = entries[i];
+        // The report this process is writing carries our pid, like the ones left by an
+        // earlier process which had the same pid
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 ||
+            strcmp(fd.cFileName, szCurrent_) == 0 || IsWriterAlive(fd.cFileName))
+        {
+            continue;
+        }
+        // Whatever was written is worth uploading, the crash record goes first
+        std::string from = std::string(szTmpDir_) + fd.cFileName;
+        std::string to = std::string(szQueueDir_) + fd.cFileName;
+        if (!MoveFileExA(from.c_str(), to.c_str(), 0))
+        {
+            RemoveReportDirectory(from);
+        }
+    }
+}
+
+void ReportSpool::ListQueued(std::vector<std::string>* pNames) const
+{
+    assert(pNames);
+    pNames->clear();
+    if (!IsOpen())
+    {
+        return;
+    }
+    std::vector<WIN32_FIND_DATAA> entries;
+    ListDirectory(szQueueDir_, &entries);
+    std::vector<QueuedReport> reports;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            QueuedReport report = { entries[i].ftCreationTime, entries[i].cFileName };
+            reports.push_back(report);
+        }
+    }
+    std::sort(reports.begin(), reports.end());
+    for (size_t i = 0; i < reports.size(); i++)
+    {
+        pNames->push_back(reports[i].name);
+    }
+}
+
+void ReportSpool::ListFiles(const std::string& name, std::vector<std::string>* pFiles) const
+{
+    assert(pFiles);
+    pFiles->clear();
+    std::string prefix = GetQueuedPath(name) + "\\";
+    std::vector<WIN32_FIND_DATAA> entries;
+    ListDirectory(prefix.c_str(), &entries);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if ((entries[i].dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+        {
+            pFiles->push_back(entries[i].cFileName);
+        }
+    }
+}
+
+std::string ReportSpool::GetQueuedPath(const std::string& name) const
+{
+    return szQueueDir_ + name;
+}
+
+void ReportSpool::RemoveQueued(const std::string& name)
+{
+    if (IsOpen() && !name.empty())
+    {
+        RemoveReportDirectory(GetQueuedPath(name));
+    }
+}
+
+void ReportSpool::RejectQueued(const std::string& name)
+{
+    if (IsOpen() && !name.empty())
+    {
+        std::string from = GetQueuedPath(name);
+        std::string to = szRejectedDir_ + name;
+        if (!MoveFileExA(from.c_str(), to.c_str(), 0))
+        {
+            LogLastError();
+        }
+    }
+}
+
+void ReportSpool::Trim()
+{
+    std::vector<std::string> names;
+    ListQueued(&names);
+    for (size_t i = 0; i + SPOOL_MAX_REPORTS < names.size(); i++)
+    {
+        RemoveQueued(names[i]);
+    }
+}
@@ -0,0 +1,73 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+enum
+{
+    // Oldest queued reports beyond this are deleted
+    SPOOL_MAX_REPORTS = 32,
+};
+
+// Directory of crash reports waiting to be uploaded:
+//
+//   <spool>\tmp\<AppName>_<date>-<time>-<pid>\     files of a report being written
+//   <spool>\queue\<AppName>_<date>-<time>-<pid>\   finished reports
+//   <spool>\rejected\<AppName>_<date>-<time>-<pid>\    reports no request can carry
+//
+// The crash path writes the files of a report into its own directory under tmp and renames
+// the directory into the queue once they are complete, so a reader of the queue never sees
+// a partial report. Paths are built at open time, the crash path does not allocate.
+class ReportSpool
+{
+public:
+    ReportSpool();
+
+    int Open(const char* pszDir);
+    bool IsOpen() const { return szQueueDir_[0] != '\0'; }
+
+    // Crash path: create the tmp directory of a report named `pszName`,
+    // `pszReportDir` receives its path with a trailing backslash
+    bool BeginReport(const char* pszName, char* pszReportDir, size_t cbReportDir);
+
+    // Crash path: move the report begun last into the queue
+    bool CommitReport();
+
+    // Queue the reports left in tmp by processes which died while writing them
+    void RecoverAbandoned();
+
+    // Names of the queued reports, oldest first
+    void ListQueued(std::vector<std::string>* pNames) const;
+
+    // Names of the files of a queued report
+    void ListFiles(const std::string& name, std::vector<std::string>* pFiles) const;
+
+    std::string GetQueuedPath(const std::string& name) const;
+
+    // Delete a queued report and its files
+    void RemoveQueued(const std::string& name);
+
+    // Move a queued report the uploader cannot send out of the queue, it's kept for
+    // whoever collects it by hand
+    void RejectQueued(const std::string& name);
+
+    // Delete the oldest reports beyond SPOOL_MAX_REPORTS
+    void Trim();
+
+private:
+    ReportSpool(const ReportSpool&);
+    ReportSpool& operator = (const ReportSpool&);
+
+    char    szTmpDir_[MAX_PATH];        // with a trailing backslash
+    char    szQueueDir_[MAX_PATH];      // with a trailing backslash
+    char    szRejectedDir_[MAX_PATH];   // with a trailing backslash
+    char    szCurrent_[MAX_PATH];       // name of the report being written
+};
+
+// Report spool of current process, closed until crSpoolReports() is called
+ReportSpool& GetReportSpool();
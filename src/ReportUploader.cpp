@@ -0,0 +1,308 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "ReportUploader.h"
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+#pragma comment(lib, "winhttp.lib")
+
+#define UPLOAD_BOUNDARY     "calmdump-7b5d4e223f1c9a0e"
+
+
+ReportUploader& GetReportUploader()
+{
+    static ReportUploader instance;
+    return instance;
+}
+
+static bool WriteRequestData(HINTERNET hRequest, const void* pData, DWORD cbData)
+{
+    const BYTE* p = (const BYTE*)pData;
+    while (cbData > 0)
+    {
+        DWORD dwWritten = 0;
+        if (!WinHttpWriteData(hRequest, p, cbData, &dwWritten) || dwWritten == 0)
+        {
+            return false;
+        }
+        p += dwWritten;
+        cbData -= dwWritten;
+    }
+    return true;
+}
+
+// Stream `size` bytes of a file, it must not have changed since its size was taken
+static bool WriteRequestFile(HINTERNET hRequest, const std::string& path, DWORD64 size, BYTE* pBuffer)
+{
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    bool bOk = true;
+    while (bOk && size > 0)
+    {
+        DWORD cbChunk = (size < UPLOAD_CHUNK_SIZE) ? (DWORD)size : UPLOAD_CHUNK_SIZE;
+        DWORD dwRead = 0;
+        bOk = ReadFile(hFile, pBuffer, cbChunk, &dwRead, NULL) && dwRead == cbChunk &&
+            WriteRequestData(hRequest, pBuffer, cbChunk);
+        size -= cbChunk;
+    }
+    CloseHandle(hFile);
+    return bOk;
+}
+
+ReportUploader::ReportUploader()
+    : hThread_(NULL), hStopEvent_(NULL)
+{
+}
+
+// The sender is left running at exit: a report is only deleted once the collector
+// acknowledged it, so an upload cut by ExitProcess() is sent again on the next start.
+ReportUploader::~ReportUploader()
+{
+}
+
+int ReportUploader::Start(const char* pszUrl)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (hThread_ != NULL || pszUrl == NULL || !connection_.Connect(pszUrl, UPLOAD_TIMEOUT))
+    {
+        return 1;
+    }
+    hStopEvent_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hStopEvent_ == NULL)
+    {
+        LogLastError();
+        connection_.Disconnect();
+        return 1;
+    }
+    hThread_ = CreateThread(NULL, 0, &ReportUploader::ThreadProc, this, 0, NULL);
+    if (hThread_ == NULL)
+    {
+        LogLastError();
+        CloseHandle(hStopEvent_);
+        hStopEvent_ = NULL;
+        connection_.Disconnect();
+        return 1;
+    }
+    return 0;
+}
+
+int ReportUploader::Stop()
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    if (hThread_ == NULL)
+    {
+        return 1;
+    }
+    SetEvent(hStopEvent_);
+    WaitForSingleObject(hThread_, INFINITE);
+    CloseHandle(hThread_);
+    CloseHandle(hStopEvent_);
+    hThread_ = NULL;
+    hStopEvent_ = NULL;
+    return 0;
+}
+
+int ReportUploader::SendQueued(const char* pszUrl)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    ReportSpool& spool = GetReportSpool();
+    if (hThread_ != NULL || pszUrl == NULL || !spool.IsOpen() ||
+        !connection_.Connect(pszUrl, UPLOAD_TIMEOUT))
+    {
+        return -1;
+    }
+    spool.RecoverAbandoned();
+    spool.Trim();
+    std::vector<std::string> queued;
+    spool.ListQueued(&queued);
+    size_t sent = 0;
+    while (sent < queued.size())
+    {
+        size_t count = queued.size() - sent;
+        if (count > UPLOAD_BATCH_SIZE)
+        {
+            count = UPLOAD_BATCH_SIZE;
+        }
+        std::vector<std::string> batch(queued.begin() + sent, queued.begin() + sent + count);
+        if (!SendBatch(batch))
+        {
+            break;
+        }
+        sent += count;
+    }
+    connection_.Disconnect();
+    return (int)(queued.size() - sent);
+}
+
+DWORD WINAPI ReportUploader::ThreadProc(LPVOID lpParameter)
+{
+    ReportUploader* self = (ReportUploader*)lpParameter;
+    ReportSpool& spool = GetReportSpool();
+
+    // Lowers the I/O and memory priority too
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    DWORD dwWait = UPLOAD_START_DELAY;
+    DWORD dwRetryDelay = UPLOAD_RETRY_MIN_DELAY;
+    while (WaitForSingleObject(self->hStopEvent_, dwWait) == WAIT_TIMEOUT)
+    {
+        spool.RecoverAbandoned();
+        spool.Trim();
+        std::vector<std::string> queued;
+        spool.ListQueued(&queued);
+        if (queued.empty())
+        {
+            // New reports only show up after a crash, they will be sent by the next start
+            break;
+        }
+        if (queued.size() > UPLOAD_BATCH_SIZE)
+        {
+            queued.resize(UPLOAD_BATCH_SIZE);
+        }
+        if (self->SendBatch(queued))
+        {
+            dwRetryDelay = UPLOAD_RETRY_MIN_DELAY;
+            dwWait = UPLOAD_BATCH_INTERVAL;
+        }
+        else
+        {
+            // Spread the retries, so a fleet does not come back at the collector all at once
+            dwWait = dwRetryDelay + GetTickCount() % (dwRetryDelay / 4);
+            dwRetryDelay = (dwRetryDelay < UPLOAD_RETRY_MAX_DELAY / 2) ? dwRetryDelay * 2 : UPLOAD_RETRY_MAX_DELAY;
+        }
+    }
+
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    self->connection_.Disconnect();
+    return 0;
+}
+
+bool ReportUploader::SendBatch(const std::vector<std::string>& names)
+{
+    ReportSpool& spool = GetReportSpool();
+
+    static const char kTail[] = "--" UPLOAD_BOUNDARY "--\r\n";
+
+    // Part headers, file paths and sizes in request order, and the reports they belong to
+    std::vector<std::string> heads;
+    std::vector<std::string> paths;
+    std::vector<DWORD64> sizes;
+    std::vector<std::string> sending;
+    DWORD64 total = sizeof(kTail) - 1;
+    std::vector<std::string> files;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        spool.ListFiles(names[i], &files);
+        if (files.empty())
+        {
+            // Nothing to send of it
+            spool.RemoveQueued(names[i]);
+            continue;
+        }
+        size_t first = heads.size();
+        DWORD64 size = 0;
+        for (size_t n = 0; n < files.size(); n++)
+        {
+            std::string path = spool.GetQueuedPath(names[i]) + "\\" + files[n];
+            WIN32_FILE_ATTRIBUTE_DATA attr = {};
+            if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attr))
+            {
+                continue;
+            }
+            heads.push_back(StringPrintf("--" UPLOAD_BOUNDARY "\r\n"
+                "Content-Disposition: form-data; name=\"%s\"; filename=\"%s\"\r\n"
+                "Content-Type: application/octet-stream\r\n\r\n", names[i].c_str(), files[n].c_str()));
+            paths.push_back(path);
+            sizes.push_back(((DWORD64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow);
+            size += heads.back().size() + sizes.back() + 2;
+        }
+        if (heads.size() == first || size + sizeof(kTail) - 1 > MAXDWORD)
+        {
+            // Unreadable, or too large for a request of its own, moved aside rather than
+            // sent again and again
+            heads.resize(first);
+            paths.resize(first);
+            sizes.resize(first);
+            spool.RejectQueued(names[i]);
+            continue;
+        }
+        sending.push_back(names[i]);
+        total += size;
+    }
+    if (sending.empty())
+    {
+        return true;
+    }
+    if (total > MAXDWORD)
+    {
+        // Too large together, each one fits a request alone
+        for (size_t i = 0; i < sending.size(); i++)
+        {
+            if (!SendBatch(std::vector<std::string>(1, sending[i])))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const WCHAR* pszPath = connection_.GetPath();
+    HINTERNET hRequest = connection_.OpenRequest(L"POST", (pszPath[0] != L'\0') ? pszPath : L"/");
+    if (hRequest == NULL)
+    {
+        return false;
+    }
+    static const WCHAR kHeaders[] = L"Content-Type: multipart/form-data; boundary=" UPLOAD_BOUNDARY;
+    bool bOk = WinHttpSendRequest(hRequest, kHeaders, (DWORD)-1L, WINHTTP_NO_REQUEST_DATA, 0,
+        (DWORD)total, 0) != FALSE;
+    std::vector<BYTE> buffer(UPLOAD_CHUNK_SIZE);
+    for (size_t i = 0; bOk && i < heads.size(); i++)
+    {
+        bOk = WriteRequestData(hRequest, heads[i].c_str(), (DWORD)heads[i].size()) &&
+            WriteRequestFile(hRequest, paths[i], sizes[i], &buffer[0]) &&
+            WriteRequestData(hRequest, "\r\n", 2);
+    }
+    bOk = bOk && WriteRequestData(hRequest, kTail, sizeof(kTail) - 1) &&
+        WinHttpReceiveResponse(hRequest, NULL);
+    DWORD dwStatus = 0;
+    DWORD cbStatus = sizeof(dwStatus);
+    if (bOk)
+    {
+        WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX, &dwStatus, &cbStatus, WINHTTP_NO_HEADER_INDEX);
+    }
+    WinHttpCloseHandle(hRequest);
+    if (dwStatus >= 400 && dwStatus < 500 && dwStatus != 408 && dwStatus != 429)
+    {
+        // Refused for good, another attempt would get the same answer
+        if (sending.size() > 1)
+        {
+            // Each one on its own, to find out which the collector refuses
+            for (size_t i = 0; i < sending.size(); i++)
+            {
+                if (!SendBatch(std::vector<std::string>(1, sending[i])))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        spool.RejectQueued(sending[0]);
+        return true;
+    }
+    if (dwStatus < 200 || dwStatus >= 300)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < sending.size(); i++)
+    {
+        spool.RemoveQueued(sending[i]);
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <atlsync.h>
+#include <string>
+#include <vector>
+#include "ReportSpool.h"
+#include "HttpConnection.h"
+
+enum
+{
+    // Time after start before the first upload, startup has the machine first (milliseconds)
+    UPLOAD_START_DELAY = 30 * 1000,
+
+    // Reports per request, and the pause between two requests
+    UPLOAD_BATCH_SIZE = 4,
+    UPLOAD_BATCH_INTERVAL = 5 * 1000,
+
+    // A failed upload is retried after a delay doubling from the min to the max
+    UPLOAD_RETRY_MIN_DELAY = 60 * 1000,
+    UPLOAD_RETRY_MAX_DELAY = 60 * 60 * 1000,
+
+    // Timeout of each connect, send and receive (milliseconds)
+    UPLOAD_TIMEOUT = 15 * 1000,
+
+    UPLOAD_CHUNK_SIZE = 64 * 1024,
+};
+
+// Uploads the queued reports of a spool to a collector.
+// Each request is a multipart/form-data POST of a batch of reports, one part per file
+// named after its report. The reports of a batch are deleted once the collector answered
+// with a 2xx status, so an upload cut short is sent again on the next attempt. A report
+// no request can carry, larger than 4 GB or unreadable, or which the collector refuses with
+// a 4xx status other than 408 and 429, is moved to the rejected directory of the spool
+// instead of being deleted or sent again.
+// The background sender waits UPLOAD_START_DELAY, runs in background processing mode and
+// pauses between batches, so it never competes with the startup of the application.
+class ReportUploader
+{
+public:
+    ReportUploader();
+    ~ReportUploader();
+
+    // Send the queued reports from a background thread
+    int Start(const char* pszUrl);
+    int Stop();
+
+    // Send the queued reports on the caller thread, returns the number of reports left
+    int SendQueued(const char* pszUrl);
+
+private:
+    ReportUploader(const ReportUploader&);
+    ReportUploader& operator = (const ReportUploader&);
+
+    static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+
+    // Upload a batch of queued reports and delete them, returns false if it failed
+    bool SendBatch(const std::vector<std::string>& names);
+
+    // Guards Start()/Stop()/SendQueued()
+    ATL::CCriticalSection   critsec_;
+
+    HANDLE                  hThread_;
+    HANDLE                  hStopEvent_;
+    HttpConnection          connection_;
+};
+
+// Background uploader of current process
+ReportUploader& GetReportUploader();
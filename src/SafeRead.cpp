@@ -0,0 +1,162 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "SafeRead.h"
+#include <assert.h>
+#include <string.h>
+#include "StackTrace.h"
+
+enum
+{
+    SAFE_READ_PAGE_SIZE = 0x1000,
+};
+
+static bool ReadSelf(DWORD_PTR address, void* pBuffer, size_t size)
+{
+    SIZE_T cbRead = 0;
+    return ReadProcessMemory(GetCurrentProcess(), (LPCVOID)address, pBuffer, size, &cbRead) && cbRead == size;
+}
+
+bool SafeRead(DWORD_PTR address, void* pBuffer, size_t size)
+{
+    assert(pBuffer);
+    if (size == 0)
+    {
+        return true;
+    }
+    const ReadableRegions& regions = GetReadableRegions();
+    if (!regions.IsEmpty() && !regions.Contains(address, size))
+    {
+        return false;
+    }
+    return ReadSelf(address, pBuffer, size);
+}
+
+int SafeReadString(DWORD_PTR address, char* pBuffer, size_t cchBuffer)
+{
+    assert(pBuffer && cchBuffer > 0);
+    size_t len = 0;
+    // One read per page, so a string ending just before an unreadable page is still copied
+    while (len + 1 < cchBuffer)
+    {
+        const DWORD_PTR curr = address + len;
+        size_t chunk = SAFE_READ_PAGE_SIZE - (curr & (SAFE_READ_PAGE_SIZE - 1));
+        if (chunk > cchBuffer - 1 - len)
+        {
+            chunk = cchBuffer - 1 - len;
+        }
+        if (!SafeRead(curr, pBuffer + len, chunk))
+        {
+            break;
+        }
+        const char* pEnd = (const char*)memchr(pBuffer + len, '\0', chunk);
+        if (pEnd != NULL)
+        {
+            return (int)(pEnd - pBuffer);
+        }
+        len += chunk;
+    }
+    pBuffer[len] = '\0';
+    return (len > 0 || cchBuffer == 1) ? (int)len : -1;
+}
+
+void ReadableRegions::Capture()
+{
+    const DWORD kReadable = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY |
+        PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    regions_.clear();
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    DWORD_PTR address = (DWORD_PTR)si.lpMinimumApplicationAddress;
+    const DWORD_PTR maxAddress = (DWORD_PTR)si.lpMaximumApplicationAddress;
+    MEMORY_BASIC_INFORMATION mbi;
+    while (address < maxAddress && VirtualQuery((LPCVOID)address, &mbi, sizeof(mbi)))
+    {
+        const DWORD_PTR begin = (DWORD_PTR)mbi.BaseAddress;
+        const DWORD_PTR end = begin + mbi.RegionSize;
+        if (end <= address)
+        {
+            break;
+        }
+        if (mbi.State == MEM_COMMIT && (mbi.Protect & kReadable) && !(mbi.Protect & PAGE_GUARD))
+        {
+            if (!regions_.empty() && regions_.back().end == begin)
+            {
+                regions_.back().end = end;
+            }
+            else
+            {
+                Region region = { begin, end };
+                regions_.push_back(region);
+            }
+        }
+        address = end;
+    }
+
+    // Our own stack commits new pages as the report goes deeper than it was at the capture
+    ThreadStackBounds bounds = {};
+    GetCurrentThreadStackBounds(&bounds);
+    const DWORD_PTR stackLow = (DWORD_PTR)bounds.StackLimit;
+    const DWORD_PTR stackHigh = (DWORD_PTR)bounds.StackBase;
+    size_t i = 0;
+    while (i < regions_.size() && regions_[i].end < stackLow)
+    {
+        i++;
+    }
+    size_t last = i;
+    while (last < regions_.size() && regions_[last].begin <= stackHigh)
+    {
+        last++;
+    }
+    Region stack = { stackLow, stackHigh };
+    if (last > i)
+    {
+        if (regions_[i].begin < stack.begin)
+        {
+            stack.begin = regions_[i].begin;
+        }
+        if (regions_[last - 1].end > stack.end)
+        {
+            stack.end = regions_[last - 1].end;
+        }
+    }
+    regions_.erase(regions_.begin() + i, regions_.begin() + last);
+    regions_.insert(regions_.begin() + i, stack);
+}
+
+void ReadableRegions::Clear()
+{
+    regions_.clear();
+}
+
+bool ReadableRegions::Contains(DWORD_PTR address, size_t size) const
+{
+    const DWORD_PTR end = address + size;
+    if (end < address)
+    {
+        return false;
+    }
+    // Last region starting at or below `address`
+    size_t low = 0;
+    size_t high = regions_.size();
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (regions_[mid].begin <= address)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low > 0 && end <= regions_[low - 1].end;
+}
+
+ReadableRegions& GetReadableRegions()
+{
+    static ReadableRegions regions;
+    return regions;
+}
@@ -0,0 +1,47 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+// Reads of memory of this process which may be unmapped, freed or made inaccessible by
+// another thread, without raising an exception. ReadProcessMemory() on our own process
+// copies in the kernel and fails where a plain read would fault, so nothing depends on
+// a __try frame or IsBadReadPtr(), and guard pages are not triggered.
+
+// Copy `size` bytes at `address`, all or nothing
+bool SafeRead(DWORD_PTR address, void* pBuffer, size_t size);
+
+// Copy a NUL terminated string, up to `cchBuffer - 1` characters.
+// Returns its length, or -1 if the first character is not readable. The copy is always
+// terminated; it stops early at the first page which cannot be read.
+int SafeReadString(DWORD_PTR address, char* pBuffer, size_t cchBuffer);
+
+// Readable committed regions of the address space, captured by a single walk of VirtualQuery().
+// While a snapshot is held, SafeRead() rejects addresses outside of it without a system call,
+// which is most of the garbage pointers found in a crashed process.
+class ReadableRegions
+{
+public:
+    void Capture();
+    void Clear();
+
+    bool IsEmpty() const { return regions_.empty(); }
+
+    // The range is inside readable memory at the time of the capture
+    bool Contains(DWORD_PTR address, size_t size) const;
+
+private:
+    struct Region
+    {
+        DWORD_PTR   begin;
+        DWORD_PTR   end;
+    };
+    std::vector<Region>     regions_;       // sorted, adjacent regions merged
+};
+
+// Snapshot consulted by SafeRead(), empty unless the crash report captured it
+ReadableRegions& GetReadableRegions();
@@ -0,0 +1,212 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "StackTable.h"
+#include <string.h>
+#include "Format.h"
+#include "ModuleMap.h"
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+
+enum
+{
+    STACK_ENTRY_EMPTY = 0,
+    STACK_ENTRY_BUSY = 1,       // being written by the thread which claimed it
+    STACK_ENTRY_READY = 2,
+};
+
+static DWORD HashFrames(const DWORD64* pFrames, USHORT depth)
+{
+    DWORD64 h = 14695981039346656037ULL;
+    for (USHORT i = 0; i < depth; i++)
+    {
+        h ^= pFrames[i];
+        h *= 1099511628211ULL;
+    }
+    return (DWORD)(h ^ (h >> 32));
+}
+
+StackTable::StackTable(DWORD capacity)
+    : entries_(NULL), capacity_(1), dropped_(0)
+{
+    while (capacity_ < capacity)
+    {
+        capacity_ <<= 1;
+    }
+    // Pages are zero filled and committed by the system on first touch
+    entries_ = (StackEntry*)VirtualAlloc(NULL, capacity_ * sizeof(StackEntry),
+        MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (entries_ == NULL)
+    {
+        capacity_ = 0;
+        LogLastError();
+    }
+}
+
+StackTable::~StackTable()
+{
+    if (entries_ != NULL)
+    {
+        VirtualFree(entries_, 0, MEM_RELEASE);
+        entries_ = NULL;
+    }
+}
+
+StackEntry* StackTable::Add(const DWORD64* pFrames, USHORT depth, LONG64 weight)
+{
+    if (depth > MAX_STACK_FRAMES)
+    {
+        depth = MAX_STACK_FRAMES;
+    }
+    const DWORD hash = HashFrames(pFrames, depth);
+    const DWORD mask = capacity_ - 1;
+    for (DWORD probe = 0; probe < capacity_; probe++)
+    {
+        StackEntry* pEntry = &entries_[(hash + probe) & mask];
+        LONG state = pEntry->state;
+        if (state == STACK_ENTRY_EMPTY)
+        {
+            state = InterlockedCompareExchange(&pEntry->state, STACK_ENTRY_BUSY, STACK_ENTRY_EMPTY);
+            if (state == STACK_ENTRY_EMPTY)
+            {
+                pEntry->hash = hash;
+                pEntry->depth = depth;
+                memcpy(pEntry->frames, pFrames, depth * sizeof(DWORD64));
+                InterlockedExchangeAdd64(&pEntry->count, 1);
+                InterlockedExchangeAdd64(&pEntry->weight, weight);
+                InterlockedExchange(&pEntry->state, STACK_ENTRY_READY);
+                return pEntry;
+            }
+        }
+        // Another thread is publishing this slot, wait for it
+        while (state == STACK_ENTRY_BUSY)
+        {
+            YieldProcessor();
+            state = pEntry->state;
+        }
+        if (pEntry->hash == hash && pEntry->depth == depth &&
+            memcmp(pEntry->frames, pFrames, depth * sizeof(DWORD64)) == 0)
+        {
+            InterlockedExchangeAdd64(&pEntry->count, 1);
+            InterlockedExchangeAdd64(&pEntry->weight, weight);
+            return pEntry;
+        }
+    }
+    InterlockedIncrement64(&dropped_);
+    return NULL;
+}
+
+void StackTable::Remove(StackEntry* pEntry, LONG64 weight)
+{
+    assert(pEntry);
+    InterlockedExchangeAdd64(&pEntry->count, -1);
+    InterlockedExchangeAdd64(&pEntry->weight, -weight);
+}
+
+const StackEntry* StackTable::GetEntry(DWORD index) const
+{
+    assert(index < capacity_);
+    const StackEntry* pEntry = &entries_[index];
+    if (pEntry->state != STACK_ENTRY_READY)
+    {
+        return NULL;
+    }
+    MemoryBarrier();
+    return pEntry;
+}
+
+void StackTable::WriteFolded(FILE* fp, bool useWeight, LONG64 divisor) const
+{
+    assert(fp);
+    char szFrame[MAX_PATH];
+    for (DWORD i = 0; i < capacity_; i++)
+    {
+        const StackEntry* pEntry = GetEntry(i);
+        if (pEntry == NULL)
+        {
+            continue;
+        }
+        LONG64 value = useWeight ? pEntry->weight / divisor : pEntry->count;
+        if (value <= 0)
+        {
+            continue;
+        }
+        // Folded stacks list the outermost frame first
+        for (int n = pEntry->depth - 1; n >= 0; n--)
+        {
+            FormatModuleOffset(szFrame, sizeof(szFrame), pEntry->frames[n]);
+            fputs(szFrame, fp);
+            if (n > 0)
+            {
+                fputc(';', fp);
+            }
+        }
+        fprintf(fp, " %I64d\n", value);
+    }
+}
+
+DWORD StackTable::GetTopEntries(const StackEntry** ppEntries, DWORD maxCount) const
+{
+    assert(ppEntries);
+    DWORD count = 0;
+    for (DWORD i = 0; i < capacity_ && maxCount > 0; i++)
+    {
+        const StackEntry* pEntry = GetEntry(i);
+        if (pEntry == NULL || pEntry->weight <= 0)
+        {
+            continue;
+        }
+        // Insertion into the sorted top list, N is small
+        DWORD pos = count;
+        while (pos > 0 && ppEntries[pos - 1]->weight < pEntry->weight)
+        {
+            if (pos < maxCount)
+            {
+                ppEntries[pos] = ppEntries[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < maxCount)
+        {
+            ppEntries[pos] = pEntry;
+            if (count < maxCount)
+            {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+int FormatModuleOffset(char* pszBuffer, size_t cbBuffer, DWORD64 address)
+{
+    ModuleInfo module;
+    if (GetModuleMap().FindModule(address, &module))
+    {
+        return (int)CR_FORMAT(pszBuffer, cbBuffer, "{s}+0x{x}", module.name, address - module.base);
+    }
+    return (int)CR_FORMAT(pszBuffer, cbBuffer, "0x{x}", address);
+}
+
+static void WriteModuleLine(const ModuleInfo& info, void* pContext)
+{
+    // Ahead of its module line, the symbolizer looks the PDB up by build id before loading the module
+    if (info.pdbName[0] != '\0')
+    {
+        char szBuildId[MODULE_BUILD_ID_LEN];
+        FormatBuildId(info.pdbGuid, info.pdbAge, szBuildId, sizeof(szBuildId));
+        fprintf((FILE*)pContext, "# build %s %s %s\n", info.name, szBuildId, info.pdbName);
+    }
+    fprintf((FILE*)pContext, "# module %s 0x%I64x 0x%x %s\n", info.name, info.base,
+        (DWORD)(info.end - info.base), info.path);
+}
+
+void WriteModuleHeader(FILE* fp)
+{
+    assert(fp);
+    // The profilers may run without the crash handler, which builds the map at install time
+    GetModuleMap().Init();
+    GetModuleMap().EnumModules(WriteModuleLine, fp);
+}
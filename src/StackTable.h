@@ -0,0 +1,70 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <stdio.h>
+#include "StackTrace.h"
+
+// A deduplicated call stack and its accumulated counters
+struct StackEntry
+{
+    volatile LONG       state;      // one of the STACK_ENTRY_xxx states
+    DWORD               hash;
+    USHORT              depth;
+    volatile LONG64     count;      // number of hits
+    volatile LONG64     weight;     // accumulated weight (bytes, cycles, ...)
+    DWORD64             frames[MAX_STACK_FRAMES];
+};
+
+// Lock-free hash table of call stacks keyed by the tuple of return addresses.
+// All memory is reserved up front, so Add() may be called from an allocator hook
+// or with a thread suspended; when the table is full new stacks are dropped and counted.
+class StackTable
+{
+public:
+    // `capacity` is rounded up to a power of two
+    explicit StackTable(DWORD capacity);
+    ~StackTable();
+
+    // Account `weight` to the stack, returns the entry or NULL if the table is full
+    StackEntry* Add(const DWORD64* pFrames, USHORT depth, LONG64 weight);
+
+    // Take back a hit of `weight` previously added to the entry, used for live counters
+    static void Remove(StackEntry* pEntry, LONG64 weight);
+
+    // Number of stacks which could not be recorded
+    LONG64 GetDropped() const { return dropped_; }
+
+    DWORD GetCapacity() const { return capacity_; }
+
+    // Entry at `index` if it is fully published, NULL otherwise
+    const StackEntry* GetEntry(DWORD index) const;
+
+    // Write stacks in folded format ("outermost;...;innermost weight"), one stack per line.
+    // Return addresses are written as `module+0xoffset` for offline symbolization,
+    // when `useWeight` is false the hit count is written instead of the weight.
+    // Weights are divided by `divisor` to convert them to a readable unit.
+    void WriteFolded(FILE* fp, bool useWeight, LONG64 divisor = 1) const;
+
+    // Fill `ppEntries` with at most `maxCount` entries of the biggest weight, returns the count.
+    // Does not allocate memory.
+    DWORD GetTopEntries(const StackEntry** ppEntries, DWORD maxCount) const;
+
+private:
+    StackTable(const StackTable&);
+    StackTable& operator = (const StackTable&);
+
+    StackEntry*         entries_;
+    DWORD               capacity_;
+    volatile LONG64     dropped_;
+};
+
+// Write the address as `module+0xoffset`, or as a plain address if it's not in any module
+int FormatModuleOffset(char* pszBuffer, size_t cbBuffer, DWORD64 address);
+
+// Write `# module <name> <base> <size> <path>` lines for every loaded module, each preceded by
+// `# build <name> <build id> <pdb name>` if it has a PDB signature, the offline symbolizer
+// uses them to map `module+0xoffset` back to the images and to find their PDBs.
+void WriteModuleHeader(FILE* fp);
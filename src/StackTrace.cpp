@@ -0,0 +1,243 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "StackTrace.h"
+#include <string.h>
+#include "Utility.h"
+
+
+// Definitions from winternl.h/ntddk.h
+typedef LONG NTSTATUS;
+
+struct CLIENT_ID_
+{
+    HANDLE  UniqueProcess;
+    HANDLE  UniqueThread;
+};
+
+struct THREAD_BASIC_INFORMATION_
+{
+    NTSTATUS    ExitStatus;
+    PVOID       TebBaseAddress;
+    CLIENT_ID_  ClientId;
+    KAFFINITY   AffinityMask;
+    LONG        Priority;
+    LONG        BasePriority;
+};
+
+typedef NTSTATUS (WINAPI* NtQueryInformationThread_t)(HANDLE, int, PVOID, ULONG, PULONG);
+
+static DllHandle& GetNtdllDll()
+{
+    static DllHandle instance("ntdll.dll");
+    return instance;
+}
+
+void GetCurrentThreadStackBounds(ThreadStackBounds* pBounds)
+{
+    assert(pBounds);
+    NT_TIB* pTib = (NT_TIB*)NtCurrentTeb();
+    pBounds->StackLimit = (DWORD64)(ULONG_PTR)pTib->StackLimit;
+    pBounds->StackBase = (DWORD64)(ULONG_PTR)pTib->StackBase;
+}
+
+BOOL GetThreadStackBounds(HANDLE hThread, ThreadStackBounds* pBounds)
+{
+    assert(pBounds);
+    static NtQueryInformationThread_t pfnQuery = (NtQueryInformationThread_t)
+        GetNtdllDll().GetFuncAddress("NtQueryInformationThread");
+    if (pfnQuery == NULL)
+    {
+        return FALSE;
+    }
+    THREAD_BASIC_INFORMATION_ tbi = {};
+    const int ThreadBasicInformation = 0;
+    if (pfnQuery(hThread, ThreadBasicInformation, &tbi, sizeof(tbi), NULL) < 0 || tbi.TebBaseAddress == NULL)
+    {
+        return FALSE;
+    }
+    // TEB starts with NT_TIB, which belongs to the same process as us
+    NT_TIB* pTib = (NT_TIB*)tbi.TebBaseAddress;
+    pBounds->StackLimit = (DWORD64)(ULONG_PTR)pTib->StackLimit;
+    pBounds->StackBase = (DWORD64)(ULONG_PTR)pTib->StackBase;
+    return pBounds->StackBase > pBounds->StackLimit;
+}
+
+// Never inlined, the frame skipped for it must exist
+__declspec(noinline) USHORT CaptureCurrentStack(DWORD skip, DWORD64* pFrames, USHORT maxFrames)
+{
+    assert(pFrames);
+    PVOID backTrace[MAX_STACK_FRAMES];
+    if (maxFrames > MAX_STACK_FRAMES)
+    {
+        maxFrames = MAX_STACK_FRAMES;
+    }
+    // Skip this function itself
+    USHORT count = RtlCaptureStackBackTrace(skip + 1, maxFrames, backTrace, NULL);
+    for (USHORT i = 0; i < count; i++)
+    {
+        pFrames[i] = (DWORD64)(ULONG_PTR)backTrace[i];
+    }
+    return count;
+}
+
+USHORT UnwindStack(CONTEXT* pContext, DWORD64 stackLow, DWORD64 stackHigh,
+                   DWORD64* pFrames, USHORT maxFrames)
+{
+    assert(pContext && pFrames);
+    USHORT count = 0;
+#if defined(_M_AMD64)
+    while (count < maxFrames)
+    {
+        DWORD64 pc = pContext->Rip;
+        DWORD64 sp = pContext->Rsp;
+        if (pc == 0 || sp < stackLow || sp >= stackHigh)
+        {
+            break;
+        }
+        pFrames[count++] = pc;
+
+        DWORD64 imageBase = 0;
+        PRUNTIME_FUNCTION pFunction = RtlLookupFunctionEntry(pc, &imageBase, NULL);
+        if (pFunction != NULL)
+        {
+            PVOID pHandlerData = NULL;
+            DWORD64 establisherFrame = 0;
+            RtlVirtualUnwind(UNW_FLAG_NHANDLER, imageBase, pc, pFunction, pContext,
+                &pHandlerData, &establisherFrame, NULL);
+        }
+        else
+        {
+            // Leaf function without unwind data, return address is on top of the stack
+            if (sp + sizeof(DWORD64) > stackHigh)
+            {
+                break;
+            }
+            pContext->Rip = *(DWORD64*)sp;
+            pContext->Rsp = sp + sizeof(DWORD64);
+        }
+
+        // The stack pointer has to move towards the stack base, or the unwind data is bogus
+        if (pContext->Rsp <= sp)
+        {
+            break;
+        }
+    }
+#elif defined(_M_IX86)
+    // No unwind tables on x86, follow the frame pointer chain
+    if (maxFrames > 0 && pContext->Eip != 0)
+    {
+        pFrames[count++] = pContext->Eip;
+    }
+    DWORD64 fp = pContext->Ebp;
+    while (count < maxFrames)
+    {
+        if (fp < stackLow || fp + 2 * sizeof(DWORD) > stackHigh || (fp & (sizeof(DWORD) - 1)) != 0)
+        {
+            break;
+        }
+        const DWORD* pFrame = (const DWORD*)(ULONG_PTR)fp;
+        DWORD next = pFrame[0];
+        DWORD ret = pFrame[1];
+        if (ret == 0)
+        {
+            break;
+        }
+        pFrames[count++] = ret;
+        if (next <= fp)
+        {
+            break;
+        }
+        fp = next;
+    }
+#else
+#error "Need to implement stack unwinding on non x86"
+#endif
+    return count;
+}
+
+// Redirect every pointer into the original stack range to the copy
+static void RelocateStackPointers(DWORD64 origLow, DWORD64 origHigh, DWORD64 copyLow, ULONG_PTR* pWords, SIZE_T nWords)
+{
+    for (SIZE_T i = 0; i < nWords; i++)
+    {
+        DWORD64 value = pWords[i];
+        if (value >= origLow && value < origHigh)
+        {
+            pWords[i] = (ULONG_PTR)(value - origLow + copyLow);
+        }
+    }
+}
+
+SIZE_T CopyThreadStack(HANDLE hThread, const ThreadStackBounds& bounds, BYTE* pCopyBuffer,
+                       SIZE_T cbCopyBuffer, CONTEXT* pContext, DWORD64* pStackAddress)
+{
+    assert(pCopyBuffer && pContext && pStackAddress);
+    memset(pContext, 0, sizeof(CONTEXT));
+    pContext->ContextFlags = CONTEXT_INTEGER | CONTEXT_CONTROL;
+
+    // Nothing but a syscall and a memcpy() while the thread is suspended:
+    // it may own the heap lock, the loader lock or the dbghelp lock.
+    if (SuspendThread(hThread) == (DWORD)-1)
+    {
+        return 0;
+    }
+    if (!GetThreadContext(hThread, pContext))
+    {
+        ResumeThread(hThread);
+        return 0;
+    }
+#if defined(_M_AMD64)
+    DWORD64 sp = pContext->Rsp;
+#elif defined(_M_IX86)
+    DWORD64 sp = pContext->Esp;
+#endif
+    sp &= ~(DWORD64)(sizeof(ULONG_PTR) - 1);
+    if (sp < bounds.StackLimit || sp >= bounds.StackBase)
+    {
+        ResumeThread(hThread);
+        return 0;
+    }
+    SIZE_T cbUsed = (SIZE_T)(bounds.StackBase - sp);
+    if (cbUsed > cbCopyBuffer)
+    {
+        // Keep the innermost part of a very deep stack
+        cbUsed = cbCopyBuffer;
+    }
+    memcpy(pCopyBuffer, (const void*)(ULONG_PTR)sp, cbUsed);
+    ResumeThread(hThread);
+    *pStackAddress = sp;
+    return cbUsed;
+}
+
+USHORT UnwindStackCopy(CONTEXT* pContext, DWORD64 stackAddress, BYTE* pCopyBuffer, SIZE_T cbUsed,
+                       DWORD64* pFrames, USHORT maxFrames)
+{
+    const DWORD64 sp = stackAddress;
+    const DWORD64 copyLow = (DWORD64)(ULONG_PTR)pCopyBuffer;
+    const DWORD64 origHigh = sp + cbUsed;
+    RelocateStackPointers(sp, origHigh, copyLow, (ULONG_PTR*)pCopyBuffer, cbUsed / sizeof(ULONG_PTR));
+#if defined(_M_AMD64)
+    RelocateStackPointers(sp, origHigh, copyLow, (ULONG_PTR*)&pContext->Rax, 16); // Rax..R15
+#elif defined(_M_IX86)
+    RelocateStackPointers(sp, origHigh, copyLow, (ULONG_PTR*)&pContext->Edi, 6);  // Edi..Eax
+    RelocateStackPointers(sp, origHigh, copyLow, (ULONG_PTR*)&pContext->Ebp, 1);
+    RelocateStackPointers(sp, origHigh, copyLow, (ULONG_PTR*)&pContext->Esp, 1);
+#endif
+    return UnwindStack(pContext, copyLow, copyLow + cbUsed, pFrames, maxFrames);
+}
+
+USHORT SampleThreadStack(HANDLE hThread, const ThreadStackBounds& bounds, BYTE* pCopyBuffer,
+                         SIZE_T cbCopyBuffer, DWORD64* pFrames, USHORT maxFrames)
+{
+    assert(pCopyBuffer && pFrames);
+    CONTEXT ctx;
+    DWORD64 sp = 0;
+    SIZE_T cbUsed = CopyThreadStack(hThread, bounds, pCopyBuffer, cbCopyBuffer, &ctx, &sp);
+    if (cbUsed == 0)
+    {
+        return 0;
+    }
+    return UnwindStackCopy(&ctx, sp, pCopyBuffer, cbUsed, pFrames, maxFrames);
+}
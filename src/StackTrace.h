@@ -0,0 +1,55 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+
+enum
+{
+    // Max number of return addresses captured by the fast unwinder
+    MAX_STACK_FRAMES = 64,
+};
+
+// Stack memory range of a thread, [StackLimit, StackBase)
+struct ThreadStackBounds
+{
+    DWORD64     StackLimit;     // lowest address
+    DWORD64     StackBase;      // highest address (stack grows down towards StackLimit)
+};
+
+
+// Get stack bounds of current thread
+void GetCurrentThreadStackBounds(ThreadStackBounds* pBounds);
+
+// Get stack bounds of the thread `hThread`, the handle needs THREAD_QUERY_INFORMATION access.
+BOOL GetThreadStackBounds(HANDLE hThread, ThreadStackBounds* pBounds);
+
+// Capture return addresses of the calling thread, skipping `skip` innermost frames.
+// Does not touch dbghelp and does not allocate memory.
+USHORT CaptureCurrentStack(DWORD skip, DWORD64* pFrames, USHORT maxFrames);
+
+// Unwind the stack described by `pContext` using the unwind tables of the loaded images
+// (frame pointer chain on x86), every memory read is checked against [stackLow, stackHigh).
+// `pContext` is modified in place. Does not touch dbghelp and does not allocate memory.
+USHORT UnwindStack(CONTEXT* pContext, DWORD64 stackLow, DWORD64 stackHigh,
+                   DWORD64* pFrames, USHORT maxFrames);
+
+// Copy the context and the used stack of another thread of this process, the thread is
+// suspended only meanwhile. The innermost `cbCopyBuffer` bytes are kept of a deeper stack.
+// Returns the bytes copied, 0 on failure; `pStackAddress` receives the address of the first one.
+SIZE_T CopyThreadStack(HANDLE hThread, const ThreadStackBounds& bounds, BYTE* pCopyBuffer,
+                       SIZE_T cbCopyBuffer, CONTEXT* pContext, DWORD64* pStackAddress);
+
+// Unwind a stack copied by CopyThreadStack(), pointers into the stack are redirected to the
+// copy, so both the copy and `pContext` are modified.
+USHORT UnwindStackCopy(CONTEXT* pContext, DWORD64 stackAddress, BYTE* pCopyBuffer, SIZE_T cbUsed,
+                       DWORD64* pFrames, USHORT maxFrames);
+
+// Sample the call stack of another thread of this process.
+// The thread is suspended only while its context and used stack are copied into `pCopyBuffer`,
+// the unwinding runs on the copy after the thread is resumed, so the sampled thread can not
+// deadlock us by holding a loader or heap lock.
+USHORT SampleThreadStack(HANDLE hThread, const ThreadStackBounds& bounds, BYTE* pCopyBuffer,
+                         SIZE_T cbCopyBuffer, DWORD64* pFrames, USHORT maxFrames);
@@ -0,0 +1,323 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "SymbolStore.h"
+#include <ctype.h>
+#include <string.h>
+#include "Utility.h"
+
+#pragma warning(disable: 4996)
+#pragma comment(lib, "winhttp.lib")
+
+
+SymbolStore& GetSymbolStore()
+{
+    static SymbolStore instance;
+    return instance;
+}
+
+// 32 hex digits of the GUID followed by the age, nothing which could leave the store
+static bool IsValidBuildId(const char* pszBuildId)
+{
+    size_t len = strlen(pszBuildId);
+    if (len < 33 || len > 40)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = pszBuildId[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IsValidPdbName(const char* pszPdbName)
+{
+    return pszPdbName[0] != '\0' && strpbrk(pszPdbName, "\\/:*?\"<>|") == NULL &&
+        strcmp(pszPdbName, ".") != 0 && strcmp(pszPdbName, "..") != 0 &&
+        _stricmp(pszPdbName, "debuginfo") != 0;
+}
+
+SymbolStore::SymbolStore()
+    : hFetchSlots_(NULL)
+{
+    hFetchSlots_ = CreateSemaphore(NULL, SYMSTORE_MAX_FETCHES, SYMSTORE_MAX_FETCHES, NULL);
+    if (hFetchSlots_ == NULL)
+    {
+        LogLastError();
+    }
+}
+
+SymbolStore::~SymbolStore()
+{
+    ClearEntries();
+    connection_.Disconnect();
+    if (hFetchSlots_ != NULL)
+    {
+        CloseHandle(hFetchSlots_);
+    }
+}
+
+int SymbolStore::Configure(const char* pszStoreDir, const char* pszServer)
+{
+    ScopedLock<ATL::CCriticalSection> lock(critsec_);
+    ClearEntries();
+    connection_.Disconnect();
+    storeDir_.clear();
+    server_.clear();
+    if (pszStoreDir == NULL)
+    {
+        return 0;
+    }
+    std::string storeDir = pszStoreDir;
+    while (!storeDir.empty() && (storeDir[storeDir.size() - 1] == '\\' || storeDir[storeDir.size() - 1] == '/'))
+    {
+        storeDir.resize(storeDir.size() - 1);
+    }
+    if (storeDir.empty() || !CreateDirectoryIfMissing(storeDir.c_str()) ||
+        !CreateDirectoryIfMissing((storeDir + "\\buildid").c_str()))
+    {
+        LogLastError();
+        return 1;
+    }
+    if (pszServer != NULL && pszServer[0] != '\0')
+    {
+        if (_strnicmp(pszServer, "http://", 7) == 0 || _strnicmp(pszServer, "https://", 8) == 0)
+        {
+            if (!connection_.Connect(pszServer, SYMSTORE_TIMEOUT))
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            server_ = pszServer;
+        }
+    }
+    storeDir_ = storeDir;
+    return 0;
+}
+
+bool SymbolStore::IsConfigured() const
+{
+    return !storeDir_.empty();
+}
+
+std::string SymbolStore::Find(const char* pszBuildId, const char* pszPdbName)
+{
+    assert(pszBuildId && pszPdbName);
+    if (storeDir_.empty() || !IsValidBuildId(pszBuildId) || !IsValidPdbName(pszPdbName))
+    {
+        return std::string();
+    }
+    // Paths ignore the case of the id, the map does not
+    std::string buildId = pszBuildId;
+    for (size_t i = 0; i < buildId.size(); i++)
+    {
+        buildId[i] = (char)toupper((unsigned char)buildId[i]);
+    }
+
+    Entry* pEntry = NULL;
+    bool bOwner = false;
+    {
+        ScopedLock<ATL::CCriticalSection> lock(critsec_);
+        std::map<std::string, Entry*>::iterator iter = entries_.find(buildId);
+        if (iter != entries_.end())
+        {
+            pEntry = iter->second;
+            if (pEntry->bReady && pEntry->path.empty() && GetTickCount64() >= pEntry->expiry)
+            {
+                // Found nowhere a while ago, it may have been published since
+                pEntry->bReady = false;
+                ResetEvent(pEntry->hReady);
+                bOwner = true;
+            }
+        }
+        else
+        {
+            HANDLE hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (hReady == NULL)
+            {
+                LogLastError();
+                return std::string();
+            }
+            pEntry = new Entry;
+            pEntry->hReady = hReady;
+            pEntry->bReady = false;
+            pEntry->expiry = 0;
+            entries_[buildId] = pEntry;
+            bOwner = true;
+        }
+    }
+    if (!bOwner)
+    {
+        WaitForSingleObject(pEntry->hReady, INFINITE);
+        ScopedLock<ATL::CCriticalSection> lock(critsec_);
+        return pEntry->path;
+    }
+    std::string path = Lookup(buildId, pszPdbName);
+    {
+        ScopedLock<ATL::CCriticalSection> lock(critsec_);
+        pEntry->path = path;
+        pEntry->expiry = GetTickCount64() + SYMSTORE_NEGATIVE_TTL;
+        pEntry->bReady = true;
+    }
+    SetEvent(pEntry->hReady);
+    return path;
+}
+
+void SymbolStore::Prefetch(const std::vector<SymbolStoreRequest>& requests)
+{
+    PrefetchJob job = { this, &requests, 0 };
+    HANDLE hThreads[SYMSTORE_MAX_FETCHES] = {};
+    DWORD count = 0;
+    while (count < SYMSTORE_MAX_FETCHES && count < requests.size())
+    {
+        hThreads[count] = CreateThread(NULL, 0, &SymbolStore::PrefetchProc, &job, 0, NULL);
+        if (hThreads[count] == NULL)
+        {
+            LogLastError();
+            break;
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        // The lookups are done again one by one when the modules are loaded
+        return;
+    }
+    WaitForMultipleObjects(count, hThreads, TRUE, INFINITE);
+    for (DWORD i = 0; i < count; i++)
+    {
+        CloseHandle(hThreads[i]);
+    }
+}
+
+DWORD WINAPI SymbolStore::PrefetchProc(LPVOID lpParameter)
+{
+    PrefetchJob* pJob = (PrefetchJob*)lpParameter;
+    for (;;)
+    {
+        LONG index = InterlockedIncrement(&pJob->next) - 1;
+        if ((size_t)index >= pJob->pRequests->size())
+        {
+            break;
+        }
+        const SymbolStoreRequest& request = (*pJob->pRequests)[index];
+        pJob->pStore->Find(request.buildId.c_str(), request.pdbName.c_str());
+    }
+    return 0;
+}
+
+std::string SymbolStore::Lookup(const std::string& buildId, const std::string& pdbName)
+{
+    const std::string dir = storeDir_ + "\\buildid\\" + buildId;
+    const std::string debugInfoPath = dir + "\\debuginfo";
+    const std::string pdbPath = dir + "\\" + pdbName;
+    if (FileExists(pdbPath.c_str()))
+    {
+        return pdbPath;
+    }
+    if (!FileExists(debugInfoPath.c_str()))
+    {
+        if ((server_.empty() && !connection_.IsConnected()) || !CreateDirectoryIfMissing(dir.c_str()))
+        {
+            return std::string();
+        }
+        // Renamed once complete, a fetch cut short never leaves a truncated PDB in the store
+        const std::string tmpPath = StringPrintf("%s.%u.tmp", debugInfoPath.c_str(), GetCurrentThreadId());
+        WaitForSingleObject(hFetchSlots_, INFINITE);
+        bool bOk = Fetch(buildId, tmpPath);
+        ReleaseSemaphore(hFetchSlots_, 1, NULL);
+        if (!bOk || !MoveFileExA(tmpPath.c_str(), debugInfoPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileA(tmpPath.c_str());
+            return std::string();
+        }
+    }
+    if (!CreateHardLinkA(pdbPath.c_str(), debugInfoPath.c_str(), NULL) &&
+        GetLastError() != ERROR_ALREADY_EXISTS &&
+        !CopyFileA(debugInfoPath.c_str(), pdbPath.c_str(), TRUE))
+    {
+        LogLastError();
+        return std::string();
+    }
+    return pdbPath;
+}
+
+bool SymbolStore::Fetch(const std::string& buildId, const std::string& tmpPath)
+{
+    if (connection_.IsConnected())
+    {
+        return Download(buildId, tmpPath);
+    }
+    // Another store in the same layout, a share or a local stand-in for the server
+    std::string path = server_ + "\\buildid\\" + buildId + "\\debuginfo";
+    return CopyFileA(path.c_str(), tmpPath.c_str(), FALSE) != FALSE;
+}
+
+bool SymbolStore::Download(const std::string& buildId, const std::string& tmpPath)
+{
+    // The request paths are appended to the server path
+    const WCHAR* pszPath = connection_.GetPath();
+    size_t len = wcslen(pszPath);
+    while (len > 0 && pszPath[len - 1] == L'/')
+    {
+        len--;
+    }
+    WCHAR szRequestPath[HTTP_MAX_URL_LEN];
+    _snwprintf_s(szRequestPath, HTTP_MAX_URL_LEN, _TRUNCATE, L"%.*s/buildid/%S/debuginfo",
+        (int)len, pszPath, buildId.c_str());
+    HINTERNET hRequest = connection_.OpenRequest(L"GET", szRequestPath);
+    if (hRequest == NULL)
+    {
+        return false;
+    }
+    DWORD dwStatus = 0;
+    DWORD cbStatus = sizeof(dwStatus);
+    bool bOk = WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) &&
+        WinHttpReceiveResponse(hRequest, NULL) &&
+        WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX, &dwStatus, &cbStatus, WINHTTP_NO_HEADER_INDEX) &&
+        dwStatus == 200;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    if (bOk)
+    {
+        hFile = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        bOk = (hFile != INVALID_HANDLE_VALUE);
+    }
+    std::vector<BYTE> buffer(SYMSTORE_CHUNK_SIZE);
+    while (bOk)
+    {
+        DWORD dwRead = 0;
+        DWORD dwWritten = 0;
+        bOk = WinHttpReadData(hRequest, &buffer[0], SYMSTORE_CHUNK_SIZE, &dwRead) != FALSE;
+        if (!bOk || dwRead == 0)
+        {
+            break;
+        }
+        bOk = WriteFile(hFile, &buffer[0], dwRead, &dwWritten, NULL) && dwWritten == dwRead;
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+    WinHttpCloseHandle(hRequest);
+    return bOk;
+}
+
+void SymbolStore::ClearEntries()
+{
+    for (std::map<std::string, Entry*>::iterator iter = entries_.begin(); iter != entries_.end(); ++iter)
+    {
+        CloseHandle(iter->second->hReady);
+        delete iter->second;
+    }
+    entries_.clear();
+}
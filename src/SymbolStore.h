@@ -0,0 +1,103 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <atlsync.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "HttpConnection.h"
+
+enum
+{
+    // Downloads in flight at once, across all the threads of the process
+    SYMSTORE_MAX_FETCHES = 4,
+
+    // Timeout of each connect, send and receive (milliseconds)
+    SYMSTORE_TIMEOUT = 60 * 1000,
+
+    // A build found nowhere is looked up again after this (milliseconds)
+    SYMSTORE_NEGATIVE_TTL = 10 * 60 * 1000,
+
+    SYMSTORE_CHUNK_SIZE = 64 * 1024,
+};
+
+// A module to look up, its build id and the file name of its PDB
+struct SymbolStoreRequest
+{
+    std::string     buildId;
+    std::string     pdbName;
+};
+
+// Local store of PDB files keyed by build id, in the layout of debuginfod:
+// `<store>\buildid\<build id>\debuginfo`, with a hard link named after the PDB next to it
+// for dbghelp, which picks the reader by the file extension.
+// A PDB missing from the store is fetched from `<server>/buildid/<build id>/debuginfo`, a
+// debuginfod server or any static file server over another store, or copied from another
+// store when the server is a directory. A build found is looked up once per process, one
+// found nowhere once per SYMSTORE_NEGATIVE_TTL, so symbolizing a backlog of reports costs
+// one fetch per build.
+class SymbolStore
+{
+public:
+    SymbolStore();
+    ~SymbolStore();
+
+    // Store directory, created if missing, and the server to fetch from, which may be NULL.
+    // A NULL directory turns the store off. Not to be called while symbolizing.
+    int Configure(const char* pszStoreDir, const char* pszServer);
+
+    bool IsConfigured() const;
+
+    // Path of the PDB of a build in the store, fetched if missing, empty if it's unavailable.
+    // A lookup of a build id already being fetched waits for that fetch.
+    std::string Find(const char* pszBuildId, const char* pszPdbName);
+
+    // Look several builds up in parallel, at most SYMSTORE_MAX_FETCHES at once
+    void Prefetch(const std::vector<SymbolStoreRequest>& requests);
+
+private:
+    SymbolStore(const SymbolStore&);
+    SymbolStore& operator = (const SymbolStore&);
+
+    struct Entry
+    {
+        HANDLE          hReady;     // manual reset, set once `path` is final
+        bool            bReady;     // as `hReady`, read under the lock
+        std::string     path;       // empty if the build was found nowhere
+        ULONGLONG       expiry;     // GetTickCount64() after which an empty `path` is stale
+    };
+
+    struct PrefetchJob
+    {
+        SymbolStore*                            pStore;
+        const std::vector<SymbolStoreRequest>*  pRequests;
+        volatile LONG                           next;
+    };
+
+    static DWORD WINAPI PrefetchProc(LPVOID lpParameter);
+
+    void ClearEntries();
+
+    // Look a build up in the store directory, then upstream
+    std::string Lookup(const std::string& buildId, const std::string& pdbName);
+
+    // Fetch the debuginfo of a build from upstream into `tmpPath`
+    bool Fetch(const std::string& buildId, const std::string& tmpPath);
+    bool Download(const std::string& buildId, const std::string& tmpPath);
+
+    // Guards `entries_` and the entries
+    ATL::CCriticalSection           critsec_;
+
+    std::map<std::string, Entry*>   entries_;       // build id -> lookup
+    std::string                     storeDir_;
+    std::string                     server_;        // upstream store directory, empty if HTTP or none
+    HANDLE                          hFetchSlots_;   // semaphore of SYMSTORE_MAX_FETCHES
+    HttpConnection                  connection_;
+};
+
+// Symbol store of the offline symbolizer
+SymbolStore& GetSymbolStore();
@@ -0,0 +1,236 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "Symbolizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "Dbghlp.h"
+#include "ModuleMap.h"
+#include "Report.h"
+#include "SymbolStore.h"
+
+#pragma warning(disable: 4996)
+
+Symbolizer::Symbolizer(const char* pszSearchPath)
+    : hSession_(NULL), bInitialized_(FALSE)
+{
+    // dbghelp only needs a unique value when it does not invade a real process
+    static volatile LONG sessionCounter = 0;
+    hSession_ = (HANDLE)(ULONG_PTR)(0xCA1D0000 + InterlockedIncrement(&sessionCounter));
+    bInitialized_ = GetDbghelpDll().SymInitialize(hSession_, (LPSTR)pszSearchPath, FALSE);
+    if (!bInitialized_)
+    {
+        LogLastError();
+    }
+}
+
+Symbolizer::~Symbolizer()
+{
+    if (bInitialized_)
+    {
+        GetDbghelpDll().SymCleanup(hSession_);
+    }
+}
+
+BOOL Symbolizer::LoadModule(const char* pszName, DWORD64 base, DWORD size, const char* pszPath)
+{
+    assert(pszName && pszPath);
+    if (!bInitialized_)
+    {
+        return FALSE;
+    }
+    if (GetDbghelpDll().SymLoadModuleEx(hSession_, NULL, pszPath, pszName, base, size, NULL, 0) == 0 &&
+        GetLastError() != ERROR_SUCCESS)
+    {
+        return FALSE;
+    }
+    modules_[pszName] = base;
+    return TRUE;
+}
+
+std::string Symbolizer::Symbolize(const std::string& frame, bool bReturnAddress)
+{
+    size_t pos = frame.rfind("+0x");
+    if (!bInitialized_ || pos == std::string::npos)
+    {
+        return frame;
+    }
+    std::map<std::string, DWORD64>::const_iterator iter = modules_.find(frame.substr(0, pos));
+    if (iter == modules_.end())
+    {
+        return frame;
+    }
+    DWORD64 address = iter->second + _strtoui64(frame.c_str() + pos + 3, NULL, 16);
+    if (bReturnAddress)
+    {
+        address--;
+    }
+
+    std::unordered_map<DWORD64, const char*>::const_iterator cached = resolved_.find(address);
+    if (cached != resolved_.end())
+    {
+        return (cached->second != NULL) ? std::string(cached->second) : frame;
+    }
+    const char* pszName = Resolve(address);
+    resolved_[address] = pszName;
+    return (pszName != NULL) ? std::string(pszName) : frame;
+}
+
+const char* Symbolizer::Resolve(DWORD64 address)
+{
+    BYTE symbolBuffer[sizeof(SYMBOL_INFO) + MAX_NAME_LEN] = {};
+    PSYMBOL_INFO pSymbol = (PSYMBOL_INFO)symbolBuffer;
+    pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    pSymbol->MaxNameLen = MAX_NAME_LEN;
+    DWORD64 symDisplacement = 0;
+    if (!GetDbghelpDll().SymFromAddr(hSession_, address, &symDisplacement, pSymbol))
+    {
+        return NULL;
+    }
+    std::string function = pSymbol->Name;
+
+    // Inline frames come innermost first, the folded format lists the outermost frame first
+    std::string inlined;
+    DWORD inlineContext = 0;
+    DWORD inlineCount = QueryInlineFrames(hSession_, address, &inlineContext);
+    for (DWORD i = 0; i < inlineCount; i++, inlineContext++)
+    {
+        if (GetDbghelpDll().SymFromInlineContext(hSession_, address, inlineContext, &symDisplacement, pSymbol))
+        {
+            inlined.insert(0, pSymbol->Name);
+            inlined.insert(0, 1, ';');
+        }
+    }
+    function.append(inlined);
+    return names_.Intern(function);
+}
+
+// Fetch the PDBs of the `# build` header lines in parallel, then rewind the file
+static void PrefetchSymbols(FILE* fin)
+{
+    std::vector<SymbolStoreRequest> requests;
+    char szBuffer[MAX_BUF_SIZE];
+    while (fgets(szBuffer, sizeof(szBuffer), fin) && szBuffer[0] == '#')
+    {
+        char szName[MAX_PATH] = {};
+        char szBuildId[MODULE_BUILD_ID_LEN] = {};
+        char szPdbName[MAX_PATH] = {};
+        if (sscanf(szBuffer, "# build %259s %47s %259[^\r\n]", szName, szBuildId, szPdbName) == 3)
+        {
+            SymbolStoreRequest request;
+            request.buildId = szBuildId;
+            request.pdbName = szPdbName;
+            requests.push_back(request);
+        }
+    }
+    GetSymbolStore().Prefetch(requests);
+    fseek(fin, 0, SEEK_SET);
+}
+
+int SymbolizeFoldedFile(const char* pszInFile, const char* pszOutFile, const char* pszSearchPath)
+{
+    if (pszInFile == NULL || pszOutFile == NULL)
+    {
+        return 1;
+    }
+    FILE* fin = fopen(pszInFile, "r");
+    if (fin == NULL)
+    {
+        return 1;
+    }
+    FILE* fout = fopen(pszOutFile, "w");
+    if (fout == NULL)
+    {
+        fclose(fin);
+        return 1;
+    }
+
+    SymbolStore& store = GetSymbolStore();
+    if (store.IsConfigured())
+    {
+        PrefetchSymbols(fin);
+    }
+
+    Symbolizer symbolizer(pszSearchPath);
+    std::map<std::string, std::string> pdbPaths;    // module name -> PDB in the symbol store
+    std::string line;
+    std::string stack;
+    char szBuffer[MAX_BUF_SIZE];
+    while (fgets(szBuffer, sizeof(szBuffer), fin))
+    {
+        // A stack may be longer than the buffer
+        line.append(szBuffer);
+        if (line.empty() || line[line.size() - 1] != '\n')
+        {
+            if (!feof(fin))
+            {
+                continue;
+            }
+        }
+        while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+        {
+            line.resize(line.size() - 1);
+        }
+
+        if (line.compare(0, 8, "# build ") == 0)
+        {
+            char szName[MAX_PATH] = {};
+            char szBuildId[MODULE_BUILD_ID_LEN] = {};
+            int offset = 0;
+            if (store.IsConfigured() &&
+                sscanf(line.c_str(), "# build %259s %47s %n", szName, szBuildId, &offset) == 2 && offset > 0)
+            {
+                std::string path = store.Find(szBuildId, line.c_str() + offset);
+                if (!path.empty())
+                {
+                    pdbPaths[szName] = path;
+                }
+            }
+        }
+        else if (line.compare(0, 9, "# module ") == 0)
+        {
+            char szName[MAX_PATH] = {};
+            DWORD64 base = 0;
+            DWORD size = 0;
+            int offset = 0;
+            if (sscanf(line.c_str(), "# module %259s %I64x %x %n", szName, &base, &size, &offset) == 3 && offset > 0)
+            {
+                // dbghelp loads a PDB in place of its image, the image is not needed then
+                std::map<std::string, std::string>::const_iterator iter = pdbPaths.find(szName);
+                const char* pszPath = (iter != pdbPaths.end()) ? iter->second.c_str() : line.c_str() + offset;
+                symbolizer.LoadModule(szName, base, size, pszPath);
+            }
+        }
+        else if (!line.empty() && line[0] != '#')
+        {
+            // "outermost;...;innermost count", the innermost frame is the only one not being a return address
+            size_t space = line.rfind(' ');
+            if (space != std::string::npos)
+            {
+                stack.clear();
+                size_t start = 0;
+                while (start < space)
+                {
+                    size_t end = line.find(';', start);
+                    if (end == std::string::npos || end > space)
+                    {
+                        end = space;
+                    }
+                    if (!stack.empty())
+                    {
+                        stack.push_back(';');
+                    }
+                    stack.append(symbolizer.Symbolize(line.substr(start, end - start), end != space));
+                    start = end + 1;
+                }
+                fprintf(fout, "%s%s\n", stack.c_str(), line.c_str() + space);
+            }
+        }
+        line.clear();
+    }
+
+    fclose(fin);
+    fclose(fout);
+    return 0;
+}
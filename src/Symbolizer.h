@@ -0,0 +1,47 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include "NameTable.h"
+
+// Offline symbolizer for raw `module+0xoffset` frames.
+// Modules are loaded into a private dbghelp session at the addresses they had in the
+// profiled process, so it works in any process with the images and PDBs at hand.
+class Symbolizer
+{
+public:
+    explicit Symbolizer(const char* pszSearchPath);
+    ~Symbolizer();
+
+    BOOL LoadModule(const char* pszName, DWORD64 base, DWORD size, const char* pszPath);
+
+    // Resolve `module+0xoffset` into `function`, or `function;inlined;...` when calls were inlined
+    // at that address, returns the frame unchanged if unknown.
+    // A return address points after the call, pass `bReturnAddress` to look up the call itself.
+    // Each distinct address is resolved and undecorated once, later frames reuse the interned name.
+    std::string Symbolize(const std::string& frame, bool bReturnAddress);
+
+private:
+    Symbolizer(const Symbolizer&);
+    Symbolizer& operator = (const Symbolizer&);
+
+    // Name of `address` with its inlined calls, interned, NULL if unknown
+    const char* Resolve(DWORD64 address);
+
+    HANDLE                          hSession_;
+    BOOL                            bInitialized_;
+    std::map<std::string, DWORD64>  modules_;   // module name -> load address
+    std::unordered_map<DWORD64, const char*> resolved_;  // address -> interned name, NULL if unknown
+    NameTable                       names_;
+};
+
+// Resolve frames of a folded-stack file written by Profiler::Dump(), using the
+// `# module` header lines and `pszSearchPath` to find symbols.
+// When the symbol store is configured, the PDBs of the `# build` lines are taken from it first.
+int SymbolizeFoldedFile(const char* pszInFile, const char* pszOutFile, const char* pszSearchPath);
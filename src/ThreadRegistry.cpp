@@ -0,0 +1,109 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "ThreadRegistry.h"
+#include <string.h>
+
+#pragma warning(disable: 4996)
+
+// No allocation when a thread starts, the pool lives in the image
+static ThreadSlot       g_slots[MAX_THREAD_SLOTS];
+
+// Handlers installed by the TLS callback, 0 if disabled
+static volatile LONG    g_autoFlags = 0;
+
+__declspec(thread) static ThreadSlot* t_pSlot = NULL;
+
+ThreadSlot* AcquireThreadSlot()
+{
+    if (t_pSlot != NULL)
+    {
+        return NULL;
+    }
+    const LONG threadId = (LONG)GetCurrentThreadId();
+    for (int i = 0; i < MAX_THREAD_SLOTS; i++)
+    {
+        ThreadSlot* pSlot = &g_slots[i];
+        if (pSlot->threadId == 0 && InterlockedCompareExchange(&pSlot->threadId, threadId, 0) == 0)
+        {
+            pSlot->flags = 0;
+            memset(&pSlot->prevHandlers, 0, sizeof(pSlot->prevHandlers));
+            GetCurrentThreadStackBounds(&pSlot->bounds);
+            t_pSlot = pSlot;
+            return pSlot;
+        }
+    }
+    return NULL;
+}
+
+ThreadSlot* GetThreadSlot()
+{
+    return t_pSlot;
+}
+
+void ReleaseThreadSlot()
+{
+    ThreadSlot* pSlot = t_pSlot;
+    if (pSlot != NULL)
+    {
+        t_pSlot = NULL;
+        InterlockedExchange(&pSlot->threadId, 0);
+    }
+}
+
+bool FindThreadStackBounds(DWORD threadId, ThreadStackBounds* pBounds)
+{
+    for (int i = 0; i < MAX_THREAD_SLOTS; i++)
+    {
+        const ThreadSlot* pSlot = &g_slots[i];
+        if ((DWORD)pSlot->threadId == threadId && threadId != 0)
+        {
+            *pBounds = pSlot->bounds;
+            // The slot may have been handed to another thread meanwhile
+            MemoryBarrier();
+            return (DWORD)pSlot->threadId == threadId;
+        }
+    }
+    return false;
+}
+
+void EnableAutoThreadHandlers(DWORD dwFlags)
+{
+    InterlockedExchange(&g_autoFlags, (LONG)dwFlags);
+}
+
+static void NTAPI ThreadRegistryTlsCallback(PVOID hModule, DWORD dwReason, PVOID pReserved)
+{
+    UNREFERENCED_PARAMETER(hModule);
+    UNREFERENCED_PARAMETER(pReserved);
+    if (dwReason == DLL_THREAD_ATTACH)
+    {
+        const DWORD dwFlags = (DWORD)g_autoFlags;
+        if (dwFlags != 0)
+        {
+            SetThreadExceptionHandlers(dwFlags);
+        }
+    }
+    else if (dwReason == DLL_THREAD_DETACH)
+    {
+        // The handlers die with the thread, only the slot is given back
+        ReleaseThreadSlot();
+    }
+}
+
+// Entries between .CRT$XLA and .CRT$XLZ are called by the loader for every thread,
+// the references keep the linker from dropping the TLS directory and the callback
+#ifdef _WIN64
+#pragma comment(linker, "/INCLUDE:_tls_used")
+#pragma comment(linker, "/INCLUDE:calmdump_tls_callback")
+#pragma const_seg(".CRT$XLF")
+extern "C" const PIMAGE_TLS_CALLBACK calmdump_tls_callback = ThreadRegistryTlsCallback;
+#pragma const_seg()
+#else
+#pragma comment(linker, "/INCLUDE:__tls_used")
+#pragma comment(linker, "/INCLUDE:_calmdump_tls_callback")
+#pragma data_seg(".CRT$XLF")
+extern "C" PIMAGE_TLS_CALLBACK calmdump_tls_callback = ThreadRegistryTlsCallback;
+#pragma data_seg()
+#endif
@@ -0,0 +1,45 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include "CrashHandler.h"
+#include "StackTrace.h"
+
+enum
+{
+    // Max number of threads with handlers installed at the same time,
+    // the slot of a thread is reused once it exits
+    MAX_THREAD_SLOTS = 1024,
+
+    // Stack kept for the exception handlers once a thread overflowed its stack
+    THREAD_STACK_GUARANTEE = 32 * 1024,
+};
+
+// Per-thread state, taken from a pool preallocated with the process
+struct ThreadSlot
+{
+    volatile LONG           threadId;       // 0 while the slot is free
+    DWORD                   flags;          // CR_INST_xxx handlers installed
+    ThreadExceptHandlers    prevHandlers;
+    ThreadStackBounds       bounds;
+};
+
+// Take a slot for the calling thread and record its stack bounds.
+// Returns NULL if the thread already has one or the pool is exhausted.
+ThreadSlot* AcquireThreadSlot();
+
+// Slot of the calling thread, NULL if none
+ThreadSlot* GetThreadSlot();
+
+// Give back the slot of the calling thread
+void ReleaseThreadSlot();
+
+// Stack bounds of a thread which has a slot, without opening the thread
+bool FindThreadStackBounds(DWORD threadId, ThreadStackBounds* pBounds);
+
+// Install the thread handlers selected by `dwFlags` in every thread started from now on,
+// from a TLS callback run by the loader before the thread start routine
+void EnableAutoThreadHandlers(DWORD dwFlags);
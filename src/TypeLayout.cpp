@@ -0,0 +1,160 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "TypeLayout.h"
+#include "Dbghlp.h"
+#include "Report.h"
+
+#pragma warning(disable: 4996)
+
+// Name of a type or of a member, empty if it has none
+static std::string GetTypeName(DWORD64 modBase, DWORD typeIndex)
+{
+    std::string name;
+    WCHAR* pwszName = NULL;
+    if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex, TI_GET_SYMNAME, &pwszName))
+    {
+        char szName[MAX_NAME_LEN];
+        _snprintf_s(szName, sizeof(szName), _TRUNCATE, "%ls", pwszName);
+        name = szName;
+        LocalFree(pwszName);
+    }
+    return name;
+}
+
+static BasicType GetBasicType(DWORD64 modBase, DWORD typeIndex)
+{
+    BasicType basicType;
+    if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex, TI_GET_BASETYPE, &basicType))
+    {
+        return basicType;
+    }
+    DWORD typeId;
+    if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex, TI_GET_TYPEID, &typeId) &&
+        GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeId, TI_GET_BASETYPE, &basicType))
+    {
+        return basicType;
+    }
+    return btNoType;
+}
+
+TypeLayoutCache::TypeLayoutCache()
+    : hitCount_(0), missCount_(0)
+{
+}
+
+const TypeLayout& TypeLayoutCache::GetLayout(DWORD64 modBase, DWORD typeIndex)
+{
+    Key key(modBase, typeIndex);
+    std::map<Key, TypeLayout>::iterator iter = layouts_.find(key);
+    if (iter != layouts_.end())
+    {
+        hitCount_++;
+        return iter->second;
+    }
+    missCount_++;
+    TypeLayout& layout = layouts_[key];
+    layout.name = GetTypeName(modBase, typeIndex);
+    layout.basicType = GetBasicType(modBase, typeIndex);
+    AddMembers(modBase, typeIndex, &layout);
+    return layout;
+}
+
+void TypeLayoutCache::Clear()
+{
+    layouts_.clear();
+    hitCount_ = 0;
+    missCount_ = 0;
+}
+
+// Child type indexes of `typeIndex` in `pBuffer`, NULL if it has none
+static const TI_FINDCHILDREN_PARAMS* FindChildren(DWORD64 modBase, DWORD typeIndex, std::vector<BYTE>* pBuffer)
+{
+    DWORD dwChildrenCount = 0;
+    GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex, TI_GET_CHILDRENCOUNT,
+        &dwChildrenCount);
+    if (dwChildrenCount == 0)
+    {
+        return NULL;
+    }
+    if (dwChildrenCount > TYPE_MAX_MEMBERS)
+    {
+        dwChildrenCount = TYPE_MAX_MEMBERS;
+    }
+    // SymGetTypeInfo(TI_FINDCHILDREN) expects more memory than just a
+    // TI_FINDCHILDREN_PARAMS struct has.
+    pBuffer->resize(sizeof(TI_FINDCHILDREN_PARAMS) + dwChildrenCount * sizeof(ULONG));
+    TI_FINDCHILDREN_PARAMS* pChildren = (TI_FINDCHILDREN_PARAMS*)&(*pBuffer)[0];
+    pChildren->Count = dwChildrenCount;
+    pChildren->Start = 0;
+    if (!GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeIndex, TI_FINDCHILDREN, pChildren))
+    {
+        return NULL;
+    }
+    return pChildren;
+}
+
+// Append the members of `typeIndex` to the layout in declaration order, members of
+// user defined type followed by their own members up to TYPE_MAX_NESTING levels.
+// Walks the type tree with an explicit stack, so a deep type costs no stack space.
+void TypeLayoutCache::AddMembers(DWORD64 modBase, DWORD typeIndex, TypeLayout* pLayout)
+{
+    struct PendingMember
+    {
+        DWORD       childId;
+        DWORD       parentOffset;
+        unsigned    nestingLevel;
+    };
+    std::vector<PendingMember> pending;
+
+    const TI_FINDCHILDREN_PARAMS* pChildren = FindChildren(modBase, typeIndex, &children_);
+    for (DWORD i = pChildren ? pChildren->Count : 0; i > 0; i--)
+    {
+        PendingMember next = { pChildren->ChildId[i - 1], 0, 0 };
+        pending.push_back(next);
+    }
+
+    while (!pending.empty() && pLayout->members.size() < TYPE_MAX_MEMBERS)
+    {
+        const PendingMember curr = pending.back();
+        pending.pop_back();
+
+        TypeMember member;
+        member.name = GetTypeName(modBase, curr.childId);
+        member.basicType = GetBasicType(modBase, curr.childId);
+        member.nestingLevel = curr.nestingLevel;
+
+        DWORD dwMemberOffset = 0;
+        GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, curr.childId, TI_GET_OFFSET, &dwMemberOffset);
+        member.offset = curr.parentOffset + dwMemberOffset;
+
+        DWORD typeId = 0;
+        DWORD dwTag = SymTagNull;
+        member.length = 0;
+        if (GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, curr.childId, TI_GET_TYPEID, &typeId))
+        {
+            GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeId, TI_GET_LENGTH, &member.length);
+            GetDbghelpDll().SymGetTypeInfo(GetCurrentProcess(), modBase, typeId, TI_GET_SYMTAG, &dwTag);
+        }
+        member.bNested = (dwTag == SymTagUDT);
+        pLayout->members.push_back(member);
+
+        if (member.bNested && curr.nestingLevel + 1 < TYPE_MAX_NESTING)
+        {
+            // Pushed in reverse, so the members come out in declaration order
+            pChildren = FindChildren(modBase, typeId, &children_);
+            for (DWORD i = pChildren ? pChildren->Count : 0; i > 0; i--)
+            {
+                PendingMember next = { pChildren->ChildId[i - 1], member.offset, curr.nestingLevel + 1 };
+                pending.push_back(next);
+            }
+        }
+    }
+}
+
+TypeLayoutCache& GetTypeLayoutCache()
+{
+    static TypeLayoutCache cache;
+    return cache;
+}
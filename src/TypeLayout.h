@@ -0,0 +1,71 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "cvconst.h"
+
+enum
+{
+    // Nested user defined types deeper than this are not expanded
+    TYPE_MAX_NESTING = 8,
+
+    // Members of a layout, nested ones included
+    TYPE_MAX_MEMBERS = 1024,
+};
+
+// Member of a user defined type, nested types are flattened in declaration order
+struct TypeMember
+{
+    std::string     name;
+    DWORD           offset;         // from the start of the outermost type
+    DWORD64         length;
+    BasicType       basicType;
+    unsigned        nestingLevel;   // 0 for the members of the outermost type
+    bool            bNested;        // member of user defined type, its members follow
+};
+
+// Everything needed to dump a variable of some type, without asking dbghelp again
+struct TypeLayout
+{
+    std::string             name;           // empty for types without a name
+    BasicType               basicType;
+    std::vector<TypeMember> members;        // empty if it's not a user defined type
+};
+
+// Layouts keyed by (module base, type index), each built with SymGetTypeInfo() the first
+// time a variable of that type is dumped. Type indexes are only meaningful in the dbghelp
+// session which returned them, so the cache must be cleared before SymCleanup().
+class TypeLayoutCache
+{
+public:
+    TypeLayoutCache();
+
+    const TypeLayout& GetLayout(DWORD64 modBase, DWORD typeIndex);
+
+    void Clear();
+
+    size_t GetHitCount() const { return hitCount_; }
+    size_t GetMissCount() const { return missCount_; }
+
+private:
+    TypeLayoutCache(const TypeLayoutCache&);
+    TypeLayoutCache& operator = (const TypeLayoutCache&);
+
+    void AddMembers(DWORD64 modBase, DWORD typeIndex, TypeLayout* pLayout);
+
+    typedef std::pair<DWORD64, DWORD> Key;
+
+    std::map<Key, TypeLayout>   layouts_;
+    std::vector<BYTE>           children_;      // TI_FINDCHILDREN_PARAMS buffer
+    size_t                      hitCount_;
+    size_t                      missCount_;
+};
+
+// Used by the crash report, which runs on one thread at a time
+TypeLayoutCache& GetTypeLayoutCache();
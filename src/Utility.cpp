@@ -18,6 +18,7 @@ be found in the Authors.txt file in the root of the source tree.
 #include <Tlhelp32.h>
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 #include <time.h>
 
 
@@ -102,11 +103,27 @@ std::string GetModuleName(HMODULE hModule)
 }
 
 // Returns base name of the EXE file that launched current process.
-std::string GetAppName()
+size_t GetAppName(char* pszBuffer, size_t cbBuffer)
 {
-    const std::string& sAppName = GetModuleName(NULL);
-    size_t end = sAppName.find_last_of('.');
-    return sAppName.substr(0, end);
+    assert(pszBuffer && cbBuffer > 0);
+    char szFileName[MAX_PATH];
+    DWORD len = GetModuleFileNameA(NULL, szFileName, MAX_PATH);
+    if (len == 0 || len >= MAX_PATH)
+    {
+        pszBuffer[0] = '\0';
+        return 0;
+    }
+    const char* pszName = strrchr(szFileName, '\\');
+    pszName = (pszName != NULL) ? pszName + 1 : szFileName;
+    const char* pszExt = strrchr(pszName, '.');
+    size_t cchName = (pszExt != NULL) ? (size_t)(pszExt - pszName) : strlen(pszName);
+    if (cchName >= cbBuffer)
+    {
+        cchName = cbBuffer - 1;
+    }
+    memcpy(pszBuffer, pszName, cchName);
+    pszBuffer[cchName] = '\0';
+    return cchName;
 }
 
 
@@ -148,6 +165,17 @@ std::string GetErrorMessage(DWORD dwError)
     return std::string(szbuffer, dwLen);
 }
 
+bool CreateDirectoryIfMissing(const char* pszDir)
+{
+    return CreateDirectoryA(pszDir, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+bool FileExists(const char* pszPath)
+{
+    DWORD dwAttributes = GetFileAttributesA(pszPath);
+    return dwAttributes != INVALID_FILE_ATTRIBUTES && !(dwAttributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
 void WriteTextToFile(const std::string& module, const std::string& message)
 {
     char filename[MAX_PATH];
@@ -159,7 +187,8 @@ void WriteTextToFile(const std::string& module, const std::string& message)
     {
         return;
     }
-    FILE* fp = fopen(filename, "a+");
+    // Binary mode, the text already ends its lines with "\r\n"
+    FILE* fp = fopen(filename, "ab");
     if (fp)
     {
         fwrite(message.c_str(), 1, message.size(), fp);
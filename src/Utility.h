@@ -38,14 +38,22 @@ void StringAppendV(std::string* dst, const char* format, va_list ap);
 std::string GetModuleName(HMODULE hModule);
 
 
-// Returns base name of the EXE file that launched current process.
-std::string GetAppName();
+// Writes base name of the EXE file that launched current process, returns its length.
+// No allocation, it is used on the crash path.
+size_t GetAppName(char* pszBuffer, size_t cbBuffer);
 
 
 // Description of calling thread's last error code
 std::string GetErrorMessage(DWORD dwError);
 
 
+// Create a directory, true if it exists already. No allocation, it is used on the crash path.
+bool CreateDirectoryIfMissing(const char* pszDir);
+
+// Whether `pszPath` is a file, not a directory
+bool FileExists(const char* pszPath);
+
+
 // Write text string to file
 void WriteTextToFile(const std::string& module, const std::string& message);
 
@@ -56,7 +64,7 @@ void GetExceptionPointers(DWORD dwExceptionCode, EXCEPTION_POINTERS* pExceptionP
 
 #define LogLastError()   do { \
                             std::string msg = GetErrorMessage(::GetLastError()); \
-                            WriteTextToFile("FATAL", StringPrintf("%s()[Line: %d][Error: 0x%x]\n%s\r\n", \
+                            WriteTextToFile("FATAL", StringPrintf("%s()[Line: %d][Error: 0x%x]\r\n%s\r\n", \
                                 __FUNCTION__, __LINE__, ::GetLastError(), msg.c_str())); \
                          } while (false);
 
@@ -87,3 +95,26 @@ struct DllHandle
 
     HMODULE     handle_;
 };
+
+
+// Enter the critical section in constructor and leave it in destructor
+template <typename Lock>
+struct ScopedLock
+{
+    explicit ScopedLock(Lock& lock)
+        : lock_(lock)
+    {
+        lock_.Enter();
+    }
+
+    ~ScopedLock()
+    {
+        lock_.Leave();
+    }
+
+    Lock&   lock_;
+
+private:
+    ScopedLock(const ScopedLock&);
+    ScopedLock& operator = (const ScopedLock&);
+};
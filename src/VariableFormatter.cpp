@@ -0,0 +1,202 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#include "VariableFormatter.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "Report.h"
+#include "SafeRead.h"
+
+#pragma warning(disable: 4996)
+
+static const char kTabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+static const char kEllipsis[] = "...";
+
+// Text in a fixed buffer, the last bytes are kept to mark the cut with "..."
+class BoundedText
+{
+public:
+    BoundedText(char* pszBuffer, size_t cbBuffer)
+        : pBegin_(pszBuffer), pCurr_(pszBuffer), pLast_(pszBuffer + cbBuffer - sizeof(kEllipsis)), bFull_(false)
+    {
+        *pCurr_ = '\0';
+    }
+
+    void Append(const char* fmt, ...)
+    {
+        if (bFull_)
+        {
+            return;
+        }
+        va_list ap;
+        va_start(ap, fmt);
+        int len = _vsnprintf_s(pCurr_, pLast_ - pCurr_ + 1, _TRUNCATE, fmt, ap);
+        va_end(ap);
+        if (len < 0)
+        {
+            pCurr_ += strlen(pCurr_);
+            memcpy(pCurr_, kEllipsis, sizeof(kEllipsis));
+            pCurr_ += sizeof(kEllipsis) - 1;
+            bFull_ = true;
+            return;
+        }
+        pCurr_ += len;
+    }
+
+    bool IsFull() const { return bFull_; }
+    size_t GetLength() const { return (size_t)(pCurr_ - pBegin_); }
+
+private:
+    char*   pBegin_;
+    char*   pCurr_;
+    char*   pLast_;         // where the NUL goes while the text fits
+    bool    bFull_;
+};
+
+// Memory of a variable, small user defined types are copied with one read for all their members
+struct VarMemory
+{
+    DWORD_PTR   address;
+    const BYTE* pCopy;              // NULL if not copied
+    size_t      cbCopy;
+};
+
+static bool ReadVariable(const VarMemory& memory, DWORD offset, void* pBuffer, size_t size)
+{
+    if (memory.pCopy != NULL && offset + size <= memory.cbCopy)
+    {
+        memcpy(pBuffer, memory.pCopy + offset, size);
+        return true;
+    }
+    return SafeRead(memory.address + offset, pBuffer, size);
+}
+
+// Append " = <value>" of a scalar, larger values are left out
+static void AppendValue(BoundedText& text, BasicType basicType, DWORD64 length, const VarMemory& memory, DWORD offset)
+{
+    if (length != 1 && length != 2 && length != 4 && length != 8)
+    {
+        return;
+    }
+    DWORD64 value = 0;
+    if (!ReadVariable(memory, offset, &value, (size_t)length))
+    {
+        text.Append(" = <unreadable>");
+        return;
+    }
+    if (basicType == btFloat && length == 4)
+    {
+        float f;
+        memcpy(&f, &value, sizeof(f));
+        text.Append(" = %f", f);
+    }
+    else if (basicType == btFloat && length == 8)
+    {
+        double d;
+        memcpy(&d, &value, sizeof(d));
+        text.Append(" = %lf", d);
+    }
+    else if (basicType == btChar && length == sizeof(void*))
+    {
+        char szText[VAR_STRING_PREVIEW];
+        if (SafeReadString((DWORD_PTR)value, szText, sizeof(szText)) >= 0)
+        {
+            text.Append(" = \"%s\"", szText);
+        }
+        else
+        {
+            text.Append(" = %I64X", value);
+        }
+    }
+    else
+    {
+        text.Append(" = %I64X", value);
+    }
+}
+
+size_t FormatVariable(char* pszBuffer, size_t cbBuffer, const VarBudget& budget, const char* pszKind,
+                      const char* pszName, const TypeLayout& layout, DWORD64 size, DWORD_PTR address)
+{
+    assert(pszBuffer && cbBuffer > sizeof(kEllipsis) && pszName);
+    BoundedText text(pszBuffer, cbBuffer);
+    if (pszKind != NULL)
+    {
+        text.Append("%s ", pszKind);
+    }
+    if (!layout.name.empty())
+    {
+        text.Append(" %s", layout.name.c_str());
+    }
+    if (layout.members.empty())
+    {
+        const VarMemory memory = { address, NULL, 0 };
+        text.Append("%s'%s'", rgBaseType[layout.basicType], pszName);
+        AppendValue(text, layout.basicType, size, memory, 0);
+        return text.GetLength();
+    }
+
+    BYTE copy[VAR_COPY_SIZE];
+    VarMemory memory = { address, NULL, 0 };
+    if (size <= sizeof(copy) && SafeRead(address, copy, (size_t)size))
+    {
+        memory.pCopy = copy;
+        memory.cbCopy = (size_t)size;
+    }
+
+    text.Append("\r\n");
+    const ULONGLONG deadline = GetTickCount64() + budget.maxMilliseconds;
+
+    // Members shown so far in the type being walked at each level
+    unsigned shown[TYPE_MAX_NESTING + 1] = {};
+
+    // Members deeper than this belong to a type which was cut, -1 for none
+    int skipAbove = -1;
+    bool bSkipping = false;
+    for (size_t i = 0; i < layout.members.size() && !text.IsFull(); i++)
+    {
+        const TypeMember& member = layout.members[i];
+        const int level = (int)member.nestingLevel;
+        if (bSkipping && level > skipAbove)
+        {
+            continue;
+        }
+        bSkipping = false;
+        if (GetTickCount64() > deadline)
+        {
+            text.Append("%.*s%s\r\n", level + 2, kTabs, kEllipsis);
+            break;
+        }
+        if (++shown[level] > budget.maxChildren)
+        {
+            // Show the cut once, then skip the siblings left and their members
+            if (shown[level] == budget.maxChildren + 1)
+            {
+                text.Append("%.*s%s\r\n", level + 2, kTabs, kEllipsis);
+            }
+            skipAbove = level - 1;
+            bSkipping = true;
+            continue;
+        }
+
+        text.Append("%.*s%s %s", level + 2, kTabs, rgBaseType[member.basicType], member.name.c_str());
+        if (!member.bNested)
+        {
+            AppendValue(text, member.basicType, member.length, memory, member.offset);
+        }
+        else if ((unsigned)level + 1 >= budget.maxDepth)
+        {
+            text.Append(" {%s}", kEllipsis);
+            skipAbove = level;
+            bSkipping = true;
+        }
+        else
+        {
+            shown[level + 1] = 0;
+        }
+        text.Append("\r\n");
+    }
+    return text.GetLength();
+}
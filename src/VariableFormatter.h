@@ -0,0 +1,37 @@
+// Copyright (C) 2013-present prototyped.cn All rights reserved.
+// Distributed under the terms and conditions of the Apache License.
+// See accompanying files LICENSE.
+
+#pragma once
+
+#include <Windows.h>
+#include "TypeLayout.h"
+
+enum
+{
+    // Default budgets of a variable in the crash report
+    VAR_MAX_DEPTH = 4,
+    VAR_MAX_CHILDREN = 64,
+    VAR_MAX_MILLISECONDS = 20,
+
+    // Characters shown of a char* value
+    VAR_STRING_PREVIEW = 32,
+
+    // User defined types up to this size are read at once, then formatted from the copy
+    VAR_COPY_SIZE = 1024,
+};
+
+// Limits of the formatting of one variable, the byte budget is the size of the output buffer
+struct VarBudget
+{
+    unsigned    maxDepth;           // levels of nested user defined types expanded
+    unsigned    maxChildren;        // members shown per type
+    DWORD       maxMilliseconds;    // the members left when it's over are cut
+};
+
+// Write a variable as `<kind> <type> '<name>' = <value>`, or its type followed by one line per
+// member if it's a user defined type. The flattened layout is walked without recursion, memory
+// is only read through SafeRead(), and the output ends with "..." where a budget ran out.
+// Returns the length written, the output is always NUL terminated.
+size_t FormatVariable(char* pszBuffer, size_t cbBuffer, const VarBudget& budget, const char* pszKind,
+                      const char* pszName, const TypeLayout& layout, DWORD64 size, DWORD_PTR address);